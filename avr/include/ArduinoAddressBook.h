@@ -14,11 +14,18 @@
 #define FSM_SERVOSWEEP       10
 #define FSM_SENTRY           11
 #define FSM_ENCODER          12
+#define FSM_PINBENCHMARK     13
+#define FSM_WHEELENCODERS    14
 
 #define MSG_MASTER_CREATE_FSM      0
 #define MSG_MASTER_DESTROY_FSM     1
 #define MSG_MASTER_LIST_FSM        2
 #define MSG_MASTER_ENCODER_SAMPLES 3
+#define MSG_MASTER_HELLO           4
+
+// Byte 3 of an FSM_ENCODER message: the number of samples, or this for
+// transition timestamps (see Encoder in Sentry.h)
+#define ENCODER_FORMAT_EDGES 0
 
 // PWM LEDs
 #define LED_GREEN     4
@@ -63,18 +70,18 @@
 #define MOTOR4_B   36
 #define MOTOR4_CS  12 // Analog
 
-// Encoders (to be determined)
+// Encoders (see Interfaces.xml). The Sentry rig's encoder shares a pin with
+// MOTOR1_ENCODER1, so Sentry and the wheel encoders (WheelEncoders) can't
+// run together.
 #define SERVO_ENCODER   35
-/*
-#define MOTOR1_ENCODER1 35-53
-#define MOTOR1_ENCODER2 35-53
-#define MOTOR2_ENCODER1 35-53
-#define MOTOR2_ENCODER2 35-53
-#define MOTOR3_ENCODER1 35-53
-#define MOTOR3_ENCODER2 35-53
-#define MOTOR4_ENCODER1 35-53
-#define MOTOR4_ENCODER2 35-53
-*/
+#define MOTOR1_ENCODER1 35
+#define MOTOR1_ENCODER2 37
+#define MOTOR2_ENCODER1 39
+#define MOTOR2_ENCODER2 41
+#define MOTOR3_ENCODER1 43
+#define MOTOR3_ENCODER2 45
+#define MOTOR4_ENCODER1 47
+#define MOTOR4_ENCODER2 49
 
 // Base (to be determined)
 #define PROXIMITY_SERVO 53
@@ -21,6 +21,7 @@
  */
 
 #include "AnalogPublisher.h"
+#include "AnalogSampler.h"
 #include "ArduinoAddressBook.h"
 
 #include <Arduino.h>
@@ -47,7 +48,7 @@ uint32_t AnalogPublisher::Step()
 {
 	ParamServer::AnalogPublisherPublisherMsg msg;
 	msg.SetPin(m_params.GetPin());
-	msg.SetValue(analogRead(m_params.GetPin()));
+	msg.SetValue(AnalogSampler::Read(m_params.GetPin()));
 	Serial.write(msg.GetBytes(), msg.GetLength());
 	return m_params.GetDelay();
 }
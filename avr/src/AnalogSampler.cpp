@@ -0,0 +1,140 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "AnalogSampler.h"
+#include "ControlTimer.h"
+
+#include <Arduino.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+AnalogSampler::Channel AnalogSampler::m_channels[AnalogSampler::MAX_CHANNELS];
+uint8_t                AnalogSampler::m_size = 0;
+uint8_t                AnalogSampler::m_next = 0;
+uint8_t                AnalogSampler::m_current = 0;
+volatile bool          AnalogSampler::m_pending = false;
+volatile bool          AnalogSampler::m_paused = false;
+
+bool AnalogSampler::Add(uint8_t pin)
+{
+	if (m_size >= MAX_CHANNELS)
+		return false;
+
+	// Seed the filter so the first few Get()s aren't ramping up from 0
+	uint16_t seed = Read(pin) << FILTER_SHIFT;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		m_channels[m_size].pin = pin;
+		m_channels[m_size].filter = seed;
+		if (m_size++ == 0)
+		{
+			m_next = 0;
+			m_pending = false;
+			ControlTimer::Attach(OnTick, NULL, ControlTimer::TICK_HZ / SAMPLE_HZ);
+		}
+	}
+	return true;
+}
+
+void AnalogSampler::Remove(uint8_t pin)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < m_size; ++i)
+		{
+			if (m_channels[i].pin == pin)
+			{
+				// Keep the order so m_next stays meaningful
+				for (uint8_t j = i + 1; j < m_size; ++j)
+					m_channels[j - 1] = m_channels[j];
+				--m_size;
+				// Whatever is converting now belongs to a shifted index; drop it
+				m_pending = false;
+				if (m_next >= m_size)
+					m_next = 0;
+				break;
+			}
+		}
+		if (m_size == 0)
+			ControlTimer::Detach(OnTick, NULL);
+	}
+}
+
+uint16_t AnalogSampler::Get(uint8_t pin)
+{
+	uint16_t value = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < m_size; ++i)
+		{
+			if (m_channels[i].pin == pin)
+			{
+				value = m_channels[i].filter >> FILTER_SHIFT;
+				break;
+			}
+		}
+	}
+	return value;
+}
+
+uint16_t AnalogSampler::Read(uint8_t pin)
+{
+	// Keep the ISR off the ADC, then wait out a conversion it may have started
+	m_paused = true;
+	while (ADCSRA & _BV(ADSC)) { }
+	// The result register is about to be overwritten, so that sample is lost
+	m_pending = false;
+
+	uint16_t value = analogRead(pin);
+
+	m_paused = false;
+	return value;
+}
+
+void AnalogSampler::OnTick(void * /* context */)
+{
+	if (m_paused || m_size == 0 || (ADCSRA & _BV(ADSC)))
+		return;
+
+	if (m_pending)
+	{
+		// ADCL must be read first, it latches ADCH
+		uint16_t sample = ADCL;
+		sample |= ADCH << 8;
+
+		// filter += sample - filter / 2^FILTER_SHIFT
+		Channel &channel = m_channels[m_current];
+		channel.filter += sample - (channel.filter >> FILTER_SHIFT);
+		m_pending = false;
+	}
+
+	// Start the next conversion. Same register setup as analogRead() on the
+	// Mega: MUX5 selects channels 8-15, AVCC reference.
+	m_current = m_next;
+	m_next = (m_next + 1) % m_size;
+	uint8_t pin = m_channels[m_current].pin;
+	ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((pin >> 3) & 0x01) << MUX5);
+	ADMUX = _BV(REFS0) | (pin & 0x07);
+	ADCSRA |= _BV(ADSC);
+	m_pending = true;
+}
@@ -0,0 +1,91 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * AnalogSampler keeps a set of analog channels sampled in the background so
+ * that FSMs can read a filtered value without waiting on the ADC. One
+ * conversion is started or collected per ControlTimer tick at SAMPLE_HZ, so
+ * with four channels each channel is sampled at SAMPLE_HZ / 4. Each channel
+ * is smoothed with an exponential moving average (alpha = 1 / 2^FILTER_SHIFT).
+ *
+ * While channels are attached the sampler owns the ADC. Code that still needs
+ * a one-off blocking conversion must use Read() instead of analogRead(),
+ * otherwise the two can end up reading each other's channel.
+ */
+class AnalogSampler
+{
+public:
+	/**
+	 * Rate of ADC conversions, shared by all channels.
+	 */
+	static const uint16_t SAMPLE_HZ = 1000;
+
+	/**
+	 * Start sampling an analog channel (0-15). The filter is seeded with a
+	 * blocking read so Get() is valid immediately. Returns false if all
+	 * channels are in use.
+	 */
+	static bool Add(uint8_t pin);
+
+	/**
+	 * Stop sampling an analog channel.
+	 */
+	static void Remove(uint8_t pin);
+
+	/**
+	 * Get the latest filtered value (0-1023) of a channel added with Add().
+	 * Returns 0 if the channel isn't being sampled.
+	 */
+	static uint16_t Get(uint8_t pin);
+
+	/**
+	 * Perform a blocking conversion on any channel without disturbing the
+	 * background sampling. Drop-in replacement for analogRead().
+	 */
+	static uint16_t Read(uint8_t pin);
+
+	/**
+	 * Collect the last conversion and start the next one. Called from the
+	 * ControlTimer interrupt.
+	 */
+	static void OnTick(void *context);
+
+private:
+	static const uint8_t MAX_CHANNELS = 8;
+	static const uint8_t FILTER_SHIFT = 3;
+
+	struct Channel
+	{
+		uint8_t  pin;
+		uint16_t filter; // filtered value << FILTER_SHIFT
+	};
+
+	static Channel          m_channels[MAX_CHANNELS];
+	static uint8_t          m_size;
+	static uint8_t          m_next;    // channel to convert next
+	static uint8_t          m_current; // channel being converted
+	static volatile bool    m_pending; // a conversion we started is in flight
+	static volatile bool    m_paused;  // Read() has borrowed the ADC
+};
@@ -29,15 +29,19 @@ BatteryMonitor::BatteryMonitor() : m_maxLevel(4), m_currentLevel(0)
 {
 	Init(FSM_BATTERYMONITOR, m_params.GetBuffer());
 
-	m_led[0] = LED_BATTERY_EMPTY;
-	m_led[1] = LED_BATTERY_LOW;
-	m_led[2] = LED_BATTERY_MEDIUM;
-	m_led[3] = LED_BATTERY_HIGH;
+	const uint8_t pins[BATTERYMONITOR_NUM_LED] =
+	{
+		LED_BATTERY_EMPTY,
+		LED_BATTERY_LOW,
+		LED_BATTERY_MEDIUM,
+		LED_BATTERY_HIGH,
+	};
 
 	for (int i = 0; i < BATTERYMONITOR_NUM_LED; ++i)
 	{
-		pinMode(m_led[i], OUTPUT);
-		digitalWrite(m_led[i], LOW);
+		pinMode(pins[i], OUTPUT);
+		digitalWrite(pins[i], LOW);
+		m_led[i] = Pin(pins[i]);
 	}
 }
 
@@ -49,7 +53,7 @@ BatteryMonitor *BatteryMonitor::NewFromArray(const TinyBuffer &params)
 BatteryMonitor::~BatteryMonitor()
 {
 	for (char i = 0; i < BATTERYMONITOR_NUM_LED; ++i)
-		digitalWrite(m_led[i], LOW);
+		m_led[i].Low();
 }
 
 uint32_t BatteryMonitor::Step()
@@ -59,12 +63,12 @@ uint32_t BatteryMonitor::Step()
 		// Turn off all the LEDs
 		m_currentLevel = 0;
 		for (char i = 0; i < BATTERYMONITOR_NUM_LED; ++i)
-			digitalWrite(m_led[i], LOW);
+			m_led[i].Low();
 	}
 	else
 	{
 		// Turn on the new LED
-		digitalWrite(m_led[m_currentLevel - 1], HIGH);
+		m_led[m_currentLevel - 1].High();
 	}
 
 	// Calculate the delay (pause on the actual battery level)
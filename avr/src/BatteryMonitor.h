@@ -23,6 +23,7 @@
 
 #include "FiniteStateMachine.h"
 #include "ParamServer.h"
+#include "Pin.h"
 
 #include <stdint.h>
 
@@ -57,7 +58,7 @@ public:
 	int GetNumCells() { return GetVoltage() > 8.5 ? 3 : 2; }
 
 private:
-	uint8_t m_led[BATTERYMONITOR_NUM_LED];
+	Pin m_led[BATTERYMONITOR_NUM_LED];
 
 	// Current battery level (between 1 and 4)
 	int m_maxLevel;
@@ -26,7 +26,7 @@
 
 #include <Arduino.h>
 
-Blink::Blink(uint8_t pin, uint32_t delay) : m_enabled(false)
+Blink::Blink(uint8_t pin, uint32_t delay) : m_pin(pin), m_enabled(false)
 {
 	Init(FSM_BLINK, m_params.GetBuffer());
 
@@ -50,19 +50,19 @@ Blink *Blink::NewFromArray(const TinyBuffer &params)
 
 Blink::~Blink()
 {
-	digitalWrite(m_params.GetPin(), LOW);
+	m_pin.Low();
 }
 
 uint32_t Blink::Step()
 {
 	if (m_enabled)
 	{
-		digitalWrite(m_params.GetPin(), LOW);
+		m_pin.Low();
 		m_enabled = false;
 	}
 	else
 	{
-		digitalWrite(m_params.GetPin(), HIGH);
+		m_pin.High();
 		m_enabled = true;
 	}
 	return m_params.GetDelay();
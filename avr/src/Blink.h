@@ -23,6 +23,7 @@
 
 #include "FiniteStateMachine.h"
 #include "ParamServer.h"
+#include "Pin.h"
 
 #include <stdint.h>
 
@@ -57,6 +58,7 @@ public:
 	virtual uint32_t Step();
 
 private:
+	Pin  m_pin;
 	bool m_enabled;
 
 private:
@@ -0,0 +1,108 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "ControlTimer.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+// 16 MHz / 8 = 2 MHz timer clock, so OCR1A = 2 MHz / TICK_HZ - 1
+#define TIMER1_PRESCALER 8
+
+ControlTimer::Slot ControlTimer::m_slots[ControlTimer::MAX_HANDLERS];
+uint8_t ControlTimer::m_size = 0;
+
+ISR(TIMER1_COMPA_vect)
+{
+	ControlTimer::Tick();
+}
+
+bool ControlTimer::Attach(Handler handler, void *context, uint16_t divider /* = 1 */)
+{
+	if (!handler || m_size >= MAX_HANDLERS)
+		return false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		Slot &slot = m_slots[m_size];
+		slot.handler = handler;
+		slot.context = context;
+		slot.divider = divider ? divider : 1;
+		slot.count = 0;
+		if (m_size++ == 0)
+			Start();
+	}
+	return true;
+}
+
+void ControlTimer::Detach(Handler handler, void *context)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < m_size; ++i)
+		{
+			if (m_slots[i].handler == handler && m_slots[i].context == context)
+			{
+				// Order doesn't matter, swap in the last slot
+				m_slots[i] = m_slots[--m_size];
+				break;
+			}
+		}
+		if (m_size == 0)
+			Stop();
+	}
+}
+
+void ControlTimer::Tick()
+{
+	for (uint8_t i = 0; i < m_size; ++i)
+	{
+		Slot &slot = m_slots[i];
+		if (++slot.count >= slot.divider)
+		{
+			slot.count = 0;
+			slot.handler(slot.context);
+		}
+	}
+}
+
+void ControlTimer::Start()
+{
+	// Arduino's init() leaves Timer1 in 8-bit phase correct PWM. Take it over:
+	// CTC mode with TOP = OCR1A, outputs disconnected.
+	TCCR1A = 0;
+	TCCR1B = _BV(WGM12) | _BV(CS11); // CTC, clk/8
+	TCNT1 = 0;
+	OCR1A = F_CPU / TIMER1_PRESCALER / TICK_HZ - 1;
+	TIMSK1 |= _BV(OCIE1A);
+}
+
+void ControlTimer::Stop()
+{
+	TIMSK1 &= ~_BV(OCIE1A);
+
+	// Hand Timer1 back the way Arduino's init() left it so that analogWrite()
+	// works on pins 11 and 12 again
+	TCCR1B = _BV(CS11) | _BV(CS10);
+	TCCR1A = _BV(WGM10);
+}
@@ -0,0 +1,81 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * ControlTimer runs hardware Timer1 in CTC mode and calls a handful of
+ * handlers from its compare-match interrupt. Work that has to happen at a
+ * fixed rate, regardless of how long the MecanumMaster loop takes to go
+ * around (sampling encoders, running control loops), belongs here instead of
+ * in an FSM's Step().
+ *
+ * Timer1 also drives PWM on pins 11 and 12 (TOP7 and TOP5), so analogWrite()
+ * on those pins is unavailable while any handler is attached. Handlers run
+ * inside the ISR with interrupts disabled: keep them short, and don't touch
+ * Serial from them.
+ */
+class ControlTimer
+{
+public:
+	typedef void (*Handler)(void *context);
+
+	/**
+	 * Frequency of the timer interrupt. Handler rates are a whole divisor of
+	 * this.
+	 */
+	static const uint16_t TICK_HZ = 5000;
+
+	/**
+	 * Call handler(context) every divider ticks. The timer is started when
+	 * the first handler is attached. Returns false if all slots are taken.
+	 */
+	static bool Attach(Handler handler, void *context, uint16_t divider = 1);
+
+	/**
+	 * Remove a handler attached with the same arguments. The timer is stopped
+	 * when the last handler is detached.
+	 */
+	static void Detach(Handler handler, void *context);
+
+	/**
+	 * Dispatch one tick to the attached handlers. Called by the ISR.
+	 */
+	static void Tick();
+
+private:
+	static void Start();
+	static void Stop();
+
+	struct Slot
+	{
+		Handler  handler;
+		void    *context;
+		uint16_t divider;
+		uint16_t count;
+	};
+
+	static const uint8_t MAX_HANDLERS = 4;
+	static Slot    m_slots[MAX_HANDLERS];
+	static uint8_t m_size;
+};
@@ -33,9 +33,11 @@
 #include "Fade.h"
 #include "Mimic.h"
 #include "MotorController.h"
+#include "PinBenchmark.h"
 #include "Sentry.h"
 #include "ServoSweep.h"
 #include "Toggle.h"
+#include "WheelEncoders.h"
 
 #include <Arduino.h> // for millis()
 #include <HardwareSerial.h> // for Serial
@@ -60,7 +62,7 @@ void MecanumMaster::Init()
 	//fsmv.PushBack(new AnalogPublisher(BATTERY_VOLTAGE, FOREVER));
 	//fsmv.PushBack(new BatteryMonitor());
 	//fsmv.PushBack(new Toggle(LED_BATTERY_EMPTY));
-	fsmv.PushBack(new Mimic(BEAGLEBOARD_BRIDGE1, LED_BATTERY_HIGH, 50));
+	fsmv.PushBack(new Mimic(BEAGLEBOARD_BRIDGE1, LED_BATTERY_HIGH, 50, true));
 	//fsmv.PushBack(new Mimic(BEAGLEBOARD_BRIDGE2, LED_BATTERY_MEDIUM, 50));
 	//fsmv.PushBack(new Mimic(BEAGLEBOARD_BRIDGE3, LED_BATTERY_LOW, 50));
 	//fsmv.PushBack(new Mimic(BEAGLEBOARD_BRIDGE4, LED_BATTERY_EMPTY, 50));
@@ -96,6 +98,9 @@ void MecanumMaster::Init()
 		digitalWrite(leds[i], HIGH);
 	}
 	*/
+
+	// Last, so the host doesn't talk to us before we're listening
+	SendHello();
 }
 
 void MecanumMaster::Spin()
@@ -145,11 +150,12 @@ void MecanumMaster::Spin()
 				m_encoder->Update();
 
 				// Consider, QRE1113 rise time is 20uS
-				if (microsValue >= ULONG_MAX - 500)
+				unsigned long period = m_encoder->GetSamplePeriod();
+				if (microsValue >= ULONG_MAX - period)
 					encoderWrapped = true;
 				else if (encoderWrapped)
 					encoderWrapped = false;
-				encoderDelay = microsValue + 500;
+				encoderDelay = microsValue + period;
 			}
 			lastMicrosValue = microsValue;
 		}
@@ -248,6 +254,9 @@ void MecanumMaster::Message(TinyBuffer &msg)
 			case FSM_MOTORCONTROLLER:
 				fsmv.PushBack(MotorController::NewFromArray(msg));
 				break;
+			case FSM_PINBENCHMARK:
+				fsmv.PushBack(PinBenchmark::NewFromArray(msg));
+				break;
 			case FSM_SENTRY:
 				{
 					Sentry *sentry = Sentry::NewFromArray(msg);
@@ -261,6 +270,9 @@ void MecanumMaster::Message(TinyBuffer &msg)
 			case FSM_TOGGLE:
 				fsmv.PushBack(Toggle::NewFromArray(msg));
 				break;
+			case FSM_WHEELENCODERS:
+				fsmv.PushBack(WheelEncoders::NewFromArray(msg));
+				break;
 			}
 		}
 		break;
@@ -301,7 +313,18 @@ void MecanumMaster::Message(TinyBuffer &msg)
 		Serial.write(buffer_bytes, sendBuffer.Length());
 		break;
 	}
+	case MSG_MASTER_HELLO:
+	{
+		SendHello();
+		break;
+	}
 	default:
 		break;
 	}
 }
+
+void MecanumMaster::SendHello()
+{
+	uint8_t hello[4] = { 4, 0, FSM_MASTER, MSG_MASTER_HELLO };
+	Serial.write(hello, sizeof(hello));
+}
@@ -44,6 +44,11 @@ class Encoder;
  * listed serially. For example:
  *   [11, 0, FSM_MASTER, MSG_MASTER_LIST_FSM, 4, 0, FSM_TOGGLE, LED_BATTERY_FULL,
  *                                            3, 0, FSM_BATTERYMONITOR]
+ *
+ * MSG_MASTER_HELLO:
+ * empty payload, response is [4, 0, FSM_MASTER, MSG_MASTER_HELLO]. The same
+ * message is sent unprompted at the end of Init(), so the host knows when the
+ * Arduino has finished resetting and is listening.
  */
 class MecanumMaster
 {
@@ -72,6 +77,11 @@ private:
 	 */
 	void Message(TinyBuffer &msg);
 
+	/**
+	 * Tell the host we're ready (MSG_MASTER_HELLO).
+	 */
+	void SendHello();
+
 	FSMVector fsmv;
 	// Previously this was an int[]. The Arduino would crash after 32 seconds.
 	// 32,767 ms is half of 65,355; 65,355 is the upper limit of a 2-byte int...
@@ -22,19 +22,35 @@
 
 #include "Mimic.h"
 #include "ArduinoAddressBook.h"
+#include "PinChange.h"
 
 #include <Arduino.h>
+#include <limits.h> // for ULONG_MAX
+#include <util/atomic.h>
 
-Mimic::Mimic(uint8_t source, uint8_t dest, unsigned long delay)
+#define FOREVER (ULONG_MAX / 2)
+
+Mimic::Mimic(uint8_t source, uint8_t dest, unsigned long delay, bool interrupt /* = false */) :
+		m_source(source), m_dest(dest), m_bAttached(false)
 {
 	Init(FSM_MIMIC, m_params.GetBuffer());
 
 	m_params.SetSource(source);
 	m_params.SetDest(dest);
 	m_params.SetDelay(delay);
+	m_params.SetInterrupt(interrupt ? 1 : 0);
 
 	pinMode(source, INPUT);
 	pinMode(dest, OUTPUT);
+
+	if (interrupt)
+		m_bAttached = PinChange::Attach(source, OnChange, this);
+}
+
+Mimic::~Mimic()
+{
+	if (m_bAttached)
+		PinChange::Detach(m_params.GetSource());
 }
 
 Mimic *Mimic::NewFromArray(const TinyBuffer &params)
@@ -42,13 +58,24 @@ Mimic *Mimic::NewFromArray(const TinyBuffer &params)
 	if (ParamServer::Mimic::Validate(params))
 	{
 		ParamServer::Mimic mimic(params);
-		return new Mimic(mimic.GetSource(), mimic.GetDest(), mimic.GetDelay());
+		return new Mimic(mimic.GetSource(), mimic.GetDest(), mimic.GetDelay(), mimic.GetInterrupt());
 	}
 	return NULL;
 }
 
 uint32_t Mimic::Step()
 {
-	digitalWrite(m_params.GetDest(), digitalRead(m_params.GetSource()));
-	return m_params.GetDelay();
+	// The first step syncs the destination; after that the interrupt takes
+	// over. An edge between the read and the write mustn't be overwritten.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		m_dest.Write(m_source.Read());
+	}
+	return m_bAttached ? FOREVER : m_params.GetDelay();
+}
+
+void Mimic::OnChange(void *context)
+{
+	Mimic *mimic = static_cast<Mimic*>(context);
+	mimic->m_dest.Write(mimic->m_source.Read());
 }
@@ -23,23 +23,30 @@
 
 #include "FiniteStateMachine.h"
 #include "ParamServer.h"
+#include "Pin.h"
 
 #include <stdint.h>
 
 /**
  * Mirror the state of a source pin to a destination pin.
  *
+ * By default the source is polled every delay ms. With interrupt set, the
+ * destination is updated from the source's pin change interrupt instead (a
+ * few microseconds after the edge) and Step() never runs again. If the source
+ * pin has no interrupt (see PinChange), Mimic falls back to polling.
+ *
  * Parameters:
  * ---
  * uint8  source # IsDigital
  * uint8  dest # IsDigital
  * uint32 delay
+ * uint8  interrupt # IsBinary
  * ---
  */
 class Mimic : public FiniteStateMachine
 {
 public:
-	Mimic(uint8_t source, uint8_t dest, unsigned long delay /* ms */);
+	Mimic(uint8_t source, uint8_t dest, unsigned long delay /* ms */, bool interrupt = false);
 
 	static Mimic *NewFromArray(const TinyBuffer &params);
 
@@ -47,10 +54,17 @@ public:
 	 * When this FSM is destructed, the destination pin is left at whatever
 	 * value the source pin was on the previous step.
 	 */
-	virtual ~Mimic() { }
+	virtual ~Mimic();
 
 	virtual uint32_t Step();
 
+private:
+	static void OnChange(void *context);
+
+	Pin  m_source;
+	Pin  m_dest;
+	bool m_bAttached;
+
 private:
 	ParamServer::Mimic m_params;
 };
@@ -21,18 +21,82 @@
  */
 
 #include "MotorController.h"
+#include "AnalogSampler.h"
 #include "ArduinoAddressBook.h"
+#include "ControlTimer.h"
+#include "Pin.h"
 
 #include <Arduino.h>
 #include <limits.h> // for ULONG_MAX
+#include <util/atomic.h>
 
 #define TIMEOUT 1000 // ms
 #define FOREVER (ULONG_MAX / 2)
 
-MotorController::MotorController() : m_bMessaged(false)
+#define DEFAULT_PERIOD 10 // ms
+#define MAX_OUTPUT     255
+
+// Output compare registers behind the MOTORn_PWM pins (Mega 2560). The control
+// loop writes these directly from the ISR instead of calling analogWrite(),
+// which does a read-modify-write of TCCRnA that could race the main loop.
+#define MOTOR1_OCR OCR3A // pin 5
+#define MOTOR2_OCR OCR4A // pin 6
+#define MOTOR3_OCR OCR3B // pin 2
+#define MOTOR4_OCR OCR3C // pin 3
+
+namespace
+{
+	/**
+	 * Count an edge on a single-channel encoder. The pin is a template
+	 * parameter so that the read resolves to a single port read.
+	 */
+	template <uint8_t PIN>
+	inline void SampleEncoder(uint8_t &level, uint16_t &ticks)
+	{
+		uint8_t value = FastPin<PIN>::Read();
+		if (value != level)
+		{
+			level = value;
+			ticks++;
+		}
+	}
+
+	/**
+	 * Apply a signed PWM output to an H-bridge. Pins A and B are on ports in
+	 * the low I/O space, so with constant values these compile to sbi/cbi and
+	 * are safe from inside an ISR.
+	 */
+	template <uint8_t PIN_A, uint8_t PIN_B>
+	inline void Drive(volatile uint16_t &ocr, int16_t output)
+	{
+		if (output >= 0)
+		{
+			FastPin<PIN_A>::High();
+			FastPin<PIN_B>::Low();
+			ocr = output;
+		}
+		else
+		{
+			FastPin<PIN_A>::Low();
+			FastPin<PIN_B>::High();
+			ocr = -output;
+		}
+	}
+}
+
+MotorController::MotorController(bool closedLoop /* = false */, uint8_t period /* = 0 */,
+		int16_t kp /* = 0 */, int16_t ki /* = 0 */, int16_t kd /* = 0 */, uint16_t csPeriod /* = 0 */) :
+		m_rateScale(0), m_lastMessage(0), m_bMoving(false), m_bAttached(false)
 {
 	Init(FSM_MOTORCONTROLLER, m_params.GetBuffer());
 
+	m_params.SetClosedLoop(closedLoop ? 1 : 0);
+	m_params.SetPeriod(period);
+	m_params.SetKp(kp);
+	m_params.SetKi(ki);
+	m_params.SetKd(kd);
+	m_params.SetCsPeriod(csPeriod);
+
 	pinMode(MOTOR1_PWM, OUTPUT);
 	pinMode(MOTOR1_A, OUTPUT);
 	pinMode(MOTOR1_B, OUTPUT);
@@ -54,85 +118,275 @@ MotorController::MotorController() : m_bMessaged(false)
 	analogWrite(MOTOR3_PWM, 0);
 	analogWrite(MOTOR4_PWM, 0);
 
-	// Debug
-	pinMode(LED_BATTERY_FULL, OUTPUT);
+	AnalogSampler::Add(MOTOR1_CS);
+	AnalogSampler::Add(MOTOR2_CS);
+	AnalogSampler::Add(MOTOR3_CS);
+	AnalogSampler::Add(MOTOR4_CS);
+
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		m_wheels[i].setpoint = 0;
+		m_wheels[i].lastError = 0;
+		m_wheels[i].integral = 0;
+		m_wheels[i].ticks = 0;
+		m_wheels[i].encoder = 0;
+		m_wheels[i].direction = 1;
+	}
+
+	if (m_params.GetClosedLoop())
+	{
+		pinMode(MOTOR1_ENCODER1, INPUT);
+		pinMode(MOTOR2_ENCODER1, INPUT);
+		pinMode(MOTOR3_ENCODER1, INPUT);
+		pinMode(MOTOR4_ENCODER1, INPUT);
+		m_wheels[0].encoder = FastPin<MOTOR1_ENCODER1>::Read();
+		m_wheels[1].encoder = FastPin<MOTOR2_ENCODER1>::Read();
+		m_wheels[2].encoder = FastPin<MOTOR3_ENCODER1>::Read();
+		m_wheels[3].encoder = FastPin<MOTOR4_ENCODER1>::Read();
+
+		// analogWrite(pin, 0) disconnects the pin from its timer. Connect the
+		// four compare outputs once here (the timers run 8-bit phase correct
+		// PWM, so OCR = 0 holds the pin low) and let the ISR set the duty.
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			MOTOR1_OCR = 0;
+			MOTOR2_OCR = 0;
+			MOTOR3_OCR = 0;
+			MOTOR4_OCR = 0;
+			TCCR3A |= _BV(COM3A1) | _BV(COM3B1) | _BV(COM3C1);
+			TCCR4A |= _BV(COM4A1);
+		}
+
+		// Divide once here rather than every period in the ISR
+		uint8_t controlPeriod = m_params.GetPeriod() ? m_params.GetPeriod() : DEFAULT_PERIOD;
+		m_rateScale = (1000UL * 256 + controlPeriod / 2) / controlPeriod;
+
+		if (ControlTimer::Attach(OnSample, this))
+		{
+			if (ControlTimer::Attach(OnControl, this, (uint32_t)controlPeriod * ControlTimer::TICK_HZ / 1000))
+				m_bAttached = true;
+			else
+				ControlTimer::Detach(OnSample, this);
+		}
+	}
 }
 
 MotorController *MotorController::NewFromArray(const TinyBuffer &params)
 {
-	return ParamServer::MotorController::Validate(params) ? new MotorController() : (MotorController*)0;
+	if (ParamServer::MotorController::Validate(params))
+	{
+		ParamServer::MotorController mc(params);
+		MotorController *motors = new MotorController(mc.GetClosedLoop(), mc.GetPeriod(), mc.GetKp(), mc.GetKi(),
+				mc.GetKd(), mc.GetCsPeriod());
+		if (mc.GetClosedLoop() && !motors->m_bAttached)
+		{
+			// The ControlTimer is full, don't run the motors without the loop
+			delete motors;
+			return NULL;
+		}
+		return motors;
+	}
+	return NULL;
 }
 
-uint32_t MotorController::Step()
+MotorController::~MotorController()
 {
-	// If Step() was called after being messaged, set MecanumMaster's delay to TIMEOUT
-	if (m_bMessaged)
+	if (m_bAttached)
 	{
-		m_bMessaged = false;
-		return TIMEOUT;
+		ControlTimer::Detach(OnControl, this);
+		ControlTimer::Detach(OnSample, this);
 	}
 
-	// Timeout occurred (no messages received for duration TIMEOUT)
-	// Stop the motors while waiting for the next message
+	AnalogSampler::Remove(MOTOR1_CS);
+	AnalogSampler::Remove(MOTOR2_CS);
+	AnalogSampler::Remove(MOTOR3_CS);
+	AnalogSampler::Remove(MOTOR4_CS);
+
+	// analogWrite(pin, 0) also disconnects the compare outputs again
 	analogWrite(MOTOR1_PWM, 0);
 	analogWrite(MOTOR2_PWM, 0);
 	analogWrite(MOTOR3_PWM, 0);
 	analogWrite(MOTOR4_PWM, 0);
+}
+
+uint32_t MotorController::Step()
+{
+	unsigned long elapsed = millis() - m_lastMessage;
+
+	// Timeout occurred (no messages received for duration TIMEOUT)
+	// Stop the motors while waiting for the next message
+	if (m_bMoving && elapsed >= TIMEOUT)
+	{
+		StopWheels();
+		m_bMoving = false;
+	}
+
+	if (m_params.GetCsPeriod())
+	{
+		PublishCurrentSense();
+		return m_params.GetCsPeriod();
+	}
+
+	// Wake up when the timeout expires, or wait dormant until the next message
+	return m_bMoving ? TIMEOUT - elapsed : FOREVER;
+}
+
+void MotorController::StopWheels()
+{
+	if (m_params.GetClosedLoop())
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			for (uint8_t i = 0; i < 4; ++i)
+			{
+				m_wheels[i].setpoint = 0;
+				m_wheels[i].lastError = 0;
+				m_wheels[i].integral = 0;
+			}
+			MOTOR1_OCR = 0;
+			MOTOR2_OCR = 0;
+			MOTOR3_OCR = 0;
+			MOTOR4_OCR = 0;
+		}
+	}
+	else
+	{
+		analogWrite(MOTOR1_PWM, 0);
+		analogWrite(MOTOR2_PWM, 0);
+		analogWrite(MOTOR3_PWM, 0);
+		analogWrite(MOTOR4_PWM, 0);
+	}
+}
+
+void MotorController::PublishCurrentSense()
+{
+	ParamServer::MotorControllerPublisherMsg msg;
+	msg.SetMotor1cs(AnalogSampler::Get(MOTOR1_CS));
+	msg.SetMotor2cs(AnalogSampler::Get(MOTOR2_CS));
+	msg.SetMotor3cs(AnalogSampler::Get(MOTOR3_CS));
+	msg.SetMotor4cs(AnalogSampler::Get(MOTOR4_CS));
+	Serial.write(msg.GetBytes(), msg.GetLength());
+}
+
+void MotorController::OnSample(void *context)
+{
+	Wheel *wheels = static_cast<MotorController*>(context)->m_wheels;
+	SampleEncoder<MOTOR1_ENCODER1>(wheels[0].encoder, wheels[0].ticks);
+	SampleEncoder<MOTOR2_ENCODER1>(wheels[1].encoder, wheels[1].ticks);
+	SampleEncoder<MOTOR3_ENCODER1>(wheels[2].encoder, wheels[2].ticks);
+	SampleEncoder<MOTOR4_ENCODER1>(wheels[3].encoder, wheels[3].ticks);
+}
+
+void MotorController::OnControl(void *context)
+{
+	MotorController *mc = static_cast<MotorController*>(context);
+	int32_t kp = mc->m_params.GetKp();
+	int32_t ki = mc->m_params.GetKi();
+	int32_t kd = mc->m_params.GetKd();
+	int16_t output[4];
+
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		Wheel &wheel = mc->m_wheels[i];
+
+		// Edges per period -> ticks per second, signed by the drive direction
+		int16_t measured = (int16_t)((wheel.ticks * mc->m_rateScale) >> 8) * wheel.direction;
+		wheel.ticks = 0;
+
+		int16_t error = wheel.setpoint - measured;
+		wheel.integral += error;
+
+		int32_t out = (kp * error + ki * wheel.integral + kd * (error - wheel.lastError)) >> 8;
+		wheel.lastError = error;
+
+		// Clamp, and stop integrating while saturated in the direction of the
+		// error so the integrator doesn't wind up
+		if (out > MAX_OUTPUT || out < -MAX_OUTPUT)
+		{
+			if ((out > 0) == (error > 0))
+				wheel.integral -= error;
+			out = out > 0 ? MAX_OUTPUT : -MAX_OUTPUT;
+		}
+
+		// Let the motor coast to a stop instead of chattering around zero
+		if (wheel.setpoint == 0 && measured == 0)
+		{
+			out = 0;
+			wheel.integral = 0;
+		}
+
+		output[i] = (int16_t)out;
+		if (out != 0)
+			wheel.direction = out > 0 ? 1 : -1;
+	}
 
-	// Wait dormant until the next message
-	return FOREVER;
+	Drive<MOTOR1_A, MOTOR1_B>(MOTOR1_OCR, output[0]);
+	Drive<MOTOR2_A, MOTOR2_B>(MOTOR2_OCR, output[1]);
+	Drive<MOTOR3_A, MOTOR3_B>(MOTOR3_OCR, output[2]);
+	Drive<MOTOR4_A, MOTOR4_B>(MOTOR4_OCR, output[3]);
 }
 
 bool MotorController::Message(const TinyBuffer &msg)
 {
 	if (msg.Length() == ParamServer::MotorControllerSubscriberMsg::GetLength())
 	{
-		// Debug
-		static uint8_t enable = 1;
-		digitalWrite(LED_BATTERY_FULL, enable);
-		enable = 1 - enable;
+		ParamServer::MotorControllerSubscriberMsg message(msg);
 
+		if (m_params.GetClosedLoop())
+		{
+			// The control loop picks the new setpoints up on its next period
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				m_wheels[0].setpoint = message.GetMotor1();
+				m_wheels[1].setpoint = message.GetMotor2();
+				m_wheels[2].setpoint = message.GetMotor3();
+				m_wheels[3].setpoint = message.GetMotor4();
+			}
+		}
+		else
+		{
+			uint8_t a, b, pwm;
 
-		ParamServer::MotorControllerSubscriberMsg message(msg);
-		uint8_t a, b, pwm;
-
-		a = message.GetMotor1() >= 0 ? 1 : 0;
-		b = 1 - a;
-		pwm = message.GetMotor1() >= 0 ? message.GetMotor1() : -message.GetMotor1();
-		digitalWrite(MOTOR1_A, a);
-		digitalWrite(MOTOR1_B, b);
-		analogWrite(MOTOR1_PWM, pwm);
-
-		a = message.GetMotor2() >= 0 ? 1 : 0;
-		b = 1 - a;
-		pwm = message.GetMotor2() >= 0 ? message.GetMotor2() : -message.GetMotor2();
-		digitalWrite(MOTOR2_A, a);
-		digitalWrite(MOTOR2_B, b);
-		analogWrite(MOTOR2_PWM, pwm);
-
-		a = message.GetMotor3() >= 0 ? 1 : 0;
-		b = 1 - a;
-		pwm = message.GetMotor3() >= 0 ? message.GetMotor3() : -message.GetMotor3();
-		digitalWrite(MOTOR3_A, a);
-		digitalWrite(MOTOR3_B, b);
-		analogWrite(MOTOR3_PWM, pwm);
-
-		a = message.GetMotor4() >= 0 ? 1 : 0;
-		b = 1 - a;
-		pwm = message.GetMotor4() >= 0 ? message.GetMotor4() : -message.GetMotor4();
-		digitalWrite(MOTOR4_A, a);
-		digitalWrite(MOTOR4_B, b);
-		analogWrite(MOTOR4_PWM, pwm);
-
-		ParamServer::MotorControllerPublisherMsg msg;
-		msg.SetMotor1cs(analogRead(MOTOR1_CS));
-		msg.SetMotor2cs(analogRead(MOTOR2_CS));
-		msg.SetMotor3cs(analogRead(MOTOR3_CS));
-		msg.SetMotor4cs(analogRead(MOTOR4_CS));
-		Serial.write(msg.GetBytes(), msg.GetLength());
+			a = message.GetMotor1() >= 0 ? 1 : 0;
+			b = 1 - a;
+			pwm = message.GetMotor1() >= 0 ? message.GetMotor1() : -message.GetMotor1();
+			FastPin<MOTOR1_A>::Write(a);
+			FastPin<MOTOR1_B>::Write(b);
+			analogWrite(MOTOR1_PWM, pwm);
+
+			a = message.GetMotor2() >= 0 ? 1 : 0;
+			b = 1 - a;
+			pwm = message.GetMotor2() >= 0 ? message.GetMotor2() : -message.GetMotor2();
+			FastPin<MOTOR2_A>::Write(a);
+			FastPin<MOTOR2_B>::Write(b);
+			analogWrite(MOTOR2_PWM, pwm);
+
+			a = message.GetMotor3() >= 0 ? 1 : 0;
+			b = 1 - a;
+			pwm = message.GetMotor3() >= 0 ? message.GetMotor3() : -message.GetMotor3();
+			FastPin<MOTOR3_A>::Write(a);
+			FastPin<MOTOR3_B>::Write(b);
+			analogWrite(MOTOR3_PWM, pwm);
+
+			a = message.GetMotor4() >= 0 ? 1 : 0;
+			b = 1 - a;
+			pwm = message.GetMotor4() >= 0 ? message.GetMotor4() : -message.GetMotor4();
+			FastPin<MOTOR4_A>::Write(a);
+			FastPin<MOTOR4_B>::Write(b);
+			analogWrite(MOTOR4_PWM, pwm);
+		}
+
+		m_lastMessage = millis();
+		m_bMoving = true;
+
+		// When publishing on a timer, Step() is already running every
+		// csPeriod ms and will notice the timeout on its own
+		if (m_params.GetCsPeriod())
+			return false;
+
+		PublishCurrentSense();
 
 		// Return true to let MecanumMaster update the timeout
-		m_bMessaged = true;
 		return true;
 	}
 	return false;
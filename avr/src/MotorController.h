@@ -29,8 +29,34 @@
 /**
  * Set the speed of the four motors.
  *
+ * In open loop (closedLoop = 0), the subscribed values are PWM duty cycles
+ * from -255 to 255 and are written straight to the H-bridges.
+ *
+ * In closed loop (closedLoop = 1), the subscribed values are wheel velocity
+ * setpoints in encoder ticks per second. A fixed-point PID per wheel runs from
+ * the ControlTimer interrupt every period ms, using the MOTORn_ENCODER1 pins
+ * for feedback, so the loop rate doesn't depend on the host or the serial
+ * link. Gains are Q8.8 fixed point (256 = 1.0) and are applied per control
+ * period; ki multiplies the running sum of the error and kd the change in
+ * error since the last period.
+ *
+ * Closed loop needs two ControlTimer slots. If they can't be had, the FSM
+ * isn't created rather than running the motors without the loop.
+ *
+ * Current sense is sampled continuously in the background by AnalogSampler
+ * and low-pass filtered, so handling a command is only pin writes. If
+ * csPeriod is 0, every command is answered with the latest filtered values.
+ * Otherwise commands aren't answered, and the values are published every
+ * csPeriod ms instead.
+ *
  * Parameters:
  * ---
+ * uint8  closedLoop # IsBinary
+ * uint8  period
+ * int16  kp
+ * int16  ki
+ * int16  kd
+ * uint16 csPeriod
  * ---
  *
  * Publish:
@@ -52,23 +78,69 @@
 class MotorController : public FiniteStateMachine
 {
 public:
-	MotorController();
+	/**
+	 * Create a new motor controller.
+	 *
+	 * @param closedLoop If true, run the velocity PID instead of raw PWM
+	 * @param period The control period in ms (0 selects the default, 10 ms)
+	 * @param kp, ki, kd Q8.8 fixed-point PID gains (closed loop only)
+	 * @param csPeriod Current sense publishing period in ms, or 0 to answer
+	 *     each command instead
+	 */
+	MotorController(bool closedLoop = false, uint8_t period = 0, int16_t kp = 0, int16_t ki = 0, int16_t kd = 0,
+			uint16_t csPeriod = 0);
 
 	static MotorController *NewFromArray(const TinyBuffer &params);
 
-	virtual ~MotorController() { }
+	/*
+	 * When this FSM is destructed, the motors are stopped and the control loop
+	 * is detached from the timer.
+	 */
+	virtual ~MotorController();
 
 	virtual uint32_t Step();
 
 	/**
-	 * By specifying a long delay, this publisher becomes a service. When a
-	 * message is sent to it (and the message's pin matches its pin), it will
-	 * emit the analog value to the serial port on command.
+	 * Apply a new set of motor commands. If csPeriod is 0, the filtered
+	 * current sense values are sent back and true is returned so that Step()
+	 * re-arms the timeout.
 	 */
 	virtual bool Message(const TinyBuffer &msg);
 
 private:
-	bool m_bMessaged;
+	/**
+	 * ControlTimer callbacks. OnSample() runs every tick and counts encoder
+	 * edges; OnControl() runs every control period and updates the PWM
+	 * outputs from the PID.
+	 */
+	static void OnSample(void *context);
+	static void OnControl(void *context);
+
+	/**
+	 * Zero the setpoints, PID state and PWM outputs.
+	 */
+	void StopWheels();
+
+	/**
+	 * Send the latest filtered current sense values to the host.
+	 */
+	void PublishCurrentSense();
+
+	struct Wheel
+	{
+		int16_t  setpoint;  // ticks per second
+		int16_t  lastError; // ticks per second
+		int32_t  integral;  // sum of the error over each period
+		uint16_t ticks;     // encoder edges seen this period
+		uint8_t  encoder;   // last sampled encoder level
+		int8_t   direction; // sign of the last output, the encoder is single channel
+	};
+
+	Wheel m_wheels[4];
+	uint32_t m_rateScale; // Q8.8, edges per control period -> ticks per second
+	unsigned long m_lastMessage; // ms
+	bool m_bMoving;
+	bool m_bAttached; // Both ControlTimer handlers
 
 private:
 	ParamServer::MotorController m_params;
@@ -0,0 +1,134 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <digitalWriteFast.h>
+#include <stdint.h>
+
+/**
+ * digitalWrite() and digitalRead() look up the pin's port, bit and timer in
+ * PROGMEM tables on every call, and turn off PWM on the pin if necessary. That
+ * works out to roughly 50-60 cycles per call. The two classes below resolve
+ * the port and bit mask once instead:
+ *
+ * FastPin<PIN> is for pins known at compile time (the MOTORn_A/B bridge pins,
+ * encoder inputs). Port, mask and the sbi/cbi-vs-cli decision all fold away,
+ * so Write() is a single sbi/cbi (2 cycles) on ports A-G, and a short
+ * interrupt-safe read-modify-write on ports H-L.
+ *
+ * Pin is for FSMs whose pin is a runtime parameter (Blink, Toggle, Mimic). It
+ * caches the port registers and mask on construction; Write() is then an
+ * interrupt-safe read-modify-write through a pointer, roughly 12-15 cycles.
+ *
+ * Neither class disconnects PWM from the pin. FSMs that may be handed a pin
+ * previously used by analogWrite() should call digitalWrite() once in their
+ * constructor, as they already do, before switching to these.
+ */
+template <uint8_t PIN>
+class FastPin
+{
+public:
+	static inline void Output() { Set(DDR(), true); }
+	static inline void Input()  { Set(DDR(), false); }
+
+	static inline void High() { Set(PORT(), true); }
+	static inline void Low()  { Set(PORT(), false); }
+	static inline void Write(uint8_t value) { if (value) High(); else Low(); }
+
+	static inline uint8_t Read() { return (*PINR() & MASK) ? HIGH : LOW; }
+
+private:
+	static const uint8_t MASK = 1 << __digitalPinToBit(PIN);
+
+	static inline volatile uint8_t *PORT() { return (volatile uint8_t*)digitalPinToPortReg(PIN); }
+	static inline volatile uint8_t *DDR()  { return (volatile uint8_t*)digitalPinToDDRReg(PIN); }
+	static inline volatile uint8_t *PINR() { return (volatile uint8_t*)digitalPinToPINReg(PIN); }
+
+	static inline void Set(volatile uint8_t *reg, bool value)
+	{
+		// Registers below 0x40 are in reach of sbi/cbi, which are atomic. The
+		// comparison is against a constant address and folds away.
+		if ((uintptr_t)reg < 0x40)
+		{
+			if (value)
+				*reg |= MASK;
+			else
+				*reg &= ~MASK;
+		}
+		else
+		{
+			uint8_t sreg = SREG;
+			cli();
+			if (value)
+				*reg |= MASK;
+			else
+				*reg &= ~MASK;
+			SREG = sreg;
+		}
+	}
+};
+
+class Pin
+{
+public:
+	/**
+	 * An invalid pin; Write() and Read() must not be called until a valid
+	 * Pin is assigned.
+	 */
+	Pin() : m_port((volatile uint8_t*)0), m_ddr((volatile uint8_t*)0), m_pin((volatile uint8_t*)0), m_mask(0) { }
+
+	Pin(uint8_t pin)
+	{
+		uint8_t port = digitalPinToPort(pin);
+		m_port = portOutputRegister(port);
+		m_ddr = portModeRegister(port);
+		m_pin = portInputRegister(port);
+		m_mask = digitalPinToBitMask(pin);
+	}
+
+	void Output() { Set(m_ddr, true); }
+	void Input()  { Set(m_ddr, false); }
+
+	void High() { Set(m_port, true); }
+	void Low()  { Set(m_port, false); }
+	void Write(uint8_t value) { Set(m_port, value != LOW); }
+
+	uint8_t Read() const { return (*m_pin & m_mask) ? HIGH : LOW; }
+
+private:
+	void Set(volatile uint8_t *reg, bool value)
+	{
+		uint8_t sreg = SREG;
+		cli();
+		if (value)
+			*reg |= m_mask;
+		else
+			*reg &= ~m_mask;
+		SREG = sreg;
+	}
+
+	volatile uint8_t *m_port;
+	volatile uint8_t *m_ddr;
+	volatile uint8_t *m_pin;
+	uint8_t           m_mask;
+};
@@ -0,0 +1,117 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "PinBenchmark.h"
+#include "ArduinoAddressBook.h"
+#include "Blink.h"
+#include "Mimic.h"
+#include "Pin.h"
+
+#include <Arduino.h>
+#include <limits.h> // for ULONG_MAX
+
+#define FOREVER    (ULONG_MAX / 2)
+#define ITERATIONS 1000
+
+#define OUTPUT_PIN TOP1
+#define INPUT_PIN  TOP2
+
+/**
+ * Time ITERATIONS runs of statement and store the total in microseconds. The
+ * empty asm keeps the loop from being optimized away when statement is empty.
+ */
+#define MEASURE(total, statement) \
+	do { \
+		unsigned long start = micros(); \
+		for (uint16_t i = 0; i < ITERATIONS; ++i) \
+		{ \
+			statement; \
+			asm volatile (""); \
+		} \
+		total = micros() - start; \
+	} while (0)
+
+namespace
+{
+	/**
+	 * Convert a measured total to cycles per iteration, less the loop overhead.
+	 */
+	uint16_t Cycles(unsigned long total, unsigned long overhead)
+	{
+		if (total <= overhead)
+			return 0;
+		return (uint16_t)(((total - overhead) * (F_CPU / 1000000UL) + ITERATIONS / 2) / ITERATIONS);
+	}
+}
+
+PinBenchmark::PinBenchmark()
+{
+	Init(FSM_PINBENCHMARK, m_params.GetBuffer());
+
+	pinMode(OUTPUT_PIN, OUTPUT);
+	digitalWrite(OUTPUT_PIN, LOW);
+	pinMode(INPUT_PIN, INPUT);
+}
+
+PinBenchmark *PinBenchmark::NewFromArray(const TinyBuffer &params)
+{
+	return ParamServer::PinBenchmark::Validate(params) ? new PinBenchmark() : NULL;
+}
+
+uint32_t PinBenchmark::Step()
+{
+	ParamServer::PinBenchmarkPublisherMsg msg;
+	Pin output(OUTPUT_PIN);
+	Pin input(INPUT_PIN);
+	Blink blink(OUTPUT_PIN, 0);
+	Mimic mimic(INPUT_PIN, OUTPUT_PIN, 0);
+	volatile uint8_t sink;
+	unsigned long overhead, total;
+
+	MEASURE(overhead, );
+
+	MEASURE(total, digitalWrite(OUTPUT_PIN, i & 1));
+	msg.SetArduinoWrite(Cycles(total, overhead));
+	MEASURE(total, sink = digitalRead(INPUT_PIN));
+	msg.SetArduinoRead(Cycles(total, overhead));
+
+	MEASURE(total, output.Write(i & 1));
+	msg.SetPinWrite(Cycles(total, overhead));
+	MEASURE(total, sink = input.Read());
+	msg.SetPinRead(Cycles(total, overhead));
+
+	MEASURE(total, FastPin<OUTPUT_PIN>::Write(i & 1));
+	msg.SetFastPinWrite(Cycles(total, overhead));
+	MEASURE(total, sink = FastPin<INPUT_PIN>::Read());
+	msg.SetFastPinRead(Cycles(total, overhead));
+
+	MEASURE(total, blink.Step());
+	msg.SetBlink(Cycles(total, overhead));
+	MEASURE(total, mimic.Step());
+	msg.SetMimic(Cycles(total, overhead));
+
+	(void)sink;
+	output.Low();
+
+	Serial.write(msg.GetBytes(), msg.GetLength());
+	return FOREVER;
+}
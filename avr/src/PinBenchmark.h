@@ -0,0 +1,72 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "FiniteStateMachine.h"
+#include "ParamServer.h"
+
+#include <stdint.h>
+
+/**
+ * Measure the cost of the pin access paths on the running hardware and
+ * publish the result, in CPU cycles per call, once. Destroy and re-create
+ * the FSM to measure again.
+ *
+ * The arduino* fields are digitalWrite()/digitalRead(), the pin* fields are
+ * the cached runtime Pin, and the fastPin* fields are FastPin<>. blink and
+ * mimic are one Blink::Step() and one Mimic::Step(). All writes go to TOP1
+ * and all reads come from TOP2, neither of which is connected.
+ *
+ * Each figure is averaged over 1000 calls with the empty loop subtracted.
+ * Interrupts stay enabled (micros() needs them), so ISRs such as the Timer0
+ * tick add a cycle or so of noise.
+ *
+ * Parameters:
+ * ---
+ * ---
+ *
+ * Publish:
+ * ---
+ * uint16 arduinoWrite
+ * uint16 arduinoRead
+ * uint16 pinWrite
+ * uint16 pinRead
+ * uint16 fastPinWrite
+ * uint16 fastPinRead
+ * uint16 blink
+ * uint16 mimic
+ * ---
+ */
+class PinBenchmark : public FiniteStateMachine
+{
+public:
+	PinBenchmark();
+
+	static PinBenchmark *NewFromArray(const TinyBuffer &params);
+
+	virtual ~PinBenchmark() { }
+
+	virtual uint32_t Step();
+
+private:
+	ParamServer::PinBenchmark m_params;
+};
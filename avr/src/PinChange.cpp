@@ -0,0 +1,196 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "PinChange.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+PinChange::Slot PinChange::m_slots[PinChange::MAX_HANDLERS];
+uint8_t PinChange::m_size = 0;
+uint8_t PinChange::m_groupState[3] = { 0, 0, 0 };
+
+ISR(INT0_vect) { PinChange::External(0); }
+ISR(INT1_vect) { PinChange::External(1); }
+ISR(INT2_vect) { PinChange::External(2); }
+ISR(INT3_vect) { PinChange::External(3); }
+ISR(INT4_vect) { PinChange::External(4); }
+ISR(INT5_vect) { PinChange::External(5); }
+ISR(PCINT0_vect) { PinChange::Group(0); }
+ISR(PCINT1_vect) { PinChange::Group(1); }
+ISR(PCINT2_vect) { PinChange::Group(2); }
+
+uint8_t PinChange::Lookup(uint8_t pin)
+{
+	// Mega 2560 pin mapping
+	switch (pin)
+	{
+	case 21: return 0; // INT0, PD0
+	case 20: return 1; // INT1, PD1
+	case 19: return 2; // INT2, PD2
+	case 18: return 3; // INT3, PD3
+	case 2:  return 4; // INT4, PE4
+	case 3:  return 5; // INT5, PE5
+	case 53: return PCINT_BASE + 0; // PB0
+	case 52: return PCINT_BASE + 1; // PB1
+	case 51: return PCINT_BASE + 2; // PB2
+	case 50: return PCINT_BASE + 3; // PB3
+	case 10: return PCINT_BASE + 4; // PB4
+	case 11: return PCINT_BASE + 5; // PB5
+	case 12: return PCINT_BASE + 6; // PB6
+	case 13: return PCINT_BASE + 7; // PB7
+	case 15: return PCINT_BASE + 9; // PJ0
+	case 14: return PCINT_BASE + 10; // PJ1
+	}
+	if (62 <= pin && pin <= 69)
+		return PCINT_BASE + 16 + (pin - 62); // PK0-PK7, A8-A15
+	return NONE;
+}
+
+uint8_t PinChange::ReadGroup(uint8_t group)
+{
+	switch (group)
+	{
+	case 0:  return PINB;
+	case 1:  return (PINE & 0x01) | (PINJ << 1); // PCINT8 is PE0, PCINT9-15 are PJ0-PJ6
+	default: return PINK;
+	}
+}
+
+bool PinChange::Attach(uint8_t pin, Handler handler, void *context)
+{
+	uint8_t source = Lookup(pin);
+	if (!handler || source == NONE || m_size >= MAX_HANDLERS)
+		return false;
+
+	bool success = true;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < m_size; ++i)
+		{
+			if (m_slots[i].source == source)
+			{
+				success = false;
+				break;
+			}
+		}
+		if (success)
+		{
+			Slot &slot = m_slots[m_size++];
+			slot.handler = handler;
+			slot.context = context;
+			slot.source = source;
+			Enable(source);
+		}
+	}
+	return success;
+}
+
+void PinChange::Detach(uint8_t pin)
+{
+	uint8_t source = Lookup(pin);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < m_size; ++i)
+		{
+			if (m_slots[i].source == source)
+			{
+				Disable(source);
+				// Order doesn't matter, swap in the last slot
+				m_slots[i] = m_slots[--m_size];
+				break;
+			}
+		}
+	}
+}
+
+void PinChange::Enable(uint8_t source)
+{
+	if (source < PCINT_BASE)
+	{
+		// ISCn = 01, interrupt on any logical change
+		uint8_t shift = (source & 3) * 2;
+		if (source < 4)
+			EICRA = (EICRA & ~(3 << shift)) | (1 << shift);
+		else
+			EICRB = (EICRB & ~(3 << shift)) | (1 << shift);
+		EIFR = _BV(source);
+		EIMSK |= _BV(source);
+	}
+	else
+	{
+		uint8_t group = (source - PCINT_BASE) / 8;
+		uint8_t bit = _BV((source - PCINT_BASE) % 8);
+		volatile uint8_t &mask = group == 0 ? PCMSK0 : group == 1 ? PCMSK1 : PCMSK2;
+		m_groupState[group] = ReadGroup(group);
+		mask |= bit;
+		PCIFR = _BV(group);
+		PCICR |= _BV(group);
+	}
+}
+
+void PinChange::Disable(uint8_t source)
+{
+	if (source < PCINT_BASE)
+	{
+		EIMSK &= ~_BV(source);
+	}
+	else
+	{
+		uint8_t group = (source - PCINT_BASE) / 8;
+		uint8_t bit = _BV((source - PCINT_BASE) % 8);
+		volatile uint8_t &mask = group == 0 ? PCMSK0 : group == 1 ? PCMSK1 : PCMSK2;
+		mask &= ~bit;
+		if (!mask)
+			PCICR &= ~_BV(group);
+	}
+}
+
+void PinChange::External(uint8_t interrupt)
+{
+	for (uint8_t i = 0; i < m_size; ++i)
+	{
+		if (m_slots[i].source == interrupt)
+		{
+			m_slots[i].handler(m_slots[i].context);
+			break;
+		}
+	}
+}
+
+void PinChange::Group(uint8_t group)
+{
+	// The vector is shared by the whole port, only dispatch to pins that
+	// actually changed
+	uint8_t state = ReadGroup(group);
+	uint8_t changed = state ^ m_groupState[group];
+	m_groupState[group] = state;
+
+	uint8_t first = PCINT_BASE + group * 8;
+	for (uint8_t i = 0; i < m_size; ++i)
+	{
+		uint8_t source = m_slots[i].source;
+		if (first <= source && source < first + 8 && (changed & _BV(source - first)))
+			m_slots[i].handler(m_slots[i].context);
+	}
+}
@@ -0,0 +1,92 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * PinChange calls a handler from an interrupt whenever a pin changes state.
+ * The external interrupts are used for pins 2, 3, 18, 19, 20 and 21, and the
+ * pin change interrupts for pins 10-15, 50-53 and A8-A15. Other pins have no
+ * interrupt and Attach() refuses them.
+ *
+ * This module owns the INTn and PCINTn vectors, so it can't be mixed with
+ * Arduino's attachInterrupt(). Handlers run inside the ISR with interrupts
+ * disabled, the same rules as ControlTimer's apply.
+ */
+class PinChange
+{
+public:
+	typedef void (*Handler)(void *context);
+
+	/**
+	 * True if the pin can raise an interrupt.
+	 */
+	static bool IsSupported(uint8_t pin) { return Lookup(pin) != NONE; }
+
+	/**
+	 * Call handler(context) on both edges of pin. Returns false if the pin
+	 * has no interrupt, already has a handler, or all slots are taken.
+	 */
+	static bool Attach(uint8_t pin, Handler handler, void *context);
+
+	/**
+	 * Stop watching pin. The interrupt is disabled when no handler is left.
+	 */
+	static void Detach(uint8_t pin);
+
+	/**
+	 * Dispatch an external interrupt (0-7). Called by the ISRs.
+	 */
+	static void External(uint8_t interrupt);
+
+	/**
+	 * Dispatch a pin change interrupt group (0-2). Called by the ISRs.
+	 */
+	static void Group(uint8_t group);
+
+private:
+	/**
+	 * Sources are numbered 0-7 for INT0-INT7 and 8-31 for PCINT0-PCINT23.
+	 */
+	static const uint8_t NONE = 0xFF;
+	static const uint8_t PCINT_BASE = 8;
+
+	static uint8_t Lookup(uint8_t pin);
+	static uint8_t ReadGroup(uint8_t group);
+	static void Enable(uint8_t source);
+	static void Disable(uint8_t source);
+
+	struct Slot
+	{
+		Handler handler;
+		void   *context;
+		uint8_t source;
+	};
+
+	static const uint8_t MAX_HANDLERS = 4;
+	static Slot    m_slots[MAX_HANDLERS];
+	static uint8_t m_size;
+
+	// Last state seen by each pin change group, to tell which pins changed
+	static uint8_t m_groupState[3];
+};
@@ -22,53 +22,91 @@
 
 #include "Sentry.h"
 #include "ArduinoAddressBook.h"
+#include "Pin.h"
 
 #include <Arduino.h>
-#include <digitalWriteFast.h>
 
 #define SERVO_PIN     53
 #define ENCODER_PIN   35
 #define PROXIMITY_PIN 2 // Analog
 
 #define INITIAL_MIDPOINT     1500 // us
+#define MIN_MICROS           800  // us
+#define MAX_MICROS           2200 // us
 #define TICKS                100
 // microseconds (pulse length) per tick, assuming 1000us = 120 degrees
 #define NOMINAL_uS_PER_TICK  30 // (1000 us / 24 degrees) * (360 degrees / TICKS)
 
+// Calibration
+#define FIRST_STRIDE         (4 * NOMINAL_uS_PER_TICK)  // us
+#define MAX_STRIDE           (16 * NOMINAL_uS_PER_TICK) // us
+#define SETTLE_BASE          20 // ms, plus 2 ms per 5 us moved (about 0.2 s / 60 degrees)
 
-Encoder::Encoder() : m_ticks(0), m_state(0), m_sampleCount(0), m_enabled(false)
+
+Encoder::Encoder() : m_ticks(0), m_state(0), m_sampleCount(0), m_length(0), m_enabled(false), m_edges(false)
 {
 	pinMode(ENCODER_PIN, INPUT);
 	//pinMode(LED_BATTERY_EMPTY, OUTPUT);
 
 	// Save some CPU cycles later
-	m_sampleMessage[1] = 0;
-	m_sampleMessage[2] = FSM_ENCODER;
+	m_message[1] = 0;
+	m_message[2] = FSM_ENCODER;
 }
 
 void Encoder::Start()
 {
 	m_ticks = 0;
-	m_state = digitalReadFast(ENCODER_PIN);
+	m_state = FastPin<ENCODER_PIN>::Read();
 	m_sampleCount = 0; // Redundant
+	m_length = 5; // Edges header
+	m_lastEdge = micros();
 	m_enabled = true;
 }
 
 void Encoder::Update()
 {
-	if (digitalReadFast(ENCODER_PIN) != m_state)
+	bool edge = false;
+	if (FastPin<ENCODER_PIN>::Read() != m_state)
 	{
 		m_state = 1 - m_state;
 		m_ticks++;
+		edge = true;
 		//digitalWrite(LED_BATTERY_EMPTY, m_state);
 	}
+
+	if (m_edges)
+	{
+		unsigned long now = micros();
+		if (edge)
+		{
+			if (m_length == 5)
+			{
+				m_message[4] = 1 - m_state; // Level before this edge
+				m_firstEdge = now;
+			}
+			// 7 bits at a time, low first, with the high bit set on all but the last
+			unsigned long delta = now - m_lastEdge;
+			m_lastEdge = now;
+			do
+			{
+				uint8_t low = delta & 0x7F;
+				delta >>= 7;
+				m_message[m_length++] = delta ? (low | 0x80) : low;
+			} while (delta);
+		}
+		// Full means no room for the longest delta (5 bytes)
+		if (m_length > 5 && (m_length > sizeof(m_message) - 5 || now - m_firstEdge >= ENCODER_EDGE_LATENCY))
+			Publish();
+		return;
+	}
+
 	// Clear the byte if newly accessed
 	if (m_sampleCount % 8 == 0)
-		m_sampleMessage[m_sampleCount / 8 + 4] = m_state;
+		m_message[m_sampleCount / 8 + 4] = m_state;
 	else
-		m_sampleMessage[m_sampleCount / 8 + 4] |= m_state << (m_sampleCount % 8);
+		m_message[m_sampleCount / 8 + 4] |= m_state << (m_sampleCount % 8);
 
-	if (++m_sampleCount == 8 * (sizeof(m_sampleMessage) - 4))
+	if (++m_sampleCount == ENCODER_SAMPLES)
 		Publish();
 }
 
@@ -77,27 +115,41 @@ void Encoder::Disable()
 	if (m_enabled)
 	{
 		m_enabled = false;
-		if (m_sampleCount)
+		if (m_sampleCount || m_length > 5)
 			Publish();
 	}
 }
 
 void Encoder::Publish()
 {
+	//m_message[1] = 0;           // Set in constructor
+	//m_message[2] = FSM_ENCODER; // Set in constructor
+	if (m_edges)
+	{
+		m_message[0] = m_length;
+		m_message[3] = ENCODER_FORMAT_EDGES;
+		Serial.write(m_message, m_length);
+		m_length = 5;
+		return;
+	}
+
 	// Only publish what's needed (1 extra byte for every 9th bit)
-	m_sampleMessage[0] = 5 + (m_sampleCount - 1) / 8;
-	//m_sampleMessage[1] = 0;           // Set in constructor
-	//m_sampleMessage[2] = FSM_ENCODER; // Set in constructor
-	m_sampleMessage[3] = m_sampleCount;
-	Serial.write(m_sampleMessage, m_sampleMessage[0]);
+	m_message[0] = 5 + (m_sampleCount - 1) / 8;
+	m_message[3] = m_sampleCount;
+	Serial.write(m_message, m_message[0]);
 
 	// Reset the samples array
 	m_sampleCount = 0;
 }
 
-Sentry::Sentry() : m_state(SEEKING_MIDPOINT), m_targetMicros(INITIAL_MIDPOINT)
+Sentry::Sentry(bool edges, bool calibrate) : m_state(SEEKING_MIDPOINT), m_target(INITIAL_MIDPOINT),
+	m_targetMicros(INITIAL_MIDPOINT), m_direction(1), m_movedMicros(0), m_movedTicks(0),
+	m_microsPerTick(NOMINAL_uS_PER_TICK << 8)
 {
 	Init(FSM_SENTRY, m_params.GetBuffer());
+	m_params.SetEdges(edges);
+	m_params.SetCalibrate(calibrate);
+	m_encoder.SetEdges(edges);
 	m_servo.attach(SERVO_PIN);
 }
 
@@ -108,7 +160,12 @@ Sentry::~Sentry()
 
 Sentry *Sentry::NewFromArray(const TinyBuffer &params)
 {
-	return ParamServer::Sentry::Validate(params) ? new Sentry() : (Sentry*)0;
+	if (ParamServer::Sentry::Validate(params))
+	{
+		ParamServer::Sentry sentry(params);
+		return new Sentry(sentry.GetEdges(), sentry.GetCalibrate());
+	}
+	return (Sentry*)0;
 }
 
 uint32_t Sentry::Step()
@@ -118,7 +175,15 @@ uint32_t Sentry::Step()
 	case SEEKING_MIDPOINT:
 		{
 			m_servo.writeMicroseconds(m_targetMicros);
-			m_state = SEEKING_LEFT;
+			if (m_params.GetCalibrate())
+			{
+				// Start the left side once centered
+				m_state = CALIBRATING_NEXT;
+			}
+			else
+			{
+				m_state = SEEKING_LEFT;
+			}
 			// Allow 1 second to center the servo
 			return 1000;
 		}
@@ -155,6 +220,33 @@ uint32_t Sentry::Step()
 			m_servo.writeMicroseconds(m_targetMicros);
 			return 50;
 		}
+	case CALIBRATING_STRIDE:
+		return Stride();
+	case CALIBRATING_BISECT:
+		return Bisect();
+	case CALIBRATING_NEXT:
+		{
+			// At the midpoint, after the last side or before the first
+			if (m_direction > 0)
+			{
+				if (m_encoder.IsEnabled())
+				{
+					m_encoder.Disable();
+					m_state = FINISHED;
+					break;
+				}
+				m_encoder.Start();
+			}
+			m_direction = -m_direction;
+			m_step = FIRST_STRIDE;
+			m_reached = INITIAL_MIDPOINT;
+			m_previous = INITIAL_MIDPOINT;
+			m_sideTicks = 0;
+			m_strideMicros = 0;
+			m_strideTicks = 0;
+			m_state = CALIBRATING_STRIDE;
+			return Move(m_reached + m_direction * m_step);
+		}
 	case FINISHED:
 	default:
 		break;
@@ -162,5 +254,114 @@ uint32_t Sentry::Step()
 	return 24L * 60L * 60L * 1000L;
 }
 
+uint32_t Sentry::Move(int target)
+{
+	target = constrain(target, MIN_MICROS, MAX_MICROS);
+	int distance = abs(target - m_target);
+	m_target = target;
+	m_startTicks = m_encoder.Ticks();
+	m_servo.writeMicroseconds(target);
+	return SETTLE_BASE + distance * 2 / 5;
+}
+
+uint32_t Sentry::Stride()
+{
+	int ticks = m_encoder.Ticks() - m_startTicks;
+	uint16_t distance = abs(m_target - m_reached);
+	uint32_t expected = ((uint32_t)distance << 8) / m_microsPerTick;
+	if ((uint32_t)ticks * 2 >= expected)
+	{
+		if (m_target != MIN_MICROS && m_target != MAX_MICROS)
+		{
+			// Still in the clear, lengthen the stride
+			m_previous = m_reached;
+			m_reached = m_target;
+			m_sideTicks += ticks;
+			m_strideMicros = distance;
+			m_strideTicks = ticks;
+			m_movedMicros += distance;
+			m_movedTicks += ticks;
+			m_microsPerTick = (m_movedMicros << 8) / m_movedTicks;
+			if (m_step < MAX_STRIDE)
+				m_step *= 2;
+			return Move(m_reached + m_direction * m_step);
+		}
+		// The servo may not reach this far; bisect up to it
+	}
+
+	// Fell short. The ticks it took are those from m_reached to the limit.
+	m_unreached = m_target;
+	m_limitTicks = ticks;
+	if (ticks == 0 && m_reached != m_previous)
+	{
+		// The last stride ended against the limit, so it counted those
+		m_unreached = m_reached;
+		m_reached = m_previous;
+		m_limitTicks = m_strideTicks;
+		m_sideTicks -= m_strideTicks;
+		m_movedMicros -= m_strideMicros;
+		m_movedTicks -= m_strideTicks;
+		m_microsPerTick = m_movedTicks ? (m_movedMicros << 8) / m_movedTicks : NOMINAL_uS_PER_TICK << 8;
+	}
+	m_bAtLimit = true;
+	m_state = CALIBRATING_BISECT;
+	if (abs(m_unreached - m_reached) <= NOMINAL_uS_PER_TICK)
+		return FinishSide();
+	return Move((m_reached + m_unreached) / 2);
+}
+
+uint32_t Sentry::Bisect()
+{
+	int ticks = m_encoder.Ticks() - m_startTicks;
+	if (m_bAtLimit)
+	{
+		// Back from the limit: any tick means the probe is short of it
+		if (ticks > 0)
+		{
+			if (ticks < m_limitTicks)
+				m_sideTicks += m_limitTicks - ticks;
+			m_reached = m_target;
+			m_limitTicks = ticks;
+			m_bAtLimit = false;
+		}
+		else
+		{
+			m_unreached = m_target;
+		}
+	}
+	else
+	{
+		// Out from m_reached: short of the limit if it didn't take every tick
+		if (ticks < m_limitTicks)
+		{
+			m_reached = m_target;
+			m_limitTicks -= ticks;
+			m_sideTicks += ticks;
+		}
+		else
+		{
+			m_unreached = m_target;
+			m_bAtLimit = true;
+		}
+	}
+
+	// Within a tick of the limit the encoder can't tell any more
+	if (abs(m_unreached - m_reached) <= NOMINAL_uS_PER_TICK)
+		return FinishSide();
+	return Move((m_reached + m_unreached) / 2);
+}
+
+uint32_t Sentry::FinishSide()
+{
+	ParamServer::SentryPublisherMsg msg;
+	msg.SetTicks(m_sideTicks);
+	msg.SetMicroseconds(m_reached - INITIAL_MIDPOINT);
+	msg.SetMicrosPerTick(m_sideTicks ? ((uint32_t)abs(m_reached - INITIAL_MIDPOINT) << 8) / m_sideTicks : 0);
+	Serial.write(msg.GetBytes(), msg.GetLength());
+
+	m_state = CALIBRATING_NEXT;
+	return Move(INITIAL_MIDPOINT);
+}
+
 
 
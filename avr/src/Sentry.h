@@ -26,17 +26,47 @@
 
 #include <Servo.h>
 
+#define ENCODER_SAMPLES       128   // per message, in the samples format
+#define ENCODER_SAMPLE_PERIOD 500   // us, in the samples format
+#define ENCODER_EDGE_LATENCY  64000 // us, longest an edge waits to be sent
+#define ENCODER_MESSAGE_SIZE  32    // bytes
+
 /**
- * Track a shaft encoder with an IR sensor.
+ * Track a shaft encoder with an IR sensor, streaming what it sees to the
+ * host as FSM_ENCODER messages in one of two formats:
+ *
+ * Samples: [length lo][length hi][FSM_ENCODER][count][bits...], the pin's
+ * level every ENCODER_SAMPLE_PERIOD us, bit i of the bits being sample i. A
+ * message is sent every ENCODER_SAMPLES samples, whether or not the wheel
+ * moves.
+ *
+ * Edges: [length lo][length hi][FSM_ENCODER][ENCODER_FORMAT_EDGES][level]
+ * [deltas...], the time of each transition in us since the one before (for
+ * the first, since the last of the previous message, or Start()), as LEB128
+ * varints; level is the pin's level before the first. The pin is polled on
+ * every pass of the main loop, and a message is sent when
+ * ENCODER_EDGE_LATENCY has passed since its first edge or it is full, so
+ * traffic follows the wheel's speed.
  */
 class Encoder
 {
 public:
 	Encoder();
 
+	/**
+	 * Choose the edges format. Call before Start().
+	 */
+	void SetEdges(bool edges) { m_edges = edges; }
+
 	void Start();
 	void Update();
 
+	/**
+	 * How often Update() wants to be called, in us (0 for as often as
+	 * possible).
+	 */
+	unsigned long GetSamplePeriod() const { return m_edges ? 0 : ENCODER_SAMPLE_PERIOD; }
+
 	int Ticks() const { return m_ticks; }
 
 	void Disable();
@@ -45,29 +75,57 @@ public:
 private:
 	void Publish();
 
-	uint8_t m_pin;
-	int     m_ticks;
-	uint8_t m_state;
-	// Use <= 128 samples, otherwise we overflow
-	uint8_t m_sampleMessage[16 + 4]; // 128 samples + 4 byte header
-	uint8_t m_sampleCount;
-	bool    m_enabled;
+	uint8_t       m_pin;
+	int           m_ticks;
+	uint8_t       m_state;
+	uint8_t       m_message[ENCODER_MESSAGE_SIZE];
+	uint8_t       m_sampleCount;  // Samples format
+	uint8_t       m_length;       // Edges format: bytes of m_message used
+	unsigned long m_lastEdge;     // micros()
+	unsigned long m_firstEdge;    // micros() of the message's first edge
+	bool          m_enabled;
+	bool          m_edges;
 };
 
 
 /**
  * Control the five colored LED arrays.
  *
+ * If edges is 1, the encoder streams transition timestamps instead of level
+ * samples (see Encoder).
+ *
+ * If calibrate is 1, the servo's endpoints are found from the encoder's
+ * feedback instead of by stepping NOMINAL_uS_PER_TICK at a time. Each side is
+ * approached in strides that double while the encoder keeps up with them.
+ * The stride that falls short (or reaches MIN/MAX_MICROS, which the servo
+ * may not) counts the ticks left from the last position reached to the
+ * limit, and the limit is then bisected against that count to within a
+ * tick: a probe that ends short of the limit sees fewer ticks. As the
+ * encoder can't tell direction, probes are one move each, alternately
+ * from the last position reached and from the limit. The endpoint reported
+ * is the furthest position reached, so it errs toward the midpoint.
+ *
+ * One message is published per side, left first: the ticks from the
+ * midpoint to the endpoint, the endpoint relative to the midpoint, and their
+ * ratio, microseconds per tick, as Q8.8 fixed point (256 = 1 us).
+ *
+ * Parameters:
+ * ---
+ * uint8 edges # IsBinary
+ * uint8 calibrate # IsBinary
+ * ---
+ *
  * Publish:
  * ---
- * uint8 ticks
- * int16 microseconds
+ * uint8  ticks
+ * int16  microseconds
+ * uint16 microsPerTick
  * ---
  */
 class Sentry : public FiniteStateMachine
 {
 public:
-	Sentry();
+	Sentry(bool edges, bool calibrate);
 
 	static Sentry *NewFromArray(const TinyBuffer &params);
 
@@ -81,11 +139,35 @@ private:
 	Encoder m_encoder;
 	Servo   m_servo;
 
+	/**
+	 * Calibration: command the servo to target and wait for it to settle.
+	 */
+	uint32_t Move(int target);
+
+	/**
+	 * Calibration: judge the last stride by the ticks it produced.
+	 */
+	uint32_t Stride();
+
+	/**
+	 * Calibration: narrow the limit down with the last probe.
+	 */
+	uint32_t Bisect();
+
+	/**
+	 * Calibration: report the endpoint of the current side and head back to
+	 * the midpoint.
+	 */
+	uint32_t FinishSide();
+
 	enum State
 	{
 		SEEKING_MIDPOINT,
 		SEEKING_LEFT,
 		SEEKING_RIGHT,
+		CALIBRATING_STRIDE, // Striding out from the midpoint
+		CALIBRATING_BISECT, // Probing between m_reached and m_unreached
+		CALIBRATING_NEXT,   // Moving back to the midpoint
 		FINISHED
 	};
 	State m_state;
@@ -96,6 +178,22 @@ private:
 	//int m_servoRight;    // microseconds (pulse length)
 	//int m_servoMidpoint; // microseconds (pulse length)
 
+	// Calibration
+	int8_t   m_direction;     // -1 for left, 1 for right
+	int      m_step;          // microseconds
+	int      m_reached;       // Furthest position reached (microseconds)
+	int      m_previous;      // m_reached before the last stride
+	int      m_unreached;     // Nearest position not reached
+	int      m_startTicks;    // Encoder ticks when the move started
+	int      m_limitTicks;    // Ticks from m_reached to the limit
+	bool     m_bAtLimit;      // The servo is against the limit, not at m_reached
+	uint8_t  m_sideTicks;     // Ticks from the midpoint to m_reached
+	uint16_t m_strideMicros;  // The last stride, to take back if it was cut
+	uint16_t m_strideTicks;   // short by the limit
+	uint32_t m_movedMicros;   // Distance and ticks of the strides, to judge
+	uint16_t m_movedTicks;    // the next one by
+	uint16_t m_microsPerTick; // Q8.8
+
 private:
 	ParamServer::Sentry m_params;
 };
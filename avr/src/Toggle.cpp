@@ -29,7 +29,7 @@
 
 #define FOREVER (ULONG_MAX / 2) // ~25 days, need some space to add current time
 
-Toggle::Toggle(uint8_t pin) : m_enabled(false)
+Toggle::Toggle(uint8_t pin) : m_pin(pin), m_enabled(false)
 {
 	Init(FSM_TOGGLE, m_params.GetBuffer());
 
@@ -51,12 +51,12 @@ Toggle *Toggle::NewFromArray(const TinyBuffer &params)
 
 Toggle::~Toggle()
 {
-	digitalWrite(m_params.GetPin(), LOW);
+	m_pin.Low();
 }
 
 uint32_t Toggle::Step()
 {
-	digitalWrite(m_params.GetPin(), m_enabled ? HIGH : LOW);
+	m_pin.Write(m_enabled ? HIGH : LOW);
 	return FOREVER;
 }
 
@@ -23,6 +23,7 @@
 
 #include "FiniteStateMachine.h"
 #include "ParamServer.h"
+#include "Pin.h"
 
 #include <stdint.h>
 
@@ -66,6 +67,7 @@ public:
 	virtual bool Message(const TinyBuffer &msg);
 
 private:
+	Pin  m_pin;
 	bool m_enabled;
 
 private:
@@ -0,0 +1,166 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "WheelEncoders.h"
+#include "ArduinoAddressBook.h"
+#include "ControlTimer.h"
+#include "Pin.h"
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+#define DEFAULT_PERIOD 20 // ms
+
+namespace
+{
+	const int8_t SKIPPED = 2;
+
+	/**
+	 * Steps for each transition, indexed by (old state << 2) | new state. The
+	 * forward sequence is 00, 10, 11, 01 (ENCODER1 leading).
+	 */
+	const int8_t TRANSITIONS[16] =
+	{
+		 0, -1,  1, SKIPPED,
+		 1,  0, SKIPPED, -1,
+		-1, SKIPPED,  0,  1,
+		SKIPPED,  1, -1,  0,
+	};
+
+	/**
+	 * Sample one wheel's channels. The pins are template parameters so that
+	 * each read resolves to a single port read.
+	 */
+	template <uint8_t PIN_1, uint8_t PIN_2>
+	inline uint8_t ReadState()
+	{
+		return (FastPin<PIN_1>::Read() << 1) | FastPin<PIN_2>::Read();
+	}
+}
+
+WheelEncoders::WheelEncoders(uint16_t period /* = 0 */) : m_ticks(0), m_lastTicks(0), m_errors(0)
+{
+	Init(FSM_WHEELENCODERS, m_params.GetBuffer());
+	m_params.SetPeriod(period);
+
+	pinMode(MOTOR1_ENCODER1, INPUT);
+	pinMode(MOTOR1_ENCODER2, INPUT);
+	pinMode(MOTOR2_ENCODER1, INPUT);
+	pinMode(MOTOR2_ENCODER2, INPUT);
+	pinMode(MOTOR3_ENCODER1, INPUT);
+	pinMode(MOTOR3_ENCODER2, INPUT);
+	pinMode(MOTOR4_ENCODER1, INPUT);
+	pinMode(MOTOR4_ENCODER2, INPUT);
+
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		m_wheels[i].count = 0;
+		m_wheels[i].lastCount = 0;
+	}
+	m_wheels[0].state = ReadState<MOTOR1_ENCODER1, MOTOR1_ENCODER2>();
+	m_wheels[1].state = ReadState<MOTOR2_ENCODER1, MOTOR2_ENCODER2>();
+	m_wheels[2].state = ReadState<MOTOR3_ENCODER1, MOTOR3_ENCODER2>();
+	m_wheels[3].state = ReadState<MOTOR4_ENCODER1, MOTOR4_ENCODER2>();
+
+	m_bAttached = ControlTimer::Attach(OnSample, this);
+}
+
+WheelEncoders *WheelEncoders::NewFromArray(const TinyBuffer &params)
+{
+	if (ParamServer::WheelEncoders::Validate(params))
+	{
+		ParamServer::WheelEncoders we(params);
+		return new WheelEncoders(we.GetPeriod());
+	}
+	return NULL;
+}
+
+WheelEncoders::~WheelEncoders()
+{
+	if (m_bAttached)
+		ControlTimer::Detach(OnSample, this);
+}
+
+uint32_t WheelEncoders::Step()
+{
+	// Take a consistent snapshot; the ISR updates all of these every tick
+	int32_t counts[4];
+	uint32_t ticks;
+	uint16_t errors;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < 4; ++i)
+			counts[i] = m_wheels[i].count;
+		ticks = m_ticks;
+		errors = m_errors;
+	}
+
+	// Steps per second. Differences are taken before scaling, so they're
+	// correct across a wrap of the counts.
+	int16_t velocities[4] = { 0, 0, 0, 0 };
+	uint32_t elapsed = ticks - m_lastTicks;
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		int32_t steps = (int32_t)((uint32_t)counts[i] - (uint32_t)m_wheels[i].lastCount);
+		if (elapsed)
+			velocities[i] = steps * ControlTimer::TICK_HZ / (int32_t)elapsed;
+		m_wheels[i].lastCount = counts[i];
+	}
+	m_lastTicks = ticks;
+
+	ParamServer::WheelEncodersPublisherMsg msg;
+	msg.SetCount1(counts[0]);
+	msg.SetCount2(counts[1]);
+	msg.SetCount3(counts[2]);
+	msg.SetCount4(counts[3]);
+	msg.SetVelocity1(velocities[0]);
+	msg.SetVelocity2(velocities[1]);
+	msg.SetVelocity3(velocities[2]);
+	msg.SetVelocity4(velocities[3]);
+	msg.SetErrors(errors);
+	Serial.write(msg.GetBytes(), msg.GetLength());
+
+	return m_params.GetPeriod() ? m_params.GetPeriod() : DEFAULT_PERIOD;
+}
+
+void WheelEncoders::OnSample(void *context)
+{
+	WheelEncoders *self = static_cast<WheelEncoders*>(context);
+
+	uint8_t states[4];
+	states[0] = ReadState<MOTOR1_ENCODER1, MOTOR1_ENCODER2>();
+	states[1] = ReadState<MOTOR2_ENCODER1, MOTOR2_ENCODER2>();
+	states[2] = ReadState<MOTOR3_ENCODER1, MOTOR3_ENCODER2>();
+	states[3] = ReadState<MOTOR4_ENCODER1, MOTOR4_ENCODER2>();
+
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		Wheel &wheel = self->m_wheels[i];
+		int8_t step = TRANSITIONS[(wheel.state << 2) | states[i]];
+		wheel.state = states[i];
+		if (step == SKIPPED)
+			self->m_errors++;
+		else
+			wheel.count += step;
+	}
+	self->m_ticks++;
+}
@@ -0,0 +1,100 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "FiniteStateMachine.h"
+#include "ParamServer.h"
+
+#include <stdint.h>
+
+/**
+ * Decode the four wheels' quadrature encoders (MOTORn_ENCODER1/2) and publish
+ * their counts and velocities every period ms (0 selects the default, 20 ms).
+ *
+ * None of the encoder pins has an external or pin change interrupt, so all
+ * eight channels are sampled from the ControlTimer interrupt on every tick
+ * instead, independent of the main loop. Each wheel's two channels form a
+ * Gray code, and every change of state counts one step forward or back (four
+ * per encoder cycle). A wheel can therefore be followed up to TICK_HZ steps
+ * per second; a state that skips one (both channels changed between samples)
+ * is counted as an error rather than guessed at.
+ *
+ * Counts are 32-bit, start at 0 when the FSM is created and wrap around, so
+ * the host should take the difference of two counts modulo 2^32. Velocities
+ * are in steps per second over the last period, timed by the same interrupt
+ * that does the counting. errors is the running total of skipped states
+ * across all wheels (also wrapping).
+ *
+ * Parameters:
+ * ---
+ * uint16 period
+ * ---
+ *
+ * Publish:
+ * ---
+ * int32  count1
+ * int32  count2
+ * int32  count3
+ * int32  count4
+ * int16  velocity1
+ * int16  velocity2
+ * int16  velocity3
+ * int16  velocity4
+ * uint16 errors
+ * ---
+ */
+class WheelEncoders : public FiniteStateMachine
+{
+public:
+	WheelEncoders(uint16_t period = 0);
+
+	static WheelEncoders *NewFromArray(const TinyBuffer &params);
+
+	/*
+	 * When this FSM is destructed, the decoder is detached from the timer.
+	 */
+	virtual ~WheelEncoders();
+
+	virtual uint32_t Step();
+
+private:
+	/**
+	 * ControlTimer callback, runs every tick and decodes all four wheels.
+	 */
+	static void OnSample(void *context);
+
+	struct Wheel
+	{
+		int32_t count;
+		int32_t lastCount; // count at the last Step()
+		uint8_t state;     // last sampled channels, (ENCODER1 << 1) | ENCODER2
+	};
+
+	Wheel             m_wheels[4];
+	volatile uint32_t m_ticks;     // ControlTimer ticks sampled
+	uint32_t          m_lastTicks; // m_ticks at the last Step()
+	uint16_t          m_errors;
+	bool              m_bAttached;
+
+private:
+	ParamServer::WheelEncoders m_params;
+};
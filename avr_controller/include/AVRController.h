@@ -21,11 +21,15 @@
  */
 #pragma once
 
+#include "TelemetryWriter.h"
+
 #include <boost/asio.hpp>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -35,14 +39,19 @@ public:
 	AVRController();
 	~AVRController() throw();
 
+	static const int HELLO_TIMEOUT = 3000; // ms
+
 	/**
-	 * Open the port and connect to the Arduino.
+	 * Open the port and connect to the Arduino. Opening the port resets the
+	 * Arduino; this returns as soon as the firmware says hello
+	 * (MSG_MASTER_HELLO), or after timeout ms if it never does (older
+	 * firmware).
 	 *
 	 * Examples:
 	 * Linux: avr_controller.Open("/dev/ttyACM0");
 	 * Win32: avr_controller.Open("COM3");
 	 */
-	bool Open(const std::string &device);
+	bool Open(const std::string &device, unsigned long timeout = HELLO_TIMEOUT);
 
 	/**
 	 * Disconnect from the Arduino and close the serial port.
@@ -86,6 +95,23 @@ public:
 	 */
 	bool Receive(unsigned int fsmId, std::string &response, unsigned long timeout = DEFAULT_TIMEOUT);
 
+	typedef boost::function<void (const std::string &msg)> Subscriber;
+
+	/**
+	 * Call subscriber with every message from the specified FSM, until
+	 * Unsubscribe(). Unlike calling Receive() in a loop, no message slips by
+	 * between calls. The subscriber runs in the read thread, so it must be
+	 * quick: nothing more is read from the port until it returns. One
+	 * subscriber per FSM; subscribing again replaces it.
+	 */
+	void Subscribe(unsigned int fsmId, const Subscriber &subscriber);
+
+	/**
+	 * Once this returns, the FSM's subscriber is not running and won't be
+	 * called again.
+	 */
+	void Unsubscribe(unsigned int fsmId);
+
 	/**
 	 * Interface with the MecanumMaster program running on the AVR.
 	 */
@@ -94,6 +120,15 @@ public:
 	void CreateFSM(const std::string &fsm);
 	void ClearFSMs();
 
+	/**
+	 * Log the telemetry the Arduino sends to stream, from the read thread:
+	 * encoder samples (FSM_ENCODER), motor current sense
+	 * (FSM_MOTORCONTROLLER) and battery voltage (FSM_ANALOGPUBLISHER on
+	 * BATTERY_VOLTAGE), whoever asked for them. Set this before calling
+	 * Open().
+	 */
+	void SetTelemetry(TelemetryWriter::Stream *stream) { m_telemetry = stream; }
+
 	static uint16_t GetMsgLength(const void *bytes) { return *reinterpret_cast<const uint16_t*>(bytes); }
 
 private:
@@ -103,6 +138,19 @@ private:
 	 */
 	bool QueryInternal(unsigned int fsmId, bool sendMsg, const std::string &msg, std::string &response, unsigned long timeout);
 
+	/**
+	 * Wait for the hello that the firmware sends when it finishes booting.
+	 * The handler must be installed before the read thread is started, or the
+	 * hello could slip past. If it doesn't arrive, the firmware is asked for
+	 * one, in case opening the port didn't reset the Arduino.
+	 */
+	bool WaitForHello(const boost::shared_ptr<std::string> &hello, const boost::shared_ptr<boost::condition> &helloCondition, unsigned long timeout);
+
+	/**
+	 * Uninstall a response handler that never fired.
+	 */
+	void RemoveResponseHandler(const boost::shared_ptr<std::string> &response);
+
 	/**
 	 * Writing to the serial port occurs in this thread. When no data is queued,
 	 * it idles.
@@ -129,6 +177,11 @@ private:
 	 */
 	void ReadCallback(const boost::system::error_code& error, size_t bytes_transferred);
 
+	/**
+	 * Log a message from the Arduino, if it is telemetry.
+	 */
+	void Log(const std::string &msg);
+
 	/**
 	 * Set the DTR bit on the serial port to the desired level (on or off).
 	 *
@@ -151,6 +204,7 @@ private:
 	volatile bool             m_bRunning;
 
 	boost::thread             m_readThread;
+	TelemetryWriter::Stream   *m_telemetry;
 
 	// Our response handler uses shared pointers to delegate memory ownership
 	// from the stack to the heap. This lets us bail out early if the response
@@ -163,6 +217,9 @@ private:
 	std::vector<ResponseHandler_t> m_responseHandlers;
 	boost::mutex                   m_responseMutex;
 
+	std::map<unsigned int, Subscriber> m_subscribers;
+	boost::mutex                       m_subscriberMutex;
+
 	/**
 	 * Use a finite state machine for message composition. FSMs are best for
 	 * this task because the number of expected characters is a function of the
@@ -0,0 +1,90 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * An FSM_ENCODER message from the Sentry's encoder, in either of the formats
+ * the firmware sends (see Encoder in the firmware's Sentry.h):
+ *
+ * Samples: the level of the encoder pin every 500 us, bit i of GetBits()
+ * being sample i.
+ *
+ * Edges: the time of each transition in us since the one before, as LEB128
+ * varints (GetData()), and the level before the first.
+ */
+class EncoderMessage
+{
+public:
+	EncoderMessage() : m_bEdges(false), m_count(0), m_level(0) { }
+
+	/**
+	 * Parse a whole message, including its length and FSM ID.
+	 *
+	 * \return False if msg isn't a well-formed FSM_ENCODER message
+	 */
+	bool Parse(const std::string &msg);
+
+	bool IsEdges() const { return m_bEdges; }
+
+	/**
+	 * Samples format: the samples, one bit each, and the bytes holding them.
+	 */
+	unsigned int GetSampleCount() const { return m_count; }
+	bool GetSample(unsigned int i) const { return m_payload[i / 8] & (1 << (i % 8)); }
+	const uint8_t *GetBits() const { return m_payload.empty() ? NULL : &m_payload[0]; }
+	size_t GetBitsLength() const { return (m_count + 7) / 8; }
+
+	/**
+	 * Edges format: the level before the first edge, the edges' varints and
+	 * the deltas they decode to (us). GetSampleCount() is the number of edges.
+	 */
+	uint8_t GetLevel() const { return m_level; }
+	const uint8_t *GetData() const { return m_payload.empty() ? NULL : &m_payload[0]; }
+	size_t GetDataLength() const { return m_payload.size(); }
+	const std::vector<uint32_t> &GetDeltas() const { return m_deltas; }
+
+	/**
+	 * The number of transitions of the encoder pin in the message. In the
+	 * samples format, a transition before the first sample isn't seen.
+	 */
+	unsigned int GetTicks() const;
+
+	/**
+	 * Decode a run of LEB128 varints (7 bits per byte, low first, the high
+	 * bit set on all but the last byte of each).
+	 *
+	 * \return False if the last varint is cut short or one overflows 32 bits
+	 */
+	static bool DecodeVarints(const uint8_t *data, size_t length, std::vector<uint32_t> &values);
+
+private:
+	bool                  m_bEdges;
+	unsigned int          m_count;
+	uint8_t               m_level;
+	std::vector<uint8_t>  m_payload; // Bits or varints
+	std::vector<uint32_t> m_deltas;
+};
@@ -0,0 +1,115 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "EncoderMessage.h"
+
+#include <stdint.h>
+
+#define SENTRY_TICKS_PER_REV   100 // Transitions per revolution of the Sentry's encoder
+#define ENCODER_SAMPLE_PERIOD  500 // us, between samples in the samples format
+#define ENCODER_WINDOW         16  // Messages the period is estimated over
+#define ENCODER_IDLE_TIMEOUT   1000000 // us without a message before the edges format counts as stopped
+
+/**
+ * Count an encoder's ticks (transitions) and estimate its period and RPM as
+ * FSM_ENCODER messages arrive, in either format, without keeping the
+ * messages around.
+ *
+ * Samples are processed 64 at a time: a word of samples XORed with itself
+ * shifted by one sample has a bit set for every transition, so the ticks in
+ * a word are a single popcount. Edges are one tick each. The period is
+ * averaged over the last ENCODER_WINDOW messages, so it follows changes in
+ * speed within about a second (the samples format sends a message every
+ * 64 ms, the edges format at most as often). The edges format sends nothing
+ * while the wheel is still, so the window only ages out if the caller
+ * reports the silence with Advance(). The first edge after a stop is timed
+ * from the last one before it, so it counts towards the ticks but not
+ * towards the period.
+ *
+ * Not thread safe; a monitor that reads it from another thread has to
+ * provide the lock.
+ */
+class EncoderTracker
+{
+public:
+	EncoderTracker(unsigned int ticksPerRev = SENTRY_TICKS_PER_REV);
+
+	void Reset();
+
+	void Add(const EncoderMessage &msg);
+
+	/**
+	 * Note that elapsed us have passed without a message. Once that adds up
+	 * to ENCODER_IDLE_TIMEOUT, the wheel is taken to have stopped and the
+	 * window is cleared.
+	 */
+	void Advance(uint32_t elapsed);
+
+	/**
+	 * Totals since Reset(). Samples are the samples format's samples, or
+	 * the edges format's edges.
+	 */
+	uint64_t GetTicks() const { return m_ticks; }
+	uint64_t GetSamples() const { return m_samples; }
+	uint64_t GetMessages() const { return m_messages; }
+
+	/**
+	 * Mean time between ticks over the window, in us, or 0 if the window
+	 * holds fewer than two ticks.
+	 */
+	double GetPeriod() const;
+
+	/**
+	 * Revolutions per minute over the window, 0 when stopped (for the edges
+	 * format, once Advance() has seen ENCODER_IDLE_TIMEOUT of silence).
+	 */
+	double GetRPM() const;
+
+private:
+	void ClearWindow();
+
+	/**
+	 * Count the transitions in the first count samples of word (bit i is
+	 * sample i), after the previous sample m_lastSample.
+	 */
+	unsigned int CountTicks(uint64_t word, unsigned int count);
+
+	struct Span
+	{
+		uint32_t ticks;
+		uint32_t duration; // us
+	};
+
+	unsigned int m_ticksPerRev;
+	uint64_t     m_ticks;
+	uint64_t     m_samples;
+	uint64_t     m_messages;
+	bool         m_bStarted;   // m_lastSample is valid
+	unsigned int m_lastSample;
+	Span         m_window[ENCODER_WINDOW];
+	unsigned int m_next;       // Oldest span in the window
+	uint32_t     m_windowTicks;
+	uint64_t     m_windowDuration;
+	uint32_t     m_idle;       // us since the last message
+	bool         m_bStopped;   // The window was cleared since the last message
+};
@@ -22,13 +22,23 @@
 #pragma once
 
 #include <exception>  // For std::exception
+#include <stdint.h>   // For uint32_t
 #include <sys/time.h> // For gettimeofday()
 
+class GPIOBackend;
+class GPIOLine;
+
+/**
+ * GPIO is the interface to a single pin. The actual I/O is done by a
+ * GPIOLine obtained from a GPIOBackend (see GPIOBackend.h): the sysfs, the
+ * GPIO character device or an in-memory simulator. Pins constructed without a
+ * backend use GPIOBackend::GetDefault().
+ */
 class GPIO
 {
 public:
 	/**
-	 * Thrown when a problem has occurred in reading or writing to the sysfs.
+	 * Thrown when a problem has occurred in reading or writing to the backend.
 	 * The post-condition of GPIO public functions is that the GPIO pin is in
 	 * an open and usable state. If this cannot be guaranteed by the function,
 	 * this exception is thrown before the function runs to completion.
@@ -37,6 +47,7 @@ public:
 	{
 	public:
 		Exception(const GPIO &gpio, const char *function, const char *msg) throw();
+		Exception(unsigned int pin, const char *function, const char *msg) throw();
 		virtual ~Exception() throw() { };
 		virtual const char* what() const throw() { return m_msg; }
 		unsigned int GetPin() const { return m_pin; }
@@ -61,18 +72,28 @@ public:
 		BOTH    = RISING | FALLING
 	};
 
+	// A recorded edge, see ReadEdges()
+	struct EdgeEvent
+	{
+		uint64_t     timestamp; // Nanoseconds on CLOCK_MONOTONIC
+		unsigned int gpio;
+		unsigned int value;     // Value after the edge
+	};
+
 	/**
 	 * A GPIO object is constructed in an invalid state and a call to Open()
-	 * must be performed before other functions are called.
+	 * must be performed before other functions are called. The backend must
+	 * outlive the GPIO object.
 	 */
 	GPIO(unsigned int gpio);
+	GPIO(unsigned int gpio, GPIOBackend &backend);
 
 	/**
 	 * The GPIO class follows a quasi-RAII model. A call to Open() acquires
 	 * the resource (pin), and the resource is released when Close() is called
 	 * or the object falls out of scope.
 	 */
-	~GPIO() throw() { Close(); }
+	~GPIO() throw();
 
 	/**
 	 * Open the pin, recording its current state, and get it ready to be
@@ -83,7 +104,7 @@ public:
 	/**
 	 * Returns true if the pin is exported and ready to be manhandled.
 	 */
-	bool IsOpen() const { return m_gpio_fd >= 0; }
+	bool IsOpen() const;
 
 	/**
 	 * Release the pin when we are done with it for use in another
@@ -99,17 +120,8 @@ public:
 	unsigned int Describe() const { return m_gpio; }
 
 	/*!
-	 * Gets the value of the pin. For pin 139, the value would be read from
-	 * /sys/class/gpio/gpio139/value.
-	 *
-	 * For performance reasons, the file descriptor is kept open. Tests on my
-	 * BeagleBoard indicate that opening /value can take several hundred
-	 * microseconds. If the fd is kept open, seeking to the beginning of /value
-	 * takes 0 to tens of microseconds. Thus, the fd is only closed when
-	 * necessary (i.e. changing direction so that /value may be re-opened as
-	 * write-only). Additionally, seeking is performed immediately after every
-	 * read and write to decrease the latency of these operations as much as
-	 * possible.
+	 * Gets the value of the pin. With the sysfs backend, for pin 139, the
+	 * value would be read from /sys/class/gpio/gpio139/value.
 	 *
 	 * \throw GPIO::Exception
 	 * \return The value of the pin (0 or 1)
@@ -137,13 +149,11 @@ public:
 	 *
 	 * \return The direction of type enum Direction (either OUT or IN).
 	 */
-	Direction GetDirection() const { return m_dir; }
+	Direction GetDirection() const;
 
 	/*!
-	 * Set the direction of the pin. The direction is controlled by writing
-	 * one of four strings to /sys/class/gpio/gpioXXX/direction: "in",
-	 * "out", "high" and "low". Out and low are equivalent. High will set
-	 * the pin to "out" and /value will be set to 1.
+	 * Set the direction of the pin. Switching to OUT drives initial_value
+	 * from the start, so the pin never glitches through the other level.
 	 *
 	 * \param dir           The direction, either IN or OUT.
 	 * \param initial_value The initial value (ignored if dir is IN).
@@ -162,7 +172,7 @@ public:
 	 * \throw GPIO::Exception
 	 * \return The edge of type enum GPIO::Edge (NONE, RISING, FALLING, or BOTH).
 	 */
-	Edge GetEdge() const { return m_edge; }
+	Edge GetEdge() const;
 	void SetEdge(Edge edge);
 
 	/*!
@@ -188,6 +198,39 @@ public:
 	bool Poll(unsigned long timeout, unsigned long &duration, bool verify = true);
 	bool Poll(unsigned long timeout, unsigned long &duration, bool verify, unsigned int &value);
 
+	/*!
+	 * Instead of blocking in Poll(), edges can be waited for with epoll. The
+	 * returned fd becomes ready when an edge is pending; AcknowledgeEdge()
+	 * clears it. GPIOEventLoop wraps this up.
+	 *
+	 * \param events (Out) The epoll events to wait for
+	 * \return The fd, or -1 if the pin is not an input with an edge set
+	 */
+	int GetEventFd(uint32_t &events) const;
+
+	/*!
+	 * Clear a pending edge without blocking.
+	 *
+	 * \throw  GPIO::Exception
+	 * \return The value after the edge, or -1 if no edge was pending
+	 */
+	int AcknowledgeEdge();
+
+	/*!
+	 * Like AcknowledgeEdge(), but return every pending edge with the time it
+	 * happened. The chardev backend queues edges in the kernel and stamps
+	 * them there, so no edge is lost to scheduling delay and the timestamp
+	 * doesn't include it. The sysfs can only report that something changed;
+	 * it yields one edge, stamped when it is read. See GPIOCapture for
+	 * recording edges in the background.
+	 *
+	 * \param events The edges, oldest first
+	 * \param count  The size of events
+	 * \throw        GPIO::Exception
+	 * \return       The number of edges written to events (0 if none were pending)
+	 */
+	unsigned int ReadEdges(EdgeEvent *events, unsigned int count);
+
 	/*!
 	 * Copy a value from one pin to another. This function can be chained:
 	 *     gpio3.Mirror(gpio2.Mirror(gpio1));
@@ -204,11 +247,15 @@ public:
 	 * taken by Pulse() is equal to (2*duration*count), minus the duration of
 	 * the final low. As a post-condition, the value is set to 0.
 	 *
+	 * Edges are timed against absolute deadlines, so they don't drift, and
+	 * signals don't end the pulse train early. To pulse without blocking, or
+	 * to drive several pins at once, use GPIOPWM.
+	 *
 	 * \param  duration The duration of the pulse (in microseconds). If count > 1
 	 *                  then this duration will also be used between each pulse.
 	 * \param  count    The total number of pulses to deliver.
 	 * \throw           GPIO::Exception
-	 * \return true     If the specified time (2*duration*count) has elapsed
+	 * \return false    If the pin is an input
 	 */
 	bool Pulse(unsigned long duration, unsigned int count = 1);
 
@@ -225,7 +272,7 @@ public:
 	 * \param duty_cycle The PWM duty cycle between 0 and 1. A duty cycle of 0 or 1
 	 *                   will force the signal fully on or fully off, respectively.
 	 * \throw           GPIO::Exception
-	 * \return true     If the specified time has elapsed, similar to Pulse()
+	 * \return false    If the pin is an input or time is 0
 	 */
 	bool PWM(unsigned long period, unsigned long time, double duty_cycle = 0.5);
 
@@ -236,40 +283,6 @@ private:
 	GPIO(const GPIO &other);
 	GPIO& operator=(const GPIO &rhs);
 
-	/**
-	 * Export a pin so that Open() may proceed.
-	 */
-	void Export();
-
-	/*!
-	 * Reopen the pin's value node in the specified RW mode. No function exists
-	 * for getting the current RW mode because it is assumed that a direction
-	 * of IN means read-only and a direction of OUT means write-only. The GPIO
-	 * class maintains this consistency.
-	 *
-	 * \param mode One of: O_RDONLY (00), O_WRONLY (01)
-	 * \throw GPIO::Exception
-	 */
-	void Reopen(int mode);
-
-	/*!
-	 * Sync m_dir with /sys/class/gpio/gpioXXX/direction. This allows m_dir to
-	 * be used as a caching variable so we don't have to hit the sysfs every
-	 * time we want to know the direction.
-	 *
-	 * \throw GPIO::Exception
-	 */
-	void ReadDirection();
-
-	/*!
-	 * Sync m_edge with /sys/class/gpio/gpioXXX/edge. This allows m_edge to be
-	 * used as a caching variable so we don't have to hit the sysfs every time
-	 * we want to know the edge.
-	 *
-	 * \throw GPIO::Exception if, for whatever reason, m_edge is not set,
-	 */
-	void ReadEdge();
-
 	/*!
 	 * Calculate the number of microseconds elapsed since the reference time.
 	 *
@@ -286,12 +299,6 @@ private:
 
 	// GPIO pin number for this class
 	unsigned int m_gpio;
-	// String representation (used internally)
-	char m_str_gpio[5];
-	// File descriptor to the GPIO pin
-	int m_gpio_fd;
-	// Current direction of the GPIO pin (IN or OUT)
-	Direction m_dir;
-	// Edge configured to generate interrupts (only used if m_dir is IN)
-	Edge m_edge;
+	// Backend-specific implementation of the pin, owned by this object
+	GPIOLine *m_line;
 };
@@ -0,0 +1,265 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIO.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * A GPIOLine does the actual I/O for one GPIO object. Each backend provides
+ * its own subclass. Direction and edge are cached here so the GPIO class can
+ * answer GetDirection() and GetEdge() without a round trip to the kernel.
+ *
+ * Lines throw GPIO::Exception on errors, following the same post-conditions
+ * as the GPIO functions that call them.
+ */
+class GPIOLine
+{
+public:
+	GPIOLine(unsigned int gpio) : m_gpio(gpio), m_dir(GPIO::IN), m_edge(GPIO::NONE) { }
+	virtual ~GPIOLine() { }
+
+	unsigned int Describe() const { return m_gpio; }
+
+	/**
+	 * Acquire the line and sync the cached direction and edge.
+	 */
+	virtual bool Open() = 0;
+	virtual bool IsOpen() const = 0;
+	virtual void Close() throw() = 0;
+
+	GPIO::Direction GetDirection() const { return m_dir; }
+	virtual void SetDirection(GPIO::Direction dir, unsigned int initial_value) = 0;
+
+	GPIO::Edge GetEdge() const { return m_edge; }
+	virtual void SetEdge(GPIO::Edge edge) = 0;
+
+	virtual unsigned int GetValue() = 0;
+	virtual void SetValue(unsigned int value) = 0;
+
+	/*!
+	 * Block until the kernel (or simulator) signals an edge of the configured
+	 * type, or until the timeout expires. Spurious wakeups are allowed; GPIO
+	 * verifies the value afterwards if asked to.
+	 *
+	 * \param timeout Maximum time to wait, in microseconds (> 0)
+	 * \throw GPIO::Exception
+	 * \return false if the timeout expired
+	 */
+	virtual bool WaitForEdge(long timeout) = 0;
+
+	/*!
+	 * A file descriptor that epoll reports ready while an edge is pending, so
+	 * that many lines can be waited on from one thread (see GPIOEventLoop).
+	 *
+	 * \param events (Out) The epoll events to wait for
+	 * \return The fd, or -1 if the line has no edge configured or can't
+	 *         provide one
+	 */
+	virtual int GetEventFd(uint32_t &events) const { return -1; }
+
+	/*!
+	 * Clear the edge reported through GetEventFd(). Never blocks.
+	 *
+	 * \throw GPIO::Exception
+	 * \return The pin's value after the edge, or -1 if no edge was pending
+	 */
+	virtual int AcknowledgeEdge() { return -1; }
+
+	/*!
+	 * Clear and return the pending edges, oldest first. Never blocks. Lines
+	 * that can't queue or timestamp edges keep the default, which reports
+	 * AcknowledgeEdge() as one edge stamped now.
+	 *
+	 * \throw GPIO::Exception
+	 * \return The number of edges written to events
+	 */
+	virtual unsigned int ReadEdges(GPIO::EdgeEvent *events, unsigned int count);
+
+	/**
+	 * The current time on the clock used for GPIO::EdgeEvent timestamps.
+	 */
+	static uint64_t Now();
+
+protected:
+	unsigned int    m_gpio;
+	GPIO::Direction m_dir;
+	GPIO::Edge      m_edge;
+};
+
+/**
+ * A GPIOLineGroup does the I/O for a GPIOGroup: several pins that share a
+ * direction and edge, whose values travel together as a bitmask (bit i is
+ * pin i). Backends that can read or write all of the pins in one operation
+ * provide their own subclass; the rest get a GPIOLineSet.
+ */
+class GPIOLineGroup
+{
+public:
+	GPIOLineGroup(const std::vector<unsigned int> &gpios) : m_gpios(gpios), m_dir(GPIO::IN), m_edge(GPIO::NONE) { }
+	virtual ~GPIOLineGroup() { }
+
+	const std::vector<unsigned int> &Describe() const { return m_gpios; }
+
+	virtual bool Open() = 0;
+	virtual bool IsOpen() const = 0;
+	virtual void Close() throw() = 0;
+
+	GPIO::Direction GetDirection() const { return m_dir; }
+	virtual void SetDirection(GPIO::Direction dir, uint32_t initial_values) = 0;
+
+	GPIO::Edge GetEdge() const { return m_edge; }
+	virtual void SetEdge(GPIO::Edge edge) = 0;
+
+	virtual uint32_t GetValues() = 0;
+	virtual void SetValues(uint32_t values) = 0;
+
+	/**
+	 * True if GetValues() and SetValues() currently sample or drive every
+	 * pin at the same instant.
+	 */
+	virtual bool IsAtomic() const = 0;
+
+	/*!
+	 * Block until an edge on any of the pins, like GPIOLine::WaitForEdge().
+	 */
+	virtual bool WaitForEdge(long timeout) = 0;
+
+	/*!
+	 * The fds that epoll reports ready while an edge is pending on any pin,
+	 * see GPIOLine::GetEventFd().
+	 *
+	 * \param fds    (Out) The fds, empty if no edge is set
+	 * \param events (Out) The epoll events to wait for
+	 */
+	virtual void GetEventFds(std::vector<int> &fds, uint32_t &events) const = 0;
+
+	/*!
+	 * Clear every pending edge. Never blocks.
+	 *
+	 * \throw GPIO::Exception
+	 * \return true if any edge was pending
+	 */
+	virtual bool AcknowledgeEdges() = 0;
+
+protected:
+	std::vector<unsigned int> m_gpios;
+	GPIO::Direction           m_dir;
+	GPIO::Edge                m_edge;
+};
+
+/**
+ * The generic GPIOLineGroup: one GPIOLine per pin, accessed in turn. Reads
+ * aren't atomic, but they are consistent: the pins are read until two passes
+ * agree, so a value that changes mid-read isn't returned torn.
+ */
+class GPIOLineSet : public GPIOLineGroup
+{
+public:
+	GPIOLineSet(GPIOBackend &backend, const std::vector<unsigned int> &gpios);
+	virtual ~GPIOLineSet();
+
+	virtual bool Open();
+	virtual bool IsOpen() const;
+	virtual void Close() throw();
+
+	virtual void SetDirection(GPIO::Direction dir, uint32_t initial_values);
+	virtual void SetEdge(GPIO::Edge edge);
+
+	virtual uint32_t GetValues();
+	virtual void SetValues(uint32_t values);
+	virtual bool IsAtomic() const { return m_lines.size() <= 1; }
+
+	virtual bool WaitForEdge(long timeout);
+
+	virtual void GetEventFds(std::vector<int> &fds, uint32_t &events) const;
+	virtual bool AcknowledgeEdges();
+
+protected:
+	/**
+	 * Read each line once.
+	 */
+	uint32_t ReadLines();
+
+	std::vector<GPIOLine*> m_lines;
+};
+
+/**
+ * A GPIOBackend creates GPIOLines. Backends are selected once at startup and
+ * must outlive every GPIO object created from them.
+ */
+class GPIOBackend
+{
+public:
+	virtual ~GPIOBackend() { }
+
+	/**
+	 * Create the line for pin gpio. The caller takes ownership.
+	 */
+	virtual GPIOLine *CreateLine(unsigned int gpio) = 0;
+
+	/**
+	 * Create the group for several pins. The caller takes ownership. Unless
+	 * overridden, this is a GPIOLineSet.
+	 */
+	virtual GPIOLineGroup *CreateGroup(const std::vector<unsigned int> &gpios);
+
+	virtual const char *GetName() const = 0;
+
+	/*!
+	 * Get pins ready ahead of time, as one batch, so that opening each one
+	 * later is cheap. Backends with nothing to prepare return true.
+	 *
+	 * \return false if any pin couldn't be prepared
+	 */
+	virtual bool Export(const std::vector<unsigned int> &gpios) { return true; }
+
+	/*!
+	 * Create a backend from a short description, as passed on the command
+	 * line:
+	 *     sysfs[:root]        The sysfs interface, rooted at /sys/class/gpio
+	 *                         unless root is given
+	 *     chardev[:dir]       The GPIO character devices, /dev/gpiochipN
+	 *                         unless dir is given
+	 *     sim                 An in-memory GPIOSimulator
+	 *
+	 * \return The new backend (owned by the caller), or NULL if spec is not
+	 *         recognized
+	 */
+	static GPIOBackend *Create(const std::string &spec);
+
+	/**
+	 * The backend used by GPIO objects that aren't given one. Until
+	 * SetDefault() is called this is the sysfs at /sys/class/gpio.
+	 */
+	static GPIOBackend &GetDefault();
+
+	/**
+	 * Replace the default backend. Call this at startup, before any GPIO
+	 * objects are created. The caller keeps ownership; pass NULL to restore
+	 * the sysfs default.
+	 */
+	static void SetDefault(GPIOBackend *backend);
+};
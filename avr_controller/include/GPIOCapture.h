@@ -0,0 +1,96 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIO.h"
+#include "SPSCRing.h"
+
+#include <boost/thread.hpp>
+#include <vector>
+
+#define GPIO_CAPTURE_SIZE 4096 // Edges buffered between drains (power of two)
+
+/**
+ * Records every edge on a set of pins in the background. A capture thread
+ * waits on all of the pins with epoll and moves their edges, timestamped by
+ * GPIO::ReadEdges(), into a lock-free ring. The consumer drains the ring in
+ * batches whenever it likes; it never blocks the capture thread and is never
+ * blocked by it. Edges that arrive while the ring is full are counted and
+ * dropped.
+ *
+ * Timestamps are only as good as the backend: with the chardev they come
+ * from the kernel's interrupt handler, with the sysfs they are taken when the
+ * capture thread wakes up, and the sysfs can merge edges that come close
+ * together.
+ */
+class GPIOCapture
+{
+public:
+	GPIOCapture();
+	~GPIOCapture() throw() { Stop(); }
+
+	/**
+	 * Capture edges on gpio, which must be open, an input and have its edge
+	 * set. Pins can only be added while stopped.
+	 */
+	bool Add(GPIO &gpio);
+
+	bool Start();
+	bool IsRunning() const { return m_epoll_fd >= 0; }
+
+	/**
+	 * Stop capturing. Edges already in the ring can still be drained.
+	 */
+	void Stop() throw();
+
+	/*!
+	 * Copy out the oldest captured edges. Must only be called from one thread
+	 * at a time.
+	 *
+	 * \param events The edges, oldest first
+	 * \param count  The size of events
+	 * \return The number of edges copied
+	 */
+	unsigned int Drain(GPIO::EdgeEvent *events, unsigned int count) { return m_ring.Pop(events, count); }
+
+	/**
+	 * The number of edges dropped because the ring was full.
+	 */
+	unsigned long GetOverflows() const { return m_overflows; }
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	GPIOCapture(const GPIOCapture &other);
+	GPIOCapture& operator=(const GPIOCapture &rhs);
+
+	void Run();
+
+	std::vector<GPIO*>                              m_pins;
+	int                                             m_epoll_fd;
+	int                                             m_wakeup_fd;
+	volatile bool                                   m_bRunning;
+	boost::thread                                   m_thread;
+	SPSCRing<GPIO::EdgeEvent, GPIO_CAPTURE_SIZE>    m_ring;
+	volatile unsigned long                          m_overflows;
+};
@@ -0,0 +1,190 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIO.h"
+#include "GPIOGroup.h"
+
+#include <boost/function.hpp>
+#include <map>
+#include <vector>
+
+/**
+ * A reactor for GPIO edges and timers. Any number of pins and timers share
+ * one epoll fd, so a single thread calling Run() replaces a thread per pin
+ * blocked in GPIO::Poll(). Stop() wakes Run() immediately instead of waiting
+ * out a poll timeout.
+ *
+ * Handlers run on the thread calling Run(). Pins and timers may be added and
+ * removed from handlers, or from any thread while Run() isn't running; only
+ * Stop() is safe to call from other threads while it is.
+ */
+class GPIOEventLoop
+{
+public:
+	typedef boost::function<void (unsigned int value)> EdgeHandler;
+	typedef boost::function<void (uint32_t values)>    GroupHandler;
+	typedef boost::function<void ()>                   TimerHandler;
+	typedef int                                        TimerID;
+
+	static const TimerID INVALID_TIMER = -1;
+
+	GPIOEventLoop();
+	~GPIOEventLoop() throw() { Close(); }
+
+	bool Open();
+	bool IsOpen() const { return m_epoll_fd >= 0; }
+
+	/**
+	 * Remove all pins and timers and release the epoll fd.
+	 */
+	void Close() throw();
+
+	/*!
+	 * Watch a pin for edges. The pin must be open, an input, and have its
+	 * edge set.
+	 *
+	 * \param gpio      The pin; it must outlive its registration
+	 * \param onEdge    Called with the pin's value after each edge
+	 * \param debounce  If non-zero, onEdge is delayed until the pin has been
+	 *                  quiet for this long (microseconds), and only called if
+	 *                  the value differs from the last one reported
+	 * \param timeout   If non-zero, onTimeout is called whenever this long
+	 *                  (microseconds) passes without an edge, and then again
+	 *                  every timeout until the next edge
+	 * \param onTimeout See timeout
+	 * \return false if the pin can't be watched
+	 */
+	bool AddPin(GPIO &gpio, const EdgeHandler &onEdge, unsigned long debounce = 0,
+		unsigned long timeout = 0, const TimerHandler &onTimeout = TimerHandler());
+	void RemovePin(GPIO &gpio);
+
+	/*!
+	 * Watch every pin of a group and debounce them together: an edge on any
+	 * pin restarts the settle timer, and once the group has been quiet for
+	 * settle microseconds its values are read and reported, if they differ
+	 * from the last ones reported. The group must be open, inputs, and have
+	 * an edge set. AddPin() with a debounce is the same thing for one pin.
+	 *
+	 * \param group     The group; it must outlive its registration
+	 * \param onSettled Called with the group's values once they settle
+	 * \param settle    Quiet time before the values count as settled
+	 *                  (microseconds). If 0, every edge is reported.
+	 * \return false if the group can't be watched
+	 */
+	bool AddGroup(GPIOGroup &group, const GroupHandler &onSettled, unsigned long settle);
+	void RemoveGroup(GPIOGroup &group);
+
+	/*!
+	 * Call handler after delay microseconds, and every delay microseconds
+	 * after that if periodic is true.
+	 *
+	 * \return An ID for RestartTimer() and CancelTimer(), or INVALID_TIMER
+	 */
+	TimerID AddTimer(unsigned long delay, const TimerHandler &handler, bool periodic = false);
+
+	/**
+	 * Re-arm a timer to fire delay microseconds from now (periodic timers
+	 * keep their period). Returns false if the timer no longer exists.
+	 */
+	bool RestartTimer(TimerID id, unsigned long delay);
+
+	/**
+	 * One-shot timers cancel themselves after firing.
+	 */
+	void CancelTimer(TimerID id);
+
+	/**
+	 * Dispatch events until Stop() is called.
+	 */
+	void Run();
+
+	/**
+	 * Make Run() return as soon as the current handler finishes. If Run()
+	 * isn't running, the next call returns immediately.
+	 */
+	void Stop();
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	GPIOEventLoop(const GPIOEventLoop &other);
+	GPIOEventLoop& operator=(const GPIOEventLoop &rhs);
+
+	// Kinds of fds registered with epoll, stored with their ID in the event
+	enum Kind
+	{
+		WAKEUP,
+		PIN_EDGE,
+		PIN_DEBOUNCE,
+		PIN_TIMEOUT,
+		TIMER
+	};
+
+	// A pin or group being watched
+	struct Pin
+	{
+		GPIO         *gpio;      // Either gpio or group is set
+		GPIOGroup    *group;
+		EdgeHandler   onEdge;
+		GroupHandler  onGroup;
+		TimerHandler  onTimeout;
+		unsigned long debounce;
+		unsigned long timeout;
+		std::vector<int> fds;    // Edge fds, owned by the pin or group
+		int           debounce_fd;
+		int           timeout_fd;
+		uint32_t      value;     // Last value reported
+	};
+
+	struct Timer
+	{
+		int           fd;
+		TimerHandler  handler;
+		unsigned long period; // 0 for one-shot
+	};
+
+	bool Watch(int fd, uint32_t events, Kind kind, int id);
+	static int CreateTimerFd();
+	static bool ArmTimerFd(int fd, unsigned long delay, unsigned long period);
+	static void ReadTimerFd(int fd);
+	/**
+	 * Register a pin or group that AddPin() or AddGroup() has filled in.
+	 */
+	bool AddWatch(int id, uint32_t events);
+	void RemoveWatch(std::map<int, Pin>::iterator it);
+	static void ClosePin(Pin &pin);
+	static uint32_t ReadValue(Pin &pin);
+
+	void OnEdge(int id);
+	void OnDebounce(int id);
+	void OnTimeout(int id);
+	void OnTimer(int id);
+
+	int                  m_epoll_fd;
+	int                  m_wakeup_fd;
+	volatile bool        m_bStop;
+	int                  m_nextID;
+	std::map<int, Pin>   m_pins;
+	std::map<int, Timer> m_timers;
+};
@@ -0,0 +1,128 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIO.h"
+
+#include <stdint.h>
+#include <vector>
+
+class GPIOBackend;
+class GPIOLineGroup;
+
+/**
+ * Several pins read or written together as a bitmask, bit i being the i'th
+ * pin given to the constructor. All pins share a direction and edge.
+ *
+ * With the chardev, pins in the same bank (e.g. the thumbwheel's, all on
+ * gpiochip4) are one kernel request, so a read samples them at the same
+ * instant with one ioctl. This only holds while no edge is set, because the
+ * chardev (v1) can only deliver edges for lines requested one at a time. The
+ * simulator is always atomic. Otherwise the pins are read until two passes
+ * agree, which is slower but still never returns a value torn by a change
+ * mid-read. IsAtomic() tells which applies.
+ */
+class GPIOGroup
+{
+public:
+	/**
+	 * Like GPIO, a group is constructed closed; call Open() first. At most 32
+	 * pins.
+	 */
+	GPIOGroup(const unsigned int *gpios, unsigned int count);
+	GPIOGroup(const unsigned int *gpios, unsigned int count, GPIOBackend &backend);
+	~GPIOGroup() throw();
+
+	bool Open();
+	bool IsOpen() const;
+	void Close() throw();
+
+	unsigned int Size() const { return m_gpios.size(); }
+	unsigned int Describe(unsigned int index) const { return m_gpios[index]; }
+
+	GPIO::Direction GetDirection() const;
+
+	/*!
+	 * \param dir            The direction of every pin
+	 * \param initial_values Bitmask driven from the start if dir is OUT
+	 * \throw GPIO::Exception
+	 */
+	void SetDirection(GPIO::Direction dir, uint32_t initial_values = 0);
+
+	GPIO::Edge GetEdge() const;
+	void SetEdge(GPIO::Edge edge);
+
+	/*!
+	 * \throw GPIO::Exception
+	 * \return The value of every pin, pin i in bit i
+	 */
+	uint32_t GetValues();
+
+	/*!
+	 * Drive every pin. No effect if the direction is IN.
+	 *
+	 * \throw GPIO::Exception
+	 */
+	void SetValues(uint32_t values);
+
+	/**
+	 * True if GetValues() and SetValues() are currently single operations.
+	 */
+	bool IsAtomic() const;
+
+	/*!
+	 * Wait for an edge on any pin, see GPIO::Poll().
+	 *
+	 * \param timeout The maximum time to wait (in microseconds)
+	 * \throw GPIO::Exception
+	 * \return false if the timeout expired or no edge is set
+	 */
+	bool Poll(unsigned long timeout);
+
+	/*!
+	 * Like GPIO::GetEventFd(), for every pin. GPIOEventLoop::AddGroup() wraps
+	 * this up.
+	 *
+	 * \param fds    (Out) The fds, empty if the group has no edge set
+	 * \param events (Out) The epoll events to wait for
+	 */
+	void GetEventFds(std::vector<int> &fds, uint32_t &events) const;
+
+	/*!
+	 * Clear every pending edge without blocking.
+	 *
+	 * \throw  GPIO::Exception
+	 * \return true if any edge was pending
+	 */
+	bool AcknowledgeEdges();
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	GPIOGroup(const GPIOGroup &other);
+	GPIOGroup& operator=(const GPIOGroup &rhs);
+
+	std::vector<unsigned int> m_gpios;
+	// Backend-specific implementation, owned by this object
+	GPIOLineGroup            *m_lines;
+};
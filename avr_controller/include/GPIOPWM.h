@@ -0,0 +1,191 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIO.h"
+
+#include <boost/thread.hpp>
+#include <vector>
+
+#define GPIO_PWM_CHANNELS 16
+#define GPIO_PWM_PRIORITY 80    // SCHED_FIFO priority of the engine's thread
+#define GPIO_PWM_LATENCY  10000 // Longest wait before a queued command applies (us)
+
+/**
+ * Software PWM and pulse trains on any number of output pins, driven by one
+ * SCHED_FIFO thread. Unlike GPIO::PWM() and GPIO::Pulse(), nothing here
+ * blocks the caller: channels are started, updated and stopped by queueing a
+ * command, which the engine picks up within GPIO_PWM_LATENCY.
+ *
+ * Every edge has an absolute deadline on CLOCK_MONOTONIC, derived from the
+ * channel's start time rather than from when the last edge actually
+ * happened, so periods don't drift. If the thread falls more than a whole
+ * period behind on a PWM channel, the missed periods are skipped and counted.
+ * How late each edge was written is kept in Stats.
+ *
+ * Once a pin is added, the engine's thread is the only one that may write
+ * to it until it is removed.
+ */
+class GPIOPWM
+{
+public:
+	typedef int ChannelID;
+
+	static const ChannelID INVALID_CHANNEL = -1;
+
+	struct Stats
+	{
+		bool          realtime;    // Whether the thread got SCHED_FIFO
+		unsigned long edges;       // Scheduled edges driven
+		unsigned long missed;      // PWM edges skipped after falling behind
+		long          minLatency;  // Time from an edge's deadline until it was written (ns)
+		long          maxLatency;
+		double        meanLatency;
+	};
+
+	GPIOPWM();
+	~GPIOPWM() throw() { Stop(); }
+
+	/**
+	 * Start the engine's thread. If it can't be made SCHED_FIFO (this needs
+	 * root or CAP_SYS_NICE), it runs at normal priority with more jitter.
+	 */
+	bool Start(int priority = GPIO_PWM_PRIORITY);
+	bool IsRunning() const { return m_bRunning; }
+
+	/**
+	 * Stop the thread. Channels that were running are left low.
+	 */
+	void Stop() throw();
+
+	/*!
+	 * Hand a pin over to the engine. The pin must be open and an output, and
+	 * must outlive the channel.
+	 *
+	 * \return The channel, or INVALID_CHANNEL if all GPIO_PWM_CHANNELS are taken
+	 */
+	ChannelID AddChannel(GPIO &gpio);
+
+	/**
+	 * Stop the channel, leave the pin low and give it back.
+	 */
+	void RemoveChannel(ChannelID id);
+
+	/*!
+	 * Run a PWM signal until told otherwise. Updating a running channel keeps
+	 * its phase; the new duty cycle applies from the next edge.
+	 *
+	 * \param period     Time between rising edges, in microseconds
+	 * \param duty_cycle Between 0 and 1. 0 and 1 hold the pin low or high.
+	 * \return false if the channel doesn't exist
+	 */
+	bool SetPWM(ChannelID id, unsigned long period, double duty_cycle);
+
+	/*!
+	 * Deliver count pulses, high for duration and then low for duration, like
+	 * GPIO::Pulse(). The pin is left low.
+	 *
+	 * \return false if the channel doesn't exist
+	 */
+	bool SetPulses(ChannelID id, unsigned long duration, unsigned int count = 1);
+
+	/**
+	 * Stop the channel and leave the pin low.
+	 */
+	bool Halt(ChannelID id);
+
+	/**
+	 * True while the channel is running or has a command queued. A pulse
+	 * train is finished once this returns false.
+	 */
+	bool IsBusy(ChannelID id) const;
+
+	Stats GetStats();
+	void ResetStats();
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	GPIOPWM(const GPIOPWM &other);
+	GPIOPWM& operator=(const GPIOPWM &rhs);
+
+	struct Command
+	{
+		enum Type { ADD, REMOVE, PWM, PULSES, HALT } type;
+		ChannelID     id;
+		GPIO         *gpio;
+		uint64_t      high;  // ns
+		uint64_t      low;   // ns
+		unsigned int  count; // Pulses, or 0 to run forever
+		unsigned long generation;
+	};
+
+	// Owned by the engine's thread
+	struct Channel
+	{
+		GPIO         *gpio;
+		bool          active;
+		bool          high;
+		uint64_t      next;      // Deadline of the next edge (ns)
+		uint64_t      highTime;  // ns
+		uint64_t      lowTime;   // ns
+		unsigned int  remaining; // Edges left in a pulse train, or 0 for PWM
+		unsigned long generation;
+	};
+
+	bool Queue(const Command &command);
+	void Run(int priority);
+
+	/**
+	 * Apply queued commands. If no channel is active, wait for one.
+	 */
+	void ApplyCommands(uint64_t now, bool wait);
+	void Apply(const Command &command, uint64_t now);
+	void Drive(Channel &channel, unsigned int value);
+	void Finish(ChannelID id, unsigned int value);
+	void RecordEdge(long latency);
+	void PublishStats();
+
+	volatile bool          m_bRunning;
+	boost::thread          m_thread;
+
+	// Caller side: commands waiting for the engine, and channel bookkeeping
+	mutable boost::mutex      m_mutex;
+	boost::condition_variable m_commandCond;
+	std::vector<Command>      m_commands;
+	bool                      m_used[GPIO_PWM_CHANNELS];
+	unsigned long             m_queued[GPIO_PWM_CHANNELS];   // Generation of the last command
+	volatile unsigned long    m_finished[GPIO_PWM_CHANNELS]; // Generation the engine has finished
+
+	// Engine side
+	Channel                m_channels[GPIO_PWM_CHANNELS];
+	std::vector<Command>   m_applying;
+
+	Stats                  m_newStats; // Not yet published
+	double                 m_newTotal;
+
+	// Published by the engine when it can take the lock without waiting
+	boost::mutex           m_statsMutex;
+	Stats                  m_stats;
+	double                 m_totalLatency;
+};
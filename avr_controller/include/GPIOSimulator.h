@@ -0,0 +1,174 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIOBackend.h"
+
+#include <boost/thread.hpp>
+#include <deque>
+#include <map>
+
+class GPIOSimulatorLine;
+
+/**
+ * An in-memory GPIO backend for running GPIO consumers off the BeagleBoard.
+ * Pins are created on first use as inputs reading 0. Like the sysfs, a pin's
+ * direction, edge and value belong to the pin and outlive any GPIO object
+ * that opens it.
+ *
+ * The outside world is played by the test: SetInput() drives an input as a
+ * button or sensor would, and ScheduleEdge() scripts the same thing to
+ * happen later. Scripted edges are applied in time order by a thread that
+ * is started with the first ScheduleEdge(), so edges also reach lines that
+ * are only waited on through their event fd (GPIOEventLoop).
+ */
+class GPIOSimulator : public GPIOBackend
+{
+public:
+	GPIOSimulator() : m_bStopping(false) { }
+	virtual ~GPIOSimulator();
+
+	virtual GPIOLine *CreateLine(unsigned int gpio);
+	virtual GPIOLineGroup *CreateGroup(const std::vector<unsigned int> &gpios);
+	virtual const char *GetName() const { return "sim"; }
+
+	/**
+	 * Drive pin gpio to value from outside. Has no effect if the pin is an
+	 * output (the output wins, as on real hardware).
+	 */
+	void SetInput(unsigned int gpio, unsigned int value);
+
+	/**
+	 * Call SetInput(gpio, value) delay microseconds from now.
+	 */
+	void ScheduleEdge(unsigned int gpio, unsigned long delay, unsigned int value);
+
+	/**
+	 * Level currently on the pin, whether driven by SetInput() or by a GPIO
+	 * object with the pin set to OUT.
+	 */
+	unsigned int GetLevel(unsigned int gpio);
+
+	/**
+	 * Number of transitions seen on the pin so far.
+	 */
+	unsigned long GetEdgeCount(unsigned int gpio);
+
+private:
+	friend class GPIOSimulatorLine;
+	friend class GPIOSimulatorGroup;
+
+	struct Pin
+	{
+		Pin() : value(0), dir(GPIO::IN), edge(GPIO::NONE), rising(0), falling(0) { }
+		unsigned int    value;
+		GPIO::Direction dir;
+		GPIO::Edge      edge;
+		unsigned long   rising;
+		unsigned long   falling;
+	};
+
+	struct Edge
+	{
+		unsigned int gpio;
+		unsigned int value;
+	};
+
+	void ScriptRun();
+
+	// The functions below expect m_mutex to be held
+
+	/**
+	 * Set the pin's level, counting the edge and waking up waiters.
+	 */
+	void SetLevel(unsigned int gpio, Pin &pin, unsigned int value);
+
+	/**
+	 * Apply the scripted edges that are due.
+	 */
+	void RunScript();
+
+	boost::mutex                                      m_mutex;
+	boost::condition_variable                         m_edgeCond;
+	std::map<unsigned int, Pin>                       m_pins;
+	std::multimap<boost::system_time, Edge>           m_script;
+	// Open lines, to signal their event fds
+	std::multimap<unsigned int, GPIOSimulatorLine*>   m_lines;
+	boost::thread                                     m_scriptThread;
+	bool                                              m_bStopping;
+};
+
+class GPIOSimulatorLine : public GPIOLine
+{
+public:
+	GPIOSimulatorLine(unsigned int gpio, GPIOSimulator &sim);
+	virtual ~GPIOSimulatorLine() { Close(); }
+
+	virtual bool Open();
+	virtual bool IsOpen() const { return m_bOpen; }
+	virtual void Close() throw();
+
+	virtual void SetDirection(GPIO::Direction dir, unsigned int initial_value);
+	virtual void SetEdge(GPIO::Edge edge);
+
+	virtual unsigned int GetValue();
+	virtual void SetValue(unsigned int value);
+
+	virtual bool WaitForEdge(long timeout);
+
+	/*!
+	 * Edges are signalled through an eventfd. Like the chardev, edges are
+	 * queued (up to 16) with the time the simulator applied them.
+	 */
+	virtual int GetEventFd(uint32_t &events) const;
+	virtual int AcknowledgeEdge();
+	virtual unsigned int ReadEdges(GPIO::EdgeEvent *events, unsigned int count);
+
+private:
+	friend class GPIOSimulator;
+
+	GPIOSimulator &m_sim;
+	bool           m_bOpen;
+	int            m_event_fd;
+	// Edge counts already reported by WaitForEdge()
+	unsigned long  m_rising;
+	unsigned long  m_falling;
+	// Edges signalled through m_event_fd and not yet read
+	std::deque<GPIO::EdgeEvent> m_pending;
+};
+
+/**
+ * Groups read and write all of their pins under the simulator's lock, so
+ * they are atomic like a single-bank chardev request.
+ */
+class GPIOSimulatorGroup : public GPIOLineSet
+{
+public:
+	GPIOSimulatorGroup(GPIOSimulator &sim, const std::vector<unsigned int> &gpios) : GPIOLineSet(sim, gpios), m_sim(sim) { }
+
+	virtual uint32_t GetValues();
+	virtual void SetValues(uint32_t values);
+	virtual bool IsAtomic() const { return true; }
+
+private:
+	GPIOSimulator &m_sim;
+};
@@ -21,44 +21,71 @@
  */
 #pragma once
 
-#include <vector>
+#include "I2CTransport.h"
 
-#define INVALID_DESCRIPTOR -1
+#include <stdint.h>
+#include <vector>
 
 class I2CBus
 {
 public:
 	/**
-	 * I2CBus encapsulates the opening/closing of /dev/i2c-* devices. After
-	 * calling Open(), the file descriptor can be retrieved with File() to be
-	 * used with ioctl(). I2CBus provides quasi-RAII; when the object falls out
-	 * of scope, the file descriptor will automatically be closed.
+	 * I2CBus encapsulates the opening/closing of an I2C bus, and the
+	 * transactions on it. The first constructor uses /dev/i2c-<i2cbus>; the
+	 * second, another transport such as an I2CSimulator, which must outlive
+	 * this object. I2CBus provides quasi-RAII; when the object falls out of
+	 * scope, the bus will automatically be closed.
 	 */
-	I2CBus(unsigned int i2cbus) : m_i2cbus(i2cbus), m_fd(INVALID_DESCRIPTOR) { }
-	~I2CBus() throw() { Close(); }
+	I2CBus(unsigned int i2cbus);
+	I2CBus(I2CTransport &transport);
+	~I2CBus() throw();
 
-	bool Open();
-	bool IsOpen() const { return m_fd >= 0; }
-	void Close() throw();
-
-	/**
-	 * Return the file descriptor of the opened device. This will be valid
-	 * after Open() returns true and until Close() is called or the object
-	 * falls out of scope.
-	 */
-	int File() const { return m_fd; }
+	bool Open() { return m_transport->Open(); }
+	bool IsOpen() const { return m_transport->IsOpen(); }
+	void Close() throw() { m_transport->Close(); }
 
 	/**
-	 * Scan an I2C bus for devices. Use SMBus "read byte" commands for probing.
-	 * This is known to lock SMBus on various write-only chips (most notably
-	 * clock chips at address 0x69).
+	 * Scan an I2C bus for devices.
 	 *
 	 * \param  devices The addresses of the detected devices. If an error occurs
 	 *                 and this returns false, devices may or may not be modified.
 	 * \return true if no error occurred; otherwise, false is returned and the
 	 *                 error message is printed to cerr.
 	 */
-	bool DetectDevices(std::vector<unsigned int> &devices);
+	bool DetectDevices(std::vector<unsigned int> &devices) { return m_transport->DetectDevices(devices); }
+
+	/**
+	 * Perform a combined transaction (I2C_RDWR): the messages are sent in
+	 * order with repeated starts and one stop at the end, and may address
+	 * different devices. Transactions longer than the kernel allows are
+	 * split.
+	 *
+	 * \param  msgs  The segments, see <linux/i2c.h>
+	 * \param  count The number of segments
+	 * \return true if every segment was transferred
+	 */
+	bool Transfer(struct i2c_msg *msgs, unsigned int count);
+
+	/**
+	 * One register write, for declaring a device's configuration as a table.
+	 * Entries may address different devices, and are applied in order.
+	 */
+	struct Register
+	{
+		uint16_t address; // Device
+		uint8_t  reg;
+		uint8_t  value;
+	};
+
+	/**
+	 * Apply a register table with a single combined transaction, then read
+	 * every register back with another and check that it holds the last
+	 * value the table gave it.
+	 *
+	 * \return false if a transaction failed or a register didn't match (the
+	 *         mismatch is printed to cerr)
+	 */
+	bool Configure(const Register *table, unsigned int count);
 
 private:
 	/**
@@ -67,6 +94,6 @@ private:
 	I2CBus(const I2CBus &other);
 	I2CBus& operator=(const I2CBus &rhs);
 
-	unsigned int m_i2cbus;
-	int m_fd;
+	I2CTransport *m_transport;
+	bool          m_owned;
 };
@@ -0,0 +1,118 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "I2CTransport.h"
+
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+class GPIOSimulator;
+
+/**
+ * An in-memory I2C transport for running the IMU off the BeagleBoard. It
+ * models the two devices on the IMU's bus closely enough for IMU to run
+ * unmodified: the ADXL345 accelerometer at 0x53, with its sample rate, FIFO
+ * (bypass and stream modes, watermark and overrun) and interrupt 1 on
+ * IMU_INT1; and the ITG3200 gyroscope at 0x68, with its sample rate, data
+ * ready status and latched or pulsed interrupt on IMU_INT0. The interrupt
+ * lines are driven on a GPIOSimulator, so pair this with an IMU constructed
+ * over the same GPIOSimulator.
+ *
+ * The devices sample on their own clock, from when the simulator is created,
+ * whether or not the bus is open. What they measure is set with
+ * SetAcceleration(), SetRotation() and SetTemperature().
+ */
+class I2CSimulator : public I2CTransport
+{
+public:
+	/**
+	 * \param gpio     Drives the interrupt lines
+	 * \param busSpeed If nonzero, transfers take as long as they would on a
+	 *                 bus clocked at busSpeed Hz
+	 */
+	I2CSimulator(GPIOSimulator &gpio, unsigned int busSpeed = 0);
+	virtual ~I2CSimulator();
+
+	virtual bool Open();
+	virtual bool IsOpen() const { return m_bOpen; }
+	virtual void Close() throw();
+
+	/**
+	 * Like the kernel, fails with errno set to ENXIO if a segment addresses
+	 * a device that isn't there. Segments before it have taken effect.
+	 */
+	virtual bool Transfer(struct i2c_msg *msgs, unsigned int count);
+	virtual bool DetectDevices(std::vector<unsigned int> &devices);
+
+	virtual const char *GetName() const { return "sim"; }
+
+	/**
+	 * What the devices measure from their next sample on, in g, degrees per
+	 * second and degrees Celsius.
+	 */
+	void SetAcceleration(float x, float y, float z);
+	void SetRotation(float x, float y, float z);
+	void SetTemperature(float celsius);
+
+	/**
+	 * Number of Transfer() calls so far.
+	 */
+	unsigned long GetTransfers();
+
+private:
+	class Device;
+	class Accelerometer;
+	class Gyroscope;
+
+	/**
+	 * This object is noncopyable.
+	 */
+	I2CSimulator(const I2CSimulator &other);
+	I2CSimulator& operator=(const I2CSimulator &rhs);
+
+	void TickRun();
+
+	// The functions below expect m_mutex to be held
+
+	Device *Find(uint16_t address);
+
+	/**
+	 * Take the samples that are due and update the interrupt lines.
+	 *
+	 * \return When the next sample is due (CLOCK_MONOTONIC, ns), or 0 if
+	 *         neither device is sampling
+	 */
+	uint64_t Tick();
+
+	GPIOSimulator             &m_gpio;
+	unsigned int              m_busSpeed;
+
+	boost::mutex              m_mutex;
+	boost::condition_variable m_tickCond;
+	Accelerometer             *m_acc;
+	Gyroscope                 *m_gyro;
+	bool                      m_bOpen;
+	bool                      m_bStopping;
+	unsigned long             m_transfers;
+	boost::thread             m_tickThread;
+};
@@ -0,0 +1,58 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <vector>
+
+struct i2c_msg;
+
+/**
+ * An I2CTransport carries an I2CBus's transactions: the kernel's
+ * /dev/i2c-N (I2CDevice), or simulated devices (I2CSimulator) so that I2C
+ * consumers can run off the BeagleBoard.
+ */
+class I2CTransport
+{
+public:
+	virtual ~I2CTransport() { }
+
+	virtual bool Open() = 0;
+	virtual bool IsOpen() const = 0;
+	virtual void Close() throw() = 0;
+
+	/**
+	 * Perform one combined transaction, as with I2C_RDWR: the messages are
+	 * sent in order with repeated starts and one stop at the end, and may
+	 * address different devices. I2CBus keeps count within the kernel's
+	 * limit (I2C_RDRW_IOCTL_MAX_MSGS).
+	 *
+	 * \return true if every message was acknowledged and transferred
+	 */
+	virtual bool Transfer(struct i2c_msg *msgs, unsigned int count) = 0;
+
+	/**
+	 * See I2CBus::DetectDevices().
+	 */
+	virtual bool DetectDevices(std::vector<unsigned int> &devices) = 0;
+
+	virtual const char *GetName() const = 0;
+};
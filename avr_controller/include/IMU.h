@@ -22,18 +22,60 @@
 #pragma once
 
 #include "GPIO.h"
+#include "GPIOEventLoop.h"
 #include "BeagleBoardAddressBook.h"
 #include "I2CBus.h"
+#include "SeqLock.h"
+#include "SPSCRing.h"
+#include "TelemetryWriter.h"
 
 #include <boost/thread.hpp>
+#include <stdint.h>
 #include <time.h> // for timespec
 
+#define ACCELEROMETER_UPDATE_FREQ 100 // Hz, default sample rate
+#define ACCELEROMETER_WAKEUP_FREQ 100 // Hz, FIFO watermark is chosen for this
+#define ACCELEROMETER_FIFO_SIZE   32  // samples
+#define IMU_ACC_QUEUE_SIZE        4096 // samples, >1s at 3200 Hz
+#define IMU_GYRO_QUEUE_SIZE       256  // samples, >2s at 100 Hz
+
 class IMU
 {
 public:
-	IMU() : m_i2c(2), m_accInt(IMU_INT1), m_gyroInt(IMU_INT0), m_bRunning(false), m_frame() { }
+	IMU() : m_i2c(2), m_accInt(IMU_INT1), m_gyroInt(IMU_INT0), m_accRate(ACCELEROMETER_UPDATE_FREQ), m_accWatermark(0), m_accPeriod(0), m_accNext(0), m_accLeft(0), m_accLastRead(0), m_accOverruns(0), m_telemetry(NULL), m_accOverflows(0), m_gyroOverflows(0), m_latest() { }
+	IMU(GPIOBackend &backend) : m_i2c(2), m_accInt(IMU_INT1, backend), m_gyroInt(IMU_INT0, backend), m_accRate(ACCELEROMETER_UPDATE_FREQ), m_accWatermark(0), m_accPeriod(0), m_accNext(0), m_accLeft(0), m_accLastRead(0), m_accOverruns(0), m_telemetry(NULL), m_accOverflows(0), m_gyroOverflows(0), m_latest() { }
+	/**
+	 * Run over another I2C transport, such as an I2CSimulator (with a
+	 * GPIOSimulator as backend). The transport must outlive this object.
+	 */
+	IMU(GPIOBackend &backend, I2CTransport &i2c) : m_i2c(i2c), m_accInt(IMU_INT1, backend), m_gyroInt(IMU_INT0, backend), m_accRate(ACCELEROMETER_UPDATE_FREQ), m_accWatermark(0), m_accPeriod(0), m_accNext(0), m_accLeft(0), m_accLastRead(0), m_accOverruns(0), m_telemetry(NULL), m_accOverflows(0), m_gyroOverflows(0), m_latest() { }
 	~IMU() throw() { Close(); }
 
+	/**
+	 * Set the accelerometer's sample rate, before calling Open(). Supported
+	 * rates are 25, 50, 100, 200, 400, 800, 1600 and 3200 Hz. Samples are
+	 * buffered in the ADXL345's FIFO and read in batches, so there are about
+	 * ACCELEROMETER_WAKEUP_FREQ wakeups per second (twice that at 3200 Hz,
+	 * where a batch is limited to half the FIFO). Rates
+	 * above 800 Hz need the bus clocked at 400 kHz to keep up.
+	 *
+	 * \return false if the rate isn't supported
+	 */
+	bool SetAccRate(unsigned int hz);
+	unsigned int GetAccRate() const { return m_accRate; }
+
+	/**
+	 * Number of times the accelerometer's FIFO was found full, meaning
+	 * samples were lost because the reader fell behind.
+	 */
+	unsigned int GetAccOverruns() const { return m_accOverruns; }
+
+	/**
+	 * Log every sample to stream as well, from the acquisition thread. Set
+	 * this before calling Open().
+	 */
+	void SetTelemetry(TelemetryWriter::Stream *stream) { m_telemetry = stream; }
+
 	bool Open();
 	bool IsOpen() const { return m_i2c.IsOpen(); } // All three resources are opened together
 	void Close() throw();
@@ -50,30 +92,130 @@ public:
 		timespec timestamp; // timestamp of the latter sample
 	};
 
-	void GetFrame(Frame &frame);
+	/**
+	 * The latest accelerometer and gyroscope readings, merged. Samples that
+	 * arrived in between calls are skipped; use DrainAcc() and DrainGyro() to
+	 * see every one. Takes no lock, so any number of threads can poll this
+	 * without holding up the acquisition thread.
+	 */
+	void GetFrame(Frame &frame) const { m_frame.Read(frame); }
+
+	/**
+	 * An accelerometer sample. The timestamp (CLOCK_MONOTONIC, ns) is
+	 * reconstructed from when its batch was read and the sample rate.
+	 */
+	struct AccSample
+	{
+		uint64_t timestamp;
+		float    x;
+		float    y;
+		float    z;
+	};
+
+	/**
+	 * A gyroscope sample. The timestamp (CLOCK_MONOTONIC, ns) is taken when
+	 * the interrupt is handled.
+	 */
+	struct GyroSample
+	{
+		uint64_t timestamp;
+		float    xrot;
+		float    yrot;
+		float    zrot;
+		float    temp;
+	};
+
+	/**
+	 * Copy out up to count queued samples, oldest first. Every sample is
+	 * queued until it is drained, or until the queue fills and new samples
+	 * are dropped (see GetAccOverflows()). Each queue may be drained by one
+	 * thread only. Never blocks.
+	 *
+	 * \return The number of samples copied
+	 */
+	unsigned int DrainAcc(AccSample *samples, unsigned int count) { return m_accQueue.Pop(samples, count); }
+	unsigned int DrainGyro(GyroSample *samples, unsigned int count) { return m_gyroQueue.Pop(samples, count); }
+
+	/**
+	 * Number of samples dropped because their queue was full.
+	 */
+	unsigned long GetAccOverflows() const { return m_accOverflows; }
+	unsigned long GetGyroOverflows() const { return m_gyroOverflows; }
 
 private:
 	/**
-	 * Set the target of the next read or write operation.
+	 * Check both devices' ID registers, in one transaction.
 	 */
-	enum Device { ACC, GYRO };
-	bool Select(Device device);
+	bool Identify();
 
-	bool InitAcc();
-	bool InitGyro();
+	bool InitInterrupts();
 
-	void AccRun();
-	void GyroRun();
+	/**
+	 * Write both devices' settings from one register table, in one
+	 * transaction, and read them back to check.
+	 */
+	bool Configure();
+
+	/**
+	 * Read after either device raises its interrupt, on m_eventThread. One
+	 * I2C_RDWR transaction reads the gyroscope (if it interrupted), every
+	 * accelerometer sample known to be in the FIFO and the FIFO's status, so
+	 * samples from both are taken together without switching slave address.
+	 */
+	void Acquire(bool gyro);
+
+	/**
+	 * Number of accelerometer samples certainly in the FIFO by now, going by
+	 * what was left at the last read and the time since.
+	 */
+	unsigned int PredictAcc(uint64_t now) const;
+
+	/**
+	 * Give each sample of a batch of count, read at now with left still in
+	 * the FIFO, a timestamp. Samples are evenly spaced; the batch is placed
+	 * where the last one ended, nudged toward what now suggests so that the
+	 * accelerometer's clock drift is tracked without passing on the jitter
+	 * of each wakeup.
+	 */
+	void StampAcc(AccSample *samples, unsigned int count, unsigned int left, uint64_t now);
+
+	/**
+	 * Handle a batch of accelerometer samples, oldest first.
+	 */
+	void OnAccSamples(const AccSample *samples, unsigned int count);
+	void OnGyroSample(const uint8_t *gyro_read, uint64_t timestamp);
+
+	/**
+	 * Called when an interrupt hasn't been seen for two periods. If the
+	 * line is already high, its edge was missed; read to clear it.
+	 */
+	void OnAccTimeout();
+	void OnGyroTimeout();
 
 	I2CBus         m_i2c;
-	boost::mutex   m_i2cMutex;
 	GPIO           m_accInt;
 	GPIO           m_gyroInt;
 
-	volatile bool  m_bRunning;
-	boost::thread  m_accThread;
-	boost::thread  m_gyroThread;
+	GPIOEventLoop  m_events;
+	boost::thread  m_eventThread;
+
+	unsigned int   m_accRate;      // Hz
+	unsigned int   m_accWatermark; // samples
+	uint64_t       m_accPeriod;    // ns
+	uint64_t       m_accNext;      // expected timestamp of the next sample, 0 if unknown
+	unsigned int   m_accLeft;      // samples left in the FIFO at the last read
+	uint64_t       m_accLastRead;  // when the FIFO was last read, 0 if unknown
+	unsigned int   m_accOverruns;
+
+	TelemetryWriter::Stream *m_telemetry;
+
+	// Written by m_eventThread only
+	SPSCRing<AccSample, IMU_ACC_QUEUE_SIZE>   m_accQueue;
+	SPSCRing<GyroSample, IMU_GYRO_QUEUE_SIZE> m_gyroQueue;
+	volatile unsigned long                    m_accOverflows;
+	volatile unsigned long                    m_gyroOverflows;
 
-	Frame          m_frame;
-	boost::mutex   m_frameMutex;
+	// m_latest is the writer's working copy, published whole through m_frame
+	Frame          m_latest;
+	SeqLock<Frame> m_frame;
 };
@@ -0,0 +1,132 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "IMU.h"
+#include "SeqLock.h"
+
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+#define FUSION_KP          2.0f  // Proportional gain, pulls toward the accelerometer's gravity
+#define FUSION_KI          0.005f // Integral gain, learns the gyroscope's bias
+#define FUSION_BATCH       64    // Samples drained from the IMU at a time
+#define FUSION_POLL_PERIOD 10000 // us
+
+/**
+ * Orientation from the IMU's samples, with a Mahony complementary filter: the
+ * gyroscope is integrated into a quaternion, and the accelerometer's view of
+ * gravity slowly corrects its drift (and, through the integral term, its
+ * bias). Gravity is then rotated out of each accelerometer sample, leaving
+ * the robot's own acceleration in the world frame.
+ *
+ * Accelerometer and gyroscope samples are taken in timestamp order, and the
+ * filter steps at each one, so it runs at the combined sample rate: between
+ * gyroscope samples the last rate is held. All math is single-precision with
+ * no divisions or calls in the inner loop beyond one square root per
+ * normalization, so it suits the Cortex-A8's NEON unit.
+ *
+ * Either feed it with Update() (e.g. from recorded data) or let it drain an
+ * IMU on its own thread with Start(). The latest State can be read from any
+ * thread without locking.
+ */
+class IMUFusion
+{
+public:
+	IMUFusion(float kp = FUSION_KP, float ki = FUSION_KI);
+	~IMUFusion() throw() { Stop(); }
+
+	struct State
+	{
+		uint64_t timestamp; // ns, CLOCK_MONOTONIC, of the last sample used
+		float    w;         // Orientation: rotates the robot's frame into
+		float    x;         // the world's (z up)
+		float    y;
+		float    z;
+		float    ax;        // Acceleration without gravity, in the world's
+		float    ay;        // frame (m/s^2)
+		float    az;
+	};
+
+	/**
+	 * Step the filter through a batch of samples. The two arrays are each
+	 * oldest first, and are merged by timestamp.
+	 *
+	 * \return The number of filter steps taken
+	 */
+	unsigned int Update(const IMU::AccSample *acc, unsigned int accCount, const IMU::GyroSample *gyro, unsigned int gyroCount);
+
+	/**
+	 * Start draining samples from imu on a new thread every
+	 * FUSION_POLL_PERIOD. The IMU's queues must not be drained by anyone
+	 * else meanwhile.
+	 */
+	bool Start(IMU &imu);
+	void Stop();
+
+	/**
+	 * Back to level, with no learned bias.
+	 */
+	void Reset();
+
+	/**
+	 * The latest orientation and acceleration. Never blocks.
+	 */
+	void GetState(State &state) const { m_published.Read(state); }
+
+	/**
+	 * The same orientation as Euler angles (radians): roll about x, pitch
+	 * about y, yaw about z.
+	 */
+	static void ToEuler(const State &state, float &roll, float &pitch, float &yaw);
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	IMUFusion(const IMUFusion &other);
+	IMUFusion& operator=(const IMUFusion &rhs);
+
+	/**
+	 * Advance to timestamp with the held gyroscope rate, correcting toward the
+	 * held accelerometer reading.
+	 */
+	void Step(uint64_t timestamp);
+
+	void Run();
+
+	const float   m_kp;
+	const float   m_ki;
+
+	// Filter state, owned by whichever thread calls Update()
+	State         m_state;
+	float         m_gyro[3];     // rad/s, last gyroscope sample
+	float         m_acc[3];      // g, last accelerometer sample
+	bool          m_hasAcc;
+	float         m_integral[3]; // rad/s, learned gyroscope bias (negated)
+
+	SeqLock<State> m_published;
+
+	IMU           *m_imu;
+	boost::thread  m_thread;
+	volatile bool  m_running;
+};
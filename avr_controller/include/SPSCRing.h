@@ -0,0 +1,107 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+/**
+ * A fixed-size, lock-free ring for exactly one producer thread and one
+ * consumer thread. Neither side ever blocks: Push() fails when the ring is
+ * full and Pop() returns nothing when it is empty, so the producer can be a
+ * time-critical thread that must not wait on a slow consumer.
+ *
+ * SIZE must be a power of two. The read and write counters run freely and
+ * wrap; only their difference matters. A full barrier separates each slot
+ * write from the counter update that publishes it (and each slot read from
+ * the update that releases it), which is what ARMv7 needs.
+ */
+template<typename T, unsigned int SIZE>
+class SPSCRing
+{
+public:
+	SPSCRing() : m_read(0), m_write(0) { }
+
+	unsigned int Capacity() const { return SIZE; }
+
+	/**
+	 * Number of items waiting. Exact from either end; from a third thread it
+	 * is only an estimate.
+	 */
+	unsigned int Size() const { return m_write - m_read; }
+	bool Empty() const { return Size() == 0; }
+
+	/**
+	 * Producer only. Returns false, dropping the item, if the ring is full.
+	 */
+	bool Push(const T &item)
+	{
+		unsigned int write = m_write;
+		if (write - m_read >= SIZE)
+			return false;
+		m_items[write & (SIZE - 1)] = item;
+		__sync_synchronize();
+		m_write = write + 1;
+		return true;
+	}
+
+	/**
+	 * Consumer only. Returns false if the ring is empty.
+	 */
+	bool Pop(T &item)
+	{
+		return Pop(&item, 1) == 1;
+	}
+
+	/**
+	 * Consumer only. Copy out up to count items in one go, paying for the
+	 * barrier once per batch rather than once per item.
+	 *
+	 * \return The number of items copied
+	 */
+	unsigned int Pop(T *items, unsigned int count)
+	{
+		unsigned int read = m_read;
+		unsigned int available = m_write - read;
+		if (count > available)
+			count = available;
+		__sync_synchronize();
+		for (unsigned int i = 0; i < count; i++)
+			items[i] = m_items[(read + i) & (SIZE - 1)];
+		__sync_synchronize();
+		m_read = read + count;
+		return count;
+	}
+
+private:
+	// Compile-time check that SIZE is a power of two
+	typedef char SizeMustBePowerOfTwo[(SIZE && !(SIZE & (SIZE - 1))) ? 1 : -1];
+
+	/**
+	 * This object is noncopyable.
+	 */
+	SPSCRing(const SPSCRing &other);
+	SPSCRing& operator=(const SPSCRing &rhs);
+
+	// Separate cache lines so producer and consumer don't false-share
+	volatile unsigned int m_read;
+	char                  m_pad[64 - sizeof(unsigned int)];
+	volatile unsigned int m_write;
+	T                     m_items[SIZE];
+};
@@ -0,0 +1,89 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <sched.h> // for sched_yield()
+
+/**
+ * Publishes a value from one writer thread to any number of readers without
+ * either side taking a lock. The writer never waits; a reader that overlaps
+ * a write notices (the sequence number is odd, or changed while copying) and
+ * copies again. Suited to small values that are read far more often than a
+ * write takes, such as the latest sensor frame.
+ *
+ * T must be copyable with plain assignment (no pointers the writer frees).
+ * Full barriers order the sequence number against the copy, which is what
+ * ARMv7 needs.
+ */
+template<typename T>
+class SeqLock
+{
+public:
+	SeqLock() : m_sequence(0), m_value() { }
+
+	/**
+	 * Writer only. Never blocks.
+	 */
+	void Write(const T &value)
+	{
+		unsigned int sequence = m_sequence;
+		m_sequence = sequence + 1; // Odd: a write is in progress
+		__sync_synchronize();
+		const_cast<T&>(m_value) = value;
+		__sync_synchronize();
+		m_sequence = sequence + 2;
+	}
+
+	/**
+	 * Any thread. Retries until it gets a copy no write overlapped.
+	 *
+	 * \return The number of retries, for statistics
+	 */
+	unsigned int Read(T &value) const
+	{
+		for (unsigned int retries = 0; ; retries++)
+		{
+			unsigned int before = m_sequence;
+			__sync_synchronize();
+			if (before & 1)
+			{
+				// The writer may have been preempted mid-write; let it finish
+				sched_yield();
+				continue;
+			}
+			value = const_cast<const T&>(m_value);
+			__sync_synchronize();
+			if (m_sequence == before)
+				return retries;
+		}
+	}
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	SeqLock(const SeqLock &other);
+	SeqLock& operator=(const SeqLock &rhs);
+
+	volatile unsigned int m_sequence;
+	volatile T            m_value;
+};
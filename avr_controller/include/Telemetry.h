@@ -0,0 +1,159 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The telemetry log format. A log is a FileHeader followed by fixed-size
+ * chunks, so chunk i is at headerSize + i * chunkSize and a reader can mmap
+ * the file and jump straight to any chunk. Everything is little endian (as
+ * are ARM, x86 and AVR) and naturally aligned, so the structures below can
+ * be read in place.
+ *
+ * A chunk is a ChunkHeader, then its records back to back from the front,
+ * and its index at the very end: count uint32_t offsets (from the start of
+ * the chunk) of its records, in the order they were written. The header
+ * also gives the time range and the record types the chunk holds, so a
+ * reader can skip chunks without touching their records. A record is a
+ * RecordHeader followed by length bytes of payload, padded to a multiple of
+ * TELEMETRY_ALIGN.
+ *
+ * Timestamps are CLOCK_MONOTONIC, in ns. Records from different sources are
+ * interleaved in the order they reached the writer, so timestamps only
+ * increase within a source; a chunk's first and last timestamps are its
+ * minimum and maximum.
+ */
+
+#define TELEMETRY_MAGIC       0x474C544D // "MTLG"
+#define TELEMETRY_CHUNK_MAGIC 0x4B4E4843 // "CHNK"
+#define TELEMETRY_VERSION     1
+#define TELEMETRY_CHUNK_SIZE  65536 // bytes
+#define TELEMETRY_ALIGN       8
+#define TELEMETRY_MAX_PAYLOAD 32    // bytes
+
+namespace Telemetry
+{
+	enum Type
+	{
+		ACC           = 1,
+		GYRO          = 2,
+		ENCODER       = 3,
+		MOTOR_CURRENT = 4,
+		BATTERY       = 5,
+		ENCODER_EDGES = 6,
+	};
+
+	struct FileHeader
+	{
+		uint32_t magic;      // TELEMETRY_MAGIC
+		uint16_t version;    // TELEMETRY_VERSION
+		uint16_t headerSize; // Offset of the first chunk
+		uint32_t chunkSize;
+		uint32_t reserved;
+		uint64_t monotonic;  // CLOCK_MONOTONIC and CLOCK_REALTIME when the
+		uint64_t realtime;   // log was opened, to put timestamps on a calendar
+	};
+
+	struct ChunkHeader
+	{
+		uint32_t magic;      // TELEMETRY_CHUNK_MAGIC
+		uint32_t sequence;   // Chunk number, from 0
+		uint32_t count;      // Records
+		uint32_t used;       // Bytes of records after the header
+		uint32_t types;      // Bit n is set if a record of type n is present
+		uint32_t reserved;
+		uint64_t first;      // Earliest and latest timestamps
+		uint64_t last;
+	};
+
+	struct RecordHeader
+	{
+		uint64_t timestamp;
+		uint16_t type;
+		uint16_t length;     // Payload, excluding padding
+		uint32_t reserved;
+	};
+
+	/**
+	 * Payloads. Each has its Type as TYPE, for TelemetryWriter::Stream::Log().
+	 */
+	struct Acc
+	{
+		static const uint16_t TYPE = ACC;
+		float x;             // g
+		float y;
+		float z;
+	};
+
+	struct Gyro
+	{
+		static const uint16_t TYPE = GYRO;
+		float xrot;          // degrees/s
+		float yrot;
+		float zrot;
+		float temp;          // degrees C
+	};
+
+	/**
+	 * One FSM_ENCODER message: count level samples of the encoder pin, bit i
+	 * of bits[i / 8] being sample i. The timestamp is when it was received,
+	 * shortly after the last sample. Only the first (count + 7) / 8 bytes of
+	 * bits are logged.
+	 */
+	struct Encoder
+	{
+		static const uint16_t TYPE = ENCODER;
+		uint8_t count;
+		uint8_t bits[TELEMETRY_MAX_PAYLOAD - 1];
+	};
+
+	/**
+	 * One FSM_ENCODER message in the edges format: the level of the encoder
+	 * pin before the first edge, then the time of each edge in us since the
+	 * one before, as LEB128 varints (see EncoderMessage). Only the varints
+	 * received are logged.
+	 */
+	struct EncoderEdges
+	{
+		static const uint16_t TYPE = ENCODER_EDGES;
+		uint8_t level;
+		uint8_t data[TELEMETRY_MAX_PAYLOAD - 1];
+	};
+
+	/**
+	 * Motor current sense, as the 10-bit ADC values the firmware publishes.
+	 */
+	struct MotorCurrent
+	{
+		static const uint16_t TYPE = MOTOR_CURRENT;
+		uint16_t motor[4];
+	};
+
+	struct Battery
+	{
+		static const uint16_t TYPE = BATTERY;
+		uint16_t raw;        // ADC value
+		uint16_t reserved;
+		float    volts;
+	};
+}
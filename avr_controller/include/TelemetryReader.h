@@ -0,0 +1,125 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "Telemetry.h"
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+#include <string>
+
+/**
+ * Read a telemetry log (see Telemetry.h) through a read-only mapping, so
+ * records are never copied and any chunk can be reached directly. A log
+ * that is still being written can be read; chunks written after Open()
+ * aren't seen until it is opened again.
+ */
+class TelemetryReader
+{
+public:
+	TelemetryReader() : m_data(NULL), m_size(0), m_chunkCount(0), m_chunk(0), m_record(0) { }
+	~TelemetryReader() throw() { Close(); }
+
+	bool Open(const std::string &path);
+	bool IsOpen() const { return m_data != NULL; }
+	void Close() throw();
+
+	const Telemetry::FileHeader &GetHeader() const { return *reinterpret_cast<const Telemetry::FileHeader*>(m_data); }
+
+	/**
+	 * Number of complete, valid chunks. A chunk that fails its checks ends
+	 * the log there.
+	 */
+	unsigned int GetChunkCount() const { return m_chunkCount; }
+	const Telemetry::ChunkHeader &GetChunk(unsigned int chunk) const { return *reinterpret_cast<const Telemetry::ChunkHeader*>(GetChunkData(chunk)); }
+
+	/**
+	 * A record, pointing into the mapping: valid until Close().
+	 */
+	struct Record
+	{
+		uint64_t    timestamp;
+		uint16_t    type;
+		uint16_t    length;
+		const void *payload;
+
+		/**
+		 * The payload as a Telemetry payload struct, or NULL if the record
+		 * is of another type. Variable-length payloads may be shorter than
+		 * T; see Telemetry::Encoder.
+		 */
+		template<typename T>
+		const T *As() const { return type == T::TYPE ? reinterpret_cast<const T*>(payload) : NULL; }
+	};
+
+	/**
+	 * Random access, through the chunk's index.
+	 *
+	 * \return false if chunk or index is out of range
+	 */
+	bool GetRecord(unsigned int chunk, unsigned int index, Record &record) const;
+
+	/**
+	 * Sequential access: return the record after the last one returned, in
+	 * the order they were written.
+	 *
+	 * \return false at the end of the log
+	 */
+	bool Next(Record &record);
+
+	/**
+	 * Make Next() start over from the first record.
+	 */
+	void Rewind() { m_chunk = 0; m_record = 0; }
+
+	/**
+	 * Make Next() start from the first chunk holding records at or after
+	 * timestamp. As sources interleave, a few records before it may follow.
+	 *
+	 * \return false if there are no such records
+	 */
+	bool Seek(uint64_t timestamp);
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	TelemetryReader(const TelemetryReader &other);
+	TelemetryReader& operator=(const TelemetryReader &rhs);
+
+	const uint8_t *GetChunkData(unsigned int chunk) const
+	{
+		const Telemetry::FileHeader &header = GetHeader();
+		return m_data + header.headerSize + (size_t)chunk * header.chunkSize;
+	}
+
+	/**
+	 * Check a chunk's header and index against its size.
+	 */
+	bool Validate(unsigned int chunk) const;
+
+	const uint8_t *m_data;
+	size_t         m_size;
+	unsigned int   m_chunkCount;
+	unsigned int   m_chunk;  // Next() position
+	unsigned int   m_record;
+};
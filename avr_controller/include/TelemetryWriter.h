@@ -0,0 +1,163 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "SPSCRing.h"
+#include "Telemetry.h"
+
+#include <boost/thread.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define TELEMETRY_QUEUE_SIZE   4096 // records per stream, >1s of 3200 Hz samples
+#define TELEMETRY_POLL_PERIOD  20000 // us
+#define TELEMETRY_FLUSH_PERIOD 1000  // ms, longest a record waits to reach the file
+
+#ifndef INVALID_DESCRIPTOR
+	#define INVALID_DESCRIPTOR -1
+#endif
+
+/**
+ * Write a telemetry log (see Telemetry.h) from any number of threads without
+ * making any of them wait on the disk.
+ *
+ * Each producing thread logs through its own Stream, a lock-free ring, so
+ * Log() is a copy and never blocks. A writer thread drains the streams every
+ * TELEMETRY_POLL_PERIOD into the chunk being filled, and writes that chunk
+ * out in place when it fills up and every TELEMETRY_FLUSH_PERIOD, so a
+ * running log can be read and at most that much is lost in a crash.
+ */
+class TelemetryWriter
+{
+public:
+	TelemetryWriter();
+	~TelemetryWriter() throw();
+
+	/**
+	 * Create (or truncate) the log file and start the writer thread.
+	 */
+	bool Open(const std::string &path);
+	bool IsOpen() const { return m_fd >= 0; }
+
+	/**
+	 * Write out everything that has been logged, and close the file.
+	 */
+	void Close() throw();
+
+	/**
+	 * A queue of records from one thread.
+	 */
+	class Stream
+	{
+	public:
+		Stream() : m_dropped(0) { }
+
+		/**
+		 * Queue a record, dropping it if the queue is full. Only ever call
+		 * this from one thread.
+		 *
+		 * \return false if the record was dropped
+		 */
+		bool Log(uint16_t type, uint64_t timestamp, const void *payload, uint16_t length);
+
+		template<typename T>
+		bool Log(uint64_t timestamp, const T &payload) { return Log(T::TYPE, timestamp, &payload, sizeof(payload)); }
+
+		/**
+		 * Number of records dropped because the queue was full.
+		 */
+		unsigned long GetDropped() const { return m_dropped; }
+
+	private:
+		friend class TelemetryWriter;
+
+		struct Slot
+		{
+			Telemetry::RecordHeader header;
+			uint8_t                 payload[TELEMETRY_MAX_PAYLOAD];
+		};
+
+		/**
+		 * This object is noncopyable.
+		 */
+		Stream(const Stream &other);
+		Stream& operator=(const Stream &rhs);
+
+		SPSCRing<Slot, TELEMETRY_QUEUE_SIZE> m_queue;
+		volatile unsigned long               m_dropped;
+	};
+
+	/**
+	 * Create a stream for a producing thread. Streams belong to the writer,
+	 * and stay valid (and may be used whether or not the log is open) until
+	 * it is destroyed.
+	 */
+	Stream *CreateStream();
+
+	/**
+	 * Records and chunks written so far.
+	 */
+	unsigned long GetRecords() const { return m_records; }
+	unsigned int GetChunks() const { return m_chunks; }
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	TelemetryWriter(const TelemetryWriter &other);
+	TelemetryWriter& operator=(const TelemetryWriter &rhs);
+
+	void WriteRun();
+
+	/**
+	 * Move queued records into the chunk, writing out chunks as they fill.
+	 *
+	 * \return false if writing failed
+	 */
+	bool Drain();
+
+	/**
+	 * Append a record to the chunk, starting a new one if it doesn't fit.
+	 */
+	bool Append(const Stream::Slot &slot);
+
+	/**
+	 * Write the chunk's header and index into its buffer, then the buffer
+	 * to its place in the file.
+	 */
+	bool Flush();
+
+	int                         m_fd;
+	std::vector<Stream*>        m_streams;
+	boost::mutex                m_streamMutex;
+
+	boost::thread               m_thread;
+	volatile bool               m_running;
+
+	// Owned by the writer thread while it runs
+	std::vector<uint8_t>        m_chunk;
+	std::vector<uint32_t>       m_index;
+	Telemetry::ChunkHeader      m_header;
+	volatile unsigned long      m_records;
+	volatile unsigned int       m_chunks;
+};
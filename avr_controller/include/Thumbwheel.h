@@ -21,13 +21,17 @@
  */
 #pragma once
 
-#include "GPIO.h"
+#include "GPIOEventLoop.h"
+#include "GPIOGroup.h"
 #include "BeagleBoardAddressBook.h"
 
+#include <boost/function.hpp>
+
 class Thumbwheel
 {
 public:
-	Thumbwheel() : m_pin1(THUMBWHEEL1), m_pin2(THUMBWHEEL2), m_pin4(THUMBWHEEL4) { }
+	Thumbwheel() : m_pins(PINS, 3) { }
+	Thumbwheel(GPIOBackend &backend) : m_pins(PINS, 3, backend) { }
 	~Thumbwheel() { }
 
 	/**
@@ -41,12 +45,27 @@ public:
 	unsigned int GetValue();
 
 	/**
-	 * Block until a new value is available. An additional settling time is
-	 * applied to better avoid returning transitory values. Returns false if the
-	 * timeout occurs before a new value is detected.
+	 * Block until a new value is available. A value is only returned once
+	 * the wheel has rested on it for the settling time, so transitory values
+	 * while it turns aren't. Returns false if no new value settles within the
+	 * timeout.
 	 */
 	bool Poll(unsigned long timeout, unsigned int &value);
 
+	typedef boost::function<void (unsigned int value)> ChangeHandler;
+
+	/*!
+	 * Report settled values from an event loop instead of blocking. Edges on
+	 * any of the three pins restart the settling time; onChange is called
+	 * the moment it runs out, if the value differs from the last one.
+	 *
+	 * \param events   The loop to watch from; it must be open
+	 * \param onChange Called with each new settled value
+	 * \return false if the pins can't be watched
+	 */
+	bool Watch(GPIOEventLoop &events, const ChangeHandler &onChange);
+	void Unwatch(GPIOEventLoop &events);
+
 private:
 	/**
 	 * This object is noncopyable.
@@ -54,7 +73,7 @@ private:
 	Thumbwheel(const Thumbwheel &other);
 	Thumbwheel& operator=(const Thumbwheel &rhs);
 
-	GPIO m_pin1;
-	GPIO m_pin2;
-	GPIO m_pin4;
+	// The 1's, 2's and 4's bits, active low
+	static const unsigned int PINS[3];
+	GPIOGroup m_pins;
 };
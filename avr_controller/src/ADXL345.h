@@ -81,3 +81,12 @@
 #define ADXL345_FIFO              (1<<6)
 #define ADXL345_STREAM            (1<<7)
 #define ADXL345_TRIGGER           (1<<6)|(1<<7)
+
+// FIFO Control/Status Fields
+#define ADXL345_SAMPLES_MASK      0x1F   // FIFO_CTL: watermark
+#define ADXL345_FIFO_MODE_MASK    0xC0   // FIFO_CTL: mode
+#define ADXL345_FIFO_ENTRIES      0x3F   // FIFO_STATUS: number of samples in the FIFO
+#define ADXL345_FIFO_SIZE         32     // samples
+
+#define ADXL345_ID                0xE5   // DEVID
+#define I2C_ADDRESS_ADXL345       0x53   // ALT ADDRESS pin grounded
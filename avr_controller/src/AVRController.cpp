@@ -21,15 +21,20 @@
  */
 
 #include "AVRController.h"
+#include "EncoderMessage.h"
 #include "ArduinoAddressBook.h" // from avr package
+#include "ParamServer.h"        // from avr package
 
+#include <algorithm> // for min()
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp> // for boost::posix_time::milliseconds
 #include <iostream>
+#include <string.h> // for memcpy()
+#include <time.h>   // for clock_gettime()
 
 using namespace std;
 
-AVRController::AVRController() : m_io(), m_port(m_io), m_bRunning(false)
+AVRController::AVRController() : m_io(), m_port(m_io), m_bRunning(false), m_telemetry(NULL)
 {
 }
 
@@ -38,20 +43,28 @@ AVRController::~AVRController() throw()
 	Close();
 }
 
-bool AVRController::Open(const string &device)
+bool AVRController::Open(const string &device, unsigned long timeout)
 {
-	// TODO: Add a new parameter, a function/callback with no parameters, that
-	// blocks until the Arduino has finished resetting itself. The function
-	// could, for example, wait for the Arduino to pull a GPIO pin low.
 	Close();
 
+	// Listen for the hello before the first byte can be read
+	boost::shared_ptr<string> hello(new string);
+	boost::shared_ptr<boost::condition> helloCondition(new boost::condition);
+	{
+		boost::mutex::scoped_lock responseLock(m_responseMutex);
+		m_responseHandlers.push_back(ResponseHandler_t(FSM_MASTER, hello, helloCondition));
+	}
+
 	// Open the port, while guarding against other open/close calls
 	boost::mutex::scoped_lock portLock(m_portMutex);
 	try
 	{
 		m_port.open(device.c_str());
 		if (!m_port.is_open())
+		{
+			RemoveResponseHandler(hello);
 			return false;
+		}
 
 		typedef boost::asio::serial_port_base asio_serial;
 		m_port.set_option(asio_serial::baud_rate(115200));
@@ -60,11 +73,6 @@ bool AVRController::Open(const string &device)
 		m_port.set_option(asio_serial::parity(asio_serial::parity::none));
 		m_port.set_option(asio_serial::flow_control(asio_serial::flow_control::none));
 
-		// Wait for the Arduino to reset itself
-		//boost::this_thread::sleep(boost::posix_time::milliseconds(2000));
-		boost::asio::deadline_timer timer(m_io, boost::posix_time::milliseconds(2000));
-		timer.wait();
-
 		// m_ioThread is the thread in which our IO callbacks are executed
 		m_bRunning = true;
 		boost::thread temp(boost::bind(&AVRController::WriteThreadRun, this));
@@ -80,18 +88,62 @@ bool AVRController::Open(const string &device)
 	catch (const boost::system::error_code &ec)
 	{
 		cerr << "AVRController::Open - Error opening " << device << ": " << ec.message() << endl;
+		RemoveResponseHandler(hello);
 		return false;
 	}
 	catch (...)
 	{
 		cerr << "AVRController::Open - Unspecified error" << endl;
+		RemoveResponseHandler(hello);
 		return false;
 	}
 
 	m_deviceName = device;
+	portLock.unlock();
+
+	// Wait for the Arduino to reset itself
+	if (!WaitForHello(hello, helloCondition, timeout))
+		cerr << "AVRController::Open - No hello from " << device << ", continuing anyway" << endl;
 	return true;
 }
 
+bool AVRController::WaitForHello(const boost::shared_ptr<string> &hello, const boost::shared_ptr<boost::condition> &helloCondition, unsigned long timeout)
+{
+	boost::system_time const endtime = boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+
+	{
+		// ReadCallback() fills in the response under this lock, so the
+		// notification can't slip in between the check and the wait
+		boost::mutex::scoped_lock responseLock(m_responseMutex);
+		while (hello->empty())
+		{
+			if (!helloCondition->timed_wait(responseLock, endtime))
+				break;
+		}
+		if (!hello->empty())
+			return true;
+	}
+	RemoveResponseHandler(hello);
+
+	// Maybe the port was already open and the Arduino didn't reset
+	struct
+	{
+		uint16_t length;
+		uint8_t id;
+		uint8_t message;
+	}
+		__attribute__((packed)) msg =
+	{
+		(uint16_t)sizeof(msg),
+		FSM_MASTER,
+		MSG_MASTER_HELLO
+	};
+
+	string strMessage(reinterpret_cast<char*>(&msg), sizeof(msg));
+	string strResponse;
+	return Query(strMessage, strResponse);
+}
+
 void AVRController::Close() throw()
 {
 	try
@@ -211,6 +263,19 @@ bool AVRController::QueryInternal(unsigned int fsmId, bool sendMsg, const std::s
 	return false;
 }
 
+void AVRController::RemoveResponseHandler(const boost::shared_ptr<string> &response)
+{
+	boost::mutex::scoped_lock responseLock(m_responseMutex);
+	for (vector<ResponseHandler_t>::iterator it = m_responseHandlers.begin(); it != m_responseHandlers.end(); ++it)
+	{
+		if (it->get<1>() == response)
+		{
+			m_responseHandlers.erase(it);
+			break;
+		}
+	}
+}
+
 void AVRController::WriteThreadRun()
 {
 	string msg;
@@ -274,6 +339,16 @@ void AVRController::ReadCallback(const boost::system::error_code &error, size_t
 		string msg = m_message.GetMessage();
 		unsigned char fsmId = msg[2];
 
+		if (m_telemetry)
+			Log(msg);
+
+		{
+			boost::mutex::scoped_lock subscriberLock(m_subscriberMutex);
+			map<unsigned int, Subscriber>::const_iterator subscriber = m_subscribers.find(fsmId);
+			if (subscriber != m_subscribers.end())
+				subscriber->second(msg);
+		}
+
 		boost::mutex::scoped_lock responseLock(m_responseMutex);
 
 		// Iterate over our response handlers, notify all handlers waiting on
@@ -305,6 +380,18 @@ void AVRController::ReadCallback(const boost::system::error_code &error, size_t
 	}
 }
 
+void AVRController::Subscribe(unsigned int fsmId, const Subscriber &subscriber)
+{
+	boost::mutex::scoped_lock subscriberLock(m_subscriberMutex);
+	m_subscribers[fsmId] = subscriber;
+}
+
+void AVRController::Unsubscribe(unsigned int fsmId)
+{
+	boost::mutex::scoped_lock subscriberLock(m_subscriberMutex);
+	m_subscribers.erase(fsmId);
+}
+
 bool AVRController::ListFSMs(std::vector<std::string> &fsmv)
 {
 	fsmv.clear();
@@ -400,6 +487,67 @@ void AVRController::ClearFSMs()
 		DestroyFSM(*it);
 }
 
+void AVRController::Log(const string &msg)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	const uint8_t *bytes = reinterpret_cast<const uint8_t*>(msg.c_str());
+	switch (bytes[2])
+	{
+	case FSM_ENCODER:
+		{
+			// Only the bytes holding samples or edges are logged
+			EncoderMessage encoder;
+			if (!encoder.Parse(msg))
+				break;
+			if (encoder.IsEdges())
+			{
+				Telemetry::EncoderEdges record;
+				record.level = encoder.GetLevel();
+				size_t length = min(encoder.GetDataLength(), sizeof(record.data));
+				memcpy(record.data, encoder.GetData(), length);
+				m_telemetry->Log(Telemetry::ENCODER_EDGES, now, &record, 1 + length);
+			}
+			else
+			{
+				Telemetry::Encoder record;
+				record.count = encoder.GetSampleCount();
+				size_t length = encoder.GetBitsLength();
+				if (length <= sizeof(record.bits))
+				{
+					memcpy(record.bits, encoder.GetBits(), length);
+					m_telemetry->Log(Telemetry::ENCODER, now, &record, 1 + length);
+				}
+			}
+		}
+		break;
+	case FSM_MOTORCONTROLLER:
+		if (msg.length() == ParamServer::MotorControllerPublisherMsg::GetLength())
+		{
+			ParamServer::MotorControllerPublisherMsg values(bytes);
+			Telemetry::MotorCurrent record = { { values.GetMotor1cs(), values.GetMotor2cs(), values.GetMotor3cs(), values.GetMotor4cs() } };
+			m_telemetry->Log(now, record);
+		}
+		break;
+	case FSM_ANALOGPUBLISHER:
+		if (msg.length() == ParamServer::AnalogPublisherPublisherMsg::GetLength())
+		{
+			ParamServer::AnalogPublisherPublisherMsg value(bytes);
+			if (value.GetPin() == BATTERY_VOLTAGE)
+			{
+				Telemetry::Battery record;
+				record.raw = value.GetValue();
+				record.reserved = 0;
+				record.volts = record.raw * 5.0f / 1024 * (BATTERY_R1 + BATTERY_R2) / BATTERY_R2;
+				m_telemetry->Log(now, record);
+			}
+		}
+		break;
+	}
+}
+
 bool AVRController::SetDTR(bool level)
 {
 	int fd = m_port.native();
@@ -0,0 +1,173 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIO.h"
+#include "GPIOBackend.h"
+#include "GPIOCapture.h"
+
+#include <iomanip>  // for setprecision()
+#include <iostream>
+#include <map>
+#include <stdlib.h> // for atoi()
+#include <string>
+#include <unistd.h> // for usleep()
+#include <vector>
+
+#define DRAIN_PERIOD 100000 // 100ms
+
+using namespace std;
+
+namespace
+{
+	// Intervals between consecutive edges of one pin, in microseconds
+	struct Stats
+	{
+		Stats() : edges(0), last(0), min(0), max(0), total(0) { }
+		unsigned long edges;
+		uint64_t      last;
+		double        min;
+		double        max;
+		double        total;
+	};
+}
+
+/**
+ * Capture edges on one or more pins and print the time between them. Useful
+ * for checking encoder, bridge-pin and IMU data-ready timing from the host.
+ */
+int main(int argc, char **argv)
+{
+	string spec = "chardev"; // The only backend with kernel timestamps
+	GPIO::Edge edge = GPIO::BOTH;
+	unsigned int seconds = 10;
+	bool verbose = false;
+	vector<unsigned int> pins;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 7, "--gpio=") == 0)
+			spec = arg.substr(7);
+		else if (arg == "--edge=rising")
+			edge = GPIO::RISING;
+		else if (arg == "--edge=falling")
+			edge = GPIO::FALLING;
+		else if (arg.compare(0, 10, "--seconds=") == 0)
+			seconds = atoi(arg.substr(10).c_str());
+		else if (arg == "--verbose")
+			verbose = true;
+		else
+			pins.push_back(atoi(argv[i]));
+	}
+	if (pins.empty() || seconds == 0)
+	{
+		cerr << "Usage: " << argv[0] << " [--gpio=<backend>] [--edge=rising|falling] [--seconds=N] [--verbose] <pin>..." << endl;
+		return 1;
+	}
+
+	GPIOBackend *backend = GPIOBackend::Create(spec);
+	if (!backend)
+	{
+		cerr << "edgecapture - Unknown GPIO backend: " << spec << endl;
+		return 1;
+	}
+
+	int result = 0;
+	{
+		vector<GPIO*> gpios;
+		GPIOCapture capture;
+		try
+		{
+			for (unsigned int i = 0; i < pins.size(); ++i)
+			{
+				GPIO *gpio = new GPIO(pins[i], *backend);
+				gpios.push_back(gpio);
+				if (!gpio->Open())
+					throw GPIO::Exception(*gpio, "edgecapture", "Failed to open pin");
+				gpio->SetDirection(GPIO::IN);
+				gpio->SetEdge(edge);
+				if (!capture.Add(*gpio))
+					throw GPIO::Exception(*gpio, "edgecapture", "Failed to capture pin");
+			}
+		}
+		catch (const GPIO::Exception &e)
+		{
+			cerr << e.what() << endl;
+			result = 1;
+		}
+
+		if (result == 0 && capture.Start())
+		{
+			cout << "Capturing " << pins.size() << " pin(s) for " << seconds << "s on " << backend->GetName() << endl;
+
+			map<unsigned int, Stats> stats;
+			GPIO::EdgeEvent events[256];
+			for (unsigned int elapsed = 0; elapsed < seconds * 1000000; elapsed += DRAIN_PERIOD)
+			{
+				usleep(DRAIN_PERIOD);
+				unsigned int n;
+				while ((n = capture.Drain(events, sizeof(events) / sizeof(events[0]))) > 0)
+				{
+					for (unsigned int i = 0; i < n; ++i)
+					{
+						Stats &s = stats[events[i].gpio];
+						if (s.edges++ > 0)
+						{
+							double interval = (events[i].timestamp - s.last) / 1000.0;
+							if (s.edges == 2 || interval < s.min)
+								s.min = interval;
+							if (interval > s.max)
+								s.max = interval;
+							s.total += interval;
+							if (verbose)
+								cout << events[i].gpio << " " << events[i].value << " +" << fixed << setprecision(3) << interval << "us" << endl;
+						}
+						s.last = events[i].timestamp;
+					}
+				}
+			}
+			capture.Stop();
+
+			cout << fixed << setprecision(3);
+			for (map<unsigned int, Stats>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+			{
+				const Stats &s = it->second;
+				cout << "Pin " << it->first << ": " << s.edges << " edges";
+				if (s.edges > 1)
+					cout << ", interval min " << s.min << "us, mean " << (s.total / (s.edges - 1)) << "us, max " << s.max << "us";
+				cout << endl;
+			}
+			if (capture.GetOverflows())
+				cout << "Dropped " << capture.GetOverflows() << " edges (ring full)" << endl;
+		}
+		else
+		{
+			result = 1;
+		}
+
+		for (unsigned int i = 0; i < gpios.size(); ++i)
+			delete gpios[i];
+	}
+
+	delete backend;
+	return result;
+}
@@ -0,0 +1,91 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "EncoderMessage.h"
+#include "ArduinoAddressBook.h" // from avr package
+
+using namespace std;
+
+bool EncoderMessage::Parse(const string &msg)
+{
+	m_payload.clear();
+	m_deltas.clear();
+
+	const uint8_t *bytes = reinterpret_cast<const uint8_t*>(msg.c_str());
+	if (msg.length() <= 4 || bytes[2] != FSM_ENCODER || (size_t)(bytes[0] | (bytes[1] << 8)) != msg.length())
+		return false;
+
+	if (bytes[3] == ENCODER_FORMAT_EDGES)
+	{
+		m_bEdges = true;
+		m_level = bytes[4];
+		m_payload.assign(bytes + 5, bytes + msg.length());
+		if (!DecodeVarints(GetData(), GetDataLength(), m_deltas))
+			return false;
+		m_count = m_deltas.size();
+	}
+	else
+	{
+		m_bEdges = false;
+		m_count = bytes[3];
+		// Make sure we don't overshoot the size of the array
+		if (m_count > 8 * (msg.length() - 4))
+			return false;
+		m_payload.assign(bytes + 4, bytes + msg.length());
+	}
+	return true;
+}
+
+unsigned int EncoderMessage::GetTicks() const
+{
+	if (m_bEdges)
+		return m_count;
+
+	unsigned int ticks = 0;
+	for (unsigned int i = 1; i < m_count; i++)
+	{
+		if (GetSample(i) != GetSample(i - 1))
+			ticks++;
+	}
+	return ticks;
+}
+
+bool EncoderMessage::DecodeVarints(const uint8_t *data, size_t length, vector<uint32_t> &values)
+{
+	uint32_t value = 0;
+	unsigned int shift = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (shift > 28 || (shift == 28 && (data[i] & 0x70)))
+			return false; // Overflow
+		value |= (uint32_t)(data[i] & 0x7F) << shift;
+		if (data[i] & 0x80)
+			shift += 7;
+		else
+		{
+			values.push_back(value);
+			value = 0;
+			shift = 0;
+		}
+	}
+	return shift == 0;
+}
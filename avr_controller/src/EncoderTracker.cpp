@@ -0,0 +1,135 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "EncoderTracker.h"
+
+#include <string.h> // for memcpy()
+
+using namespace std;
+
+EncoderTracker::EncoderTracker(unsigned int ticksPerRev /* = SENTRY_TICKS_PER_REV */) : m_ticksPerRev(ticksPerRev)
+{
+	Reset();
+}
+
+void EncoderTracker::Reset()
+{
+	m_ticks = 0;
+	m_samples = 0;
+	m_messages = 0;
+	m_bStarted = false;
+	m_lastSample = 0;
+	ClearWindow();
+}
+
+void EncoderTracker::ClearWindow()
+{
+	memset(m_window, 0, sizeof(m_window));
+	m_next = 0;
+	m_windowTicks = 0;
+	m_windowDuration = 0;
+	m_idle = 0;
+	m_bStopped = true;
+}
+
+void EncoderTracker::Add(const EncoderMessage &msg)
+{
+	Span span = { 0, 0 };
+	unsigned int ticks = 0;
+	if (msg.IsEdges())
+	{
+		const vector<uint32_t> &deltas = msg.GetDeltas();
+		vector<uint32_t>::const_iterator it = deltas.begin();
+		ticks = deltas.size();
+		// After a stop, or Start(), the first delta includes the time spent
+		// still. Keep it out of the window.
+		if ((m_bStopped || m_idle) && it != deltas.end())
+			++it;
+		for (; it != deltas.end(); ++it)
+		{
+			span.duration += *it;
+			span.ticks++;
+		}
+		m_lastSample = deltas.size() % 2 ? !msg.GetLevel() : msg.GetLevel();
+		m_bStarted = true;
+	}
+	else if (msg.GetSampleCount())
+	{
+		// The bits are little endian, as are ARM and x86, so eight bytes
+		// load as samples 0-63 of a word
+		const uint8_t *bits = msg.GetBits();
+		unsigned int count = msg.GetSampleCount();
+		if (!m_bStarted)
+		{
+			m_lastSample = bits[0] & 1;
+			m_bStarted = true;
+		}
+		for (unsigned int i = 0; i < count; i += 64)
+		{
+			uint64_t word = 0;
+			unsigned int samples = count - i < 64 ? count - i : 64;
+			memcpy(&word, bits + i / 8, (samples + 7) / 8);
+			span.ticks += CountTicks(word, samples);
+		}
+		span.duration = count * ENCODER_SAMPLE_PERIOD;
+		ticks = span.ticks;
+	}
+
+	m_ticks += ticks;
+	m_samples += msg.GetSampleCount();
+	m_messages++;
+	m_idle = 0;
+	m_bStopped = false;
+
+	// Slide the window
+	m_windowTicks += span.ticks - m_window[m_next].ticks;
+	m_windowDuration += span.duration;
+	m_windowDuration -= m_window[m_next].duration;
+	m_window[m_next] = span;
+	m_next = (m_next + 1) % ENCODER_WINDOW;
+}
+
+void EncoderTracker::Advance(uint32_t elapsed)
+{
+	m_idle += elapsed;
+	if (m_idle >= ENCODER_IDLE_TIMEOUT)
+		ClearWindow();
+}
+
+unsigned int EncoderTracker::CountTicks(uint64_t word, unsigned int count)
+{
+	uint64_t mask = count < 64 ? (1ULL << count) - 1 : ~0ULL;
+	uint64_t previous = (word << 1) | m_lastSample;
+	m_lastSample = (word >> (count - 1)) & 1;
+	return __builtin_popcountll((word ^ previous) & mask);
+}
+
+double EncoderTracker::GetPeriod() const
+{
+	return m_windowTicks >= 2 ? (double)m_windowDuration / m_windowTicks : 0.0;
+}
+
+double EncoderTracker::GetRPM() const
+{
+	double period = GetPeriod();
+	return period > 0.0 ? 60.0e6 / (period * m_ticksPerRev) : 0.0;
+}
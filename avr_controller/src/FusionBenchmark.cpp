@@ -0,0 +1,188 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "IMUFusion.h"
+
+#include <fstream>
+#include <iostream>
+#include <math.h>     // for M_PI
+#include <stdio.h>    // for sscanf()
+#include <stdlib.h>   // for atoi(), rand()
+#include <string>
+#include <time.h>     // for clock_gettime()
+#include <vector>
+
+#define DEFAULT_ACC_RATE  800   // Hz
+#define GYRO_RATE         100   // Hz
+#define SYNTHETIC_SECONDS 10
+#define MIN_DURATION      1.0   // s of filtering to time
+
+using namespace std;
+
+/**
+ * Report how many IMUFusion updates per second this machine manages.
+ *
+ *     fusionbench [--rate=Hz] [recording.csv]
+ *
+ * The recording has one sample per line, as telemetry2csv writes them:
+ *
+ *     acc,<timestamp ns>,<x g>,<y g>,<z g>
+ *     gyro,<timestamp ns>,<x deg/s>,<y deg/s>,<z deg/s>,<temp C>
+ *
+ * Without one, ten seconds of a robot turning in place at 30 deg/s are made
+ * up, with the accelerometer at the given rate and some noise. The samples
+ * are filtered repeatedly for at least a second, and the final orientation
+ * is printed so the result can be sanity-checked.
+ */
+namespace
+{
+	double Now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+	float Noise(float amplitude)
+	{
+		return amplitude * (2.0f * rand() / RAND_MAX - 1.0f);
+	}
+
+	bool Load(const char *path, vector<IMU::AccSample> &acc, vector<IMU::GyroSample> &gyro)
+	{
+		ifstream file(path);
+		if (!file)
+			return false;
+
+		string line;
+		while (getline(file, line))
+		{
+			unsigned long long timestamp;
+			if (line.compare(0, 4, "acc,") == 0)
+			{
+				IMU::AccSample sample;
+				if (sscanf(line.c_str() + 4, "%llu,%f,%f,%f", &timestamp, &sample.x, &sample.y, &sample.z) == 4)
+				{
+					sample.timestamp = timestamp;
+					acc.push_back(sample);
+				}
+			}
+			else if (line.compare(0, 5, "gyro,") == 0)
+			{
+				IMU::GyroSample sample;
+				if (sscanf(line.c_str() + 5, "%llu,%f,%f,%f,%f", &timestamp, &sample.xrot, &sample.yrot, &sample.zrot, &sample.temp) == 5)
+				{
+					sample.timestamp = timestamp;
+					gyro.push_back(sample);
+				}
+			}
+		}
+		return true;
+	}
+
+	void Synthesize(unsigned int accRate, vector<IMU::AccSample> &acc, vector<IMU::GyroSample> &gyro)
+	{
+		const uint64_t start = 1000000000ULL;
+		for (unsigned int i = 0; i < SYNTHETIC_SECONDS * accRate; i++)
+		{
+			IMU::AccSample sample;
+			sample.timestamp = start + (uint64_t)i * 1000000000ULL / accRate;
+			sample.x = Noise(0.02f);
+			sample.y = Noise(0.02f);
+			sample.z = 1.0f + Noise(0.02f);
+			acc.push_back(sample);
+		}
+		for (unsigned int i = 0; i < SYNTHETIC_SECONDS * GYRO_RATE; i++)
+		{
+			IMU::GyroSample sample;
+			sample.timestamp = start + (uint64_t)i * 1000000000ULL / GYRO_RATE;
+			sample.xrot = Noise(0.5f);
+			sample.yrot = Noise(0.5f);
+			sample.zrot = 30.0f + Noise(0.5f);
+			sample.temp = 35.0f;
+			gyro.push_back(sample);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int accRate = DEFAULT_ACC_RATE;
+	const char *recording = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 7, "--rate=") == 0)
+			accRate = atoi(arg.substr(7).c_str());
+		else if (arg.compare(0, 2, "--") != 0 && !recording)
+			recording = argv[i];
+		else
+			accRate = 0;
+	}
+	if (accRate == 0)
+	{
+		cerr << "Usage: " << argv[0] << " [--rate=Hz] [recording.csv]" << endl;
+		return 1;
+	}
+
+	vector<IMU::AccSample> acc;
+	vector<IMU::GyroSample> gyro;
+	if (recording)
+	{
+		if (!Load(recording, acc, gyro) || (acc.empty() && gyro.empty()))
+		{
+			cerr << "fusionbench - Can't read samples from " << recording << endl;
+			return 1;
+		}
+	}
+	else
+	{
+		Synthesize(accRate, acc, gyro);
+	}
+	cout << acc.size() << " accelerometer and " << gyro.size() << " gyroscope samples" << endl;
+
+	IMUFusion fusion;
+	IMUFusion::State state;
+	unsigned long steps = 0;
+	unsigned int passes = 0;
+	double start = Now();
+	double elapsed;
+	do
+	{
+		fusion.Reset();
+		steps += fusion.Update(acc.empty() ? NULL : &acc[0], acc.size(), gyro.empty() ? NULL : &gyro[0], gyro.size());
+		passes++;
+		elapsed = Now() - start;
+	} while (elapsed < MIN_DURATION);
+
+	fusion.GetState(state);
+	float roll, pitch, yaw;
+	IMUFusion::ToEuler(state, roll, pitch, yaw);
+
+	cout << passes << " passes, " << (unsigned long)(steps / elapsed) << " updates/s, "
+	     << elapsed * 1e9 / steps << " ns/update" << endl;
+	cout << "Final roll " << roll * 180 / M_PI << " deg, pitch " << pitch * 180 / M_PI
+	     << " deg, yaw " << yaw * 180 / M_PI << " deg; acceleration ("
+	     << state.ax << ", " << state.ay << ", " << state.az << ") m/s^2" << endl;
+	return 0;
+}
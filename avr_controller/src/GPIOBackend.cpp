@@ -0,0 +1,251 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOBackend.h"
+#include "GPIOChardev.h"
+#include "GPIOSimulator.h"
+#include "GPIOSysfs.h"
+
+#include <errno.h>  // for errno
+#include <poll.h>   // for poll()
+#include <string.h> // for strerror()
+#include <time.h>   // for clock_gettime()
+
+#define GROUP_READ_PASSES 4 // Give up on a consistent read after this many
+
+using namespace std;
+
+namespace
+{
+	// NULL means the sysfs; resolved lazily so that GPIO objects with static
+	// storage duration don't depend on initialization order
+	GPIOBackend *defaultBackend = NULL;
+
+	/**
+	 * If spec is name or name:arg, put arg (or "") in arg and return true.
+	 */
+	bool Match(const string &spec, const char *name, string &arg)
+	{
+		string prefix(name);
+		if (spec == prefix)
+		{
+			arg.clear();
+			return true;
+		}
+		if (spec.compare(0, prefix.length() + 1, prefix + ":") == 0)
+		{
+			arg = spec.substr(prefix.length() + 1);
+			return true;
+		}
+		return false;
+	}
+}
+
+unsigned int GPIOLine::ReadEdges(GPIO::EdgeEvent *events, unsigned int count)
+{
+	int value = AcknowledgeEdge();
+	if (value < 0 || count == 0)
+		return 0;
+	events[0].timestamp = Now();
+	events[0].gpio = m_gpio;
+	events[0].value = value;
+	return 1;
+}
+
+uint64_t GPIOLine::Now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+GPIOLineSet::GPIOLineSet(GPIOBackend &backend, const vector<unsigned int> &gpios) : GPIOLineGroup(gpios)
+{
+	for (vector<unsigned int>::const_iterator it = gpios.begin(); it != gpios.end(); ++it)
+		m_lines.push_back(backend.CreateLine(*it));
+}
+
+GPIOLineSet::~GPIOLineSet()
+{
+	Close();
+	for (vector<GPIOLine*>::iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+		delete *it;
+}
+
+bool GPIOLineSet::Open()
+{
+	for (vector<GPIOLine*>::iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+	{
+		if (!(*it)->IsOpen() && !(*it)->Open())
+		{
+			Close();
+			return false;
+		}
+	}
+	if (!m_lines.empty())
+	{
+		m_dir = m_lines[0]->GetDirection();
+		m_edge = m_lines[0]->GetEdge();
+	}
+	return true;
+}
+
+bool GPIOLineSet::IsOpen() const
+{
+	return !m_lines.empty() && m_lines[0]->IsOpen();
+}
+
+void GPIOLineSet::Close() throw()
+{
+	for (vector<GPIOLine*>::iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+		(*it)->Close();
+}
+
+void GPIOLineSet::SetDirection(GPIO::Direction dir, uint32_t initial_values)
+{
+	for (unsigned int i = 0; i < m_lines.size(); i++)
+		m_lines[i]->SetDirection(dir, (initial_values >> i) & 1);
+	m_dir = dir;
+}
+
+void GPIOLineSet::SetEdge(GPIO::Edge edge)
+{
+	for (unsigned int i = 0; i < m_lines.size(); i++)
+		m_lines[i]->SetEdge(edge);
+	m_edge = edge;
+}
+
+uint32_t GPIOLineSet::ReadLines()
+{
+	uint32_t values = 0;
+	for (unsigned int i = 0; i < m_lines.size(); i++)
+		values |= m_lines[i]->GetValue() << i;
+	return values;
+}
+
+uint32_t GPIOLineSet::GetValues()
+{
+	uint32_t values = ReadLines();
+	if (IsAtomic() || m_dir == GPIO::OUT)
+		return values;
+
+	// Read until two passes agree so a change mid-read isn't returned torn
+	for (unsigned int pass = 1; pass < GROUP_READ_PASSES; pass++)
+	{
+		uint32_t again = ReadLines();
+		if (again == values)
+			break;
+		values = again;
+	}
+	return values;
+}
+
+void GPIOLineSet::SetValues(uint32_t values)
+{
+	for (unsigned int i = 0; i < m_lines.size(); i++)
+		m_lines[i]->SetValue((values >> i) & 1);
+}
+
+bool GPIOLineSet::WaitForEdge(long timeout)
+{
+	if (m_lines.size() == 1)
+		return m_lines[0]->WaitForEdge(timeout);
+
+	vector<struct pollfd> fds;
+	vector<GPIOLine*> lines;
+	for (vector<GPIOLine*>::iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+	{
+		uint32_t events;
+		int fd = (*it)->GetEventFd(events);
+		if (fd < 0)
+			continue;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = (events & POLLPRI) ? POLLPRI : POLLIN;
+		pfd.revents = 0;
+		fds.push_back(pfd);
+		lines.push_back(*it);
+	}
+	if (fds.empty())
+		return false;
+
+	// Round the timeout up to the next millisecond, see GPIOSysfsLine
+	int ret = poll(&fds[0], fds.size(), (int)(timeout - 1) / 1000 + 1);
+	if (ret < 0)
+		throw GPIO::Exception(m_gpios[0], "GPIO::Poll", strerror(errno));
+
+	bool edge = false;
+	for (unsigned int i = 0; i < fds.size(); i++)
+	{
+		if (fds[i].revents)
+			edge = (lines[i]->AcknowledgeEdge() >= 0) || edge;
+	}
+	return edge;
+}
+
+void GPIOLineSet::GetEventFds(vector<int> &fds, uint32_t &events) const
+{
+	fds.clear();
+	events = 0;
+	for (vector<GPIOLine*>::const_iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+	{
+		int fd = (*it)->GetEventFd(events);
+		if (fd >= 0)
+			fds.push_back(fd);
+	}
+}
+
+bool GPIOLineSet::AcknowledgeEdges()
+{
+	bool edge = false;
+	for (vector<GPIOLine*>::iterator it = m_lines.begin(); it != m_lines.end(); ++it)
+		edge = ((*it)->AcknowledgeEdge() >= 0) || edge;
+	return edge;
+}
+
+GPIOLineGroup *GPIOBackend::CreateGroup(const vector<unsigned int> &gpios)
+{
+	return new GPIOLineSet(*this, gpios);
+}
+
+GPIOBackend *GPIOBackend::Create(const string &spec)
+{
+	string arg;
+	if (Match(spec, "sysfs", arg))
+		return new GPIOSysfs(arg.empty() ? SYSFS_GPIO_DIR : arg);
+	if (Match(spec, "chardev", arg))
+		return new GPIOChardev(arg.empty() ? CHARDEV_GPIO_DIR : arg);
+	if (spec == "sim")
+		return new GPIOSimulator();
+	return NULL;
+}
+
+GPIOBackend &GPIOBackend::GetDefault()
+{
+	static GPIOSysfs sysfs;
+	return defaultBackend ? *defaultBackend : sysfs;
+}
+
+void GPIOBackend::SetDefault(GPIOBackend *backend)
+{
+	defaultBackend = backend;
+}
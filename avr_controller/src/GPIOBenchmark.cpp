@@ -0,0 +1,183 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIO.h"
+#include "GPIOBackend.h"
+#include "GPIOSysfs.h" // for SYSFS_GPIO_DIR
+
+#include <fcntl.h>    // for open()
+#include <iomanip>    // for setw()
+#include <iostream>
+#include <stdio.h>    // for snprintf()
+#include <stdlib.h>   // for atoi()
+#include <string>
+#include <time.h>     // for clock_gettime()
+#include <unistd.h>   // for I/O functions
+
+#define DEFAULT_ITERATIONS 10000
+
+using namespace std;
+
+/**
+ * Report the cost, in nanoseconds per operation, of each GPIO value path.
+ *
+ *     gpiobench [--gpio=<backend>] [--iterations=N] <pin>
+ *
+ * The pin is switched to OUT and toggled, so pick one that is safe to drive.
+ * With the sysfs backend, the syscall sequence GPIO used before the
+ * read-write value fd (reopen on every output read, lseek after every
+ * access, NUL written with the value) is timed as well, for comparison.
+ */
+namespace
+{
+	double Now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1e9 + ts.tv_nsec;
+	}
+
+	void Report(const char *path, double start, unsigned int iterations)
+	{
+		cout << setw(28) << left << path << (Now() - start) / iterations << " ns/op" << endl;
+	}
+
+	/**
+	 * Time the old sysfs sequences on root/gpioN/value.
+	 */
+	void BenchmarkLegacy(const string &root, unsigned int pin, unsigned int iterations)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/gpio%u/value", pin);
+		string value = root + path;
+		char ch;
+		double start;
+
+		int fd = open(value.c_str(), O_WRONLY);
+		if (fd < 0)
+		{
+			cerr << "gpiobench - Can't open " << value << endl;
+			return;
+		}
+
+		start = Now();
+		for (unsigned int i = 0; i < iterations; ++i)
+		{
+			if (write(fd, (i & 1) ? "1" : "0", 2) != 2 || lseek(fd, 0, SEEK_SET) < 0)
+				break;
+		}
+		Report("legacy SetValue (OUT)", start, iterations);
+
+		start = Now();
+		for (unsigned int i = 0; i < iterations; ++i)
+		{
+			close(fd);
+			fd = open(value.c_str(), O_RDONLY);
+			if (fd < 0 || read(fd, &ch, 1) != 1)
+				break;
+			close(fd);
+			fd = open(value.c_str(), O_WRONLY);
+		}
+		Report("legacy GetValue (OUT)", start, iterations);
+
+		if (fd >= 0)
+			close(fd);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string spec = "sysfs";
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	int pin = -1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 7, "--gpio=") == 0)
+			spec = arg.substr(7);
+		else if (arg.compare(0, 13, "--iterations=") == 0)
+			iterations = atoi(arg.substr(13).c_str());
+		else
+			pin = atoi(argv[i]);
+	}
+	if (pin < 0 || iterations == 0)
+	{
+		cerr << "Usage: " << argv[0] << " [--gpio=<backend>] [--iterations=N] <pin>" << endl;
+		return 1;
+	}
+
+	GPIOBackend *backend = GPIOBackend::Create(spec);
+	if (!backend)
+	{
+		cerr << "gpiobench - Unknown GPIO backend: " << spec << endl;
+		return 1;
+	}
+
+	cout << "Backend: " << backend->GetName() << ", pin " << pin << ", " << iterations << " iterations" << endl;
+
+	try
+	{
+		GPIO gpio(pin, *backend);
+		if (!gpio.Open())
+		{
+			delete backend;
+			return 1;
+		}
+
+		volatile unsigned int sink = 0;
+		double start;
+
+		gpio.SetDirection(GPIO::IN);
+		start = Now();
+		for (unsigned int i = 0; i < iterations; ++i)
+			sink = gpio.GetValue();
+		Report("GetValue (IN)", start, iterations);
+
+		gpio.SetDirection(GPIO::OUT, 0);
+		start = Now();
+		for (unsigned int i = 0; i < iterations; ++i)
+			gpio.SetValue(i & 1);
+		Report("SetValue (OUT)", start, iterations);
+
+		start = Now();
+		for (unsigned int i = 0; i < iterations; ++i)
+			sink = gpio.GetValue();
+		Report("GetValue (OUT, shadowed)", start, iterations);
+		(void)sink;
+
+		gpio.SetValue(0);
+		gpio.Close();
+
+		if (spec == "sysfs" || spec.compare(0, 6, "sysfs:") == 0)
+			BenchmarkLegacy(spec.length() > 6 ? spec.substr(6) : SYSFS_GPIO_DIR, pin, iterations);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+		delete backend;
+		return 1;
+	}
+
+	delete backend;
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOCapture.h"
+
+#include <boost/bind.hpp>
+#include <errno.h>       // for errno
+#include <iostream>      // for cerr
+#include <string.h>      // for strerror()
+#include <sys/epoll.h>   // for epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/eventfd.h> // for eventfd()
+#include <unistd.h>      // for read(), write(), close()
+
+#define EDGE_BATCH 16
+
+#ifndef INVALID_SOCKET
+	#define INVALID_SOCKET -1
+#endif
+
+using namespace std;
+
+GPIOCapture::GPIOCapture() : m_epoll_fd(INVALID_SOCKET), m_wakeup_fd(INVALID_SOCKET), m_bRunning(false), m_overflows(0)
+{
+}
+
+bool GPIOCapture::Add(GPIO &gpio)
+{
+	if (IsRunning())
+		return false;
+
+	uint32_t events;
+	if (gpio.GetEventFd(events) < 0)
+	{
+		cerr << "GPIOCapture::Add - Pin " << gpio.Describe() << " can't be captured (not an input with an edge?)" << endl;
+		return false;
+	}
+	m_pins.push_back(&gpio);
+	return true;
+}
+
+bool GPIOCapture::Start()
+{
+	if (IsRunning())
+		return true;
+
+	m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	bool success = m_epoll_fd >= 0 && m_wakeup_fd >= 0;
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	if (success)
+	{
+		event.events = EPOLLIN;
+		event.data.u32 = m_pins.size(); // One past the pins
+		success = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &event) == 0;
+	}
+
+	for (unsigned int i = 0; success && i < m_pins.size(); i++)
+	{
+		try
+		{
+			// Start from a clean slate
+			m_pins[i]->AcknowledgeEdge();
+		}
+		catch (const GPIO::Exception &e)
+		{
+			cerr << e.what() << endl;
+			success = false;
+			break;
+		}
+		uint32_t events;
+		int fd = m_pins[i]->GetEventFd(events);
+		event.events = events;
+		event.data.u32 = i;
+		success = fd >= 0 && epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+	}
+
+	if (!success)
+	{
+		cerr << "GPIOCapture::Start - " << strerror(errno) << endl;
+		Stop();
+		return false;
+	}
+
+	m_bRunning = true;
+	boost::thread temp(boost::bind(&GPIOCapture::Run, this));
+	m_thread.swap(temp);
+	return true;
+}
+
+void GPIOCapture::Stop() throw()
+{
+	m_bRunning = false;
+	if (m_wakeup_fd >= 0)
+	{
+		uint64_t one = 1;
+		ssize_t ret = write(m_wakeup_fd, &one, sizeof(one));
+		(void)ret;
+	}
+	m_thread.join();
+
+	if (m_wakeup_fd >= 0)
+	{
+		close(m_wakeup_fd);
+		m_wakeup_fd = INVALID_SOCKET;
+	}
+	if (m_epoll_fd >= 0)
+	{
+		close(m_epoll_fd);
+		m_epoll_fd = INVALID_SOCKET;
+	}
+}
+
+void GPIOCapture::Run()
+{
+	struct epoll_event ready[EDGE_BATCH];
+	GPIO::EdgeEvent edges[EDGE_BATCH];
+
+	while (m_bRunning)
+	{
+		int count = epoll_wait(m_epoll_fd, ready, EDGE_BATCH, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			cerr << "GPIOCapture::Run - " << strerror(errno) << endl;
+			break;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			if (ready[i].data.u32 >= m_pins.size())
+				continue; // Woken by Stop()
+
+			GPIO &gpio = *m_pins[ready[i].data.u32];
+			try
+			{
+				// A full batch means there may be more queued
+				unsigned int n;
+				do
+				{
+					n = gpio.ReadEdges(edges, EDGE_BATCH);
+					for (unsigned int j = 0; j < n; j++)
+					{
+						if (!m_ring.Push(edges[j]))
+							m_overflows++;
+					}
+				} while (n == EDGE_BATCH);
+			}
+			catch (const GPIO::Exception &e)
+			{
+				cerr << e.what() << endl;
+			}
+		}
+	}
+}
@@ -0,0 +1,611 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOChardev.h"
+
+#include <errno.h>     // for errno
+#include <fcntl.h>     // for open()
+#include <iostream>    // for cerr
+#include <linux/gpio.h>
+#include <poll.h>      // for poll()
+#include <sys/epoll.h> // for EPOLLIN
+#include <stdio.h>     // for snprintf()
+#include <string.h>    // for strerror()
+#include <sys/ioctl.h> // for ioctl()
+#include <time.h>      // for clock_gettime()
+#include <unistd.h>    // for I/O functions
+
+#define CONSUMER_LABEL "avr_controller"
+#define CHARDEV_EVENT_BATCH 16 // GPIO event queue length in the kernel
+#define GROUP_READ_PASSES   4  // See GPIOLineSet
+
+#ifndef INVALID_SOCKET
+	#define INVALID_SOCKET -1
+#endif
+
+GPIOLine *GPIOChardev::CreateLine(unsigned int gpio)
+{
+	return new GPIOChardevLine(gpio, m_dir);
+}
+
+GPIOLineGroup *GPIOChardev::CreateGroup(const std::vector<unsigned int> &gpios)
+{
+	return new GPIOChardevGroup(gpios, m_dir);
+}
+
+GPIOChardevLine::GPIOChardevLine(unsigned int gpio, const std::string &dir)
+	: GPIOLine(gpio), m_offset(gpio % CHARDEV_CHIP_SIZE), m_chip_fd(INVALID_SOCKET), m_line_fd(INVALID_SOCKET), m_shadow(-1)
+{
+	char chip[24];
+	snprintf(chip, sizeof(chip), "/gpiochip%d", gpio / CHARDEV_CHIP_SIZE);
+	m_chip_path = dir + chip;
+}
+
+bool GPIOChardevLine::Open()
+{
+	if (IsOpen())
+		return true;
+
+	m_chip_fd = open(m_chip_path.c_str(), O_RDWR | O_CLOEXEC);
+	if (m_chip_fd < 0)
+	{
+		std::cerr << "GPIO::Open - Pin " << m_gpio << ": " << m_chip_path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	try
+	{
+		gpioline_info info;
+		memset(&info, 0, sizeof(info));
+		info.line_offset = m_offset;
+		if (ioctl(m_chip_fd, GPIO_GET_LINEINFO_IOCTL, &info) < 0)
+			throw GPIO::Exception(m_gpio, "GPIO::Open", strerror(errno));
+
+		m_dir = (info.flags & GPIOLINE_FLAG_IS_OUT) ? GPIO::OUT : GPIO::IN;
+		m_edge = GPIO::NONE;
+
+		// Outputs are requested on first use, see the class description
+		if (m_dir == GPIO::IN)
+			Request(0);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void GPIOChardevLine::Close() throw()
+{
+	Release();
+	if (m_chip_fd >= 0)
+	{
+		close(m_chip_fd);
+		m_chip_fd = INVALID_SOCKET;
+	}
+}
+
+void GPIOChardevLine::Release() throw()
+{
+	if (m_line_fd >= 0)
+	{
+		close(m_line_fd);
+		m_line_fd = INVALID_SOCKET;
+	}
+	m_shadow = -1;
+}
+
+void GPIOChardevLine::Request(unsigned int initial_value)
+{
+	Release();
+
+	if (m_dir == GPIO::IN && m_edge != GPIO::NONE)
+	{
+		gpioevent_request req;
+		memset(&req, 0, sizeof(req));
+		req.lineoffset = m_offset;
+		req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+		switch (m_edge)
+		{
+		case GPIO::RISING:
+			req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+			break;
+		case GPIO::FALLING:
+			req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+			break;
+		default:
+			req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+			break;
+		}
+		strncpy(req.consumer_label, CONSUMER_LABEL, sizeof(req.consumer_label) - 1);
+		if (ioctl(m_chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0)
+			throw GPIO::Exception(m_gpio, "GPIO::Request", strerror(errno));
+		m_line_fd = req.fd;
+	}
+	else
+	{
+		gpiohandle_request req;
+		memset(&req, 0, sizeof(req));
+		req.lineoffsets[0] = m_offset;
+		req.lines = 1;
+		req.flags = (m_dir == GPIO::OUT ? GPIOHANDLE_REQUEST_OUTPUT : GPIOHANDLE_REQUEST_INPUT);
+		req.default_values[0] = initial_value ? 1 : 0;
+		strncpy(req.consumer_label, CONSUMER_LABEL, sizeof(req.consumer_label) - 1);
+		if (ioctl(m_chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+			throw GPIO::Exception(m_gpio, "GPIO::Request", strerror(errno));
+		m_line_fd = req.fd;
+		if (m_dir == GPIO::OUT)
+			m_shadow = initial_value ? 1 : 0;
+	}
+}
+
+void GPIOChardevLine::SetDirection(GPIO::Direction dir, unsigned int initial_value)
+{
+	// If the pin is already set to this direction, there's no effect
+	if (m_dir == dir)
+		return;
+
+	m_dir = dir;
+	Request(initial_value);
+}
+
+void GPIOChardevLine::SetEdge(GPIO::Edge edge)
+{
+	// If the edge for this pin is already set to this edge, there's no effect
+	if (m_edge == edge)
+		return;
+
+	m_edge = edge;
+	if (m_dir == GPIO::IN)
+		Request(0);
+}
+
+unsigned int GPIOChardevLine::GetValue()
+{
+	if (m_line_fd < 0)
+		Request(0);
+
+	// Outputs read back what we last drove them to
+	if (m_dir == GPIO::OUT && m_shadow >= 0)
+		return m_shadow;
+
+	gpiohandle_data data;
+	memset(&data, 0, sizeof(data));
+	if (ioctl(m_line_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::GetValue", strerror(errno));
+	return data.values[0] ? 1 : 0;
+}
+
+void GPIOChardevLine::SetValue(unsigned int value)
+{
+	// No effect if direction is IN
+	if (m_dir == GPIO::IN)
+		return;
+
+	// The first write requests the line with the value already set
+	if (m_line_fd < 0)
+	{
+		Request(value);
+		return;
+	}
+
+	gpiohandle_data data;
+	memset(&data, 0, sizeof(data));
+	data.values[0] = value ? 1 : 0;
+	m_shadow = -1;
+	if (ioctl(m_line_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::SetValue", strerror(errno));
+	m_shadow = data.values[0];
+}
+
+bool GPIOChardevLine::WaitForEdge(long timeout)
+{
+	if (m_dir != GPIO::IN || m_edge == GPIO::NONE || m_line_fd < 0)
+		return false;
+
+	struct pollfd fd_event;
+	fd_event.fd = m_line_fd;
+	fd_event.events = POLLIN;
+	fd_event.revents = 0;
+
+	// Round the timeout up to the next millisecond, see GPIOSysfsLine
+	int ret = poll(&fd_event, 1, (int)(timeout - 1) / 1000 + 1);
+	if (ret < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::Poll", strerror(errno));
+	if (ret == 0)
+		return false;
+	if (!(fd_event.revents & POLLIN))
+		throw GPIO::Exception(m_gpio, "GPIO::Poll", "poll() was interrupted by an error");
+
+	// Drain every queued event; the caller only cares that one happened
+	do
+	{
+		gpioevent_data event;
+		if (read(m_line_fd, &event, sizeof(event)) != sizeof(event))
+			throw GPIO::Exception(m_gpio, "GPIO::Poll", strerror(errno));
+	}
+	while (poll(&fd_event, 1, 0) > 0 && (fd_event.revents & POLLIN));
+
+	return true;
+}
+
+int GPIOChardevLine::GetEventFd(uint32_t &events) const
+{
+	events = EPOLLIN;
+	return (m_dir == GPIO::IN && m_edge != GPIO::NONE) ? m_line_fd : -1;
+}
+
+int GPIOChardevLine::AcknowledgeEdge()
+{
+	if (m_dir != GPIO::IN || m_edge == GPIO::NONE || m_line_fd < 0)
+		return -1;
+
+	// Drain the queue and report the level after the last edge
+	int value = -1;
+	struct pollfd fd_event;
+	fd_event.fd = m_line_fd;
+	fd_event.events = POLLIN;
+	while (poll(&fd_event, 1, 0) > 0 && (fd_event.revents & POLLIN))
+	{
+		gpioevent_data event;
+		if (read(m_line_fd, &event, sizeof(event)) != sizeof(event))
+			throw GPIO::Exception(m_gpio, "GPIO::AcknowledgeEdge", strerror(errno));
+		value = (event.id == GPIOEVENT_EVENT_RISING_EDGE) ? 1 : 0;
+	}
+	return value;
+}
+
+unsigned int GPIOChardevLine::ReadEdges(GPIO::EdgeEvent *events, unsigned int count)
+{
+	if (m_dir != GPIO::IN || m_edge == GPIO::NONE || m_line_fd < 0)
+		return 0;
+
+	struct pollfd fd_event;
+	fd_event.fd = m_line_fd;
+	fd_event.events = POLLIN;
+	if (poll(&fd_event, 1, 0) <= 0 || !(fd_event.revents & POLLIN))
+		return 0;
+
+	// One read() returns as many queued events as fit, up to the kernel's 16
+	gpioevent_data data[CHARDEV_EVENT_BATCH];
+	if (count > CHARDEV_EVENT_BATCH)
+		count = CHARDEV_EVENT_BATCH;
+	ssize_t bytes = read(m_line_fd, data, count * sizeof(gpioevent_data));
+	if (bytes < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::ReadEdges", strerror(errno));
+
+	// Kernels before 5.7 stamp events with CLOCK_REALTIME, later ones
+	// with CLOCK_MONOTONIC. Move realtime stamps onto the monotonic clock.
+	struct timespec real;
+	clock_gettime(CLOCK_REALTIME, &real);
+	uint64_t monotonic = Now();
+	uint64_t realtime = static_cast<uint64_t>(real.tv_sec) * 1000000000ULL + real.tv_nsec;
+
+	unsigned int n = bytes / sizeof(gpioevent_data);
+	for (unsigned int i = 0; i < n; i++)
+	{
+		uint64_t timestamp = data[i].timestamp;
+		if (timestamp > monotonic + 1000000000ULL * 60 * 60 * 24 * 365)
+			timestamp -= realtime - monotonic;
+		events[i].timestamp = timestamp;
+		events[i].gpio = m_gpio;
+		events[i].value = (data[i].id == GPIOEVENT_EVENT_RISING_EDGE) ? 1 : 0;
+	}
+	return n;
+}
+
+GPIOChardevGroup::GPIOChardevGroup(const std::vector<unsigned int> &gpios, const std::string &dir)
+	: GPIOLineGroup(gpios), m_dir_path(dir), m_shadow(0), m_bShadow(false)
+{
+}
+
+bool GPIOChardevGroup::Open()
+{
+	if (IsOpen())
+		return true;
+
+	// Sort the pins by chip
+	for (unsigned int i = 0; i < m_gpios.size(); i++)
+	{
+		char chip[24];
+		snprintf(chip, sizeof(chip), "/gpiochip%d", m_gpios[i] / CHARDEV_CHIP_SIZE);
+		std::string path = m_dir_path + chip;
+
+		std::vector<Chip>::iterator it = m_chips.begin();
+		while (it != m_chips.end() && it->path != path)
+			++it;
+		if (it == m_chips.end())
+		{
+			Chip c;
+			c.path = path;
+			c.fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+			if (c.fd < 0)
+			{
+				std::cerr << "GPIO::Open - Pin " << m_gpios[i] << ": " << path << ": " << strerror(errno) << std::endl;
+				Close();
+				return false;
+			}
+			m_chips.push_back(c);
+			it = m_chips.end() - 1;
+		}
+		it->pins.push_back(i);
+	}
+
+	try
+	{
+		// The group is an output only if every pin already is
+		m_dir = GPIO::OUT;
+		for (std::vector<Chip>::iterator chip = m_chips.begin(); chip != m_chips.end(); ++chip)
+		{
+			for (std::vector<unsigned int>::iterator pin = chip->pins.begin(); pin != chip->pins.end(); ++pin)
+			{
+				gpioline_info info;
+				memset(&info, 0, sizeof(info));
+				info.line_offset = m_gpios[*pin] % CHARDEV_CHIP_SIZE;
+				if (ioctl(chip->fd, GPIO_GET_LINEINFO_IOCTL, &info) < 0)
+					throw GPIO::Exception(m_gpios[*pin], "GPIO::Open", strerror(errno));
+				if (!(info.flags & GPIOLINE_FLAG_IS_OUT))
+					m_dir = GPIO::IN;
+			}
+		}
+		m_edge = GPIO::NONE;
+
+		// Outputs are requested on first use, like GPIOChardevLine
+		if (m_dir == GPIO::IN)
+			Request(0);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void GPIOChardevGroup::Close() throw()
+{
+	Release();
+	for (std::vector<Chip>::iterator it = m_chips.begin(); it != m_chips.end(); ++it)
+		close(it->fd);
+	m_chips.clear();
+}
+
+void GPIOChardevGroup::Release() throw()
+{
+	for (std::vector<Handle>::iterator it = m_handles.begin(); it != m_handles.end(); ++it)
+		close(it->fd);
+	m_handles.clear();
+	m_bShadow = false;
+}
+
+void GPIOChardevGroup::Request(uint32_t initial_values)
+{
+	Release();
+
+	for (std::vector<Chip>::iterator chip = m_chips.begin(); chip != m_chips.end(); ++chip)
+	{
+		if (m_dir == GPIO::IN && m_edge != GPIO::NONE)
+		{
+			// One event request per pin
+			for (std::vector<unsigned int>::iterator pin = chip->pins.begin(); pin != chip->pins.end(); ++pin)
+			{
+				gpioevent_request req;
+				memset(&req, 0, sizeof(req));
+				req.lineoffset = m_gpios[*pin] % CHARDEV_CHIP_SIZE;
+				req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+				req.eventflags = (m_edge == GPIO::RISING ? GPIOEVENT_REQUEST_RISING_EDGE :
+				                  m_edge == GPIO::FALLING ? GPIOEVENT_REQUEST_FALLING_EDGE :
+				                                            GPIOEVENT_REQUEST_BOTH_EDGES);
+				strncpy(req.consumer_label, CONSUMER_LABEL, sizeof(req.consumer_label) - 1);
+				if (ioctl(chip->fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0)
+				{
+					int error = errno;
+					Release();
+					throw GPIO::Exception(m_gpios[*pin], "GPIO::Request", strerror(error));
+				}
+				Handle handle;
+				handle.fd = req.fd;
+				handle.pins.push_back(*pin);
+				handle.events = true;
+				m_handles.push_back(handle);
+			}
+		}
+		else
+		{
+			// Every pin on the chip in one request
+			gpiohandle_request req;
+			memset(&req, 0, sizeof(req));
+			req.lines = chip->pins.size();
+			for (unsigned int i = 0; i < chip->pins.size(); i++)
+			{
+				req.lineoffsets[i] = m_gpios[chip->pins[i]] % CHARDEV_CHIP_SIZE;
+				req.default_values[i] = (initial_values >> chip->pins[i]) & 1;
+			}
+			req.flags = (m_dir == GPIO::OUT ? GPIOHANDLE_REQUEST_OUTPUT : GPIOHANDLE_REQUEST_INPUT);
+			strncpy(req.consumer_label, CONSUMER_LABEL, sizeof(req.consumer_label) - 1);
+			if (ioctl(chip->fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+			{
+				int error = errno;
+				Release();
+				throw GPIO::Exception(m_gpios[chip->pins[0]], "GPIO::Request", strerror(error));
+			}
+			Handle handle;
+			handle.fd = req.fd;
+			handle.pins = chip->pins;
+			handle.events = false;
+			m_handles.push_back(handle);
+		}
+	}
+
+	if (m_dir == GPIO::OUT)
+	{
+		m_shadow = initial_values;
+		m_bShadow = true;
+	}
+}
+
+void GPIOChardevGroup::SetDirection(GPIO::Direction dir, uint32_t initial_values)
+{
+	if (m_dir == dir)
+		return;
+
+	m_dir = dir;
+	Request(initial_values);
+}
+
+void GPIOChardevGroup::SetEdge(GPIO::Edge edge)
+{
+	if (m_edge == edge)
+		return;
+
+	m_edge = edge;
+	if (m_dir == GPIO::IN)
+		Request(0);
+}
+
+uint32_t GPIOChardevGroup::ReadHandles()
+{
+	uint32_t values = 0;
+	for (std::vector<Handle>::iterator it = m_handles.begin(); it != m_handles.end(); ++it)
+	{
+		gpiohandle_data data;
+		memset(&data, 0, sizeof(data));
+		if (ioctl(it->fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+			throw GPIO::Exception(m_gpios[it->pins[0]], "GPIO::GetValues", strerror(errno));
+		for (unsigned int i = 0; i < it->pins.size(); i++)
+			values |= (data.values[i] ? 1U : 0U) << it->pins[i];
+	}
+	return values;
+}
+
+uint32_t GPIOChardevGroup::GetValues()
+{
+	if (m_handles.empty())
+		Request(0);
+
+	// Outputs read back what we last drove them to
+	if (m_dir == GPIO::OUT && m_bShadow)
+		return m_shadow;
+
+	uint32_t values = ReadHandles();
+	if (IsAtomic())
+		return values;
+
+	for (unsigned int pass = 1; pass < GROUP_READ_PASSES; pass++)
+	{
+		uint32_t again = ReadHandles();
+		if (again == values)
+			break;
+		values = again;
+	}
+	return values;
+}
+
+void GPIOChardevGroup::SetValues(uint32_t values)
+{
+	if (m_dir == GPIO::IN)
+		return;
+
+	// The first write requests the pins with the values already set
+	if (m_handles.empty())
+	{
+		Request(values);
+		return;
+	}
+
+	m_bShadow = false;
+	for (std::vector<Handle>::iterator it = m_handles.begin(); it != m_handles.end(); ++it)
+	{
+		gpiohandle_data data;
+		memset(&data, 0, sizeof(data));
+		for (unsigned int i = 0; i < it->pins.size(); i++)
+			data.values[i] = (values >> it->pins[i]) & 1;
+		if (ioctl(it->fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0)
+			throw GPIO::Exception(m_gpios[it->pins[0]], "GPIO::SetValues", strerror(errno));
+	}
+	m_shadow = values;
+	m_bShadow = true;
+}
+
+bool GPIOChardevGroup::WaitForEdge(long timeout)
+{
+	std::vector<struct pollfd> fds;
+	for (std::vector<Handle>::iterator it = m_handles.begin(); it != m_handles.end(); ++it)
+	{
+		if (!it->events)
+			continue;
+		struct pollfd pfd;
+		pfd.fd = it->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		fds.push_back(pfd);
+	}
+	if (fds.empty())
+		return false;
+
+	// Round the timeout up to the next millisecond, see GPIOSysfsLine
+	int ret = poll(&fds[0], fds.size(), (int)(timeout - 1) / 1000 + 1);
+	if (ret < 0)
+		throw GPIO::Exception(m_gpios[0], "GPIO::Poll", strerror(errno));
+	if (ret == 0)
+		return false;
+
+	// Drain every queued event; the caller only cares that one happened
+	AcknowledgeEdges();
+	return true;
+}
+
+void GPIOChardevGroup::GetEventFds(std::vector<int> &fds, uint32_t &events) const
+{
+	fds.clear();
+	events = EPOLLIN;
+	for (std::vector<Handle>::const_iterator it = m_handles.begin(); it != m_handles.end(); ++it)
+	{
+		if (it->events)
+			fds.push_back(it->fd);
+	}
+}
+
+bool GPIOChardevGroup::AcknowledgeEdges()
+{
+	bool edge = false;
+	for (std::vector<Handle>::iterator it = m_handles.begin(); it != m_handles.end(); ++it)
+	{
+		if (!it->events)
+			continue;
+
+		struct pollfd fd_event;
+		fd_event.fd = it->fd;
+		fd_event.events = POLLIN;
+		while (poll(&fd_event, 1, 0) > 0 && (fd_event.revents & POLLIN))
+		{
+			gpioevent_data event;
+			if (read(it->fd, &event, sizeof(event)) != sizeof(event))
+				throw GPIO::Exception(m_gpios[it->pins[0]], "GPIO::AcknowledgeEdges", strerror(errno));
+			edge = true;
+		}
+	}
+	return edge;
+}
@@ -0,0 +1,166 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIOBackend.h"
+
+#include <string>
+#include <vector>
+
+#define CHARDEV_GPIO_DIR  "/dev"
+#define CHARDEV_CHIP_SIZE 32 // OMAP GPIO banks are 32 lines wide
+
+/**
+ * The GPIO character device interface (/dev/gpiochipN, Linux 4.8+). Values
+ * are read and written with a single ioctl on a line handle instead of
+ * formatting and parsing strings through the sysfs, and edges arrive as
+ * events on the handle.
+ *
+ * Pins keep their sysfs numbering: pin N is line N % CHARDEV_CHIP_SIZE of
+ * gpiochip(N / CHARDEV_CHIP_SIZE), which matches the DM3730's six 32-line
+ * banks.
+ *
+ * Unlike the sysfs, the kernel does not remember a line's edge or output
+ * value once its handle is released. Open() therefore reports an edge of
+ * NONE, and an output line is only requested on the first SetValue() (or
+ * GetValue(), which drives it low) so that opening it doesn't glitch it.
+ */
+class GPIOChardev : public GPIOBackend
+{
+public:
+	GPIOChardev(const std::string &dir = CHARDEV_GPIO_DIR) : m_dir(dir) { }
+	virtual ~GPIOChardev() { }
+
+	virtual GPIOLine *CreateLine(unsigned int gpio);
+	virtual GPIOLineGroup *CreateGroup(const std::vector<unsigned int> &gpios);
+	virtual const char *GetName() const { return "chardev"; }
+
+private:
+	std::string m_dir;
+};
+
+class GPIOChardevLine : public GPIOLine
+{
+public:
+	GPIOChardevLine(unsigned int gpio, const std::string &dir);
+	virtual ~GPIOChardevLine() { Close(); }
+
+	virtual bool Open();
+	virtual bool IsOpen() const { return m_chip_fd >= 0; }
+	virtual void Close() throw();
+
+	virtual void SetDirection(GPIO::Direction dir, unsigned int initial_value);
+	virtual void SetEdge(GPIO::Edge edge);
+
+	virtual unsigned int GetValue();
+	virtual void SetValue(unsigned int value);
+
+	virtual bool WaitForEdge(long timeout);
+
+	virtual int GetEventFd(uint32_t &events) const;
+	virtual int AcknowledgeEdge();
+	virtual unsigned int ReadEdges(GPIO::EdgeEvent *events, unsigned int count);
+
+private:
+	/*!
+	 * (Re-)request the line from the chip with the current direction and
+	 * edge. Input lines with an edge get an event handle, everything else a
+	 * plain line handle.
+	 *
+	 * \param initial_value Value driven from the start if the line is an output
+	 * \throw GPIO::Exception
+	 */
+	void Request(unsigned int initial_value);
+
+	void Release() throw();
+
+	// Path of the chip device, e.g. /dev/gpiochip4
+	std::string  m_chip_path;
+	// Offset of the line within the chip
+	unsigned int m_offset;
+	// File descriptor of the chip
+	int          m_chip_fd;
+	// File descriptor of the line (or event) handle
+	int          m_line_fd;
+	// Last value driven while the direction is OUT, or -1 if unknown
+	int          m_shadow;
+};
+
+/**
+ * Pins are requested together, one request per chip, so pins on the same
+ * chip are read and written with a single ioctl. The v1 uAPI can only
+ * deliver edges for lines requested one at a time, so while an edge is set
+ * every pin has its own event request and reads go pin by pin (until two
+ * passes agree, like GPIOLineSet).
+ */
+class GPIOChardevGroup : public GPIOLineGroup
+{
+public:
+	GPIOChardevGroup(const std::vector<unsigned int> &gpios, const std::string &dir);
+	virtual ~GPIOChardevGroup() { Close(); }
+
+	virtual bool Open();
+	virtual bool IsOpen() const { return !m_chips.empty(); }
+	virtual void Close() throw();
+
+	virtual void SetDirection(GPIO::Direction dir, uint32_t initial_values);
+	virtual void SetEdge(GPIO::Edge edge);
+
+	virtual uint32_t GetValues();
+	virtual void SetValues(uint32_t values);
+	virtual bool IsAtomic() const { return m_handles.size() == 1; }
+
+	virtual bool WaitForEdge(long timeout);
+
+	virtual void GetEventFds(std::vector<int> &fds, uint32_t &events) const;
+	virtual bool AcknowledgeEdges();
+
+private:
+	struct Chip
+	{
+		std::string               path;
+		int                       fd;
+		std::vector<unsigned int> pins;    // Indices into m_gpios
+	};
+
+	struct Handle
+	{
+		int                       fd;
+		std::vector<unsigned int> pins;    // Indices into m_gpios, in request order
+		bool                      events;  // An event request (one pin)
+	};
+
+	/**
+	 * (Re-)request the pins with the current direction and edge, see
+	 * GPIOChardevLine::Request().
+	 */
+	void Request(uint32_t initial_values);
+	void Release() throw();
+	uint32_t ReadHandles();
+
+	std::string         m_dir_path;
+	std::vector<Chip>   m_chips;
+	std::vector<Handle> m_handles;
+	// Last values driven while the direction is OUT, valid if m_bShadow
+	uint32_t            m_shadow;
+	bool                m_bShadow;
+};
@@ -0,0 +1,471 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOEventLoop.h"
+
+#include <errno.h>       // for errno
+#include <iostream>      // for cerr
+#include <string.h>      // for strerror()
+#include <sys/epoll.h>   // for epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/eventfd.h> // for eventfd()
+#include <sys/timerfd.h> // for timerfd_create(), timerfd_settime()
+#include <unistd.h>      // for read(), write(), close()
+
+#define MAX_EVENTS 16
+
+#ifndef INVALID_SOCKET
+	#define INVALID_SOCKET -1
+#endif
+
+using namespace std;
+
+namespace
+{
+	// epoll_event.data.u64 holds the kind in the high word and the ID in the low word
+	inline uint64_t Pack(int kind, int id) { return (static_cast<uint64_t>(kind) << 32) | static_cast<uint32_t>(id); }
+	inline int UnpackKind(uint64_t data) { return static_cast<int>(data >> 32); }
+	inline int UnpackID(uint64_t data) { return static_cast<int>(data & 0xFFFFFFFF); }
+}
+
+const GPIOEventLoop::TimerID GPIOEventLoop::INVALID_TIMER;
+
+GPIOEventLoop::GPIOEventLoop() : m_epoll_fd(INVALID_SOCKET), m_wakeup_fd(INVALID_SOCKET), m_bStop(false), m_nextID(0)
+{
+}
+
+bool GPIOEventLoop::Open()
+{
+	if (IsOpen())
+		return true;
+
+	m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_epoll_fd < 0 || m_wakeup_fd < 0 || !Watch(m_wakeup_fd, EPOLLIN, WAKEUP, 0))
+	{
+		cerr << "GPIOEventLoop::Open - " << strerror(errno) << endl;
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void GPIOEventLoop::Close() throw()
+{
+	for (map<int, Pin>::iterator it = m_pins.begin(); it != m_pins.end(); ++it)
+		ClosePin(it->second);
+	m_pins.clear();
+
+	for (map<int, Timer>::iterator it = m_timers.begin(); it != m_timers.end(); ++it)
+		close(it->second.fd);
+	m_timers.clear();
+
+	if (m_wakeup_fd >= 0)
+	{
+		close(m_wakeup_fd);
+		m_wakeup_fd = INVALID_SOCKET;
+	}
+	if (m_epoll_fd >= 0)
+	{
+		close(m_epoll_fd);
+		m_epoll_fd = INVALID_SOCKET;
+	}
+}
+
+bool GPIOEventLoop::Watch(int fd, uint32_t events, Kind kind, int id)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.u64 = Pack(kind, id);
+	return epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+int GPIOEventLoop::CreateTimerFd()
+{
+	return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+bool GPIOEventLoop::ArmTimerFd(int fd, unsigned long delay, unsigned long period)
+{
+	struct itimerspec spec;
+	// A zero it_value would disarm the timer
+	if (delay == 0)
+		delay = 1;
+	spec.it_value.tv_sec = delay / 1000000;
+	spec.it_value.tv_nsec = (delay % 1000000) * 1000;
+	spec.it_interval.tv_sec = period / 1000000;
+	spec.it_interval.tv_nsec = (period % 1000000) * 1000;
+	return timerfd_settime(fd, 0, &spec, NULL) == 0;
+}
+
+void GPIOEventLoop::ReadTimerFd(int fd)
+{
+	uint64_t expirations;
+	ssize_t ret = read(fd, &expirations, sizeof(expirations));
+	(void)ret;
+}
+
+void GPIOEventLoop::ClosePin(Pin &pin)
+{
+	// Closing an fd removes it from the epoll set; the pin's own fd isn't ours
+	if (pin.debounce_fd >= 0)
+		close(pin.debounce_fd);
+	if (pin.timeout_fd >= 0)
+		close(pin.timeout_fd);
+}
+
+uint32_t GPIOEventLoop::ReadValue(Pin &pin)
+{
+	return pin.group ? pin.group->GetValues() : pin.gpio->GetValue();
+}
+
+bool GPIOEventLoop::AddPin(GPIO &gpio, const EdgeHandler &onEdge, unsigned long debounce /* = 0 */,
+		unsigned long timeout /* = 0 */, const TimerHandler &onTimeout /* = TimerHandler() */)
+{
+	if (!IsOpen())
+		return false;
+
+	uint32_t events = 0;
+	int fd = gpio.GetEventFd(events);
+	if (fd < 0)
+	{
+		cerr << "GPIOEventLoop::AddPin - Pin " << gpio.Describe() << " can't be watched (not an input with an edge?)" << endl;
+		return false;
+	}
+
+	int id = m_nextID++;
+	Pin &pin = m_pins[id];
+	pin.gpio = &gpio;
+	pin.group = NULL;
+	pin.onEdge = onEdge;
+	pin.onTimeout = onTimeout;
+	pin.debounce = debounce;
+	pin.timeout = timeout;
+	pin.fds.push_back(fd);
+	return AddWatch(id, events);
+}
+
+bool GPIOEventLoop::AddGroup(GPIOGroup &group, const GroupHandler &onSettled, unsigned long settle)
+{
+	if (!IsOpen())
+		return false;
+
+	uint32_t events = 0;
+	vector<int> fds;
+	group.GetEventFds(fds, events);
+	if (fds.empty())
+	{
+		cerr << "GPIOEventLoop::AddGroup - Pin " << group.Describe(0) << " can't be watched (not an input with an edge?)" << endl;
+		return false;
+	}
+
+	int id = m_nextID++;
+	Pin &pin = m_pins[id];
+	pin.gpio = NULL;
+	pin.group = &group;
+	pin.onGroup = onSettled;
+	pin.debounce = settle;
+	pin.timeout = 0;
+	pin.fds = fds;
+	return AddWatch(id, events);
+}
+
+bool GPIOEventLoop::AddWatch(int id, uint32_t events)
+{
+	Pin &pin = m_pins[id];
+	pin.debounce_fd = INVALID_SOCKET;
+	pin.timeout_fd = INVALID_SOCKET;
+	pin.value = 0;
+
+	bool success = true;
+	try
+	{
+		// Clear anything pending from before we started watching
+		if (pin.group)
+			pin.group->AcknowledgeEdges();
+		else
+			pin.gpio->AcknowledgeEdge();
+		pin.value = ReadValue(pin);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+		success = false;
+	}
+
+	if (success && pin.debounce)
+	{
+		pin.debounce_fd = CreateTimerFd();
+		success = pin.debounce_fd >= 0 && Watch(pin.debounce_fd, EPOLLIN, PIN_DEBOUNCE, id);
+	}
+	if (success && pin.timeout)
+	{
+		pin.timeout_fd = CreateTimerFd();
+		success = pin.timeout_fd >= 0 && Watch(pin.timeout_fd, EPOLLIN, PIN_TIMEOUT, id) &&
+			ArmTimerFd(pin.timeout_fd, pin.timeout, pin.timeout);
+	}
+	for (vector<int>::const_iterator it = pin.fds.begin(); success && it != pin.fds.end(); ++it)
+		success = Watch(*it, events, PIN_EDGE, id);
+
+	if (!success)
+	{
+		cerr << "GPIOEventLoop::AddWatch - Pin " << (pin.group ? pin.group->Describe(0) : pin.gpio->Describe()) <<
+			": " << strerror(errno) << endl;
+		RemoveWatch(m_pins.find(id));
+	}
+	return success;
+}
+
+void GPIOEventLoop::RemovePin(GPIO &gpio)
+{
+	for (map<int, Pin>::iterator it = m_pins.begin(); it != m_pins.end(); ++it)
+	{
+		if (it->second.gpio == &gpio)
+		{
+			RemoveWatch(it);
+			break;
+		}
+	}
+}
+
+void GPIOEventLoop::RemoveGroup(GPIOGroup &group)
+{
+	for (map<int, Pin>::iterator it = m_pins.begin(); it != m_pins.end(); ++it)
+	{
+		if (it->second.group == &group)
+		{
+			RemoveWatch(it);
+			break;
+		}
+	}
+}
+
+void GPIOEventLoop::RemoveWatch(map<int, Pin>::iterator it)
+{
+	// The edge fds belong to the pin or group, so only unregister them
+	for (vector<int>::const_iterator fd = it->second.fds.begin(); fd != it->second.fds.end(); ++fd)
+		epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+	ClosePin(it->second);
+	m_pins.erase(it);
+}
+
+GPIOEventLoop::TimerID GPIOEventLoop::AddTimer(unsigned long delay, const TimerHandler &handler, bool periodic /* = false */)
+{
+	if (!IsOpen())
+		return INVALID_TIMER;
+
+	int fd = CreateTimerFd();
+	if (fd < 0)
+		return INVALID_TIMER;
+
+	int id = m_nextID++;
+	if (!Watch(fd, EPOLLIN, TIMER, id) || !ArmTimerFd(fd, delay, periodic ? delay : 0))
+	{
+		close(fd);
+		return INVALID_TIMER;
+	}
+
+	Timer &timer = m_timers[id];
+	timer.fd = fd;
+	timer.handler = handler;
+	timer.period = periodic ? delay : 0;
+	return id;
+}
+
+bool GPIOEventLoop::RestartTimer(TimerID id, unsigned long delay)
+{
+	map<int, Timer>::iterator it = m_timers.find(id);
+	if (it == m_timers.end())
+		return false;
+	return ArmTimerFd(it->second.fd, delay, it->second.period);
+}
+
+void GPIOEventLoop::CancelTimer(TimerID id)
+{
+	map<int, Timer>::iterator it = m_timers.find(id);
+	if (it != m_timers.end())
+	{
+		close(it->second.fd);
+		m_timers.erase(it);
+	}
+}
+
+void GPIOEventLoop::Run()
+{
+	struct epoll_event events[MAX_EVENTS];
+
+	while (!m_bStop && IsOpen())
+	{
+		int count = epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			cerr << "GPIOEventLoop::Run - " << strerror(errno) << endl;
+			break;
+		}
+
+		for (int i = 0; i < count && !m_bStop; ++i)
+		{
+			// Handlers may remove pins and timers; the dispatchers look the
+			// ID up again and skip stale events
+			int id = UnpackID(events[i].data.u64);
+			switch (UnpackKind(events[i].data.u64))
+			{
+			case WAKEUP:
+				break;
+			case PIN_EDGE:
+				OnEdge(id);
+				break;
+			case PIN_DEBOUNCE:
+				OnDebounce(id);
+				break;
+			case PIN_TIMEOUT:
+				OnTimeout(id);
+				break;
+			case TIMER:
+				OnTimer(id);
+				break;
+			}
+		}
+	}
+
+	// Consume the wakeup so the next Run() blocks again
+	if (m_wakeup_fd >= 0)
+	{
+		uint64_t count;
+		ssize_t ret = read(m_wakeup_fd, &count, sizeof(count));
+		(void)ret;
+	}
+	m_bStop = false;
+}
+
+void GPIOEventLoop::Stop()
+{
+	m_bStop = true;
+	if (m_wakeup_fd >= 0)
+	{
+		uint64_t one = 1;
+		ssize_t ret = write(m_wakeup_fd, &one, sizeof(one));
+		(void)ret;
+	}
+}
+
+void GPIOEventLoop::OnEdge(int id)
+{
+	map<int, Pin>::iterator it = m_pins.find(id);
+	if (it == m_pins.end())
+		return;
+	Pin &pin = it->second;
+
+	int value;
+	try
+	{
+		if (pin.group)
+			value = pin.group->AcknowledgeEdges() ? 0 : -1;
+		else
+			value = pin.gpio->AcknowledgeEdge();
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+		return;
+	}
+	if (value < 0)
+		return; // Spurious
+
+	// Any edge restarts the idle timeout
+	if (pin.timeout_fd >= 0)
+		ArmTimerFd(pin.timeout_fd, pin.timeout, pin.timeout);
+
+	if (pin.debounce_fd >= 0)
+	{
+		// Wait for the pin to settle; every edge pushes the deadline back
+		ArmTimerFd(pin.debounce_fd, pin.debounce, 0);
+	}
+	else if (pin.group)
+	{
+		OnDebounce(id);
+	}
+	else
+	{
+		pin.value = value;
+		if (pin.onEdge)
+			pin.onEdge(value);
+	}
+}
+
+void GPIOEventLoop::OnDebounce(int id)
+{
+	map<int, Pin>::iterator it = m_pins.find(id);
+	if (it == m_pins.end())
+		return;
+	Pin &pin = it->second;
+	if (pin.debounce_fd >= 0)
+		ReadTimerFd(pin.debounce_fd);
+
+	uint32_t value;
+	try
+	{
+		value = ReadValue(pin);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+		return;
+	}
+
+	// A glitch that settled back to where it was isn't reported
+	if (value != pin.value)
+	{
+		pin.value = value;
+		if (pin.group && pin.onGroup)
+			pin.onGroup(value);
+		else if (pin.gpio && pin.onEdge)
+			pin.onEdge(value);
+	}
+}
+
+void GPIOEventLoop::OnTimeout(int id)
+{
+	map<int, Pin>::iterator it = m_pins.find(id);
+	if (it == m_pins.end())
+		return;
+	ReadTimerFd(it->second.timeout_fd);
+	if (it->second.onTimeout)
+		it->second.onTimeout();
+}
+
+void GPIOEventLoop::OnTimer(int id)
+{
+	map<int, Timer>::iterator it = m_timers.find(id);
+	if (it == m_timers.end())
+		return;
+	ReadTimerFd(it->second.fd);
+
+	// Copy the handler; a one-shot timer is gone by the time it runs
+	TimerHandler handler = it->second.handler;
+	if (it->second.period == 0)
+		CancelTimer(id);
+	if (handler)
+		handler();
+}
@@ -1,35 +1,92 @@
-#include <stdlib.h> // for system()
-#include <unistd.h> // for setuid()
+#include <errno.h>    // for errno
+#include <fcntl.h>    // for open()
+#include <stdio.h>    // for snprintf()
+#include <stdlib.h>   // for strtoul()
+#include <string.h>   // for strlen()
+#include <sys/stat.h> // for chmod()
+#include <unistd.h>   // for setuid(), write()
 
 #include <iostream>
-#include <string>
+
+#define SYSFS_GPIO_DIR "/sys/class/gpio"
 
 using namespace std;
 
+namespace
+{
+	/*!
+	 * Make a file globally-writable, like chmod a+w.
+	 */
+	bool MakeWritable(const char *path)
+	{
+		struct stat st;
+		if (stat(path, &st) != 0)
+			return false;
+		return chmod(path, st.st_mode | S_IWUSR | S_IWGRP | S_IWOTH) == 0;
+	}
+
+	/*!
+	 * Export a pin, if it isn't already, and make its files writable.
+	 */
+	bool Export(unsigned long gpio)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), SYSFS_GPIO_DIR "/gpio%lu/value", gpio);
+		if (access(path, F_OK) != 0)
+		{
+			int fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
+			if (fd < 0)
+				return false;
+			char pin[16];
+			int len = snprintf(pin, sizeof(pin), "%lu", gpio);
+			// EBUSY means it was exported in the meantime
+			bool exported = write(fd, pin, len) == len || errno == EBUSY;
+			close(fd);
+			if (!exported)
+				return false;
+		}
+
+		bool ret = MakeWritable(path);
+		snprintf(path, sizeof(path), SYSFS_GPIO_DIR "/gpio%lu/direction", gpio);
+		ret &= MakeWritable(path);
+		snprintf(path, sizeof(path), SYSFS_GPIO_DIR "/gpio%lu/edge", gpio);
+		ret &= MakeWritable(path);
+		return ret;
+	}
+}
+
 /**
- * Export a GPIO pin and configure it as globally-writable. The owner and group
- * of this program must be root:
+ * Export GPIO pins and configure them as globally-writable. Everything is done
+ * with system calls; no shell is started, so exporting a batch of pins costs
+ * one exec. The owner and group of this program must be root:
  *
  * sudo chown root:root gpio_export
  * sudo chmod 4755 gpio_export
  */
 int main(int argc, char **argv)
 {
-	if (argc != 2)
+	if (argc < 2)
 	{
-		cout << "Incorrect usage: gpio_export pin" << endl;
+		cout << "Incorrect usage: gpio_export pin [pin...]" << endl;
 		return -1;
 	}
 
-	string pin(argv[1]);
 	bool ret = true;
 
 	ret &= 0 == setuid(0);
-	ret &= 0 == system("chmod a+w /sys/class/gpio/export");
-	ret &= 0 == system("chmod a+w /sys/class/gpio/unexport");
-	ret &= 0 == system(("echo " + pin + " > /sys/class/gpio/export").c_str());
-	ret &= 0 == system(("chmod a+w /sys/class/gpio/gpio" + pin + "/value "
-                                  "/sys/class/gpio/gpio" + pin + "/direction "
-                                  "/sys/class/gpio/gpio" + pin + "/edge").c_str());
+	ret &= MakeWritable(SYSFS_GPIO_DIR "/export");
+	ret &= MakeWritable(SYSFS_GPIO_DIR "/unexport");
+	for (int i = 1; i < argc; i++)
+	{
+		char *end;
+		unsigned long gpio = strtoul(argv[i], &end, 10);
+		if (end == argv[i] || *end != '\0')
+		{
+			cerr << "Invalid pin: " << argv[i] << endl;
+			ret = false;
+			continue;
+		}
+		ret &= Export(gpio);
+	}
 	return ret ? 0 : 1;
 }
@@ -0,0 +1,124 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOGroup.h"
+#include "GPIOBackend.h"
+
+GPIOGroup::GPIOGroup(const unsigned int *gpios, unsigned int count) : m_gpios(gpios, gpios + count)
+{
+	m_lines = GPIOBackend::GetDefault().CreateGroup(m_gpios);
+}
+
+GPIOGroup::GPIOGroup(const unsigned int *gpios, unsigned int count, GPIOBackend &backend) : m_gpios(gpios, gpios + count)
+{
+	m_lines = backend.CreateGroup(m_gpios);
+}
+
+GPIOGroup::~GPIOGroup() throw()
+{
+	Close();
+	delete m_lines;
+}
+
+bool GPIOGroup::Open()
+{
+	if (m_gpios.empty() || m_gpios.size() > 32)
+		return false;
+	return IsOpen() || m_lines->Open();
+}
+
+bool GPIOGroup::IsOpen() const
+{
+	return m_lines->IsOpen();
+}
+
+void GPIOGroup::Close() throw()
+{
+	m_lines->Close();
+}
+
+GPIO::Direction GPIOGroup::GetDirection() const
+{
+	return m_lines->GetDirection();
+}
+
+void GPIOGroup::SetDirection(GPIO::Direction dir, uint32_t initial_values /* = 0 */)
+{
+	if (!IsOpen())
+		throw GPIO::Exception(m_gpios[0], "GPIOGroup::SetDirection", "Group is not open");
+	m_lines->SetDirection(dir, initial_values);
+}
+
+GPIO::Edge GPIOGroup::GetEdge() const
+{
+	return m_lines->GetEdge();
+}
+
+void GPIOGroup::SetEdge(GPIO::Edge edge)
+{
+	if (!IsOpen())
+		throw GPIO::Exception(m_gpios[0], "GPIOGroup::SetEdge", "Group is not open");
+	m_lines->SetEdge(edge);
+}
+
+uint32_t GPIOGroup::GetValues()
+{
+	if (!IsOpen())
+		throw GPIO::Exception(m_gpios[0], "GPIOGroup::GetValues", "Group is not open");
+	return m_lines->GetValues();
+}
+
+void GPIOGroup::SetValues(uint32_t values)
+{
+	if (GetDirection() == GPIO::IN)
+		return;
+	if (!IsOpen())
+		throw GPIO::Exception(m_gpios[0], "GPIOGroup::SetValues", "Group is not open");
+	m_lines->SetValues(values);
+}
+
+bool GPIOGroup::IsAtomic() const
+{
+	return m_lines->IsAtomic();
+}
+
+bool GPIOGroup::Poll(unsigned long timeout)
+{
+	if (GetDirection() == GPIO::OUT || GetEdge() == GPIO::NONE || timeout == 0)
+		return false;
+	if (!IsOpen())
+		throw GPIO::Exception(m_gpios[0], "GPIOGroup::Poll", "Group is not open");
+	return m_lines->WaitForEdge(timeout);
+}
+
+void GPIOGroup::GetEventFds(std::vector<int> &fds, uint32_t &events) const
+{
+	fds.clear();
+	events = 0;
+	if (GetDirection() == GPIO::IN && GetEdge() != GPIO::NONE && IsOpen())
+		m_lines->GetEventFds(fds, events);
+}
+
+bool GPIOGroup::AcknowledgeEdges()
+{
+	return IsOpen() && m_lines->AcknowledgeEdges();
+}
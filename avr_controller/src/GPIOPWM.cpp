@@ -0,0 +1,444 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOPWM.h"
+#include "GPIOBackend.h" // for GPIOLine::Now()
+
+#include <boost/bind.hpp>
+#include <errno.h>    // for EINTR
+#include <iostream>   // for cerr
+#include <limits.h>   // for LONG_MAX
+#include <pthread.h>  // for pthread_setschedparam()
+#include <sched.h>    // for SCHED_FIFO
+#include <string.h>   // for strerror()
+#include <time.h>     // for clock_nanosleep()
+
+using namespace std;
+
+const GPIOPWM::ChannelID GPIOPWM::INVALID_CHANNEL;
+
+namespace
+{
+	void ClearStats(GPIOPWM::Stats &stats)
+	{
+		bool realtime = stats.realtime;
+		memset(&stats, 0, sizeof(stats));
+		stats.realtime = realtime;
+		stats.minLatency = LONG_MAX;
+	}
+
+	void SleepUntil(uint64_t deadline)
+	{
+		struct timespec t;
+		t.tv_sec = deadline / 1000000000ULL;
+		t.tv_nsec = deadline % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) { }
+	}
+}
+
+GPIOPWM::GPIOPWM() : m_bRunning(false), m_newTotal(0), m_totalLatency(0)
+{
+	for (unsigned int i = 0; i < GPIO_PWM_CHANNELS; i++)
+	{
+		m_used[i] = false;
+		m_queued[i] = 0;
+		m_finished[i] = 0;
+		m_channels[i].gpio = NULL;
+		m_channels[i].active = false;
+	}
+	m_stats.realtime = false;
+	ClearStats(m_stats);
+	m_newStats.realtime = false;
+	ClearStats(m_newStats);
+}
+
+bool GPIOPWM::Start(int priority /* = GPIO_PWM_PRIORITY */)
+{
+	if (m_bRunning)
+		return true;
+
+	m_bRunning = true;
+	boost::thread temp(boost::bind(&GPIOPWM::Run, this, priority));
+	m_thread.swap(temp);
+	return true;
+}
+
+void GPIOPWM::Stop() throw()
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_bRunning = false;
+		m_commandCond.notify_all();
+	}
+	m_thread.join();
+}
+
+GPIOPWM::ChannelID GPIOPWM::AddChannel(GPIO &gpio)
+{
+	if (!gpio.IsOpen() || gpio.GetDirection() != GPIO::OUT)
+		return INVALID_CHANNEL;
+
+	ChannelID id = INVALID_CHANNEL;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		for (unsigned int i = 0; i < GPIO_PWM_CHANNELS; i++)
+		{
+			if (!m_used[i])
+			{
+				m_used[i] = true;
+				id = i;
+				break;
+			}
+		}
+	}
+	if (id == INVALID_CHANNEL)
+		return INVALID_CHANNEL;
+
+	Command command;
+	command.type = Command::ADD;
+	command.id = id;
+	command.gpio = &gpio;
+	Queue(command);
+	return id;
+}
+
+void GPIOPWM::RemoveChannel(ChannelID id)
+{
+	Command command;
+	command.type = Command::REMOVE;
+	command.id = id;
+	if (Queue(command))
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_used[id] = false;
+	}
+}
+
+bool GPIOPWM::SetPWM(ChannelID id, unsigned long period, double duty_cycle)
+{
+	Command command;
+	command.type = Command::PWM;
+	command.id = id;
+	if (duty_cycle < 0)
+		duty_cycle = 0;
+	if (duty_cycle > 1)
+		duty_cycle = 1;
+	command.high = static_cast<uint64_t>(period * duty_cycle * 1000);
+	command.low = static_cast<uint64_t>(period) * 1000 - command.high;
+	command.count = 0;
+	return Queue(command);
+}
+
+bool GPIOPWM::SetPulses(ChannelID id, unsigned long duration, unsigned int count /* = 1 */)
+{
+	Command command;
+	command.type = Command::PULSES;
+	command.id = id;
+	command.high = static_cast<uint64_t>(duration) * 1000;
+	command.low = command.high;
+	command.count = count;
+	return Queue(command);
+}
+
+bool GPIOPWM::Halt(ChannelID id)
+{
+	Command command;
+	command.type = Command::HALT;
+	command.id = id;
+	return Queue(command);
+}
+
+bool GPIOPWM::IsBusy(ChannelID id) const
+{
+	if (id < 0 || id >= GPIO_PWM_CHANNELS)
+		return false;
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_finished[id] != m_queued[id];
+}
+
+bool GPIOPWM::Queue(const Command &command)
+{
+	if (command.id < 0 || command.id >= GPIO_PWM_CHANNELS)
+		return false;
+
+	boost::mutex::scoped_lock lock(m_mutex);
+	if (!m_used[command.id])
+		return false;
+	m_commands.push_back(command);
+	m_commands.back().generation = ++m_queued[command.id];
+	m_commandCond.notify_all();
+	return true;
+}
+
+GPIOPWM::Stats GPIOPWM::GetStats()
+{
+	boost::mutex::scoped_lock lock(m_statsMutex);
+	Stats stats = m_stats;
+	if (stats.edges == 0)
+		stats.minLatency = 0;
+	return stats;
+}
+
+void GPIOPWM::ResetStats()
+{
+	boost::mutex::scoped_lock lock(m_statsMutex);
+	ClearStats(m_stats);
+	m_totalLatency = 0;
+}
+
+void GPIOPWM::Run(int priority)
+{
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error)
+		cerr << "GPIOPWM::Run - Can't use SCHED_FIFO (" << strerror(error) << "), expect more jitter" << endl;
+	{
+		boost::mutex::scoped_lock lock(m_statsMutex);
+		m_stats.realtime = (error == 0);
+		m_newStats.realtime = (error == 0);
+	}
+
+	uint64_t now = GPIOLine::Now();
+	while (m_bRunning)
+	{
+		bool active = false;
+		for (unsigned int i = 0; i < GPIO_PWM_CHANNELS; i++)
+			active = active || m_channels[i].active;
+
+		ApplyCommands(now, !active);
+
+		// Sleep until the next edge, but wake up in time to take new commands
+		uint64_t deadline = GPIOLine::Now() + GPIO_PWM_LATENCY * 1000ULL;
+		bool edge = false;
+		for (unsigned int i = 0; i < GPIO_PWM_CHANNELS; i++)
+		{
+			if (m_channels[i].active && m_channels[i].next <= deadline)
+			{
+				deadline = m_channels[i].next;
+				edge = true;
+			}
+		}
+		SleepUntil(deadline);
+		now = GPIOLine::Now();
+		if (!edge)
+			continue;
+
+		for (unsigned int i = 0; i < GPIO_PWM_CHANNELS; i++)
+		{
+			Channel &channel = m_channels[i];
+			if (!channel.active || channel.next > now)
+				continue;
+
+			try
+			{
+				Drive(channel, channel.high ? 0 : 1);
+			}
+			catch (const GPIO::Exception &e)
+			{
+				cerr << e.what() << endl;
+				channel.active = false;
+				m_finished[i] = channel.generation;
+				continue;
+			}
+			RecordEdge(static_cast<long>(GPIOLine::Now() - channel.next));
+
+			if (channel.remaining && --channel.remaining == 0)
+			{
+				// The pulse train ended on a falling edge
+				channel.active = false;
+				m_finished[i] = channel.generation;
+				continue;
+			}
+
+			// Schedule from the deadline, not from now, so the period doesn't drift
+			channel.next += channel.high ? channel.highTime : channel.lowTime;
+
+			// Too far behind to catch up without squeezing periods; skip them
+			uint64_t period = channel.highTime + channel.lowTime;
+			if (!channel.remaining && now > channel.next + period)
+			{
+				uint64_t missed = (now - channel.next) / period;
+				channel.next += missed * period;
+				m_newStats.missed += missed;
+			}
+		}
+		PublishStats();
+	}
+
+	// Leave everything low
+	for (unsigned int i = 0; i < GPIO_PWM_CHANNELS; i++)
+	{
+		if (m_channels[i].active)
+			Finish(i, 0);
+	}
+	PublishStats();
+}
+
+void GPIOPWM::ApplyCommands(uint64_t now, bool wait)
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex, boost::defer_lock);
+		if (wait)
+		{
+			lock.lock();
+			while (m_bRunning && m_commands.empty())
+				m_commandCond.wait(lock);
+		}
+		else if (!lock.try_lock())
+		{
+			// Don't wait on a caller; the commands will keep
+			return;
+		}
+		m_applying.swap(m_commands);
+	}
+
+	if (wait)
+		now = GPIOLine::Now();
+	for (vector<Command>::const_iterator it = m_applying.begin(); it != m_applying.end(); ++it)
+	{
+		try
+		{
+			Apply(*it, now);
+		}
+		catch (const GPIO::Exception &e)
+		{
+			cerr << e.what() << endl;
+			m_channels[it->id].active = false;
+			m_finished[it->id] = it->generation;
+		}
+	}
+	m_applying.clear();
+}
+
+void GPIOPWM::Apply(const Command &command, uint64_t now)
+{
+	Channel &channel = m_channels[command.id];
+	channel.generation = command.generation;
+
+	switch (command.type)
+	{
+	case Command::ADD:
+		channel.gpio = command.gpio;
+		channel.active = false;
+		channel.high = false;
+		m_finished[command.id] = command.generation;
+		break;
+
+	case Command::REMOVE:
+	case Command::HALT:
+		Finish(command.id, 0);
+		if (command.type == Command::REMOVE)
+			channel.gpio = NULL;
+		break;
+
+	case Command::PWM:
+		if (command.high == 0 || command.low == 0)
+		{
+			// 0% or 100%, no edges to schedule
+			Finish(command.id, command.high ? 1 : 0);
+		}
+		else if (channel.active && channel.remaining == 0)
+		{
+			// Keep the phase of a running PWM signal
+			channel.highTime = command.high;
+			channel.lowTime = command.low;
+		}
+		else
+		{
+			channel.highTime = command.high;
+			channel.lowTime = command.low;
+			channel.remaining = 0;
+			channel.active = true;
+			Drive(channel, 1);
+			channel.next = now + channel.highTime;
+		}
+		break;
+
+	case Command::PULSES:
+		if (command.high == 0 || command.count == 0)
+		{
+			Finish(command.id, 0);
+		}
+		else
+		{
+			channel.highTime = command.high;
+			channel.lowTime = command.low;
+			channel.remaining = command.count * 2 - 1; // Edges after the first
+			channel.active = true;
+			Drive(channel, 1);
+			channel.next = now + channel.highTime;
+		}
+		break;
+	}
+}
+
+void GPIOPWM::Drive(Channel &channel, unsigned int value)
+{
+	channel.gpio->SetValue(value);
+	channel.high = (value != 0);
+}
+
+void GPIOPWM::Finish(ChannelID id, unsigned int value)
+{
+	Channel &channel = m_channels[id];
+	channel.active = false;
+	if (channel.gpio)
+	{
+		channel.gpio->SetValue(value);
+		channel.high = (value != 0);
+	}
+	m_finished[id] = channel.generation;
+}
+
+void GPIOPWM::RecordEdge(long latency)
+{
+	if (latency < 0)
+		latency = 0;
+	m_newStats.edges++;
+	if (latency < m_newStats.minLatency)
+		m_newStats.minLatency = latency;
+	if (latency > m_newStats.maxLatency)
+		m_newStats.maxLatency = latency;
+	m_newTotal += latency;
+}
+
+void GPIOPWM::PublishStats()
+{
+	boost::mutex::scoped_lock lock(m_statsMutex, boost::try_to_lock);
+	if (!lock.owns_lock())
+		return; // Try again after the next edge
+
+	m_stats.edges += m_newStats.edges;
+	m_stats.missed += m_newStats.missed;
+	if (m_newStats.minLatency < m_stats.minLatency)
+		m_stats.minLatency = m_newStats.minLatency;
+	if (m_newStats.maxLatency > m_stats.maxLatency)
+		m_stats.maxLatency = m_newStats.maxLatency;
+	m_totalLatency += m_newTotal;
+	if (m_stats.edges)
+		m_stats.meanLatency = m_totalLatency / m_stats.edges;
+
+	ClearStats(m_newStats);
+	m_newTotal = 0;
+}
@@ -0,0 +1,372 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOSimulator.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <errno.h>       // for errno
+#include <string.h>      // for strerror()
+#include <sys/epoll.h>   // for EPOLLIN
+#include <sys/eventfd.h> // for eventfd()
+#include <unistd.h>      // for read(), write(), close()
+
+#define SIM_EDGE_QUEUE 16 // Same as the kernel's GPIO event queue
+
+#ifndef INVALID_SOCKET
+	#define INVALID_SOCKET -1
+#endif
+
+GPIOSimulator::~GPIOSimulator()
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_bStopping = true;
+		m_edgeCond.notify_all();
+	}
+	m_scriptThread.join();
+}
+
+GPIOLine *GPIOSimulator::CreateLine(unsigned int gpio)
+{
+	return new GPIOSimulatorLine(gpio, *this);
+}
+
+GPIOLineGroup *GPIOSimulator::CreateGroup(const std::vector<unsigned int> &gpios)
+{
+	return new GPIOSimulatorGroup(*this, gpios);
+}
+
+void GPIOSimulator::SetInput(unsigned int gpio, unsigned int value)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	RunScript();
+	Pin &pin = m_pins[gpio];
+	if (pin.dir == GPIO::IN)
+		SetLevel(gpio, pin, value);
+}
+
+void GPIOSimulator::ScheduleEdge(unsigned int gpio, unsigned long delay, unsigned int value)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+
+	// Start the thread before taking the time so its startup isn't counted
+	if (m_scriptThread.get_id() == boost::thread::id())
+	{
+		boost::thread temp(boost::bind(&GPIOSimulator::ScriptRun, this));
+		m_scriptThread.swap(temp);
+	}
+
+	Edge edge;
+	edge.gpio = gpio;
+	edge.value = value;
+	m_script.insert(std::make_pair(boost::get_system_time() + boost::posix_time::microseconds(delay), edge));
+
+	// Waiters may need to wake up earlier than they planned
+	m_edgeCond.notify_all();
+}
+
+void GPIOSimulator::ScriptRun()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	while (!m_bStopping)
+	{
+		RunScript();
+		if (m_script.empty())
+			m_edgeCond.wait(lock);
+		else
+			m_edgeCond.timed_wait(lock, m_script.begin()->first);
+	}
+}
+
+unsigned int GPIOSimulator::GetLevel(unsigned int gpio)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	RunScript();
+	return m_pins[gpio].value;
+}
+
+unsigned long GPIOSimulator::GetEdgeCount(unsigned int gpio)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	RunScript();
+	const Pin &pin = m_pins[gpio];
+	return pin.rising + pin.falling;
+}
+
+void GPIOSimulator::SetLevel(unsigned int gpio, Pin &pin, unsigned int value)
+{
+	value = value ? 1 : 0;
+	if (pin.value == value)
+		return;
+
+	pin.value = value;
+	if (value)
+		pin.rising++;
+	else
+		pin.falling++;
+	m_edgeCond.notify_all();
+
+	// Signal the lines watching for this edge
+	GPIO::Edge edge = value ? GPIO::RISING : GPIO::FALLING;
+	typedef std::multimap<unsigned int, GPIOSimulatorLine*>::iterator LineIt;
+	std::pair<LineIt, LineIt> range = m_lines.equal_range(gpio);
+	for (LineIt it = range.first; it != range.second; ++it)
+	{
+		if (it->second->m_dir == GPIO::IN && (it->second->m_edge & edge))
+		{
+			if (it->second->m_pending.size() < SIM_EDGE_QUEUE)
+			{
+				GPIO::EdgeEvent event;
+				event.timestamp = GPIOLine::Now();
+				event.gpio = gpio;
+				event.value = value;
+				it->second->m_pending.push_back(event);
+			}
+			uint64_t one = 1;
+			ssize_t ret = write(it->second->m_event_fd, &one, sizeof(one));
+			(void)ret;
+		}
+	}
+}
+
+void GPIOSimulator::RunScript()
+{
+	boost::system_time now = boost::get_system_time();
+	while (!m_script.empty() && m_script.begin()->first <= now)
+	{
+		const Edge &edge = m_script.begin()->second;
+		Pin &pin = m_pins[edge.gpio];
+		if (pin.dir == GPIO::IN)
+			SetLevel(edge.gpio, pin, edge.value);
+		m_script.erase(m_script.begin());
+	}
+}
+
+GPIOSimulatorLine::GPIOSimulatorLine(unsigned int gpio, GPIOSimulator &sim)
+	: GPIOLine(gpio), m_sim(sim), m_bOpen(false), m_event_fd(INVALID_SOCKET), m_rising(0), m_falling(0)
+{
+}
+
+bool GPIOSimulatorLine::Open()
+{
+	if (m_bOpen)
+		return true;
+
+	m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_event_fd < 0)
+		return false;
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.m_lines.insert(std::make_pair(m_gpio, this));
+	m_sim.RunScript();
+	const GPIOSimulator::Pin &pin = m_sim.m_pins[m_gpio];
+	m_dir = pin.dir;
+	m_edge = pin.edge;
+	m_rising = pin.rising;
+	m_falling = pin.falling;
+	m_bOpen = true;
+	return true;
+}
+
+void GPIOSimulatorLine::Close() throw()
+{
+	if (!m_bOpen)
+		return;
+
+	{
+		boost::mutex::scoped_lock lock(m_sim.m_mutex);
+		typedef std::multimap<unsigned int, GPIOSimulatorLine*>::iterator LineIt;
+		std::pair<LineIt, LineIt> range = m_sim.m_lines.equal_range(m_gpio);
+		for (LineIt it = range.first; it != range.second; ++it)
+		{
+			if (it->second == this)
+			{
+				m_sim.m_lines.erase(it);
+				break;
+			}
+		}
+	}
+	close(m_event_fd);
+	m_event_fd = INVALID_SOCKET;
+	m_pending.clear();
+	m_bOpen = false;
+}
+
+void GPIOSimulatorLine::SetDirection(GPIO::Direction dir, unsigned int initial_value)
+{
+	if (m_dir == dir)
+		return;
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.RunScript();
+	GPIOSimulator::Pin &pin = m_sim.m_pins[m_gpio];
+	pin.dir = dir;
+	if (dir == GPIO::OUT)
+		m_sim.SetLevel(m_gpio, pin, initial_value);
+	m_dir = dir;
+}
+
+void GPIOSimulatorLine::SetEdge(GPIO::Edge edge)
+{
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.m_pins[m_gpio].edge = edge;
+	m_edge = edge;
+}
+
+unsigned int GPIOSimulatorLine::GetValue()
+{
+	if (!m_bOpen)
+		throw GPIO::Exception(m_gpio, "GPIO::GetValue", "Pin is not open");
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.RunScript();
+	return m_sim.m_pins[m_gpio].value;
+}
+
+void GPIOSimulatorLine::SetValue(unsigned int value)
+{
+	// No effect if direction is IN
+	if (m_dir == GPIO::IN)
+		return;
+	if (!m_bOpen)
+		throw GPIO::Exception(m_gpio, "GPIO::SetValue", "Pin is not open");
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.RunScript();
+	m_sim.SetLevel(m_gpio, m_sim.m_pins[m_gpio], value);
+}
+
+bool GPIOSimulatorLine::WaitForEdge(long timeout)
+{
+	if (!m_bOpen)
+		throw GPIO::Exception(m_gpio, "GPIO::Poll", "Pin is not open");
+
+	boost::system_time deadline = boost::get_system_time() + boost::posix_time::microseconds(timeout);
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	while (true)
+	{
+		m_sim.RunScript();
+
+		const GPIOSimulator::Pin &pin = m_sim.m_pins[m_gpio];
+		bool rose = (pin.rising != m_rising) && (m_edge & GPIO::RISING);
+		bool fell = (pin.falling != m_falling) && (m_edge & GPIO::FALLING);
+		m_rising = pin.rising;
+		m_falling = pin.falling;
+		if (rose || fell)
+			return true;
+
+		boost::system_time now = boost::get_system_time();
+		if (now >= deadline)
+			return false;
+
+		// Sleep until the deadline or the next scripted edge, whichever is first
+		boost::system_time wake = deadline;
+		if (!m_sim.m_script.empty() && m_sim.m_script.begin()->first < wake)
+			wake = m_sim.m_script.begin()->first;
+		m_sim.m_edgeCond.timed_wait(lock, wake);
+	}
+}
+
+int GPIOSimulatorLine::GetEventFd(uint32_t &events) const
+{
+	events = EPOLLIN;
+	return m_event_fd;
+}
+
+int GPIOSimulatorLine::AcknowledgeEdge()
+{
+	if (!m_bOpen)
+		return -1;
+
+	uint64_t count;
+	if (read(m_event_fd, &count, sizeof(count)) != sizeof(count))
+	{
+		if (errno == EAGAIN)
+			return -1;
+		throw GPIO::Exception(m_gpio, "GPIO::AcknowledgeEdge", strerror(errno));
+	}
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	const GPIOSimulator::Pin &pin = m_sim.m_pins[m_gpio];
+	m_rising = pin.rising;
+	m_falling = pin.falling;
+	m_pending.clear();
+	return pin.value;
+}
+
+unsigned int GPIOSimulatorLine::ReadEdges(GPIO::EdgeEvent *events, unsigned int count)
+{
+	if (!m_bOpen)
+		return 0;
+
+	// The eventfd is written under the simulator's lock, so holding it keeps
+	// the counter and the queue in step
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	uint64_t pending;
+	if (read(m_event_fd, &pending, sizeof(pending)) != sizeof(pending) && errno != EAGAIN)
+		throw GPIO::Exception(m_gpio, "GPIO::ReadEdges", strerror(errno));
+
+	unsigned int n = 0;
+	while (n < count && !m_pending.empty())
+	{
+		events[n++] = m_pending.front();
+		m_pending.pop_front();
+	}
+
+	// Stay readable if edges are left over
+	if (!m_pending.empty())
+	{
+		uint64_t one = 1;
+		ssize_t ret = write(m_event_fd, &one, sizeof(one));
+		(void)ret;
+	}
+
+	const GPIOSimulator::Pin &pin = m_sim.m_pins[m_gpio];
+	m_rising = pin.rising;
+	m_falling = pin.falling;
+	return n;
+}
+
+uint32_t GPIOSimulatorGroup::GetValues()
+{
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.RunScript();
+	uint32_t values = 0;
+	for (unsigned int i = 0; i < m_gpios.size(); i++)
+		values |= m_sim.m_pins[m_gpios[i]].value << i;
+	return values;
+}
+
+void GPIOSimulatorGroup::SetValues(uint32_t values)
+{
+	// No effect if direction is IN
+	if (m_dir == GPIO::IN)
+		return;
+
+	boost::mutex::scoped_lock lock(m_sim.m_mutex);
+	m_sim.RunScript();
+	for (unsigned int i = 0; i < m_gpios.size(); i++)
+		m_sim.SetLevel(m_gpios[i], m_sim.m_pins[m_gpios[i]], (values >> i) & 1);
+}
@@ -0,0 +1,435 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOSysfs.h"
+
+#include <errno.h>    // for errno
+#include <fcntl.h>    // for open()
+#include <iostream>   // for cerr
+#include <poll.h>     // for poll()
+#include <sys/epoll.h> // for EPOLLPRI
+#include <stdio.h>    // for snprintf()
+#include <string.h>   // for strerror()
+#include <sys/stat.h> // for stat()
+#include <sys/wait.h> // for waitpid()
+#include <unistd.h>   // for I/O functions, fork(), execv()
+
+#ifndef INVALID_SOCKET
+	#define INVALID_SOCKET -1
+#endif
+
+GPIOLine *GPIOSysfs::CreateLine(unsigned int gpio)
+{
+	return new GPIOSysfsLine(gpio, m_root);
+}
+
+bool GPIOSysfs::Export(const std::vector<unsigned int> &gpios)
+{
+	std::vector<unsigned int> remaining;
+	for (std::vector<unsigned int>::const_iterator it = gpios.begin(); it != gpios.end(); ++it)
+	{
+		if (!ExportDirect(m_root, *it))
+			remaining.push_back(*it);
+	}
+	if (remaining.empty())
+		return true;
+	if (m_root != SYSFS_GPIO_DIR)
+		return false;
+	return ExportHelper(remaining);
+}
+
+bool GPIOSysfs::ExportDirect(const std::string &root, unsigned int gpio)
+{
+	char gpio_dir[16];
+	snprintf(gpio_dir, sizeof(gpio_dir), "/gpio%d", gpio);
+	std::string value = root + gpio_dir + "/value";
+
+	struct stat st;
+	if (stat(value.c_str(), &st) != 0)
+	{
+		int fd = open((root + "/export").c_str(), O_WRONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		char pin[8];
+		int len = snprintf(pin, sizeof(pin), "%d", gpio);
+		// EBUSY means someone else exported it first
+		bool exported = write(fd, pin, len) == len || errno == EBUSY;
+		close(fd);
+		if (!exported)
+			return false;
+	}
+
+	// Exported, but only any use if we can drive it
+	return access(value.c_str(), W_OK) == 0 &&
+	       access((root + gpio_dir + "/direction").c_str(), W_OK) == 0 &&
+	       access((root + gpio_dir + "/edge").c_str(), W_OK) == 0;
+}
+
+bool GPIOSysfs::ExportHelper(const std::vector<unsigned int> &gpios)
+{
+	// Build argv before forking, so the child only has to exec
+	std::vector<std::string> args;
+	for (std::vector<unsigned int>::const_iterator it = gpios.begin(); it != gpios.end(); ++it)
+	{
+		char pin[8];
+		snprintf(pin, sizeof(pin), "%d", *it);
+		args.push_back(pin);
+	}
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(EXPORT_HELPER));
+	for (std::vector<std::string>::iterator it = args.begin(); it != args.end(); ++it)
+		argv.push_back(const_cast<char*>(it->c_str()));
+	argv.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0)
+	{
+		execv(EXPORT_HELPER, &argv[0]);
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+			return false;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+GPIOSysfsLine::GPIOSysfsLine(unsigned int gpio, const std::string &root)
+	: GPIOLine(gpio), m_root(root), m_gpio_fd(INVALID_SOCKET), m_shadow(-1)
+{
+	char gpio_dir[16];
+	snprintf(gpio_dir, sizeof(gpio_dir), "/gpio%d", m_gpio);
+	m_dir_path = m_root + gpio_dir;
+}
+
+bool GPIOSysfsLine::Open()
+{
+	if (IsOpen())
+		return true;
+
+	// First start by checking to see if the pin is exported
+	struct stat st;
+	if (stat(m_dir_path.c_str(), &st) != 0)
+	{
+		Export();
+		if (stat(m_dir_path.c_str(), &st) != 0)
+		{
+			std::cerr << "GPIO::Open - Pin " << m_gpio << ": Unable to export pin" << std::endl;
+			return false;
+		}
+	}
+
+	// Now, sync m_dir and m_edge with the sysfs values
+	try
+	{
+		ReadDirection();
+		ReadEdge();
+		OpenValue();
+	}
+	catch (const GPIO::Exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void GPIOSysfsLine::Close() throw()
+{
+	if (IsOpen())
+	{
+		close(m_gpio_fd);
+		m_gpio_fd = INVALID_SOCKET;
+	}
+	m_shadow = -1;
+}
+
+void GPIOSysfsLine::Export()
+{
+	if (GPIOSysfs::ExportDirect(m_root, m_gpio) || m_root != SYSFS_GPIO_DIR)
+		return;
+	GPIOSysfs::ExportHelper(std::vector<unsigned int>(1, m_gpio));
+}
+
+/**
+ * Post-condition: Pin is ready for reading/writing. An exception is thrown to
+ * indicate an invalid pin.
+ */
+void GPIOSysfsLine::OpenValue()
+{
+	Close();
+	m_gpio_fd = open((m_dir_path + "/value").c_str(), O_RDWR | O_CLOEXEC);
+	if (!IsOpen())
+		throw GPIO::Exception(m_gpio, __func__, strerror(errno));
+}
+
+unsigned int GPIOSysfsLine::ReadValue(const char *function)
+{
+	char ch; // '0' or '1'
+
+	// pread() always reads from the beginning, no lseek() needed before or after
+	ssize_t num = pread(m_gpio_fd, &ch, 1, 0);
+	if (num < 0)
+		throw GPIO::Exception(m_gpio, function, strerror(errno));
+	if (num != 1)
+		throw GPIO::Exception(m_gpio, function, "Failed to read value");
+
+	// If we read a character, return 1 for everything not '0'
+	return ch != '0' ? 1 : 0;
+}
+
+/**
+ * If an exception is thrown, the pin is still open and the next read may
+ * succeed; the exception was probably ephemeral.
+ */
+unsigned int GPIOSysfsLine::GetValue()
+{
+	// Outputs read back what we last wrote to them
+	if (m_dir == GPIO::OUT)
+	{
+		if (m_shadow < 0)
+			m_shadow = ReadValue("GPIO::GetValue");
+		return m_shadow;
+	}
+
+	return ReadValue("GPIO::GetValue");
+}
+
+/**
+ * If an exception is thrown, the value may or may not have been written to
+ * the pin, and the shadow value is forgotten.
+ */
+void GPIOSysfsLine::SetValue(unsigned int value)
+{
+	// No effect if direction is IN
+	if (m_dir == GPIO::IN)
+		return;
+
+	value = value ? 1 : 0;
+	m_shadow = -1;
+
+	ssize_t num = pwrite(m_gpio_fd, value ? "1" : "0", 1, 0);
+
+	// If we encountered a problem, raise an exception to let the caller know
+	if (num < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::SetValue", strerror(errno));
+	else if (num != 1)
+		throw GPIO::Exception(m_gpio, "GPIO::SetValue", "Failed to write value");
+
+	m_shadow = value;
+}
+
+void GPIOSysfsLine::ReadDirection()
+{
+	// Open /sys/class/gpio/gpioXXX/direction for reading
+	int fd_dir = open((m_dir_path + "/direction").c_str(), O_RDONLY);
+	if (fd_dir < 0)
+		throw GPIO::Exception(m_gpio, __func__, strerror(errno));
+
+	ssize_t num; // number of bytes read
+	char read_value[4];
+	num = read(fd_dir, read_value, sizeof(read_value));
+	close(fd_dir);
+
+	if (num < 2) // minimum 2 chars for "in"
+		throw GPIO::Exception(m_gpio, __func__, "Direction string is too short");
+
+	if (strncmp(read_value, "in", 2) == 0)
+		m_dir = GPIO::IN;
+	else if (strncmp(read_value, "out", 3) == 0 || // These three are equivalent.
+			 strncmp(read_value, "low", 3) == 0 || // Only "out" should be read,
+			 strncmp(read_value, "high", 4) == 0)  // but just in case.
+		m_dir = GPIO::OUT;
+	else
+		throw GPIO::Exception(m_gpio, __func__, "Unknown direction value");
+}
+
+/**
+ * The direction is controlled by writing one of four strings to
+ * /sys/class/gpio/gpioXXX/direction: "in", "out", "high" and "low". Out and
+ * low are equivalent. High will set the pin to "out" and /value will be set
+ * to 1.
+ */
+void GPIOSysfsLine::SetDirection(GPIO::Direction dir, unsigned int initial_value)
+{
+	// If the pin is already set to this direction, there's no effect
+	if (m_dir == dir)
+		return;
+
+	// Open /sys/class/gpio/gpioXXX/direction for writing
+	int fd_dir = open((m_dir_path + "/direction").c_str(), O_WRONLY);
+	if (fd_dir < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::SetDirection", strerror(errno));
+
+	bool success; // did the write succeed?
+
+	// Write "in", "high" or "low" to /direction ("out" is the same as "low)
+	if (dir == GPIO::IN)
+		success = (write(fd_dir, "in", 3) == 3);
+	else
+	{
+		if (initial_value)
+			success = (write(fd_dir, "high", 5) == 5);
+		else
+			success = (write(fd_dir, "low", 4) == 4);
+	}
+	close(fd_dir);
+
+	if (!success)
+		throw GPIO::Exception(m_gpio, "GPIO::SetDirection", "Error writing direction");
+
+	// Record the new direction. The value node is read-write, so it stays open
+	m_dir = dir;
+	m_shadow = (dir == GPIO::OUT) ? (initial_value ? 1 : 0) : -1;
+}
+
+void GPIOSysfsLine::ReadEdge()
+{
+	// Open /sys/class/gpio/gpioXXX/edge for reading
+	int fd_edge = open((m_dir_path + "/edge").c_str(), O_RDONLY);
+	if (fd_edge < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::ReadEdge", strerror(errno));
+
+	ssize_t num; // number of bytes read
+	char read_value[7];
+	num = read(fd_edge, read_value, sizeof(read_value)); // length of "falling"
+	close(fd_edge);
+
+	if (num < 4) // minimum 4 chars for "none"
+		throw GPIO::Exception(m_gpio, "GPIO::ReadEdge", "Direction string is too short");
+
+	// We just compare the first 4 bytes. Sometimes this is all that's read
+	if (strncmp(read_value, "none", 4) == 0)
+		m_edge = GPIO::NONE;
+	else if (strncmp(read_value, "rising", 4) == 0)
+		m_edge = GPIO::RISING;
+	else if (strncmp(read_value, "falling", 4) == 0)
+		m_edge = GPIO::FALLING;
+	else if (strncmp(read_value, "both", 4) == 0)
+		m_edge = GPIO::BOTH;
+	else
+		throw GPIO::Exception(m_gpio, "GPIO::ReadEdge", "Unknown edge value");
+}
+
+void GPIOSysfsLine::SetEdge(GPIO::Edge edge)
+{
+	// If the edge for this pin is already set to this edge, there's no effect
+	if (m_edge == edge)
+		return;
+
+	// Open /sys/class/gpio/gpioXXX/edge for writing
+	int fd_edge = open((m_dir_path + "/edge").c_str(), O_WRONLY);
+	if (fd_edge < 0)
+		throw GPIO::Exception(m_gpio, "GPIO::SetEdge", strerror(errno));
+
+	bool success; // did the write succeed?
+
+	switch (edge)
+	{
+	case GPIO::NONE:
+		success = (write(fd_edge, "none", 5) == 5);
+		break;
+	case GPIO::RISING:
+		success = (write(fd_edge, "rising", 7) == 7);
+		break;
+	case GPIO::FALLING:
+		success = (write(fd_edge, "falling", 8) == 8);
+		break;
+	case GPIO::BOTH:
+	default:
+		success = (write(fd_edge, "both", 5) == 5);
+		break;
+	}
+	close(fd_edge);
+	if (!success)
+		throw GPIO::Exception(m_gpio, "GPIO::SetEdge", "Error writing edge");
+
+	// Record the new edge
+	m_edge = edge;
+}
+
+bool GPIOSysfsLine::WaitForEdge(long timeout)
+{
+	struct pollfd fd_value_ptr[1];
+	memset(reinterpret_cast<void*>(fd_value_ptr), 0, sizeof(fd_value_ptr));
+	fd_value_ptr[0].fd = m_gpio_fd;   // File descriptor to poll
+	fd_value_ptr[0].events = POLLPRI; // Types of events we care about
+
+	// Block until triggered by an interrupt or timeout occurs. Timeouts are
+	// in milliseconds! To preserve the timeout condition that "duration
+	// will be exactly equal to timeout", we conservatively round up (unless
+	// remaining is an exact multiple of 1000) a.k.a. ceiling.
+	int ret = poll(fd_value_ptr, 1, (int)(timeout - 1) / 1000 + 1);
+
+	if (ret > 0)
+	{
+		// ret is 1 (number of fd's changed); check return events
+		if (fd_value_ptr[0].revents & POLLPRI)
+		{
+			// Kernel documentation states:
+			//    "After poll(2) returns, either lseek(2) to the beginning
+			//    of the sysfs file and read the new value or close the file
+			//    and re-open it to read the value."
+			// pread() at offset 0 does both in one call. Without this read,
+			// the next poll() would return immediately for the same edge.
+			ReadValue("GPIO::Poll");
+			return true;
+		}
+		else if (fd_value_ptr[0].revents & POLLERR)
+		{
+			// poll() encountered an error condition
+			throw GPIO::Exception(m_gpio, "GPIO::Poll", "poll() was interrupted by an error");
+		}
+		else
+		{
+			// What else can cause poll() to return? Notify the user here
+			char buffer[40];
+			snprintf(buffer, sizeof(buffer), "Unknown poll(), \"revents\": %d\n", fd_value_ptr[0].revents);
+			throw GPIO::Exception(m_gpio, "GPIO::Poll", buffer);
+		}
+	}
+	else if (ret < 0)
+	{
+		// Negative value indicating error
+		throw GPIO::Exception(m_gpio, "GPIO::Poll", strerror(errno));
+	}
+
+	// If ret is 0, the call timed out and no file descriptors were ready
+	return false;
+}
+
+int GPIOSysfsLine::GetEventFd(uint32_t &events) const
+{
+	events = EPOLLPRI;
+	return m_gpio_fd;
+}
+
+int GPIOSysfsLine::AcknowledgeEdge()
+{
+	// Without a pending edge this is just a read, which is harmless
+	return ReadValue("GPIO::AcknowledgeEdge");
+}
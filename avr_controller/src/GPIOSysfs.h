@@ -0,0 +1,152 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "GPIOBackend.h"
+
+#include <string>
+#include <vector>
+
+#define SYSFS_GPIO_DIR "/sys/class/gpio"
+#define EXPORT_HELPER  "./gpio_export" // in current bin directory
+
+/**
+ * The sysfs GPIO interface (/sys/class/gpio). The root directory can be
+ * changed so that tests can point the backend at a temporary tree laid out
+ * like the sysfs: <root>/gpioN/{value,direction,edge}.
+ */
+class GPIOSysfs : public GPIOBackend
+{
+public:
+	GPIOSysfs(const std::string &root = SYSFS_GPIO_DIR) : m_root(root) { }
+	virtual ~GPIOSysfs() { }
+
+	virtual GPIOLine *CreateLine(unsigned int gpio);
+	virtual const char *GetName() const { return "sysfs"; }
+
+	/*!
+	 * Export the pins and make them writable, so that opening them later
+	 * costs nothing. Pins are written to <root>/export directly when that
+	 * is enough (we're root, or a udev rule hands out the pins); otherwise
+	 * the setuid helper is run once for the whole list.
+	 */
+	virtual bool Export(const std::vector<unsigned int> &gpios);
+
+	/*!
+	 * Export without the helper.
+	 *
+	 * \return true if the pin is exported and its files are writable
+	 */
+	static bool ExportDirect(const std::string &root, unsigned int gpio);
+
+	/*!
+	 * Run the setuid helper (gpio_export) once for a list of pins. The
+	 * helper is exec'd directly; no shell is involved.
+	 */
+	static bool ExportHelper(const std::vector<unsigned int> &gpios);
+
+private:
+	std::string m_root;
+};
+
+class GPIOSysfsLine : public GPIOLine
+{
+public:
+	GPIOSysfsLine(unsigned int gpio, const std::string &root);
+	virtual ~GPIOSysfsLine() { Close(); }
+
+	virtual bool Open();
+	virtual bool IsOpen() const { return m_gpio_fd >= 0; }
+	virtual void Close() throw();
+
+	virtual void SetDirection(GPIO::Direction dir, unsigned int initial_value);
+	virtual void SetEdge(GPIO::Edge edge);
+
+	/*!
+	 * For performance reasons, the file descriptor is kept open. Tests on my
+	 * BeagleBoard indicate that opening /value can take several hundred
+	 * microseconds. /value is opened once, read-write, and accessed with
+	 * pread()/pwrite() at offset 0, so each read or write is exactly one
+	 * syscall regardless of direction. The last value written to an output
+	 * is shadowed, so reading an output back costs no syscall at all.
+	 */
+	virtual unsigned int GetValue();
+	virtual void SetValue(unsigned int value);
+
+	virtual bool WaitForEdge(long timeout);
+
+	/*!
+	 * The sysfs signals edges as POLLPRI on /value, and reading /value
+	 * clears it.
+	 */
+	virtual int GetEventFd(uint32_t &events) const;
+	virtual int AcknowledgeEdge();
+
+private:
+	/**
+	 * Export a pin so that Open() may proceed, see GPIOSysfs::Export(). Only
+	 * the real sysfs has the helper; a test tree must already contain the
+	 * pin's directory (or an export file).
+	 */
+	void Export();
+
+	/*!
+	 * Open the pin's value node read-write.
+	 *
+	 * \throw GPIO::Exception
+	 */
+	void OpenValue();
+
+	/*!
+	 * Read /value with a single pread().
+	 *
+	 * \throw GPIO::Exception
+	 */
+	unsigned int ReadValue(const char *function);
+
+	/*!
+	 * Sync m_dir with /sys/class/gpio/gpioXXX/direction. This allows m_dir to
+	 * be used as a caching variable so we don't have to hit the sysfs every
+	 * time we want to know the direction.
+	 *
+	 * \throw GPIO::Exception
+	 */
+	void ReadDirection();
+
+	/*!
+	 * Sync m_edge with /sys/class/gpio/gpioXXX/edge. This allows m_edge to be
+	 * used as a caching variable so we don't have to hit the sysfs every time
+	 * we want to know the edge.
+	 *
+	 * \throw GPIO::Exception if, for whatever reason, m_edge is not set,
+	 */
+	void ReadEdge();
+
+	// Root of the sysfs tree, normally SYSFS_GPIO_DIR
+	std::string m_root;
+	// Directory of this pin, <root>/gpioN
+	std::string m_dir_path;
+	// File descriptor to the GPIO pin
+	int m_gpio_fd;
+	// Last value written while the direction is OUT, or -1 if unknown
+	int m_shadow;
+};
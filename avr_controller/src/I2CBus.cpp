@@ -21,81 +21,114 @@
  */
 
 #include "I2CBus.h"
+#include "I2CDevice.h"
 #include "i2c-dev.h"  // There are two of these, one at <linux/i2c-dev.h> and one from i2c-tools
 
 #include <errno.h>    // for errno
-#include <fcntl.h>    // for open()
 #include <iostream>   // for cerr
 #include <stdio.h>    // for snprintf()
 #include <string.h>   // for strerror()
 
-#define I2C_BUS_FILENAME "/dev/i2c-%d"
-
-#define I2C_FIRST_ADDRESS 0x03 // Set to 0x00 for non-regular addresses
-#define I2C_LAST_ADDRESS  0x77 // Set to 0x7F for non-regular addresses
+#ifndef I2C_RDRW_IOCTL_MAX_MSGS
+#define I2C_RDRW_IOCTL_MAX_MSGS 42 // from linux/i2c-dev.h
+#endif
 
 using namespace std;
 
-bool I2CBus::Open()
+I2CBus::I2CBus(unsigned int i2cbus) : m_transport(new I2CDevice(i2cbus)), m_owned(true)
 {
-	if (!IsOpen())
-	{
-		char filename[sizeof(I2C_BUS_FILENAME) + 2]; // Allow 4 digits for the bus number
-		snprintf(filename, sizeof(filename), I2C_BUS_FILENAME, m_i2cbus);
-		m_fd = open(filename, O_RDWR);
-		return m_fd >= 0;
-	}
-	return true;
 }
 
-void I2CBus::Close() throw()
+I2CBus::I2CBus(I2CTransport &transport) : m_transport(&transport), m_owned(false)
+{
+}
+
+I2CBus::~I2CBus() throw()
+{
+	Close();
+	if (m_owned)
+		delete m_transport;
+}
+
+bool I2CBus::Transfer(struct i2c_msg *msgs, unsigned int count)
 {
-	if (IsOpen())
+	while (count > 0)
 	{
-		close(m_fd);
-		m_fd = INVALID_DESCRIPTOR;
+		unsigned int batch = count < I2C_RDRW_IOCTL_MAX_MSGS ? count : I2C_RDRW_IOCTL_MAX_MSGS;
+		if (!m_transport->Transfer(msgs, batch))
+			return false;
+		msgs += batch;
+		count -= batch;
 	}
+	return true;
 }
 
-bool I2CBus::DetectDevices(vector<unsigned int> &devices)
+bool I2CBus::Configure(const Register *table, unsigned int count)
 {
-	unsigned long funcs;
-	if (ioctl(m_fd, I2C_FUNCS, &funcs) < 0)
+	if (count == 0)
+		return true;
+
+	vector<uint8_t> writes(2 * count);
+	vector<struct i2c_msg> msgs(count);
+	for (unsigned int i = 0; i < count; i++)
 	{
-		cerr << "I2CBus::DetectDevices - Could not get the adapter functionality matrix";
-		return false;
+		writes[2 * i] = table[i].reg;
+		writes[2 * i + 1] = table[i].value;
+		msgs[i].addr = table[i].address;
+		msgs[i].flags = 0;
+		msgs[i].len = 2;
+		msgs[i].buf = reinterpret_cast<char*>(&writes[2 * i]);
 	}
-	if (!(funcs & I2C_FUNC_SMBUS_READ_BYTE))
+	if (!Transfer(&msgs[0], count))
 	{
-		cerr << "I2CBus::DetectDevices - Can't use SMBus Read Byte command on this bus";
+		cerr << "I2CBus::Configure - Write failed: " << strerror(errno) << endl;
 		return false;
 	}
 
-	devices.clear();
+	// Read back the final value of each register: a later entry for the same
+	// register supersedes an earlier one
+	vector<unsigned int> verify;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		bool superseded = false;
+		for (unsigned int j = i + 1; j < count && !superseded; j++)
+			superseded = table[j].address == table[i].address && table[j].reg == table[i].reg;
+		if (!superseded)
+			verify.push_back(i);
+	}
 
-	for (unsigned int i = I2C_FIRST_ADDRESS; i < I2C_LAST_ADDRESS; i++)
+	vector<uint8_t> reads(verify.size());
+	msgs.resize(2 * verify.size());
+	for (unsigned int i = 0; i < verify.size(); i++)
 	{
-		// Set the slave address
-		if (ioctl(m_fd, I2C_SLAVE, i) < 0)
+		const Register &entry = table[verify[i]];
+		msgs[2 * i].addr = entry.address;
+		msgs[2 * i].flags = 0;
+		msgs[2 * i].len = 1;
+		msgs[2 * i].buf = reinterpret_cast<char*>(&writes[2 * verify[i]]); // The register number
+		msgs[2 * i + 1].addr = entry.address;
+		msgs[2 * i + 1].flags = I2C_M_RD;
+		msgs[2 * i + 1].len = 1;
+		msgs[2 * i + 1].buf = reinterpret_cast<char*>(&reads[i]);
+	}
+	if (!Transfer(&msgs[0], msgs.size()))
+	{
+		cerr << "I2CBus::Configure - Read-back failed: " << strerror(errno) << endl;
+		return false;
+	}
+
+	bool ret = true;
+	for (unsigned int i = 0; i < verify.size(); i++)
+	{
+		const Register &entry = table[verify[i]];
+		if (reads[i] != entry.value)
 		{
-			if (errno == EBUSY)
-			{
-				// Device (or maybe bus?) is busy...
-				continue;
-			}
-			else
-			{
-				char address[4];
-				snprintf(address, sizeof(address), "0x%02x", i);
-				cerr << "I2CBus::DetectDevices - Could not set address to " <<
-						address << ": " << strerror(errno);
-				return false;
-			}
+			char message[64];
+			snprintf(message, sizeof(message), "0x%02x register 0x%02x is 0x%02x, expected 0x%02x",
+				entry.address, entry.reg, reads[i], entry.value);
+			cerr << "I2CBus::Configure - " << message << endl;
+			ret = false;
 		}
-
-		// Probe the address
-		if (i2c_smbus_read_byte(m_fd) >= 0)
-			devices.push_back(i);
 	}
-	return true;
+	return ret;
 }
@@ -0,0 +1,61 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+#pragma once
+
+#include "I2CTransport.h"
+
+#define INVALID_DESCRIPTOR -1
+
+/**
+ * The kernel's I2C interface, /dev/i2c-N.
+ */
+class I2CDevice : public I2CTransport
+{
+public:
+	I2CDevice(unsigned int i2cbus) : m_i2cbus(i2cbus), m_fd(INVALID_DESCRIPTOR) { }
+	virtual ~I2CDevice() throw() { Close(); }
+
+	virtual bool Open();
+	virtual bool IsOpen() const { return m_fd >= 0; }
+	virtual void Close() throw();
+
+	virtual bool Transfer(struct i2c_msg *msgs, unsigned int count);
+
+	/**
+	 * Uses SMBus "read byte" commands for probing. This is known to lock
+	 * SMBus on various write-only chips (most notably clock chips at address
+	 * 0x69).
+	 */
+	virtual bool DetectDevices(std::vector<unsigned int> &devices);
+
+	virtual const char *GetName() const { return "i2c-dev"; }
+
+private:
+	/**
+	 * This object is noncopyable.
+	 */
+	I2CDevice(const I2CDevice &other);
+	I2CDevice& operator=(const I2CDevice &rhs);
+
+	unsigned int m_i2cbus;
+	int          m_fd;
+};
@@ -0,0 +1,539 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "I2CSimulator.h"
+#include "ADXL345.h"
+#include "BeagleBoardAddressBook.h"
+#include "GPIOSimulator.h"
+#include "ITG3200.h"
+#include "i2c-dev.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <errno.h>   // for errno
+#include <string.h>  // for memset()
+#include <time.h>    // for clock_gettime()
+
+#define ADXL345_LSB             0.0039f // g, full resolution
+#define ITG3200_LSB             14.375f // LSB per degree/s
+#define ITG3200_TEMP_OFFSET     -13200  // LSB at 35 degrees C
+#define ITG3200_TEMP_LSB        280     // LSB per degree C
+
+using namespace std;
+
+namespace
+{
+	uint64_t Now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	int16_t Saturate(float value)
+	{
+		if (value > 32767.0f)
+			return 32767;
+		if (value < -32768.0f)
+			return -32768;
+		return static_cast<int16_t>(value < 0 ? value - 0.5f : value + 0.5f);
+	}
+}
+
+/**
+ * A device's register file, register pointer and sample clock. Reads and
+ * writes auto-increment the register pointer, as both devices do.
+ */
+class I2CSimulator::Device
+{
+public:
+	Device(uint16_t address, unsigned int pin) : m_bPulse(false), m_address(address), m_pin(pin), m_pointer(0), m_next(0)
+	{
+		memset(m_registers, 0, sizeof(m_registers));
+	}
+	virtual ~Device() { }
+
+	uint16_t GetAddress() const { return m_address; }
+	unsigned int GetPin() const { return m_pin; }
+
+	/**
+	 * A write segment: the first byte selects the register, the rest are
+	 * written from there on.
+	 */
+	void Write(const uint8_t *buf, unsigned int len)
+	{
+		if (len == 0)
+			return;
+		m_pointer = buf[0];
+		for (unsigned int i = 1; i < len; i++)
+			OnWrite(m_pointer++, buf[i]);
+	}
+
+	void Read(uint8_t *buf, unsigned int len)
+	{
+		uint8_t first = m_pointer;
+		for (unsigned int i = 0; i < len; i++)
+			buf[i] = OnRead(m_pointer++);
+		OnReadDone(first, len);
+	}
+
+	/**
+	 * Take the samples that are due by now.
+	 *
+	 * \return When the next one is due, or 0 if not sampling
+	 */
+	uint64_t Tick(uint64_t now)
+	{
+		uint64_t period = GetPeriod();
+		if (period == 0)
+		{
+			m_next = 0;
+			return 0;
+		}
+		if (m_next == 0)
+			m_next = now + period;
+		while (m_next <= now)
+		{
+			Sample();
+			m_next += period;
+		}
+		return m_next;
+	}
+
+	/**
+	 * Level of the interrupt line.
+	 */
+	virtual unsigned int GetInterrupt() const = 0;
+
+	/**
+	 * True if the interrupt line was pulsed to its active level (and back)
+	 * since the last call.
+	 */
+	bool TakePulse()
+	{
+		bool bPulse = m_bPulse;
+		m_bPulse = false;
+		return bPulse;
+	}
+
+protected:
+	/**
+	 * Sample period in ns, or 0 if not sampling.
+	 */
+	virtual uint64_t GetPeriod() const = 0;
+	virtual void Sample() = 0;
+
+	virtual void OnWrite(uint8_t reg, uint8_t value) { m_registers[reg] = value; }
+	virtual uint8_t OnRead(uint8_t reg) { return m_registers[reg]; }
+	virtual void OnReadDone(uint8_t first, unsigned int len) { }
+
+	/**
+	 * Start the sample clock over, after the rate changed.
+	 */
+	void Restart() { m_next = 0; }
+
+	uint8_t      m_registers[256];
+	bool         m_bPulse;
+
+private:
+	uint16_t     m_address;
+	unsigned int m_pin;
+	uint8_t      m_pointer;
+	uint64_t     m_next;
+};
+
+class I2CSimulator::Accelerometer : public Device
+{
+public:
+	Accelerometer() : Device(I2C_ADDRESS_ADXL345, IMU_INT1), m_head(0), m_count(0), m_bOverrun(false)
+	{
+		m_registers[ADXL345_DEVID] = ADXL345_ID;
+		m_registers[ADXL345_BW_RATE] = ADXL345_DATA_RATE_100_HZ;
+		memset(m_value, 0, sizeof(m_value));
+		memset(m_last, 0, sizeof(m_last));
+	}
+
+	void SetAcceleration(float x, float y, float z)
+	{
+		m_value[0] = Saturate(x / ADXL345_LSB);
+		m_value[1] = Saturate(y / ADXL345_LSB);
+		m_value[2] = Saturate(z / ADXL345_LSB);
+	}
+
+	virtual unsigned int GetInterrupt() const
+	{
+		// Sources mapped to interrupt 1 have their INT_MAP bit cleared
+		bool bActive = (GetSource() & m_registers[ADXL345_INT_ENABLE] & ~m_registers[ADXL345_INT_MAP]) != 0;
+		if (m_registers[ADXL345_DATA_FORMAT] & ADXL345_INT_INVERT)
+			bActive = !bActive;
+		return bActive ? 1 : 0;
+	}
+
+protected:
+	virtual uint64_t GetPeriod() const
+	{
+		if (!(m_registers[ADXL345_POWER_CTL] & ADXL345_MEASURE))
+			return 0;
+		// 3200 Hz at code 15, halving with each code below
+		unsigned int code = m_registers[ADXL345_BW_RATE] & 0x0F;
+		return 1000000000ULL * (1 << (15 - code)) / 3200;
+	}
+
+	virtual void Sample()
+	{
+		uint8_t mode = m_registers[ADXL345_FIFO_CTL] & ADXL345_FIFO_MODE_MASK;
+		if (mode == ADXL345_BYPASS)
+		{
+			// The data registers hold the latest sample only
+			m_bOverrun = m_count > 0;
+			m_count = 0;
+		}
+		else if (m_count == ADXL345_FIFO_SIZE)
+		{
+			m_bOverrun = true;
+			if (mode == ADXL345_FIFO)
+				return; // FIFO mode stops collecting when full
+			Pop(); // Stream mode keeps the latest
+		}
+		int16_t *entry = m_fifo[(m_head + m_count) % ADXL345_FIFO_SIZE];
+		memcpy(entry, m_value, sizeof(m_value));
+		m_count++;
+	}
+
+	virtual void OnWrite(uint8_t reg, uint8_t value)
+	{
+		switch (reg)
+		{
+		case ADXL345_DEVID:
+		case ADXL345_INT_SOURCE:
+		case ADXL345_DATAX0:
+		case ADXL345_DATAX1:
+		case ADXL345_DATAY0:
+		case ADXL345_DATAY1:
+		case ADXL345_DATAZ0:
+		case ADXL345_DATAZ1:
+		case ADXL345_FIFO_STATUS:
+			return; // Read-only
+		case ADXL345_BW_RATE:
+		case ADXL345_POWER_CTL:
+			Restart();
+			break;
+		case ADXL345_FIFO_CTL:
+			if ((value & ADXL345_FIFO_MODE_MASK) == ADXL345_BYPASS)
+				m_count = 0;
+			break;
+		}
+		Device::OnWrite(reg, value);
+	}
+
+	virtual uint8_t OnRead(uint8_t reg)
+	{
+		if (ADXL345_DATAX0 <= reg && reg <= ADXL345_DATAZ1)
+		{
+			// Little endian; the head of the FIFO, or the last sample popped
+			const int16_t *sample = m_count > 0 ? m_fifo[m_head] : m_last;
+			uint16_t value = sample[(reg - ADXL345_DATAX0) / 2];
+			return (reg - ADXL345_DATAX0) % 2 == 0 ? value & 0xFF : value >> 8;
+		}
+		if (reg == ADXL345_INT_SOURCE)
+			return GetSource();
+		if (reg == ADXL345_FIFO_STATUS)
+			return m_count & ADXL345_FIFO_ENTRIES;
+		return Device::OnRead(reg);
+	}
+
+	virtual void OnReadDone(uint8_t first, unsigned int len)
+	{
+		// A read starting in the data registers pops a sample
+		if (ADXL345_DATAX0 <= first && first <= ADXL345_DATAZ1 && len > 0)
+		{
+			if (m_count > 0)
+				Pop();
+			m_bOverrun = false;
+		}
+	}
+
+private:
+	uint8_t GetSource() const
+	{
+		uint8_t source = 0;
+		if (m_count > 0)
+			source |= ADXL345_DATA_READY;
+		uint8_t mode = m_registers[ADXL345_FIFO_CTL] & ADXL345_FIFO_MODE_MASK;
+		if (mode != ADXL345_BYPASS && m_count >= (m_registers[ADXL345_FIFO_CTL] & ADXL345_SAMPLES_MASK))
+			source |= ADXL345_WATERMARK;
+		if (m_bOverrun)
+			source |= ADXL345_OVERRUN;
+		return source;
+	}
+
+	void Pop()
+	{
+		memcpy(m_last, m_fifo[m_head], sizeof(m_last));
+		m_head = (m_head + 1) % ADXL345_FIFO_SIZE;
+		m_count--;
+	}
+
+	int16_t      m_value[3];
+	int16_t      m_fifo[ADXL345_FIFO_SIZE][3];
+	int16_t      m_last[3];
+	unsigned int m_head;
+	unsigned int m_count;
+	bool         m_bOverrun;
+};
+
+class I2CSimulator::Gyroscope : public Device
+{
+public:
+	Gyroscope() : Device(I2C_ADDRESS_ITG3200, IMU_INT0)
+	{
+		m_registers[ITG3200_WHO_AM_I] = I2C_ADDRESS_ITG3200;
+		memset(m_value, 0, sizeof(m_value));
+		SetTemperature(35);
+	}
+
+	void SetRotation(float x, float y, float z)
+	{
+		m_value[1] = Saturate(x * ITG3200_LSB);
+		m_value[2] = Saturate(y * ITG3200_LSB);
+		m_value[3] = Saturate(z * ITG3200_LSB);
+	}
+
+	void SetTemperature(float celsius)
+	{
+		m_value[0] = Saturate((celsius - 35) * ITG3200_TEMP_LSB + ITG3200_TEMP_OFFSET);
+	}
+
+	virtual unsigned int GetInterrupt() const
+	{
+		// Unlatched, the line only pulses (see Sample())
+		uint8_t config = m_registers[ITG3200_INT_CFG];
+		bool bActive = (config & ITG3200_INT_CFG_LATCH_INT_EN) && (config & ITG3200_INT_CFG_RAW_RDY_EN) &&
+			(m_registers[ITG3200_INT_STATUS] & ITG3200_INT_STATUS_RAW_DATA_RDY);
+		if (config & ITG3200_INT_CFG_ACTL)
+			bActive = !bActive;
+		return bActive ? 1 : 0;
+	}
+
+protected:
+	virtual uint64_t GetPeriod() const
+	{
+		if (m_registers[ITG3200_PWR_MGM] & ITG3200_PWR_MGM_SLEEP)
+			return 0;
+		// The internal rate is 8 kHz with the low pass filter off, else 1 kHz
+		unsigned int internal = (m_registers[ITG3200_DLPF_FS] & 0x07) == 0 ? 8000 : 1000;
+		return 1000000000ULL * (m_registers[ITG3200_SMPLRT_DIV] + 1) / internal;
+	}
+
+	virtual void Sample()
+	{
+		// Big endian, temperature first
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			m_registers[ITG3200_TEMP_OUT_H + 2 * i] = static_cast<uint16_t>(m_value[i]) >> 8;
+			m_registers[ITG3200_TEMP_OUT_L + 2 * i] = static_cast<uint16_t>(m_value[i]) & 0xFF;
+		}
+		m_registers[ITG3200_INT_STATUS] |= ITG3200_INT_STATUS_RAW_DATA_RDY;
+		uint8_t config = m_registers[ITG3200_INT_CFG];
+		if (!(config & ITG3200_INT_CFG_LATCH_INT_EN) && (config & ITG3200_INT_CFG_RAW_RDY_EN))
+			m_bPulse = true;
+	}
+
+	virtual void OnWrite(uint8_t reg, uint8_t value)
+	{
+		if (ITG3200_INT_STATUS <= reg && reg <= ITG3200_GYRO_ZOUT_L)
+			return; // Read-only
+		if (reg == ITG3200_SMPLRT_DIV || reg == ITG3200_DLPF_FS || reg == ITG3200_PWR_MGM)
+			Restart();
+		Device::OnWrite(reg, value);
+	}
+
+	virtual void OnReadDone(uint8_t first, unsigned int len)
+	{
+		// The latch is cleared by reading the status register, or by any
+		// read with INT_ANYRD
+		bool bStatus = first <= ITG3200_INT_STATUS && ITG3200_INT_STATUS < first + len;
+		if (bStatus || (m_registers[ITG3200_INT_CFG] & ITG3200_INT_CFG_INT_ANYRD))
+			m_registers[ITG3200_INT_STATUS] &= ~ITG3200_INT_STATUS_RAW_DATA_RDY;
+	}
+
+private:
+	int16_t m_value[4]; // temperature, x, y, z
+};
+
+I2CSimulator::I2CSimulator(GPIOSimulator &gpio, unsigned int busSpeed)
+  : m_gpio(gpio), m_busSpeed(busSpeed), m_acc(new Accelerometer), m_gyro(new Gyroscope),
+    m_bOpen(false), m_bStopping(false), m_transfers(0)
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		Tick();
+	}
+	boost::thread tickTemp(boost::bind(&I2CSimulator::TickRun, this));
+	m_tickThread.swap(tickTemp);
+}
+
+I2CSimulator::~I2CSimulator()
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_bStopping = true;
+		m_tickCond.notify_all();
+	}
+	m_tickThread.join();
+	delete m_acc;
+	delete m_gyro;
+}
+
+bool I2CSimulator::Open()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_bOpen = true;
+	return true;
+}
+
+void I2CSimulator::Close() throw()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_bOpen = false;
+}
+
+bool I2CSimulator::Transfer(struct i2c_msg *msgs, unsigned int count)
+{
+	unsigned long bits = 0;
+	bool ret = true;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (!m_bOpen)
+		{
+			errno = EBADF;
+			return false;
+		}
+		m_transfers++;
+
+		// Catch up first, so the transfer sees every sample due by now
+		Tick();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			Device *device = Find(msgs[i].addr);
+			if (!device)
+			{
+				errno = ENXIO; // Not acknowledged
+				ret = false;
+				break;
+			}
+			uint8_t *buf = reinterpret_cast<uint8_t*>(msgs[i].buf);
+			if (msgs[i].flags & I2C_M_RD)
+				device->Read(buf, msgs[i].len);
+			else
+				device->Write(buf, msgs[i].len);
+			// (Repeated) start, then address and data bytes with their ACKs
+			bits += 1 + 9 * (1 + msgs[i].len);
+		}
+		Tick();
+		m_tickCond.notify_all(); // The sample rates may have changed
+	}
+
+	// Take the bus time outside the lock, so the devices keep sampling
+	if (m_busSpeed != 0 && count > 0)
+		boost::this_thread::sleep(boost::posix_time::microseconds((bits + 1) * 1000000 / m_busSpeed));
+	return ret;
+}
+
+bool I2CSimulator::DetectDevices(vector<unsigned int> &devices)
+{
+	devices.clear();
+	devices.push_back(I2C_ADDRESS_ADXL345);
+	devices.push_back(I2C_ADDRESS_ITG3200);
+	return true;
+}
+
+void I2CSimulator::SetAcceleration(float x, float y, float z)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_acc->SetAcceleration(x, y, z);
+}
+
+void I2CSimulator::SetRotation(float x, float y, float z)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_gyro->SetRotation(x, y, z);
+}
+
+void I2CSimulator::SetTemperature(float celsius)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_gyro->SetTemperature(celsius);
+}
+
+unsigned long I2CSimulator::GetTransfers()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_transfers;
+}
+
+void I2CSimulator::TickRun()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	while (!m_bStopping)
+	{
+		uint64_t next = Tick();
+		if (next == 0)
+		{
+			m_tickCond.wait(lock);
+		}
+		else
+		{
+			uint64_t now = Now();
+			if (next > now)
+				m_tickCond.timed_wait(lock, boost::posix_time::microseconds((next - now + 999) / 1000));
+		}
+	}
+}
+
+I2CSimulator::Device *I2CSimulator::Find(uint16_t address)
+{
+	if (address == m_acc->GetAddress())
+		return m_acc;
+	if (address == m_gyro->GetAddress())
+		return m_gyro;
+	return NULL;
+}
+
+uint64_t I2CSimulator::Tick()
+{
+	uint64_t now = Now();
+	uint64_t next = 0;
+	Device *devices[] = { m_acc, m_gyro };
+	for (unsigned int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++)
+	{
+		uint64_t due = devices[i]->Tick(now);
+		if (due != 0 && (next == 0 || due < next))
+			next = due;
+
+		unsigned int level = devices[i]->GetInterrupt();
+		if (devices[i]->TakePulse())
+			m_gpio.SetInput(devices[i]->GetPin(), !level);
+		m_gpio.SetInput(devices[i]->GetPin(), level);
+	}
+	return next;
+}
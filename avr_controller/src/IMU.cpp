@@ -25,38 +25,110 @@
 #include "ADXL345.h"
 #include "ITG3200.h"
 
-#include <algorithm> // for std::find()
 #include <iostream>  // for cerr
+#include <stdio.h>   // for snprintf()
+#include <time.h>    // for clock_gettime()
 #include <vector>
 
-#define ACCELEROMETER_UPDATE_FREQ 100 // Hz
 #define GYROSCOPE_UPDATE_FREQ     100 // Hz
 
-#define I2C_ADDRESS_ADXL345       0x53
-#define I2C_ADDRESS_ITG3200       0x68
+#define ADXL345_DRAIN_PASSES      4      // Re-read the FIFO at most this often per wakeup
+#define IMU_MAX_BATCH             16     // Accelerometer samples per transaction (I2C_RDWR allows 42 segments)
 
 using namespace std;
 
+namespace
+{
+	uint64_t Now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	struct i2c_msg Message(uint16_t address, uint16_t flags, void *buf, uint16_t len)
+	{
+		struct i2c_msg msg;
+		msg.addr = address;
+		msg.flags = flags;
+		msg.len = len;
+		msg.buf = reinterpret_cast<char*>(buf);
+		return msg;
+	}
+
+	struct timespec ToTimespec(uint64_t ns)
+	{
+		struct timespec ts;
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		return ts;
+	}
+
+	/*!
+	 * ADXL345 BW_RATE codes for the supported rates.
+	 */
+	bool GetRateCode(unsigned int hz, uint8_t &code)
+	{
+		switch (hz)
+		{
+		case 25:   code = ADXL345_DATA_RATE_25_HZ;   return true;
+		case 50:   code = ADXL345_DATA_RATE_50_HZ;   return true;
+		case 100:  code = ADXL345_DATA_RATE_100_HZ;  return true;
+		case 200:  code = ADXL345_DATA_RATE_200_HZ;  return true;
+		case 400:  code = ADXL345_DATA_RATE_400_HZ;  return true;
+		case 800:  code = ADXL345_DATA_RATE_800_HZ;  return true;
+		case 1600: code = ADXL345_DATA_RATE_1600_HZ; return true;
+		case 3200: code = ADXL345_DATA_RATE_3200_HZ; return true;
+		default:
+			return false;
+		}
+	}
+}
+
+bool IMU::SetAccRate(unsigned int hz)
+{
+	uint8_t code;
+	if (IsOpen() || !GetRateCode(hz, code))
+		return false;
+	m_accRate = hz;
+	return true;
+}
+
 bool IMU::Open()
 {
 	if (IsOpen())
 		return true;
 
+	// Wake up once every watermark samples, keeping half the FIFO free for
+	// samples that arrive while a batch is being read
+	m_accWatermark = m_accRate / ACCELEROMETER_WAKEUP_FREQ;
+	if (m_accWatermark < 1)
+		m_accWatermark = 1;
+	if (m_accWatermark > ACCELEROMETER_FIFO_SIZE / 2)
+		m_accWatermark = ACCELEROMETER_FIFO_SIZE / 2;
+	m_accPeriod = 1000000000ULL / m_accRate;
+	m_accNext = 0;
+	m_accLeft = 0;
+	m_accLastRead = 0;
+	m_accOverruns = 0;
+
 	if (m_i2c.Open() && m_accInt.Open() && m_gyroInt.Open())
 	{
-		vector<unsigned int> devices;
-		if (m_i2c.DetectDevices(devices) &&
-				find(devices.begin(), devices.end(), I2C_ADDRESS_ADXL345) != devices.end() &&
-				find(devices.begin(), devices.end(), I2C_ADDRESS_ITG3200) != devices.end())
+		if (Identify())
 		{
-			if (InitAcc() && InitGyro())
+			if (InitInterrupts() && Configure())
 			{
-				m_bRunning = true;
-				boost::thread accTemp(boost::bind(&IMU::AccRun, this));
-				m_accThread.swap(accTemp);
-				boost::thread gyroTemp(boost::bind(&IMU::GyroRun, this));
-				m_gyroThread.swap(gyroTemp);
-				return true;
+				// Both interrupts are served by one thread
+				if (m_events.Open() &&
+					m_events.AddPin(m_accInt, boost::bind(&IMU::Acquire, this, false), 0,
+						2 * 1000000 * m_accWatermark / m_accRate, boost::bind(&IMU::OnAccTimeout, this)) &&
+					m_events.AddPin(m_gyroInt, boost::bind(&IMU::Acquire, this, true), 0,
+						2 * 1000000 / GYROSCOPE_UPDATE_FREQ, boost::bind(&IMU::OnGyroTimeout, this)))
+				{
+					boost::thread eventTemp(boost::bind(&GPIOEventLoop::Run, &m_events));
+					m_eventThread.swap(eventTemp);
+					return true;
+				}
 			}
 			else
 			{
@@ -65,7 +137,22 @@ bool IMU::Open()
 		}
 		else
 		{
-			cerr << "IMU::Open - Failed to detect devices 0x53 (ADXL345) and 0x68 (ITG3200)" << endl;
+			// Only now is the whole bus worth scanning, to say what is there
+			cerr << "IMU::Open - Failed to detect devices 0x53 (ADXL345) and 0x68 (ITG3200)";
+			vector<unsigned int> devices;
+			if (m_i2c.DetectDevices(devices))
+			{
+				cerr << "; found";
+				for (vector<unsigned int>::const_iterator it = devices.begin(); it != devices.end(); ++it)
+				{
+					char address[8];
+					snprintf(address, sizeof(address), " 0x%02x", *it);
+					cerr << address;
+				}
+				if (devices.empty())
+					cerr << " nothing";
+			}
+			cerr << endl;
 		}
 	}
 	Close();
@@ -74,137 +161,272 @@ bool IMU::Open()
 
 void IMU::Close() throw()
 {
-	m_bRunning = false;
-	m_accThread.join();
-	m_gyroThread.join();
+	m_events.Stop();
+	m_eventThread.join();
+	m_events.Close();
 	m_i2c.Close();
 	m_accInt.Close();
 	m_gyroInt.Close();
 }
 
-bool IMU::Select(Device device)
+bool IMU::Identify()
 {
-	return ioctl(m_i2c.File(), I2C_SLAVE, device == ACC ? I2C_ADDRESS_ADXL345 : I2C_ADDRESS_ITG3200) >= 0;
+	// Read both ID registers in one transaction
+	uint8_t idRegister = 0x00; // ADXL345_DEVID and ITG3200_WHO_AM_I
+	uint8_t accId = 0;
+	uint8_t gyroId = 0;
+	struct i2c_msg msgs[] =
+	{
+		Message(I2C_ADDRESS_ADXL345, 0, &idRegister, 1),
+		Message(I2C_ADDRESS_ADXL345, I2C_M_RD, &accId, 1),
+		Message(I2C_ADDRESS_ITG3200, 0, &idRegister, 1),
+		Message(I2C_ADDRESS_ITG3200, I2C_M_RD, &gyroId, 1),
+	};
+	return m_i2c.Transfer(msgs, sizeof(msgs) / sizeof(msgs[0])) &&
+		accId == ADXL345_ID && (gyroId & ITG3200_ID_MASK) == (I2C_ADDRESS_ITG3200 & ITG3200_ID_MASK);
 }
 
-bool IMU::InitAcc()
+bool IMU::InitInterrupts()
 {
-	// Interrupt is triggered when logic is high
-	m_accInt.SetDirection(GPIO::IN);
-	m_accInt.SetEdge(GPIO::RISING);
-
-	bool ret = true;
-
-	ret &= Select(ACC);
+	try
+	{
+		// Interrupts are triggered when logic is high
+		m_accInt.SetDirection(GPIO::IN);
+		m_accInt.SetEdge(GPIO::RISING);
+		m_gyroInt.SetDirection(GPIO::IN);
+		m_gyroInt.SetEdge(GPIO::RISING);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+		return false;
+	}
+	return true;
+}
 
-	// Default ADXL345 rate is 100 Hz, which is exactly what we want
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ADXL345_BW_RATE, ADXL345_DATA_RATE_100_HZ) >= 0);
+bool IMU::Configure()
+{
+	uint8_t rate;
+	GetRateCode(m_accRate, rate);
 
-	// Install the data-ready event on interrupt 1
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ADXL345_INT_ENABLE, ADXL345_DATA_READY) >= 0);
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ADXL345_INT_MAP, ADXL345_DATA_READY & ADXL345_INTERRUPT1) >= 0);
+	const I2CBus::Register table[] =
+	{
+		// Stop measuring while the FIFO is reconfigured
+		{ I2C_ADDRESS_ADXL345, ADXL345_POWER_CTL,   0 },
+		{ I2C_ADDRESS_ADXL345, ADXL345_BW_RATE,     rate },
+		// Install the watermark event on interrupt 1
+		{ I2C_ADDRESS_ADXL345, ADXL345_INT_ENABLE,  ADXL345_WATERMARK },
+		{ I2C_ADDRESS_ADXL345, ADXL345_INT_MAP,     ADXL345_WATERMARK & ADXL345_INTERRUPT1 },
+		// Set the range to +/- 4G (using the same resolution as 2G)
+		{ I2C_ADDRESS_ADXL345, ADXL345_DATA_FORMAT, ADXL345_RANGE_4G | ADXL345_FULL_RES },
+		// Stream mode: the FIFO keeps the latest 32 samples, and the watermark
+		// interrupt is raised while it holds at least m_accWatermark. Going
+		// through bypass mode empties it
+		{ I2C_ADDRESS_ADXL345, ADXL345_FIFO_CTL,    ADXL345_BYPASS },
+		{ I2C_ADDRESS_ADXL345, ADXL345_FIFO_CTL,    (uint8_t)(ADXL345_STREAM | (m_accWatermark & ADXL345_SAMPLES_MASK)) },
+		// Put the accelerometer in MEASURE mode
+		{ I2C_ADDRESS_ADXL345, ADXL345_POWER_CTL,   ADXL345_MEASURE },
+
+		// Set sample rate divider for 100 Hz operation (1KHz / (9 + 1))
+		{ I2C_ADDRESS_ITG3200, ITG3200_SMPLRT_DIV,  9 },
+		// Set internal clock to 1kHz with 42Hz LPF and Full Scale to 3 for proper operation
+		{ I2C_ADDRESS_ITG3200, ITG3200_DLPF_FS,     ITG3200_DLPF_FS_SEL_0 | ITG3200_DLPF_FS_SEL_1 | ITG3200_DLPF_CFG_0 },
+		// Setup the interrupt to trigger when new data is ready: Stay high until any register is read
+		{ I2C_ADDRESS_ITG3200, ITG3200_INT_CFG,     ITG3200_INT_CFG_LATCH_INT_EN | ITG3200_INT_CFG_INT_ANYRD | ITG3200_INT_CFG_RAW_RDY_EN },
+		// Select X gyro PLL for clock source
+		//{ I2C_ADDRESS_ITG3200, ITG3200_PWR_MGM,   ITG3200_PWR_MGM_CLK_SEL_0 },
+	};
+
+	return m_i2c.Configure(table, sizeof(table) / sizeof(table[0]));
+}
 
-	// Set the range to +/- 4G (using the same resolution as 2G)
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ADXL345_DATA_FORMAT, ADXL345_RANGE_4G | ADXL345_FULL_RES) >= 0);
+unsigned int IMU::PredictAcc(uint64_t now) const
+{
+	if (m_accLastRead == 0)
+		return 0;
+
+	// Entries left behind last time, plus those produced since. Hold back a
+	// sample, plus one per 16 elapsed, in case the device's clock is slow
+	uint64_t produced = (now - m_accLastRead) / m_accPeriod;
+	uint64_t margin = 1 + produced / 16;
+	uint64_t available = m_accLeft + produced;
+	if (available <= margin)
+		return 0;
+	available -= margin;
+	return available < IMU_MAX_BATCH ? (unsigned int)available : IMU_MAX_BATCH;
+}
 
-	// Disable the "patent pending FIFO technology"
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ADXL345_FIFO_CTL, ADXL345_BYPASS) >= 0);
+void IMU::Acquire(bool gyro)
+{
+	uint64_t now = Now();
 
-	// Put the accelerometer in MEASURE mode
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ADXL345_POWER_CTL, ADXL345_MEASURE) >= 0);
+	// The watermark interrupt guarantees at least that many samples
+	unsigned int accCount = PredictAcc(now);
+	if (!gyro && accCount < m_accWatermark)
+		accCount = m_accWatermark;
 
-	return ret;
-}
+	uint8_t gyroRegister = ITG3200_TEMP_OUT_H;
+	uint8_t dataRegister = ADXL345_DATAX0;
+	uint8_t statusRegister = ADXL345_FIFO_STATUS;
 
-bool IMU::InitGyro()
-{
-	// Interrupt is triggered when logic is high
-	m_gyroInt.SetDirection(GPIO::IN);
-	m_gyroInt.SetEdge(GPIO::RISING);
+	// ITG3200 outputs big endian. Conversion is necessary, so alignment doesn't matter
+	uint8_t gyro_read[8];
+	// ADXL345 outputs little endian. Allocate shorts so the data is memory-aligned
+	int16_t acc_read[IMU_MAX_BATCH][3];
+	uint8_t status;
 
-	bool ret = true;
+	AccSample samples[IMU_MAX_BATCH];
+	struct i2c_msg msgs[2 * (IMU_MAX_BATCH + 2)];
 
-	ret &= Select(GYRO);
+	for (unsigned int pass = 0; pass < ADXL345_DRAIN_PASSES; pass++)
+	{
+		// One transaction: the gyroscope's sample, the accelerometer samples
+		// known to be waiting (each read of the data registers pops one) and
+		// then the number still waiting
+		unsigned int count = 0;
+		if (gyro)
+		{
+			msgs[count++] = Message(I2C_ADDRESS_ITG3200, 0, &gyroRegister, 1);
+			msgs[count++] = Message(I2C_ADDRESS_ITG3200, I2C_M_RD, gyro_read, sizeof(gyro_read));
+		}
+		for (unsigned int i = 0; i < accCount; i++)
+		{
+			msgs[count++] = Message(I2C_ADDRESS_ADXL345, 0, &dataRegister, 1);
+			msgs[count++] = Message(I2C_ADDRESS_ADXL345, I2C_M_RD, acc_read[i], sizeof(acc_read[i]));
+		}
+		msgs[count++] = Message(I2C_ADDRESS_ADXL345, 0, &statusRegister, 1);
+		msgs[count++] = Message(I2C_ADDRESS_ADXL345, I2C_M_RD, &status, 1);
 
-	// Set sample rate divider for 100 Hz operation (1KHz / (9 + 1))
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ITG3200_SMPLRT_DIV, 9) >= 0);
+		if (!m_i2c.Transfer(msgs, count))
+		{
+			m_accLastRead = 0; // Lost track of the FIFO
+			return; // what else can we do?
+		}
+		uint64_t end = Now();
 
-	// Set internal clock to 1kHz with 42Hz LPF and Full Scale to 3 for proper operation
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ITG3200_DLPF_FS,
-		ITG3200_DLPF_FS_SEL_0 | ITG3200_DLPF_FS_SEL_1 | ITG3200_DLPF_CFG_0) >= 0);
+		if (gyro)
+		{
+			OnGyroSample(gyro_read, now);
+			gyro = false;
+		}
 
-	// Setup the interrupt to trigger when new data is ready: Stay high until any register is read
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ITG3200_INT_CFG,
-		ITG3200_INT_CFG_LATCH_INT_EN | ITG3200_INT_CFG_INT_ANYRD | ITG3200_INT_CFG_RAW_RDY_EN) >= 0);
+		unsigned int left = status & ADXL345_FIFO_ENTRIES;
+		if (accCount + left >= ACCELEROMETER_FIFO_SIZE)
+		{
+			// It was full, samples were dropped and the timeline is broken
+			m_accOverruns++;
+			m_accNext = 0;
+		}
+		m_accLeft = left;
+		m_accLastRead = end;
 
-	/*
-	// Select X gyro PLL for clock source
-	ret &= (i2c_smbus_write_byte_data(m_i2c.File(), ITG3200_PWR_MGM, ITG3200_PWR_MGM_CLK_SEL_0) >= 0);
-	*/
+		if (accCount > 0)
+		{
+			for (unsigned int i = 0; i < accCount; i++)
+			{
+				samples[i].x = acc_read[i][0] * 0.0039f;
+				samples[i].y = acc_read[i][1] * 0.0039f;
+				samples[i].z = acc_read[i][2] * 0.0039f;
+			}
+			StampAcc(samples, accCount, left, end);
+			OnAccSamples(samples, accCount);
+		}
 
-	return ret;
+		// Leave a partial batch for next time, unless it holds the interrupt
+		// high: without a new edge, it would only be noticed at the timeout
+		if (left < m_accWatermark)
+			break;
+		accCount = left < IMU_MAX_BATCH ? left : IMU_MAX_BATCH;
+	}
 }
 
-void IMU::AccRun()
+void IMU::StampAcc(AccSample *samples, unsigned int count, unsigned int left, uint64_t now)
 {
-	// ADXL345 outputs little endian. Allocate three shorts so the data is memory-aligned
-	int16_t acc_read[3];
-	unsigned long duration = 0; // Unused
+	// The newest sample in the FIFO was taken somewhere in the period before
+	// now, and the left ones came after the batch
+	uint64_t span = (count - 1 + left) * m_accPeriod + m_accPeriod / 2;
+	uint64_t observed = now > span ? now - span : 0;
 
-	while (m_bRunning)
+	uint64_t first = observed;
+	if (m_accNext != 0)
 	{
-		// Wait twice the period for the interrupt to rise (or a timeout if already risen)
-		if (!m_accInt.Poll(2 * 1000000 / ACCELEROMETER_UPDATE_FREQ, duration, false) && m_accInt.GetValue() != 1)
-			continue;
+		int64_t error = (int64_t)(observed - m_accNext);
+		// More than a few periods out means a gap (or a stall); start over
+		if (error < 4 * (int64_t)m_accPeriod && error > -4 * (int64_t)m_accPeriod)
+			first = m_accNext + error / 8;
+	}
 
-		{
-			boost::mutex::scoped_lock i2cLock(m_i2cMutex);
-			Select(ACC);
-			if (i2c_smbus_read_i2c_block_data(m_i2c.File(), ADXL345_DATAX0, sizeof(acc_read),
-					reinterpret_cast<uint8_t*>(acc_read)) < 0)
-				continue; // what else can we do?
-		}
+	for (unsigned int i = 0; i < count; i++)
+		samples[i].timestamp = first + i * m_accPeriod;
+	m_accNext = first + count * m_accPeriod;
+}
 
+void IMU::OnAccSamples(const AccSample *samples, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (!m_accQueue.Push(samples[i]))
+			m_accOverflows++;
+		if (m_telemetry)
 		{
-			boost::mutex::scoped_lock frameLock(m_frameMutex);
-			m_frame.x = acc_read[0] * 0.0039f;
-			m_frame.y = acc_read[1] * 0.0039f;
-			m_frame.z = acc_read[2] * 0.0039f;
+			Telemetry::Acc record = { samples[i].x, samples[i].y, samples[i].z };
+			m_telemetry->Log(samples[i].timestamp, record);
 		}
 	}
+
+	const AccSample &latest = samples[count - 1];
+	m_latest.x = latest.x;
+	m_latest.y = latest.y;
+	m_latest.z = latest.z;
+	m_latest.timestamp = ToTimespec(latest.timestamp);
+	m_frame.Write(m_latest);
 }
 
-void IMU::GyroRun()
+void IMU::OnGyroSample(const uint8_t *gyro_read, uint64_t timestamp)
 {
-	// ITG3200 outputs big endian. Conversion is necessary, so alignment doesn't matter
-	uint8_t gyro_read[8];
-	unsigned long duration = 0; // Unused
-
-	while (m_bRunning)
+	GyroSample sample;
+	sample.timestamp = timestamp;
+	sample.temp = (13200 + static_cast<int16_t>((gyro_read[0] << 8) | gyro_read[1])) / 280.0f + 35;
+	sample.xrot = static_cast<int16_t>((gyro_read[2] << 8) | gyro_read[3]) / 14.375f;
+	sample.yrot = static_cast<int16_t>((gyro_read[4] << 8) | gyro_read[5]) / 14.375f;
+	sample.zrot = static_cast<int16_t>((gyro_read[6] << 8) | gyro_read[7]) / 14.375f;
+
+	if (!m_gyroQueue.Push(sample))
+		m_gyroOverflows++;
+	if (m_telemetry)
 	{
-		// Wait twice the period for the interrupt to rise (or a timeout if already risen)
-		if (!m_gyroInt.Poll(2 * 1000000 / GYROSCOPE_UPDATE_FREQ, duration, false) && m_gyroInt.GetValue() != 1)
-			continue;
+		Telemetry::Gyro record = { sample.xrot, sample.yrot, sample.zrot, sample.temp };
+		m_telemetry->Log(timestamp, record);
+	}
 
-		{
-			boost::mutex::scoped_lock i2cLock(m_i2cMutex);
-			Select(GYRO);
-			if (i2c_smbus_read_i2c_block_data(m_i2c.File(), ITG3200_TEMP_OUT_H, sizeof(gyro_read), gyro_read) < 0)
-				continue; // what else can we do?
-		}
+	m_latest.temp = sample.temp;
+	m_latest.xrot = sample.xrot;
+	m_latest.yrot = sample.yrot;
+	m_latest.zrot = sample.zrot;
+	m_latest.timestamp = ToTimespec(timestamp);
+	m_frame.Write(m_latest);
+}
 
-		{
-			boost::mutex::scoped_lock frameLock(m_frameMutex);
-			m_frame.temp = (13200 + static_cast<int16_t>((gyro_read[0] << 8) | gyro_read[1])) / 280.0f + 35;
-			m_frame.xrot = static_cast<int16_t>((gyro_read[2] << 8) | gyro_read[3]) / 14.375f;
-			m_frame.yrot = static_cast<int16_t>((gyro_read[4] << 8) | gyro_read[5]) / 14.375f;
-			m_frame.zrot = static_cast<int16_t>((gyro_read[6] << 8) | gyro_read[7]) / 14.375f;
-		}
+void IMU::OnAccTimeout()
+{
+	try
+	{
+		if (m_accInt.GetValue() == 1)
+			Acquire(false);
+	}
+	catch (const GPIO::Exception &e)
+	{
 	}
 }
 
-void IMU::GetFrame(Frame &frame)
+void IMU::OnGyroTimeout()
 {
-	boost::mutex::scoped_lock frameLock(m_frameMutex);
-	frame = m_frame;
+	try
+	{
+		if (m_gyroInt.GetValue() == 1)
+			Acquire(true);
+	}
+	catch (const GPIO::Exception &e)
+	{
+	}
 }
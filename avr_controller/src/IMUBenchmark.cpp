@@ -0,0 +1,238 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "IMU.h" // for IMU::Frame
+#include "SeqLock.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <errno.h>    // for EINTR
+#include <iomanip>    // for setw()
+#include <iostream>
+#include <stdlib.h>   // for atoi()
+#include <string>
+#include <time.h>     // for clock_gettime()
+#include <vector>
+
+#define DEFAULT_READERS     4
+#define DEFAULT_SECONDS     5
+#define DEFAULT_WRITE_RATE  3200 // Hz, the fastest accelerometer rate
+#define READ_RATE           1000 // Hz
+
+using namespace std;
+
+/**
+ * Measure how much readers of the latest IMU frame hold up the thread that
+ * publishes it, with the old mutex and with the SeqLock that replaced it.
+ *
+ *     imubench [--readers=N] [--seconds=N] [--rate=Hz]
+ *
+ * One writer publishes a frame at the given rate while each reader polls it
+ * at 1 kHz. No IMU is needed. For each scheme, the time the writer spends
+ * publishing is reported (its worst case is what can push the acquisition
+ * thread past the next interrupt), along with the readers' cost per read and,
+ * for the SeqLock, how often a read had to be retried.
+ */
+namespace
+{
+	uint64_t Now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	void SleepUntil(uint64_t deadline)
+	{
+		timespec ts;
+		ts.tv_sec = deadline / 1000000000ULL;
+		ts.tv_nsec = deadline % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) { }
+	}
+
+	struct Stats
+	{
+		Stats() : count(0), total(0), max(0), retries(0) { }
+
+		void Add(uint64_t ns)
+		{
+			count++;
+			total += ns;
+			if (ns > max)
+				max = ns;
+		}
+
+		void Merge(const Stats &other)
+		{
+			count += other.count;
+			total += other.total;
+			if (other.max > max)
+				max = other.max;
+			retries += other.retries;
+		}
+
+		unsigned long count;
+		uint64_t      total;
+		uint64_t      max;
+		unsigned long retries;
+	};
+
+	/**
+	 * The two ways of publishing a frame, behind one interface.
+	 */
+	class MutexFrame
+	{
+	public:
+		void Write(const IMU::Frame &frame)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_frame = frame;
+		}
+
+		unsigned int Read(IMU::Frame &frame)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			frame = m_frame;
+			return 0;
+		}
+
+	private:
+		IMU::Frame   m_frame;
+		boost::mutex m_mutex;
+	};
+
+	class SeqLockFrame
+	{
+	public:
+		void Write(const IMU::Frame &frame) { m_frame.Write(frame); }
+		unsigned int Read(IMU::Frame &frame) { return m_frame.Read(frame); }
+
+	private:
+		SeqLock<IMU::Frame> m_frame;
+	};
+
+	template<typename FRAME>
+	class Benchmark
+	{
+	public:
+		Benchmark() : m_running(false) { }
+
+		void Run(const char *name, unsigned int readers, unsigned int seconds, unsigned int rate)
+		{
+			m_running = true;
+			m_readerStats.assign(readers, Stats());
+
+			boost::thread_group threads;
+			for (unsigned int i = 0; i < readers; i++)
+				threads.create_thread(boost::bind(&Benchmark::ReadThread, this, i));
+
+			// Write on this thread
+			IMU::Frame frame = IMU::Frame();
+			uint64_t period = 1000000000ULL / rate;
+			uint64_t end = Now() + seconds * 1000000000ULL;
+			for (uint64_t next = Now(); next < end; next += period)
+			{
+				SleepUntil(next);
+				frame.x += 1.0f;
+				frame.timestamp.tv_nsec = next % 1000000000ULL;
+				uint64_t start = Now();
+				m_frame.Write(frame);
+				m_writerStats.Add(Now() - start);
+			}
+
+			m_running = false;
+			threads.join_all();
+
+			Stats reads;
+			for (unsigned int i = 0; i < readers; i++)
+				reads.Merge(m_readerStats[i]);
+
+			cout << setw(8) << left << name
+			     << "write mean " << setw(6) << right << (m_writerStats.count ? m_writerStats.total / m_writerStats.count : 0)
+			     << " ns, max " << setw(8) << m_writerStats.max << " ns;  "
+			     << "read mean " << setw(6) << (reads.count ? reads.total / reads.count : 0)
+			     << " ns, max " << setw(8) << reads.max << " ns, "
+			     << reads.retries << " retries in " << reads.count << " reads" << endl;
+		}
+
+	private:
+		void ReadThread(unsigned int index)
+		{
+			Stats &stats = m_readerStats[index];
+			IMU::Frame frame;
+			uint64_t period = 1000000000ULL / READ_RATE;
+			for (uint64_t next = Now(); m_running; next += period)
+			{
+				SleepUntil(next);
+				uint64_t start = Now();
+				stats.retries += m_frame.Read(frame);
+				stats.Add(Now() - start);
+			}
+		}
+
+		FRAME          m_frame;
+		Stats          m_writerStats;
+		vector<Stats>  m_readerStats;
+		volatile bool  m_running;
+	};
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int readers = DEFAULT_READERS;
+	unsigned int seconds = DEFAULT_SECONDS;
+	unsigned int rate = DEFAULT_WRITE_RATE;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 10, "--readers=") == 0)
+			readers = atoi(arg.substr(10).c_str());
+		else if (arg.compare(0, 10, "--seconds=") == 0)
+			seconds = atoi(arg.substr(10).c_str());
+		else if (arg.compare(0, 7, "--rate=") == 0)
+			rate = atoi(arg.substr(7).c_str());
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--readers=N] [--seconds=N] [--rate=Hz]" << endl;
+			return 1;
+		}
+	}
+	if (seconds == 0 || rate == 0)
+	{
+		cerr << "Usage: " << argv[0] << " [--readers=N] [--seconds=N] [--rate=Hz]" << endl;
+		return 1;
+	}
+
+	cout << "Writer at " << rate << " Hz, " << readers << " readers at " << READ_RATE << " Hz, "
+	     << seconds << " s each" << endl;
+
+	{
+		Benchmark<MutexFrame> benchmark;
+		benchmark.Run("mutex", readers, seconds, rate);
+	}
+	{
+		Benchmark<SeqLockFrame> benchmark;
+		benchmark.Run("seqlock", readers, seconds, rate);
+	}
+	return 0;
+}
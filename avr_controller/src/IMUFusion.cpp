@@ -0,0 +1,206 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "IMUFusion.h"
+
+#include <boost/bind.hpp>
+#include <math.h>   // for sqrtf(), atan2f(), asinf()
+#include <unistd.h> // for usleep()
+
+#define GRAVITY        9.80665f             // m/s^2
+#define DEG_TO_RAD     0.017453292519943f
+#define MAX_STEP       0.1f                 // s, longer gaps aren't integrated
+
+using namespace std;
+
+namespace
+{
+	inline float InvSqrt(float x)
+	{
+		return 1.0f / sqrtf(x);
+	}
+}
+
+IMUFusion::IMUFusion(float kp, float ki) : m_kp(kp), m_ki(ki), m_imu(NULL), m_running(false)
+{
+	Reset();
+}
+
+void IMUFusion::Reset()
+{
+	m_state.timestamp = 0;
+	m_state.w = 1.0f;
+	m_state.x = m_state.y = m_state.z = 0.0f;
+	m_state.ax = m_state.ay = m_state.az = 0.0f;
+	m_gyro[0] = m_gyro[1] = m_gyro[2] = 0.0f;
+	m_acc[0] = m_acc[1] = m_acc[2] = 0.0f;
+	m_hasAcc = false;
+	m_integral[0] = m_integral[1] = m_integral[2] = 0.0f;
+	m_published.Write(m_state);
+}
+
+unsigned int IMUFusion::Update(const IMU::AccSample *acc, unsigned int accCount, const IMU::GyroSample *gyro, unsigned int gyroCount)
+{
+	unsigned int i = 0;
+	unsigned int j = 0;
+	while (i < accCount || j < gyroCount)
+	{
+		if (j >= gyroCount || (i < accCount && acc[i].timestamp <= gyro[j].timestamp))
+		{
+			// Integrate up to the sample, then correct toward it from here on
+			Step(acc[i].timestamp);
+			m_acc[0] = acc[i].x;
+			m_acc[1] = acc[i].y;
+			m_acc[2] = acc[i].z;
+			m_hasAcc = true;
+
+			// Rotate the sample into the world frame and take away gravity
+			const float w = m_state.w, x = m_state.x, y = m_state.y, z = m_state.z;
+			const float ax = m_acc[0], ay = m_acc[1], az = m_acc[2];
+			m_state.ax = GRAVITY * ((1.0f - 2.0f * (y * y + z * z)) * ax + 2.0f * (x * y - w * z) * ay + 2.0f * (x * z + w * y) * az);
+			m_state.ay = GRAVITY * (2.0f * (x * y + w * z) * ax + (1.0f - 2.0f * (x * x + z * z)) * ay + 2.0f * (y * z - w * x) * az);
+			m_state.az = GRAVITY * (2.0f * (x * z - w * y) * ax + 2.0f * (y * z + w * x) * ay + (1.0f - 2.0f * (x * x + y * y)) * az - 1.0f);
+			i++;
+		}
+		else
+		{
+			Step(gyro[j].timestamp);
+			m_gyro[0] = gyro[j].xrot * DEG_TO_RAD;
+			m_gyro[1] = gyro[j].yrot * DEG_TO_RAD;
+			m_gyro[2] = gyro[j].zrot * DEG_TO_RAD;
+			j++;
+		}
+	}
+
+	if (accCount + gyroCount > 0)
+		m_published.Write(m_state);
+	return accCount + gyroCount;
+}
+
+void IMUFusion::Step(uint64_t timestamp)
+{
+	uint64_t last = m_state.timestamp;
+	if (timestamp <= last)
+		return; // Out of order, hold
+	m_state.timestamp = timestamp;
+	if (last == 0)
+		return; // First sample, nothing to integrate
+
+	float dt = (timestamp - last) * 1e-9f;
+	if (dt > MAX_STEP)
+		return;
+
+	float w = m_state.w, x = m_state.x, y = m_state.y, z = m_state.z;
+	float gx = m_gyro[0], gy = m_gyro[1], gz = m_gyro[2];
+
+	if (m_hasAcc)
+	{
+		float ax = m_acc[0], ay = m_acc[1], az = m_acc[2];
+		float norm = ax * ax + ay * ay + az * az;
+		if (norm > 0.0f)
+		{
+			norm = InvSqrt(norm);
+			ax *= norm;
+			ay *= norm;
+			az *= norm;
+
+			// Which way is up, according to the orientation so far
+			float vx = 2.0f * (x * z - w * y);
+			float vy = 2.0f * (w * x + y * z);
+			float vz = w * w - x * x - y * y + z * z;
+
+			// Error is the rotation between the two: their cross product
+			float ex = ay * vz - az * vy;
+			float ey = az * vx - ax * vz;
+			float ez = ax * vy - ay * vx;
+
+			m_integral[0] += m_ki * ex * dt;
+			m_integral[1] += m_ki * ey * dt;
+			m_integral[2] += m_ki * ez * dt;
+
+			gx += m_kp * ex + m_integral[0];
+			gy += m_kp * ey + m_integral[1];
+			gz += m_kp * ez + m_integral[2];
+		}
+	}
+
+	// Integrate the rate of change of the quaternion
+	float half = 0.5f * dt;
+	float qw = w + (-x * gx - y * gy - z * gz) * half;
+	float qx = x + ( w * gx + y * gz - z * gy) * half;
+	float qy = y + ( w * gy - x * gz + z * gx) * half;
+	float qz = z + ( w * gz + x * gy - y * gx) * half;
+
+	float norm = InvSqrt(qw * qw + qx * qx + qy * qy + qz * qz);
+	m_state.w = qw * norm;
+	m_state.x = qx * norm;
+	m_state.y = qy * norm;
+	m_state.z = qz * norm;
+}
+
+void IMUFusion::ToEuler(const State &state, float &roll, float &pitch, float &yaw)
+{
+	const float w = state.w, x = state.x, y = state.y, z = state.z;
+	roll = atan2f(2.0f * (w * x + y * z), 1.0f - 2.0f * (x * x + y * y));
+	float sinp = 2.0f * (w * y - z * x);
+	pitch = sinp >= 1.0f ? (float)M_PI_2 : (sinp <= -1.0f ? -(float)M_PI_2 : asinf(sinp));
+	yaw = atan2f(2.0f * (w * z + x * y), 1.0f - 2.0f * (y * y + z * z));
+}
+
+bool IMUFusion::Start(IMU &imu)
+{
+	if (m_running)
+		return false;
+
+	m_imu = &imu;
+	m_running = true;
+	boost::thread temp(boost::bind(&IMUFusion::Run, this));
+	m_thread.swap(temp);
+	return true;
+}
+
+void IMUFusion::Stop()
+{
+	m_running = false;
+	m_thread.join();
+	m_imu = NULL;
+}
+
+void IMUFusion::Run()
+{
+	IMU::AccSample acc[FUSION_BATCH];
+	IMU::GyroSample gyro[FUSION_BATCH];
+
+	while (m_running)
+	{
+		unsigned int accCount;
+		unsigned int gyroCount;
+		do
+		{
+			accCount = m_imu->DrainAcc(acc, FUSION_BATCH);
+			gyroCount = m_imu->DrainGyro(gyro, FUSION_BATCH);
+			Update(acc, accCount, gyro, gyroCount);
+		} while (accCount == FUSION_BATCH || gyroCount == FUSION_BATCH);
+
+		usleep(FUSION_POLL_PERIOD);
+	}
+}
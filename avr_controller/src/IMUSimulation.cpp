@@ -0,0 +1,170 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "GPIOSimulator.h"
+#include "I2CSimulator.h"
+#include "IMU.h"
+
+#include <errno.h>    // for EINTR
+#include <iostream>
+#include <stdlib.h>   // for atoi()
+#include <string>
+#include <time.h>     // for clock_gettime()
+#include <vector>
+
+#define DEFAULT_SECONDS     5
+#define DRAIN_RATE          100 // Hz
+
+using namespace std;
+
+/**
+ * Run the IMU's acquisition code against simulated devices, to see what it
+ * costs and how it keeps up at a given accelerometer rate without the
+ * BeagleBoard.
+ *
+ *     imusim [--rate=Hz] [--seconds=N] [--bus=Hz]
+ *
+ * The queues are drained at 100 Hz, as IMUFusion would. Reported are the
+ * samples per second from each sensor, the latency from a sample's
+ * timestamp to its being drained, samples lost (FIFO overruns and queue
+ * overflows) and I2C transactions per second. With --bus, transactions take
+ * as long as they would with the bus at that clock (100000 or 400000).
+ */
+namespace
+{
+	uint64_t Now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	void SleepUntil(uint64_t deadline)
+	{
+		timespec ts;
+		ts.tv_sec = deadline / 1000000000ULL;
+		ts.tv_nsec = deadline % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) { }
+	}
+
+	struct Latency
+	{
+		Latency() : count(0), total(0), max(0) { }
+
+		void Add(uint64_t now, uint64_t timestamp)
+		{
+			uint64_t ns = now > timestamp ? now - timestamp : 0;
+			count++;
+			total += ns;
+			if (ns > max)
+				max = ns;
+		}
+
+		void Print(const char *name, double seconds) const
+		{
+			cout << name << count / seconds << " samples/s, latency mean "
+			     << (count ? total / count / 1000 : 0) << " us, max " << max / 1000 << " us" << endl;
+		}
+
+		unsigned long count;
+		uint64_t      total;
+		uint64_t      max;
+	};
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int rate = ACCELEROMETER_UPDATE_FREQ;
+	unsigned int seconds = DEFAULT_SECONDS;
+	unsigned int bus = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 7, "--rate=") == 0)
+			rate = atoi(arg.substr(7).c_str());
+		else if (arg.compare(0, 10, "--seconds=") == 0)
+			seconds = atoi(arg.substr(10).c_str());
+		else if (arg.compare(0, 6, "--bus=") == 0)
+			bus = atoi(arg.substr(6).c_str());
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--rate=Hz] [--seconds=N] [--bus=Hz]" << endl;
+			return 1;
+		}
+	}
+
+	GPIOSimulator gpio;
+	I2CSimulator i2c(gpio, bus);
+	i2c.SetAcceleration(0.0f, 0.0f, 1.0f);
+	i2c.SetRotation(0.0f, 0.0f, 10.0f);
+
+	IMU imu(gpio, i2c);
+	if (seconds == 0 || !imu.SetAccRate(rate))
+	{
+		cerr << "Usage: " << argv[0] << " [--rate=Hz] [--seconds=N] [--bus=Hz]" << endl;
+		cerr << "Rates are 25, 50, 100, 200, 400, 800, 1600 and 3200 Hz" << endl;
+		return 1;
+	}
+	if (!imu.Open())
+	{
+		cerr << "Failed to open the IMU" << endl;
+		return 1;
+	}
+
+	cout << "Accelerometer at " << rate << " Hz, bus " ;
+	if (bus)
+		cout << bus << " Hz";
+	else
+		cout << "untimed";
+	cout << ", " << seconds << " s" << endl;
+
+	vector<IMU::AccSample> acc(IMU_ACC_QUEUE_SIZE);
+	vector<IMU::GyroSample> gyro(IMU_GYRO_QUEUE_SIZE);
+	Latency accLatency;
+	Latency gyroLatency;
+
+	uint64_t start = Now();
+	unsigned long transfers = i2c.GetTransfers();
+	uint64_t end = start + seconds * 1000000000ULL;
+	for (uint64_t next = start; next < end; next += 1000000000ULL / DRAIN_RATE)
+	{
+		SleepUntil(next);
+		unsigned int count = imu.DrainAcc(&acc[0], acc.size());
+		uint64_t now = Now();
+		for (unsigned int i = 0; i < count; i++)
+			accLatency.Add(now, acc[i].timestamp);
+		count = imu.DrainGyro(&gyro[0], gyro.size());
+		for (unsigned int i = 0; i < count; i++)
+			gyroLatency.Add(now, gyro[i].timestamp);
+	}
+	double elapsed = (Now() - start) / 1e9;
+	transfers = i2c.GetTransfers() - transfers;
+	imu.Close();
+
+	accLatency.Print("Accelerometer: ", elapsed);
+	gyroLatency.Print("Gyroscope:     ", elapsed);
+	cout << "Lost: " << imu.GetAccOverruns() << " FIFO overruns, "
+	     << imu.GetAccOverflows() << " + " << imu.GetGyroOverflows() << " queue overflows" << endl;
+	cout << "I2C: " << transfers / elapsed << " transactions/s" << endl;
+	return 0;
+}
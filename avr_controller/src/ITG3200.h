@@ -41,3 +41,10 @@
 #define ITG3200_INT_CFG_INT_ANYRD    (1<<4)
 #define ITG3200_INT_CFG_ITG_RDY_EN   (1<<2)
 #define ITG3200_INT_CFG_RAW_RDY_EN   (1<<0)
+
+// Interrupt Status Bits
+#define ITG3200_INT_STATUS_ITG_RDY      (1<<2)
+#define ITG3200_INT_STATUS_RAW_DATA_RDY (1<<0)
+
+#define ITG3200_ID_MASK           0x7E // WHO_AM_I holds bits 6-1 of the address
+#define I2C_ADDRESS_ITG3200       0x68 // AD0 pin grounded
@@ -21,11 +21,13 @@
  */
 
 #include "SentryMonitor.h"
+#include "EncoderMessage.h"
 #include "GPIO.h"
 #include "BeagleBoardAddressBook.h"
 #include "ArduinoAddressBook.h"
 #include "ParamServer.h"
 
+#include <boost/bind.hpp>
 #include <unistd.h> // for usleep()
 #include <string>
 #include <iostream>
@@ -36,13 +38,37 @@ using namespace std;
 
 int main(int argc, char **argv)
 {
+	bool edges = false;
+	bool calibrate = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg == "--edges")
+			edges = true;
+		else if (arg == "--calibrate")
+			calibrate = true;
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--edges] [--calibrate]" << endl;
+			return 1;
+		}
+	}
+
 	SentryMonitor justdoit;
-	justdoit.Main();
+	justdoit.Main(edges, calibrate);
 	return 0;
 }
 
-void SentryMonitor::Main()
+void SentryMonitor::Main(bool edges, bool calibrate)
 {
+	// Encoder messages are logged by m_arduino's read thread as they arrive
+	string filename = NextFilename();
+	if (!m_log.Open(filename))
+		return;
+	m_arduino.SetTelemetry(m_log.CreateStream());
+	m_arduino.Subscribe(FSM_ENCODER, boost::bind(&SentryMonitor::OnEncoder, this, _1));
+	m_arduino.Subscribe(FSM_SENTRY, boost::bind(&SentryMonitor::OnSentry, this, _1));
+
 	cout << "Opening Arduino port" << endl;
 	GPIO gpio(ARDUINO_BRIDGE1);
 	gpio.Open();
@@ -57,85 +83,96 @@ void SentryMonitor::Main()
 
 	cout << "Uploading Sentry" << endl;
 	ParamServer::Sentry sentry;
+	sentry.SetEdges(edges ? 1 : 0);
+	sentry.SetCalibrate(calibrate ? 1 : 0);
 	m_arduino.CreateFSM(sentry.GetString());
 
-	int timeout = 0;
-	string samples;
-	while (timeout <= 5000)
+	// The edges format is quiet while the wheel is still, so silence only
+	// means the Sentry is done once it has lasted SENTRY_TIMEOUT
+	unsigned int timeout = 0;
+	while (timeout < SENTRY_TIMEOUT)
 	{
-		string response;
-		// Publish period = 1ms / 2 samples * 128 samples / message = 64ms
-		if (m_arduino.Receive(FSM_ENCODER, response, 128))
-		{
-			// Parse the response manually
-			if (response.length() <= 4)
-			{
-				cout << "Error: Invalid message length (" << response.length() << ")" << endl;
-				break; // Invalid message
-			}
-
-			const uint8_t *bytes = reinterpret_cast<const uint8_t*>(response.c_str());
-			unsigned int sampleCount = bytes[3];
-			// Make sure we don't overshoot the size of the array
-			if (sampleCount >  8 * (response.length() - 4))
-			{
-				cout << "Error: Invalid samples size (" << sampleCount << ")" << endl;
-				break;
-			}
-
-			bytes += 4; // Fast-forward to pertinent data
-
-			for (unsigned int i = 0; i < sampleCount; i++)
-			{
-				samples.push_back(bytes[i / 8] & (1 << (i % 8)) ? '1' : '0');
-				samples.push_back(' ');
-			}
+		usleep(SENTRY_REPORT_PERIOD * 1000);
 
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (m_bReceived)
+		{
+			cout << m_tracker.GetTicks() << " ticks in " << m_tracker.GetSamples() <<
+				(edges ? " edges" : " samples") << ", " << m_tracker.GetRPM() << " RPM" << endl;
+			m_bReceived = false;
 			timeout = 0;
 		}
 		else
 		{
-			if (samples.length())
-			{
-				// Finished gathering our set of samples
-				Process(samples);
-				samples = "";
-			}
-			timeout += 128;
-			// Report every second
-			if (timeout % 1000 < 128)
-				cout << "Timeout (" << timeout << " ms)..." << endl;
+			// The edges format is silent while the wheel is still
+			m_tracker.Advance(SENTRY_REPORT_PERIOD * 1000);
+			timeout += SENTRY_REPORT_PERIOD;
+			cout << "Timeout (" << timeout << " ms)..." << endl;
 		}
 	}
 	cout << "Finished receiving data" << endl;
 	m_arduino.DestroyFSM(sentry.GetString());
 	gpio.SetValue(0);
+
+	m_arduino.Unsubscribe(FSM_ENCODER);
+	m_arduino.Unsubscribe(FSM_SENTRY);
+	m_arduino.Close();
+	m_log.Close();
+
+	cout << "Logged " << m_tracker.GetMessages() << " messages (" << m_tracker.GetTicks() << " ticks) to " <<
+		filename << ", " << m_log.GetRecords() << " records" << endl;
+	if (m_invalid)
+		cout << "Error: " << m_invalid << " invalid messages" << endl;
+}
+
+void SentryMonitor::OnEncoder(const string &msg)
+{
+	EncoderMessage encoder;
+	bool valid = encoder.Parse(msg);
+
+	boost::mutex::scoped_lock lock(m_mutex);
+	if (valid)
+	{
+		m_tracker.Add(encoder);
+		m_bReceived = true;
+	}
+	else
+	{
+		m_invalid++;
+	}
+}
+
+void SentryMonitor::OnSentry(const string &msg)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	if (msg.length() != ParamServer::SentryPublisherMsg::GetLength())
+	{
+		m_invalid++;
+		return;
+	}
+
+	// Left comes first, so its endpoint is negative
+	ParamServer::SentryPublisherMsg sentry(msg);
+	cout << (sentry.GetMicroseconds() < 0 ? "Left" : "Right") << " endpoint: " <<
+		sentry.GetMicroseconds() << " us, " << (unsigned int)sentry.GetTicks() << " ticks";
+	if (sentry.GetMicrosPerTick())
+		cout << ", " << sentry.GetMicrosPerTick() / 256.0 << " us/tick";
+	cout << endl;
 }
 
-void SentryMonitor::Process(const string &samples)
+string SentryMonitor::NextFilename()
 {
 	int i = 0;
 	char filename[32];
 	while (i < 10000)
 	{
-		snprintf(filename, sizeof(filename), "%s%04d.txt", CurrentDate().c_str(), i);
+		snprintf(filename, sizeof(filename), "%s%04d.tlog", CurrentDate().c_str(), i);
 		ifstream ifile(filename);
 		if (!ifile)
 			break; // Found our file name
 		i++;
 	}
-
-	//get the current time from the clock -- one second resolution
-	ofstream ofile(filename);
-	if (!ofile)
-	{
-		cout << "Error: Count not write to file: " << filename << endl;
-		return;
-	}
-
-	ofile << samples;
-	ofile.close();
-	cout << "Wrote " << (samples.length() / 2) << " samples to " << filename << endl;
+	return filename;
 }
 
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
@@ -22,18 +22,58 @@
 #pragma once
 
 #include "AVRController.h"
+#include "EncoderTracker.h"
+#include "TelemetryWriter.h"
+
 #include <boost/thread.hpp>
+#include <string>
+
+#define SENTRY_REPORT_PERIOD 1000 // ms
+#define SENTRY_TIMEOUT       5000 // ms
 
+/**
+ * Run the Sentry and follow its encoder as the messages stream in: each
+ * message is counted by an EncoderTracker and logged to a telemetry file
+ * (written out incrementally by TelemetryWriter), then dropped. Ticks and
+ * RPM are reported every second, until the encoder has been quiet for
+ * SENTRY_TIMEOUT ms.
+ */
 class SentryMonitor
 {
 public:
-	SentryMonitor() { }
-	void Main();
+	SentryMonitor() : m_invalid(0), m_bReceived(false) { }
+
+	/**
+	 * \param edges Have the encoder send transition timestamps instead of
+	 *        level samples
+	 * \param calibrate Find the servo's endpoints from the encoder instead of
+	 *        stepping out to MIN/MAX_MICROS
+	 */
+	void Main(bool edges, bool calibrate);
 
 	static const std::string CurrentDate();
 
 private:
-	void Process(const std::string &samples);
-	AVRController m_arduino;
-};
+	/**
+	 * Called by m_arduino's read thread with each FSM_ENCODER message.
+	 */
+	void OnEncoder(const std::string &msg);
+
+	/**
+	 * Called by m_arduino's read thread with each FSM_SENTRY message, one
+	 * per side.
+	 */
+	void OnSentry(const std::string &msg);
 
+	/**
+	 * Find an unused log file name for today: YYYYmmddNNNN.tlog.
+	 */
+	static std::string NextFilename();
+
+	AVRController   m_arduino;
+	TelemetryWriter m_log;
+	EncoderTracker  m_tracker;
+	unsigned long   m_invalid;   // Messages that didn't parse
+	bool            m_bReceived; // Since the last report
+	boost::mutex    m_mutex;     // For the above
+};
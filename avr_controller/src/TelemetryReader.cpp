@@ -0,0 +1,167 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "TelemetryReader.h"
+
+#include <errno.h>    // for errno
+#include <fcntl.h>    // for open()
+#include <iostream>   // for cerr
+#include <string.h>   // for strerror()
+#include <sys/mman.h> // for mmap()
+#include <sys/stat.h> // for fstat()
+#include <unistd.h>   // for close()
+
+using namespace std;
+
+bool TelemetryReader::Open(const string &path)
+{
+	Close();
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		cerr << "TelemetryReader::Open - Can't open " << path << ": " << strerror(errno) << endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Telemetry::FileHeader))
+	{
+		cerr << "TelemetryReader::Open - " << path << " is not a telemetry log" << endl;
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // The mapping keeps the file
+	if (data == MAP_FAILED)
+	{
+		cerr << "TelemetryReader::Open - Can't map " << path << ": " << strerror(errno) << endl;
+		return false;
+	}
+	m_data = reinterpret_cast<const uint8_t*>(data);
+	m_size = st.st_size;
+
+	const Telemetry::FileHeader &header = GetHeader();
+	if (header.magic != TELEMETRY_MAGIC || header.version != TELEMETRY_VERSION ||
+		header.headerSize < sizeof(Telemetry::FileHeader) || header.headerSize > m_size ||
+		header.headerSize % TELEMETRY_ALIGN != 0 ||
+		header.chunkSize <= sizeof(Telemetry::ChunkHeader) || header.chunkSize % TELEMETRY_ALIGN != 0)
+	{
+		cerr << "TelemetryReader::Open - " << path << " is not a version " << TELEMETRY_VERSION << " telemetry log" << endl;
+		Close();
+		return false;
+	}
+
+	// Only whole chunks count; the last may still be being written
+	unsigned int chunks = (m_size - header.headerSize) / header.chunkSize;
+	for (m_chunkCount = 0; m_chunkCount < chunks; m_chunkCount++)
+	{
+		if (!Validate(m_chunkCount))
+			break;
+	}
+	Rewind();
+	return true;
+}
+
+void TelemetryReader::Close() throw()
+{
+	if (m_data)
+	{
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+		m_data = NULL;
+		m_size = 0;
+	}
+	m_chunkCount = 0;
+	Rewind();
+}
+
+bool TelemetryReader::Validate(unsigned int chunk) const
+{
+	const uint32_t chunkSize = GetHeader().chunkSize;
+	const uint8_t *data = GetChunkData(chunk);
+	const Telemetry::ChunkHeader &header = GetChunk(chunk);
+	if (header.magic != TELEMETRY_CHUNK_MAGIC || header.sequence != chunk)
+		return false;
+	// Records and index must fit, without overlapping
+	if ((uint64_t)sizeof(header) + header.used + (uint64_t)header.count * sizeof(uint32_t) > chunkSize)
+		return false;
+
+	const uint32_t *index = reinterpret_cast<const uint32_t*>(data + chunkSize - header.count * sizeof(uint32_t));
+	for (unsigned int i = 0; i < header.count; i++)
+	{
+		if (index[i] < sizeof(header) || index[i] % TELEMETRY_ALIGN != 0 ||
+			index[i] + sizeof(Telemetry::RecordHeader) > sizeof(header) + header.used)
+			return false;
+		const Telemetry::RecordHeader &record = *reinterpret_cast<const Telemetry::RecordHeader*>(data + index[i]);
+		if (index[i] + sizeof(record) + record.length > sizeof(header) + header.used)
+			return false;
+	}
+	return true;
+}
+
+bool TelemetryReader::GetRecord(unsigned int chunk, unsigned int index, Record &record) const
+{
+	if (chunk >= m_chunkCount || index >= GetChunk(chunk).count)
+		return false;
+
+	const uint32_t chunkSize = GetHeader().chunkSize;
+	const uint8_t *data = GetChunkData(chunk);
+	const uint32_t *offsets = reinterpret_cast<const uint32_t*>(data + chunkSize - GetChunk(chunk).count * sizeof(uint32_t));
+	const Telemetry::RecordHeader &header = *reinterpret_cast<const Telemetry::RecordHeader*>(data + offsets[index]);
+	record.timestamp = header.timestamp;
+	record.type = header.type;
+	record.length = header.length;
+	record.payload = &header + 1;
+	return true;
+}
+
+bool TelemetryReader::Next(Record &record)
+{
+	while (m_chunk < m_chunkCount)
+	{
+		if (GetRecord(m_chunk, m_record, record))
+		{
+			m_record++;
+			return true;
+		}
+		m_chunk++;
+		m_record = 0;
+	}
+	return false;
+}
+
+bool TelemetryReader::Seek(uint64_t timestamp)
+{
+	for (unsigned int chunk = 0; chunk < m_chunkCount; chunk++)
+	{
+		if (GetChunk(chunk).last >= timestamp)
+		{
+			m_chunk = chunk;
+			m_record = 0;
+			return true;
+		}
+	}
+	m_chunk = m_chunkCount;
+	m_record = 0;
+	return false;
+}
@@ -0,0 +1,114 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "AVRController.h"
+#include "ArduinoAddressBook.h"
+#include "BeagleBoardAddressBook.h"
+#include "IMU.h"
+#include "ParamServer.h"
+#include "TelemetryWriter.h"
+
+#include <iostream>
+#include <stdlib.h>   // for atoi()
+#include <string>
+#include <unistd.h>   // for sleep()
+
+#define DEFAULT_SECONDS        60
+#define DEFAULT_BATTERY_PERIOD 30000 // ms
+
+using namespace std;
+
+/**
+ * Record a telemetry log from the robot.
+ *
+ *     telemetryrecord [--seconds=N] [--battery=ms] [--imu] log.tlog
+ *
+ * The battery voltage is published by the Arduino every --battery ms (0 for
+ * never), and every IMU sample is logged with --imu. Encoder samples and
+ * motor current sense are logged whenever the Arduino sends them. Convert
+ * the log with telemetry2csv.
+ */
+int main(int argc, char **argv)
+{
+	unsigned int seconds = DEFAULT_SECONDS;
+	unsigned int battery = DEFAULT_BATTERY_PERIOD;
+	bool bImu = false;
+	string path;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 10, "--seconds=") == 0)
+			seconds = atoi(arg.substr(10).c_str());
+		else if (arg.compare(0, 10, "--battery=") == 0)
+			battery = atoi(arg.substr(10).c_str());
+		else if (arg == "--imu")
+			bImu = true;
+		else if (arg.compare(0, 2, "--") != 0 && path.empty())
+			path = arg;
+		else
+		{
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty() || seconds == 0)
+	{
+		cerr << "Usage: " << argv[0] << " [--seconds=N] [--battery=ms] [--imu] log.tlog" << endl;
+		return 1;
+	}
+
+	TelemetryWriter log;
+	if (!log.Open(path))
+		return 1;
+
+	AVRController arduino;
+	arduino.SetTelemetry(log.CreateStream());
+	if (!arduino.Open(ARDUINO_PORT))
+	{
+		cerr << "Failed to open " << ARDUINO_PORT << endl;
+		return 1;
+	}
+
+	ParamServer::AnalogPublisher publisher;
+	publisher.SetPin(BATTERY_VOLTAGE);
+	publisher.SetDelay(battery);
+	if (battery)
+		arduino.CreateFSM(publisher.GetString());
+
+	IMU imu;
+	imu.SetTelemetry(log.CreateStream());
+	if (bImu && !imu.Open())
+		cerr << "Failed to open the IMU, continuing without it" << endl;
+
+	cout << "Recording to " << path << " for " << seconds << " s" << endl;
+	sleep(seconds);
+
+	imu.Close();
+	if (battery)
+		arduino.DestroyFSM(publisher.GetString());
+	arduino.Close();
+	log.Close();
+
+	cout << "Wrote " << log.GetRecords() << " records in " << log.GetChunks() << " chunks" << endl;
+	return 0;
+}
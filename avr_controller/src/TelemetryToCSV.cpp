@@ -0,0 +1,166 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "EncoderMessage.h"
+#include "TelemetryReader.h"
+
+#include <iostream>
+#include <stdio.h>    // for printf()
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Convert a telemetry log to CSV on stdout, one record per line.
+ *
+ *     telemetry2csv [--types=acc,gyro,encoder,current,battery,edges] log.tlog
+ *
+ * Each line starts with the record type and its timestamp (CLOCK_MONOTONIC,
+ * ns), followed by the record's fields:
+ *
+ *     acc,<timestamp>,<x g>,<y g>,<z g>
+ *     gyro,<timestamp>,<x deg/s>,<y deg/s>,<z deg/s>,<temp C>
+ *     encoder,<timestamp>,<count>,<samples as 0s and 1s, oldest first>
+ *     current,<timestamp>,<motor1>,<motor2>,<motor3>,<motor4>
+ *     battery,<timestamp>,<raw>,<volts>
+ *     edges,<timestamp>,<level before the first edge>,<us since the previous edge>,...
+ *
+ * The acc and gyro lines are what fusionbench reads. Lines are in the order
+ * the records were logged, which is only in time order within each type.
+ */
+namespace
+{
+	const char *TYPE_NAMES[] = { NULL, "acc", "gyro", "encoder", "current", "battery", "edges" };
+	const unsigned int TYPE_COUNT = sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]);
+
+	/**
+	 * Parse a comma-separated list of type names into a mask of types.
+	 */
+	bool ParseTypes(const string &list, uint32_t &types)
+	{
+		types = 0;
+		size_t start = 0;
+		while (start <= list.length())
+		{
+			size_t end = list.find(',', start);
+			if (end == string::npos)
+				end = list.length();
+			string name = list.substr(start, end - start);
+			unsigned int type;
+			for (type = 1; type < TYPE_COUNT; type++)
+			{
+				if (name == TYPE_NAMES[type])
+					break;
+			}
+			if (type == TYPE_COUNT)
+				return false;
+			types |= 1 << type;
+			start = end + 1;
+		}
+		return true;
+	}
+
+	void Print(const TelemetryReader::Record &record)
+	{
+		unsigned long long timestamp = record.timestamp;
+		if (const Telemetry::Acc *acc = record.As<Telemetry::Acc>())
+		{
+			printf("acc,%llu,%f,%f,%f\n", timestamp, acc->x, acc->y, acc->z);
+		}
+		else if (const Telemetry::Gyro *gyro = record.As<Telemetry::Gyro>())
+		{
+			printf("gyro,%llu,%f,%f,%f,%f\n", timestamp, gyro->xrot, gyro->yrot, gyro->zrot, gyro->temp);
+		}
+		else if (const Telemetry::Encoder *encoder = record.As<Telemetry::Encoder>())
+		{
+			unsigned int count = encoder->count;
+			if (count > 8 * (record.length - 1u))
+				count = 8 * (record.length - 1u); // Truncated
+			printf("encoder,%llu,%u,", timestamp, count);
+			for (unsigned int i = 0; i < count; i++)
+				putchar(encoder->bits[i / 8] & (1 << (i % 8)) ? '1' : '0');
+			putchar('\n');
+		}
+		else if (const Telemetry::EncoderEdges *edges = record.As<Telemetry::EncoderEdges>())
+		{
+			// A delta cut short by truncation is dropped
+			vector<uint32_t> deltas;
+			EncoderMessage::DecodeVarints(edges->data, record.length ? record.length - 1u : 0, deltas);
+			printf("edges,%llu,%u", timestamp, edges->level);
+			for (unsigned int i = 0; i < deltas.size(); i++)
+				printf(",%u", deltas[i]);
+			putchar('\n');
+		}
+		else if (const Telemetry::MotorCurrent *current = record.As<Telemetry::MotorCurrent>())
+		{
+			printf("current,%llu,%u,%u,%u,%u\n", timestamp, current->motor[0], current->motor[1], current->motor[2], current->motor[3]);
+		}
+		else if (const Telemetry::Battery *battery = record.As<Telemetry::Battery>())
+		{
+			printf("battery,%llu,%u,%f\n", timestamp, battery->raw, battery->volts);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t types = ~0;
+	string path;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 8, "--types=") == 0 && ParseTypes(arg.substr(8), types))
+			continue;
+		else if (arg.compare(0, 2, "--") != 0 && path.empty())
+			path = arg;
+		else
+		{
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty())
+	{
+		cerr << "Usage: " << argv[0] << " [--types=acc,gyro,encoder,current,battery,edges] log.tlog" << endl;
+		return 1;
+	}
+
+	TelemetryReader reader;
+	if (!reader.Open(path))
+		return 1;
+
+	for (unsigned int chunk = 0; chunk < reader.GetChunkCount(); chunk++)
+	{
+		// Skip chunks with nothing of interest without touching their records
+		if (!(reader.GetChunk(chunk).types & types))
+			continue;
+		TelemetryReader::Record record;
+		for (unsigned int i = 0; reader.GetRecord(chunk, i, record); i++)
+		{
+			if (record.type < 32 && (types & (1 << record.type)))
+				Print(record);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ *        Copyright (C) 2112 Garrett Brown <gbruin@ucla.edu>
+ *
+ *  This Program is free software; you can redistribute it and/or modify it
+ *  under the terms of the Modified BSD License.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the organization nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  This Program is distributed AS IS in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "TelemetryWriter.h"
+
+#include <boost/bind.hpp>
+#include <errno.h>    // for errno
+#include <fcntl.h>    // for open()
+#include <iostream>   // for cerr
+#include <string.h>   // for memcpy(), strerror()
+#include <time.h>     // for clock_gettime()
+#include <unistd.h>   // for pwrite(), close(), usleep()
+
+#define TELEMETRY_DRAIN_BATCH 64 // records
+
+using namespace std;
+
+namespace
+{
+	uint64_t Now(clockid_t clock)
+	{
+		struct timespec ts;
+		clock_gettime(clock, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	uint32_t Padded(uint32_t length)
+	{
+		return (length + TELEMETRY_ALIGN - 1) & ~(TELEMETRY_ALIGN - 1);
+	}
+}
+
+bool TelemetryWriter::Stream::Log(uint16_t type, uint64_t timestamp, const void *payload, uint16_t length)
+{
+	if (length > TELEMETRY_MAX_PAYLOAD)
+		return false;
+
+	Slot slot;
+	slot.header.timestamp = timestamp;
+	slot.header.type = type;
+	slot.header.length = length;
+	slot.header.reserved = 0;
+	memcpy(slot.payload, payload, length);
+	if (!m_queue.Push(slot))
+	{
+		m_dropped++;
+		return false;
+	}
+	return true;
+}
+
+TelemetryWriter::TelemetryWriter() : m_fd(INVALID_DESCRIPTOR), m_running(false), m_records(0), m_chunks(0)
+{
+}
+
+TelemetryWriter::~TelemetryWriter() throw()
+{
+	Close();
+	for (vector<Stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+		delete *it;
+}
+
+bool TelemetryWriter::Open(const string &path)
+{
+	if (IsOpen())
+		return false;
+
+	m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0)
+	{
+		cerr << "TelemetryWriter::Open - Can't create " << path << ": " << strerror(errno) << endl;
+		return false;
+	}
+
+	Telemetry::FileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = TELEMETRY_MAGIC;
+	header.version = TELEMETRY_VERSION;
+	header.headerSize = sizeof(header);
+	header.chunkSize = TELEMETRY_CHUNK_SIZE;
+	header.monotonic = Now(CLOCK_MONOTONIC);
+	header.realtime = Now(CLOCK_REALTIME);
+	if (pwrite(m_fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		cerr << "TelemetryWriter::Open - Can't write to " << path << ": " << strerror(errno) << endl;
+		close(m_fd);
+		m_fd = INVALID_DESCRIPTOR;
+		return false;
+	}
+
+	m_chunk.assign(TELEMETRY_CHUNK_SIZE, 0);
+	m_index.clear();
+	memset(&m_header, 0, sizeof(m_header));
+	m_header.magic = TELEMETRY_CHUNK_MAGIC;
+	m_records = 0;
+	m_chunks = 0;
+
+	m_running = true;
+	boost::thread temp(boost::bind(&TelemetryWriter::WriteRun, this));
+	m_thread.swap(temp);
+	return true;
+}
+
+void TelemetryWriter::Close() throw()
+{
+	m_running = false;
+	m_thread.join();
+	if (IsOpen())
+	{
+		close(m_fd);
+		m_fd = INVALID_DESCRIPTOR;
+	}
+}
+
+TelemetryWriter::Stream *TelemetryWriter::CreateStream()
+{
+	boost::mutex::scoped_lock lock(m_streamMutex);
+	m_streams.push_back(new Stream);
+	return m_streams.back();
+}
+
+void TelemetryWriter::WriteRun()
+{
+	uint64_t lastFlush = Now(CLOCK_MONOTONIC);
+	bool ok = true;
+	while (m_running && ok)
+	{
+		ok = Drain();
+		uint64_t now = Now(CLOCK_MONOTONIC);
+		if (ok && now - lastFlush >= TELEMETRY_FLUSH_PERIOD * 1000000ULL)
+		{
+			ok = Flush();
+			lastFlush = now;
+		}
+		usleep(TELEMETRY_POLL_PERIOD);
+	}
+
+	// Whatever was logged before Close() makes it to the file
+	if (ok && Drain())
+		Flush();
+}
+
+bool TelemetryWriter::Drain()
+{
+	boost::mutex::scoped_lock lock(m_streamMutex);
+	Stream::Slot slots[TELEMETRY_DRAIN_BATCH];
+	for (vector<Stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+	{
+		unsigned int count;
+		do
+		{
+			count = (*it)->m_queue.Pop(slots, TELEMETRY_DRAIN_BATCH);
+			for (unsigned int i = 0; i < count; i++)
+			{
+				if (!Append(slots[i]))
+					return false;
+			}
+		} while (count == TELEMETRY_DRAIN_BATCH);
+	}
+	return true;
+}
+
+bool TelemetryWriter::Append(const Stream::Slot &slot)
+{
+	uint32_t size = sizeof(Telemetry::RecordHeader) + Padded(slot.header.length);
+	if (sizeof(Telemetry::ChunkHeader) + m_header.used + size + sizeof(uint32_t) * (m_header.count + 1) > TELEMETRY_CHUNK_SIZE)
+	{
+		// Full: write it out for the last time and start the next
+		if (!Flush())
+			return false;
+		m_header.sequence++;
+		m_header.count = 0;
+		m_header.used = 0;
+		m_header.types = 0;
+		m_index.clear();
+		memset(&m_chunk[0], 0, m_chunk.size());
+	}
+
+	uint32_t offset = sizeof(Telemetry::ChunkHeader) + m_header.used;
+	memcpy(&m_chunk[offset], &slot.header, sizeof(slot.header));
+	memcpy(&m_chunk[offset + sizeof(slot.header)], slot.payload, slot.header.length);
+	m_index.push_back(offset);
+
+	if (m_header.count == 0 || slot.header.timestamp < m_header.first)
+		m_header.first = slot.header.timestamp;
+	if (m_header.count == 0 || slot.header.timestamp > m_header.last)
+		m_header.last = slot.header.timestamp;
+	if (slot.header.type < 32)
+		m_header.types |= 1 << slot.header.type;
+	m_header.count++;
+	m_header.used += size;
+	m_chunks = m_header.sequence + 1;
+	m_records++;
+	return true;
+}
+
+bool TelemetryWriter::Flush()
+{
+	if (m_header.count == 0)
+		return true;
+
+	memcpy(&m_chunk[0], &m_header, sizeof(m_header));
+	memcpy(&m_chunk[TELEMETRY_CHUNK_SIZE - sizeof(uint32_t) * m_index.size()], &m_index[0], sizeof(uint32_t) * m_index.size());
+
+	off_t offset = sizeof(Telemetry::FileHeader) + (off_t)m_header.sequence * TELEMETRY_CHUNK_SIZE;
+	if (pwrite(m_fd, &m_chunk[0], TELEMETRY_CHUNK_SIZE, offset) != TELEMETRY_CHUNK_SIZE)
+	{
+		cerr << "TelemetryWriter::Flush - Write failed: " << strerror(errno) << endl;
+		return false;
+	}
+	return true;
+}
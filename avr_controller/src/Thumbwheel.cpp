@@ -22,56 +22,72 @@
 
 #include "Thumbwheel.h"
 
-#include <unistd.h> // for usleep()
+#include <boost/bind.hpp>
 
 #define SETTLING_TIME 1000 // ms
-#define SETTLING_STEP 100 // ms
+
+const unsigned int Thumbwheel::PINS[3] = { THUMBWHEEL1, THUMBWHEEL2, THUMBWHEEL4 };
 
 bool Thumbwheel::Open()
 {
-	if (!(m_pin1.Open() && m_pin2.Open() && m_pin4.Open()))
+	if (!m_pins.Open())
 		return false;
-	m_pin1.SetDirection(GPIO::IN);
-	m_pin2.SetDirection(GPIO::IN);
-	m_pin4.SetDirection(GPIO::IN);
-	m_pin1.SetEdge(GPIO::BOTH);
-	m_pin2.SetEdge(GPIO::BOTH);
-	m_pin4.SetEdge(GPIO::BOTH);
+	m_pins.SetDirection(GPIO::IN);
+	m_pins.SetEdge(GPIO::NONE);
 	return true;
 }
 
 unsigned int Thumbwheel::GetValue()
 {
-	return (1 - m_pin1.GetValue()) << 0 | (1 - m_pin2.GetValue()) << 1 | (1 - m_pin4.GetValue()) << 2;
+	// All three bits at once, so a value that is changing can't be read torn
+	return ~m_pins.GetValues() & 0x7;
 }
 
-bool Thumbwheel::Poll(unsigned long timeout, unsigned int &value)
+namespace
 {
-	// Poll on pin 1, because the 1's bit changes on every value
-	unsigned long duration;
-	if (!m_pin1.Poll(timeout, duration))
-		return false;
-	(void)duration; // silence compiler warning
-
-	// We want to go SETTLING_TIME milliseconds without seeing a new value
-	unsigned int oldValue = GetValue();
-	unsigned int newValue;
-	int timeLeft = SETTLING_TIME;
-	do
+	void OnSettled(const Thumbwheel::ChangeHandler &onChange, uint32_t values)
 	{
-		usleep(SETTLING_STEP * 1000);
-		timeLeft -= SETTLING_STEP;
-		newValue = GetValue();
-		// If the value changed, use it as the old value and start over
-		if (newValue != oldValue)
-		{
-			oldValue = newValue;
-			timeLeft = SETTLING_TIME;
-		}
+		// Active low
+		onChange(~values & 0x7);
+	}
 
+	void OnPolled(GPIOEventLoop &events, unsigned int &result, bool &changed, unsigned int value)
+	{
+		result = value;
+		changed = true;
+		events.Stop();
 	}
-	while (timeLeft > 0);
+}
 
-	value = newValue;
+bool Thumbwheel::Watch(GPIOEventLoop &events, const ChangeHandler &onChange)
+{
+	m_pins.SetEdge(GPIO::BOTH);
+	if (!events.AddGroup(m_pins, boost::bind(OnSettled, onChange, _1), SETTLING_TIME * 1000UL))
+	{
+		m_pins.SetEdge(GPIO::NONE);
+		return false;
+	}
 	return true;
 }
+
+void Thumbwheel::Unwatch(GPIOEventLoop &events)
+{
+	events.RemoveGroup(m_pins);
+
+	// Edges are only enabled while watching: with the chardev, pins requested
+	// for edges can't be read together (see GPIOGroup)
+	m_pins.SetEdge(GPIO::NONE);
+}
+
+bool Thumbwheel::Poll(unsigned long timeout, unsigned int &value)
+{
+	GPIOEventLoop events;
+	bool changed = false;
+	if (!events.Open() || !Watch(events, boost::bind(OnPolled, boost::ref(events), boost::ref(value), boost::ref(changed), _1)))
+		return false;
+
+	events.AddTimer(timeout, boost::bind(&GPIOEventLoop::Stop, &events));
+	events.Run();
+	Unwatch(events);
+	return changed;
+}
@@ -22,16 +22,27 @@
 
 #include "Upstart.h"
 #include "GPIO.h"
+#include "GPIOBackend.h"
 #include "BeagleBoardAddressBook.h"
 #include "ParamServer.h"
 
-#include <unistd.h> // for usleep
+#include <boost/bind.hpp>
+#include <errno.h>         // for errno
+#include <poll.h>          // for poll()
+#include <stdlib.h>        // for system
+#include <string.h>        // for strerror()
+#include <sys/inotify.h>   // for inotify_init1()
+#include <time.h>          // for clock_gettime()
+#include <unistd.h>        // for access(), read()
 #include <string>
+#include <vector>
 
 #include <iostream>
 
 #define SHUTDOWN_COMMAND "./system_shutdown" // in current bin directory
 #define BUTTON_TIMEOUT 5000000UL  // 5.0s
+#define BUTTON_DEBOUNCE 20000UL   // 20ms
+#define SERIAL_TIMEOUT  30000     // ms, the serial port usually appears well before
 //#define POWER_TIMEOUT 5000000UL  // 5.0s
 
 #define RED_FADE 1000
@@ -40,181 +51,240 @@ using namespace std;
 
 int main(int argc, char **argv)
 {
-	Upstart justdoit;
-	justdoit.Main();
+	// Pick the GPIO backend, e.g. --gpio=chardev (see GPIOBackend::Create())
+	GPIOBackend *backend = NULL;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		if (arg.compare(0, 7, "--gpio=") == 0)
+		{
+			delete backend;
+			backend = GPIOBackend::Create(arg.substr(7));
+			if (!backend)
+			{
+				cerr << "Upstart - Unknown GPIO backend: " << arg.substr(7) << endl;
+				return 1;
+			}
+		}
+	}
+	GPIOBackend::SetDefault(backend);
+
+	{
+		Upstart justdoit;
+		justdoit.Main();
+	}
+
+	GPIOBackend::SetDefault(NULL);
+	delete backend;
+	return 0;
 }
-void Upstart::Main()
+Upstart::Upstart() :
+	m_green(BUTTON_GREEN),
+	m_red(BUTTON_RED),
+	m_arduino4(ARDUINO_BRIDGE4),
+	m_greenState(DISABLED),
+	m_redTimer(GPIOEventLoop::INVALID_TIMER)
 {
-	// Wait 10 seconds
-	usleep(10000000L);
+}
 
+void Upstart::Main()
+{
+	Phase phase("export");
+
+	// Export every pin up front, in one go, so opening them later is cheap
+	vector<unsigned int> pins;
+	pins.push_back(ARDUINO_BRIDGE1);
+	pins.push_back(ARDUINO_BRIDGE2);
+	pins.push_back(ARDUINO_BRIDGE3);
+	pins.push_back(ARDUINO_BRIDGE4);
+	pins.push_back(BUTTON_GREEN);
+	pins.push_back(BUTTON_RED);
+	if (!GPIOBackend::GetDefault().Export(pins))
+		cerr << "Upstart::Main - Failed to export GPIO pins" << endl;
+
+	// GPIO is ready, let the Arduino know we're up
 	GPIO arduino1(ARDUINO_BRIDGE1);
 	arduino1.Open();
 	arduino1.SetDirection(GPIO::OUT, 0);
 
-	// Wait 20 seconds
-	usleep(20000000L);
+	// Wait for the Arduino's serial port to show up
+	phase.Next("serial");
+	if (!WaitForDevice(ARDUINO_PORT, SERIAL_TIMEOUT))
+		cerr << "Upstart::Main - Timed out waiting for " << ARDUINO_PORT << endl;
 
-	// Connect to the Arduino
+	// Connect to the Arduino, this waits for the firmware to say hello
+	phase.Next("arduino");
 	arduino.Open(ARDUINO_PORT);
 
-	// Wait 2 seconds
-	usleep(2000000L);
-
+	phase.Next("buttons");
 	GPIO arduino2(ARDUINO_BRIDGE2);
 	arduino2.Open();
 	arduino2.SetDirection(GPIO::OUT, 0);
 
-	// Rev up the threads
-	m_bRunning = true;
-
-	boost::thread tempGreen(boost::bind(&Upstart::GreenThreadRun, this));
-	m_greenThread.swap(tempGreen);
+	ParamServer::Fade fade;
+	fade.SetPin(LED_EMERGENCY);
+	fade.SetPeriod(RED_FADE);
+	fade.SetDelay(50);
+	fade.SetCurve(1);
+	m_strFade = fade.GetString();
+	arduino.DestroyFSM(m_strFade); // Make sure FSM isn't running before we start
 
-	//boost::thread tempYellow(boost::bind(&Upstart::YellowThreadRun, this));
-	//m_yellowThread.swap(tempYellow);
+	bool success = m_events.Open();
+	try
+	{
+		m_arduino4.Open();
+		m_arduino4.SetDirection(GPIO::OUT, 0);
 
-	boost::thread tempRed(boost::bind(&Upstart::RedThreadRun, this));
-	m_redThread.swap(tempRed);
+		m_green.Open();
+		m_green.SetDirection(GPIO::IN);
+		m_green.SetEdge(GPIO::BOTH);
 
-	//boost::thread tempThumbwheel(boost::bind(&Upstart::ThumbwheelThreadRun, this));
-	//m_thumbwheelThread.swap(tempThumbwheel);
+		m_red.Open();
+		m_red.SetDirection(GPIO::IN);
+		m_red.SetEdge(GPIO::BOTH);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+		success = false;
+	}
 
-	//boost::thread tempIMU(boost::bind(&Upstart::IMUThreadRun, this));
-	//m_IMUThread.swap(tempIMU);
+	// Both buttons on one thread: this one
+	if (success &&
+		m_events.AddPin(m_green, boost::bind(&Upstart::OnGreen, this, _1), BUTTON_DEBOUNCE) &&
+		m_events.AddPin(m_red, boost::bind(&Upstart::OnRed, this, _1), BUTTON_DEBOUNCE))
+	{
+		phase.Next(NULL);
+		m_events.Run();
+	}
+	m_events.Close();
 
-	// Run until all threads have completed
-	m_greenThread.join();
-	m_redThread.join();
+	try
+	{
+		if (m_arduino4.IsOpen())
+			m_arduino4.SetValue(1);
+	}
+	catch (const GPIO::Exception &e)
+	{
+		cerr << e.what() << endl;
+	}
+	arduino.DestroyFSM(m_strFade);
 
 	GPIO arduino3(ARDUINO_BRIDGE3);
 	arduino3.Open();
 	arduino3.SetDirection(GPIO::OUT, 0);
 }
 
-void Upstart::GreenThreadRun()
+void Upstart::OnGreen(unsigned int value)
 {
-	GPIO gpio(BUTTON_GREEN);
-	gpio.Open();
-
-	gpio.SetDirection(GPIO::IN);
-	gpio.SetEdge(GPIO::BOTH);
+	if (value != 0)
+		return; // Depressed
 
-	/*
-	ParamServer::BatteryMonitor bm;
-	string fsm = bm.GetString();
-	arduino.DestroyFSM(fsm); // Make sure FSM isn't running before we start
-	*/
-
-	GPIO arduino4(ARDUINO_BRIDGE4);
-	arduino4.Open();
-	arduino4.SetDirection(GPIO::OUT, 0);
-
-	enum STATE
+	// Pressed
+	try
 	{
-		ENABLED = 0,
-		DISABLED = 1
-	} state = DISABLED;
-
-	unsigned long duration = 0;
-	unsigned int post_value = 0;
-
-	while (m_bRunning)
-	{
-		try
+		if (m_greenState == DISABLED)
 		{
-			if (gpio.Poll(BUTTON_TIMEOUT, duration, true, post_value))
-			{
-				// No timeout
-				if (post_value == 0)
-				{
-					// Pressed
-					if (state == DISABLED)
-					{
-						//arduino.CreateFSM(fsm);
-						arduino4.SetValue(1);
-						state = ENABLED;
-					}
-					else
-					{
-						//arduino.DestroyFSM(fsm);
-						arduino4.SetValue(0);
-						state = DISABLED;
-					}
-				}
-				else
-				{
-					// Depressed
-				}
-			}
-			else
-			{
-				// Timeout
-			}
+			m_arduino4.SetValue(1);
+			m_greenState = ENABLED;
 		}
-		catch (const GPIO::Exception &e)
+		else
 		{
-			m_bRunning = false;
+			m_arduino4.SetValue(0);
+			m_greenState = DISABLED;
 		}
 	}
-	//arduino.DestroyFSM(fsm);
-	arduino4.SetValue(1);
+	catch (const GPIO::Exception &e)
+	{
+		// Let Main() shut down cleanly instead of unwinding out of Run()
+		cerr << e.what() << endl;
+		m_events.Stop();
+	}
 }
 
-void Upstart::RedThreadRun()
+void Upstart::OnRed(unsigned int value)
 {
-	GPIO gpio(BUTTON_RED);
-	gpio.Open();
-
-	gpio.SetDirection(GPIO::IN);
-	gpio.SetEdge(GPIO::BOTH);
+	if (value == 0)
+	{
+		// Pressed, start counting towards a shutdown
+		arduino.CreateFSM(m_strFade);
+		m_events.CancelTimer(m_redTimer);
+		m_redTimer = m_events.AddTimer(BUTTON_TIMEOUT, boost::bind(&Upstart::OnRedHeld, this));
+	}
+	else
+	{
+		// Depressed before the timeout
+		arduino.DestroyFSM(m_strFade);
+		m_events.CancelTimer(m_redTimer);
+		m_redTimer = GPIOEventLoop::INVALID_TIMER;
+	}
+}
 
-	ParamServer::ChristmasTree xmastree;
-	string strXmastree = xmastree.GetString();
-	ParamServer::Fade fade;
-	fade.SetPin(LED_EMERGENCY);
-	fade.SetPeriod(RED_FADE);
-	fade.SetDelay(50);
-	fade.SetCurve(1);
-	string strFade = fade.GetString();
-	arduino.DestroyFSM(strFade); // Make sure FSM isn't running before we start
+void Upstart::OnRedHeld()
+{
+	m_redTimer = GPIOEventLoop::INVALID_TIMER;
+	arduino.DestroyFSM(m_strFade);
+	int result = system(SHUTDOWN_COMMAND);
+	(void)result;
+	m_events.Stop();
+}
 
-	unsigned long duration = 0;
-	unsigned int post_value = 0;
+bool Upstart::WaitForDevice(const string &path, unsigned long timeout)
+{
+	if (access(path.c_str(), R_OK | W_OK) == 0)
+		return true;
+
+	// Watch the directory: the node is created there, and udev may fix up
+	// its permissions a moment later
+	string dir = path.substr(0, path.find_last_of('/'));
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, dir.empty() ? "/" : dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0)
+	{
+		cerr << "Upstart::WaitForDevice - inotify error: " << strerror(errno) << endl;
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
 
-	while (m_bRunning)
+	uint64_t deadline = Phase::Now() + timeout;
+	bool ready = false;
+	for (;;)
 	{
-		try
+		// Check after adding the watch, so a node created in between is seen
+		if (access(path.c_str(), R_OK | W_OK) == 0)
 		{
-			if (gpio.Poll(BUTTON_TIMEOUT, duration, true, post_value))
-			{
-				// No timeout
-				if (post_value == 0)
-					arduino.CreateFSM(strFade);
-				else
-					arduino.DestroyFSM(strFade);
-			}
-			else
-			{
-				// Timed out
-				if (gpio.GetValue() == 0)
-				{
-					// Timed out on press waiting for depress
-					m_bRunning = false;
-					arduino.DestroyFSM(strFade);
-					int result = system(SHUTDOWN_COMMAND);
-					(void)result;
-				}
-				else
-				{
-					// Timed out on depress waiting for press
-				}
-			}
-		}
-		catch (const GPIO::Exception &e)
-		{
-			m_bRunning = false;
+			ready = true;
+			break;
 		}
+		uint64_t now = Phase::Now();
+		if (now >= deadline)
+			break;
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ret = poll(&pfd, 1, (int)(deadline - now));
+		if (ret < 0 && errno != EINTR)
+			break;
+
+		// Drain the events, we only care that something changed
+		char buf[4096];
+		while (read(fd, buf, sizeof(buf)) > 0) { }
 	}
-	arduino.DestroyFSM(strFade);
+	close(fd);
+	return ready;
+}
+
+uint64_t Upstart::Phase::Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void Upstart::Phase::Next(const char *name)
+{
+	uint64_t now = Now();
+	if (m_name)
+		cout << "Upstart - " << m_name << ": " << (now - m_start) << " ms" << endl;
+	m_name = name;
+	m_start = now;
 }
@@ -22,31 +22,78 @@
 #pragma once
 
 #include "AVRController.h"
-#include <boost/thread.hpp>
+#include "GPIO.h"
+#include "GPIOEventLoop.h"
 
+#include <stdint.h>
+#include <string>
+
+/**
+ * Boot sequencer and button handler. Each boot step starts as soon as the one
+ * it depends on is ready (pins exported, serial port present, firmware says
+ * hello), with a timeout in case it never is, and the time spent in each phase
+ * is logged. The buttons are served by a single GPIOEventLoop on the main
+ * thread rather than a thread per button.
+ */
 class Upstart
 {
 public:
-	Upstart() : m_bRunning(false) { }
+	Upstart();
 	void Main();
 
-	void GreenThreadRun();
-	void YellowThreadRun() { };
-	void RedThreadRun();
-	void ThumbwheelThreadRun() { }
-	void IMUThreadRun() { }
-
 private:
+	/**
+	 * Green button: toggle ARDUINO_BRIDGE4 on each press.
+	 */
+	void OnGreen(unsigned int value);
+
+	/**
+	 * Red button: fade the emergency LED while held, and shut down if held
+	 * for BUTTON_TIMEOUT.
+	 */
+	void OnRed(unsigned int value);
+	void OnRedHeld();
+
+	/**
+	 * Block until path exists and is readable and writable, using inotify
+	 * rather than polling. Returns false after timeout ms.
+	 */
+	static bool WaitForDevice(const std::string &path, unsigned long timeout);
+
+	/**
+	 * Logs how long each boot phase took, when the next one starts.
+	 */
+	class Phase
+	{
+	public:
+		Phase(const char *name) : m_name(name), m_start(Now()) { }
+		~Phase() { Next(NULL); }
+
+		/**
+		 * Log the current phase and start timing the next (NULL for none).
+		 */
+		void Next(const char *name);
+
+		static uint64_t Now(); // ms, monotonic
+
+	private:
+		const char *m_name;
+		uint64_t    m_start;
+	};
+
 	AVRController arduino;
 
-	boost::thread m_greenThread;
-	boost::thread m_yellowThread;
-	boost::thread m_redThread;
-	boost::thread m_thumbwheelThread;
-	boost::thread m_IMUThread;
+	GPIOEventLoop m_events;
+	GPIO          m_green;
+	GPIO          m_red;
+	GPIO          m_arduino4;
 
-	// Used for threads waiting on file descriptors (where condition variables
-	// can't be used unless you turn the variable into a fd pipe and wait on that)
-	bool m_bRunning;
-};
+	enum STATE
+	{
+		ENABLED = 0,
+		DISABLED = 1
+	} m_greenState;
 
+	GPIOEventLoop::TimerID m_redTimer;
+	std::string            m_strFade;
+};
@@ -23,14 +23,27 @@
 #include "AVRController.h"
 #include "ArduinoAddressBook.h"
 #include "BeagleBoardAddressBook.h"
+#include "EncoderMessage.h"
+#include "EncoderTracker.h"
 #include "ParamServer.h"
+#include "GPIOCapture.h"
+#include "GPIOEventLoop.h"
+#include "GPIOGroup.h"
+#include "GPIOPWM.h"
+#include "GPIOSimulator.h"
 #include "I2CBus.h"
+#include "I2CSimulator.h"
 #include "IMU.h"
+#include "IMUFusion.h"
 #include "MotorController.h"
+#include "TelemetryReader.h"
+#include "TelemetryWriter.h"
 #include "Thumbwheel.h"
 
+#include <boost/bind.hpp>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <math.h> // for M_PI
 #include <string>
 #include <vector>
 
@@ -102,6 +115,197 @@ TEST(GPIOTest, thumnbwheel)
 	}
 }
 
+TEST(GPIOTest, simulator)
+{
+	GPIOSimulator sim;
+	sim.SetInput(BUTTON_GREEN, 1);
+
+	GPIO button(BUTTON_GREEN, sim);
+	ASSERT_TRUE(button.Open());
+	EXPECT_NO_THROW(button.SetDirection(GPIO::IN));
+	EXPECT_NO_THROW(button.SetEdge(GPIO::BOTH));
+	EXPECT_EQ(button.GetValue(), 1);
+
+	// Press the button 20ms from now
+	sim.ScheduleEdge(BUTTON_GREEN, 20000, 0);
+	unsigned long duration = 0;
+	unsigned int post_value = 2;
+	EXPECT_TRUE(button.Poll(1000000, duration, true, post_value));
+	EXPECT_GE(duration, 20000);
+	EXPECT_EQ(post_value, 0);
+
+	// Nothing else is scripted
+	EXPECT_FALSE(button.Poll(10000, duration));
+
+	GPIO bridge(ARDUINO_BRIDGE1, sim);
+	ASSERT_TRUE(bridge.Open());
+	EXPECT_NO_THROW(bridge.SetDirection(GPIO::OUT, 1));
+	EXPECT_EQ(sim.GetLevel(ARDUINO_BRIDGE1), 1);
+	EXPECT_NO_THROW(bridge.Mirror(button));
+	EXPECT_EQ(sim.GetLevel(ARDUINO_BRIDGE1), 0);
+
+	// Thumbwheel pins are active low
+	Thumbwheel tw(sim);
+	sim.SetInput(THUMBWHEEL1, 0);
+	sim.SetInput(THUMBWHEEL2, 1);
+	sim.SetInput(THUMBWHEEL4, 0);
+	ASSERT_TRUE(tw.Open());
+	EXPECT_EQ(tw.GetValue(), 5);
+
+	// Groups read and write as a bitmask, pin i in bit i
+	const unsigned int pins[] = { IMU_INT0, IMU_INT1, ARDUINO_BRIDGE2 };
+	GPIOGroup group(pins, 3, sim);
+	ASSERT_TRUE(group.Open());
+	EXPECT_TRUE(group.IsAtomic());
+	EXPECT_NO_THROW(group.SetDirection(GPIO::OUT, 0x5));
+	EXPECT_EQ(sim.GetLevel(IMU_INT0), 1);
+	EXPECT_EQ(sim.GetLevel(IMU_INT1), 0);
+	EXPECT_EQ(sim.GetLevel(ARDUINO_BRIDGE2), 1);
+	EXPECT_NO_THROW(group.SetValues(0x2));
+	EXPECT_EQ(group.GetValues(), 0x2);
+	EXPECT_EQ(sim.GetLevel(IMU_INT1), 1);
+}
+
+namespace
+{
+	void RecordEdge(vector<unsigned int> &edges, unsigned int value) { edges.push_back(value); }
+	void StopLoop(GPIOEventLoop &events) { events.Stop(); }
+}
+
+TEST(GPIOTest, eventLoop)
+{
+	GPIOSimulator sim;
+	sim.SetInput(BUTTON_GREEN, 1);
+	sim.SetInput(BUTTON_RED, 1);
+
+	GPIO green(BUTTON_GREEN, sim);
+	GPIO red(BUTTON_RED, sim);
+	ASSERT_TRUE(green.Open());
+	ASSERT_TRUE(red.Open());
+	green.SetDirection(GPIO::IN);
+	green.SetEdge(GPIO::BOTH);
+	red.SetDirection(GPIO::IN);
+	red.SetEdge(GPIO::BOTH);
+
+	GPIOEventLoop events;
+	ASSERT_TRUE(events.Open());
+
+	vector<unsigned int> greenEdges, redEdges;
+	ASSERT_TRUE(events.AddPin(green, boost::bind(RecordEdge, boost::ref(greenEdges), _1)));
+	// Red bounces; only the settled value should be reported
+	ASSERT_TRUE(events.AddPin(red, boost::bind(RecordEdge, boost::ref(redEdges), _1), 20000));
+
+	sim.ScheduleEdge(BUTTON_GREEN, 10000, 0);
+	sim.ScheduleEdge(BUTTON_GREEN, 20000, 1);
+	sim.ScheduleEdge(BUTTON_RED, 10000, 0);
+	sim.ScheduleEdge(BUTTON_RED, 12000, 1);
+	sim.ScheduleEdge(BUTTON_RED, 14000, 0);
+	EXPECT_NE(events.AddTimer(100000, boost::bind(StopLoop, boost::ref(events))), GPIOEventLoop::INVALID_TIMER);
+	events.Run();
+
+	ASSERT_EQ(greenEdges.size(), 2);
+	EXPECT_EQ(greenEdges[0], 0);
+	EXPECT_EQ(greenEdges[1], 1);
+	ASSERT_EQ(redEdges.size(), 1);
+	EXPECT_EQ(redEdges[0], 0);
+}
+
+TEST(GPIOTest, thumbwheelSettle)
+{
+	GPIOSimulator sim;
+	sim.SetInput(THUMBWHEEL1, 0);
+	sim.SetInput(THUMBWHEEL2, 1);
+	sim.SetInput(THUMBWHEEL4, 0);
+
+	Thumbwheel tw(sim);
+	ASSERT_TRUE(tw.Open());
+	ASSERT_EQ(tw.GetValue(), 5);
+
+	// Turn the wheel from 5 to 2, passing through 4 and 6 on the way. Only
+	// pins 2 and 4 change at the end.
+	sim.ScheduleEdge(THUMBWHEEL1, 10000, 1);
+	sim.ScheduleEdge(THUMBWHEEL2, 20000, 0);
+	sim.ScheduleEdge(THUMBWHEEL4, 30000, 1);
+	unsigned int value = 0;
+	EXPECT_TRUE(tw.Poll(BUTTON_TIMEOUT, value));
+	EXPECT_EQ(value, 2);
+
+	// Nothing changes, so nothing settles
+	EXPECT_FALSE(tw.Poll(50000, value));
+}
+
+TEST(GPIOTest, capture)
+{
+	GPIOSimulator sim;
+	sim.SetInput(IMU_INT0, 0);
+
+	GPIO gpio(IMU_INT0, sim);
+	ASSERT_TRUE(gpio.Open());
+	gpio.SetDirection(GPIO::IN);
+	gpio.SetEdge(GPIO::BOTH);
+
+	GPIOCapture capture;
+	ASSERT_TRUE(capture.Add(gpio));
+	ASSERT_TRUE(capture.Start());
+
+	// A burst that no poller could keep up with, then a gap
+	for (unsigned int i = 0; i < 10; i++)
+		sim.ScheduleEdge(IMU_INT0, 10000 + i, (i + 1) & 1);
+	sim.ScheduleEdge(IMU_INT0, 30000, 1);
+	usleep(60000);
+	capture.Stop();
+
+	GPIO::EdgeEvent events[16];
+	ASSERT_EQ(capture.Drain(events, 16), 11);
+	for (unsigned int i = 0; i < 11; i++)
+	{
+		EXPECT_EQ(events[i].gpio, IMU_INT0);
+		EXPECT_EQ(events[i].value, (i + 1) & 1);
+		if (i > 0)
+			EXPECT_GE(events[i].timestamp, events[i - 1].timestamp);
+	}
+	EXPECT_GE(events[10].timestamp - events[9].timestamp, 15000000ULL);
+	EXPECT_EQ(capture.GetOverflows(), 0);
+}
+
+TEST(GPIOTest, pwm)
+{
+	GPIOSimulator sim;
+	GPIO led(ARDUINO_BRIDGE4, sim);
+	ASSERT_TRUE(led.Open());
+	led.SetDirection(GPIO::OUT, 0);
+
+	GPIOPWM pwm;
+	GPIOPWM::ChannelID id = pwm.AddChannel(led);
+	ASSERT_NE(id, GPIOPWM::INVALID_CHANNEL);
+	ASSERT_TRUE(pwm.Start());
+
+	// Five 1ms pulses, without blocking
+	ASSERT_TRUE(pwm.SetPulses(id, 1000, 5));
+	for (unsigned int i = 0; i < 100 && pwm.IsBusy(id); i++)
+		usleep(1000);
+	EXPECT_FALSE(pwm.IsBusy(id));
+	EXPECT_EQ(sim.GetEdgeCount(ARDUINO_BRIDGE4), 10);
+	EXPECT_EQ(sim.GetLevel(ARDUINO_BRIDGE4), 0);
+
+	// 1kHz PWM for 50ms, updated while running
+	ASSERT_TRUE(pwm.SetPWM(id, 1000, 0.5));
+	usleep(25000);
+	ASSERT_TRUE(pwm.SetPWM(id, 1000, 0.25));
+	usleep(25000);
+	EXPECT_TRUE(pwm.IsBusy(id));
+	ASSERT_TRUE(pwm.Halt(id));
+	for (unsigned int i = 0; i < 100 && pwm.IsBusy(id); i++)
+		usleep(1000);
+	EXPECT_EQ(sim.GetLevel(ARDUINO_BRIDGE4), 0);
+	EXPECT_GT(sim.GetEdgeCount(ARDUINO_BRIDGE4), 80);
+
+	GPIOPWM::Stats stats = pwm.GetStats();
+	EXPECT_GT(stats.edges, 80);
+	EXPECT_LE(stats.minLatency, stats.maxLatency);
+	pwm.Stop();
+}
+
 AVRController arduino;
 
 TEST(AVRTest, fsm)
@@ -247,6 +451,99 @@ TEST(I2CTest, detect)
 	}
 }
 
+TEST(IMUTest, fusion)
+{
+	// One second, level, turning 90 deg/s about z
+	vector<IMU::AccSample> acc(400);
+	vector<IMU::GyroSample> gyro(100);
+	for (unsigned int i = 0; i < acc.size(); i++)
+	{
+		IMU::AccSample sample = { 1000000000ULL + i * 2500000ULL, 0.0f, 0.0f, 1.0f };
+		acc[i] = sample;
+	}
+	for (unsigned int i = 0; i < gyro.size(); i++)
+	{
+		IMU::GyroSample sample = { 1000000000ULL + i * 10000000ULL, 0.0f, 0.0f, 90.0f, 35.0f };
+		gyro[i] = sample;
+	}
+
+	IMUFusion fusion;
+	EXPECT_EQ(fusion.Update(&acc[0], acc.size(), &gyro[0], gyro.size()), acc.size() + gyro.size());
+
+	IMUFusion::State state;
+	float roll, pitch, yaw;
+	fusion.GetState(state);
+	IMUFusion::ToEuler(state, roll, pitch, yaw);
+	EXPECT_NEAR(yaw * 180 / M_PI, 90.0f * 0.9975f, 1.0f); // Last sample is at 0.9975s
+	EXPECT_NEAR(roll, 0.0f, 0.01f);
+	EXPECT_NEAR(pitch, 0.0f, 0.01f);
+	EXPECT_NEAR(state.ax, 0.0f, 0.01f);
+	EXPECT_NEAR(state.ay, 0.0f, 0.01f);
+	EXPECT_NEAR(state.az, 0.0f, 0.01f);
+
+	// Tipped onto its side: the accelerometer pulls roll toward 90 deg
+	fusion.Reset();
+	for (unsigned int i = 0; i < acc.size(); i++)
+	{
+		acc[i].y = 1.0f;
+		acc[i].z = 0.0f;
+		acc[i].timestamp += 10 * 1000000000ULL;
+	}
+	for (unsigned int pass = 0; pass < 10; pass++)
+	{
+		fusion.Update(&acc[0], acc.size(), NULL, 0);
+		for (unsigned int i = 0; i < acc.size(); i++)
+			acc[i].timestamp += 1000000000ULL;
+	}
+	fusion.GetState(state);
+	IMUFusion::ToEuler(state, roll, pitch, yaw);
+	EXPECT_NEAR(roll * 180 / M_PI, 90.0f, 2.0f);
+}
+
+TEST(IMUTest, simulator)
+{
+	GPIOSimulator gpio;
+	I2CSimulator i2c(gpio);
+	i2c.SetAcceleration(0.0f, 0.5f, -1.0f);
+	i2c.SetRotation(10.0f, 0.0f, -45.0f);
+	i2c.SetTemperature(30.0f);
+
+	IMU imu(gpio, i2c);
+	ASSERT_TRUE(imu.SetAccRate(800));
+	ASSERT_TRUE(imu.Open());
+	usleep(1000 * 300); // 300ms (240 and 30 samples)
+	imu.Close();
+
+	vector<IMU::AccSample> acc(IMU_ACC_QUEUE_SIZE);
+	acc.resize(imu.DrainAcc(&acc[0], acc.size()));
+	EXPECT_GT(acc.size(), 200u);
+	EXPECT_LT(acc.size(), 260u);
+	for (unsigned int i = 0; i < acc.size(); i++)
+	{
+		EXPECT_NEAR(acc[i].x, 0.0f, 0.01f);
+		EXPECT_NEAR(acc[i].y, 0.5f, 0.01f);
+		EXPECT_NEAR(acc[i].z, -1.0f, 0.01f);
+		if (i > 0)
+			EXPECT_GT(acc[i].timestamp, acc[i - 1].timestamp);
+	}
+
+	vector<IMU::GyroSample> gyro(IMU_GYRO_QUEUE_SIZE);
+	gyro.resize(imu.DrainGyro(&gyro[0], gyro.size()));
+	EXPECT_GT(gyro.size(), 20u);
+	EXPECT_LT(gyro.size(), 35u);
+	for (unsigned int i = 0; i < gyro.size(); i++)
+	{
+		EXPECT_NEAR(gyro[i].xrot, 10.0f, 0.1f);
+		EXPECT_NEAR(gyro[i].zrot, -45.0f, 0.1f);
+		EXPECT_NEAR(gyro[i].temp, 30.0f, 0.1f);
+		if (i > 0)
+			EXPECT_GT(gyro[i].timestamp, gyro[i - 1].timestamp);
+	}
+
+	EXPECT_EQ(imu.GetAccOverruns(), 0u);
+	EXPECT_EQ(imu.GetAccOverflows(), 0u);
+}
+
 TEST(IMUTest, imu)
 {
 	if (bTestIMU)
@@ -276,6 +573,171 @@ TEST(IMUTest, imu)
 	}
 }
 
+TEST(TelemetryTest, log)
+{
+	const char *path = "/tmp/avrtest.tlog";
+
+	TelemetryWriter writer;
+	ASSERT_TRUE(writer.Open(path));
+	TelemetryWriter::Stream *imu = writer.CreateStream();
+	TelemetryWriter::Stream *avr = writer.CreateStream();
+
+	// Enough samples for several chunks, in batches the writer keeps up with
+	const unsigned int SAMPLES = 10000;
+	for (unsigned int i = 0; i < SAMPLES; i++)
+	{
+		Telemetry::Acc acc = { (float)i, 0.0f, 1.0f };
+		EXPECT_TRUE(imu->Log(1000000000ULL + i * 1000000ULL, acc));
+		if (i % 1000 == 999)
+			usleep(1000 * 30); // 30ms
+	}
+	Telemetry::Encoder encoder = { 12, { 0xA5, 0x0F } };
+	EXPECT_TRUE(avr->Log(Telemetry::ENCODER, 1500000000ULL, &encoder, 1 + 2));
+	Telemetry::Battery battery = { 600, 0, 7.5f };
+	EXPECT_TRUE(avr->Log(1500000000ULL, battery));
+	writer.Close();
+	EXPECT_EQ(writer.GetRecords(), SAMPLES + 2);
+
+	TelemetryReader reader;
+	ASSERT_TRUE(reader.Open(path));
+	EXPECT_EQ(reader.GetChunkCount(), writer.GetChunks());
+	EXPECT_GT(reader.GetChunkCount(), 1u);
+
+	unsigned int accCount = 0;
+	bool bEncoder = false;
+	bool bBattery = false;
+	TelemetryReader::Record record;
+	while (reader.Next(record))
+	{
+		if (const Telemetry::Acc *acc = record.As<Telemetry::Acc>())
+		{
+			EXPECT_EQ(record.timestamp, 1000000000ULL + accCount * 1000000ULL);
+			EXPECT_EQ(acc->x, (float)accCount);
+			accCount++;
+		}
+		else if (const Telemetry::Encoder *samples = record.As<Telemetry::Encoder>())
+		{
+			EXPECT_EQ(record.length, 3);
+			EXPECT_EQ(samples->count, 12);
+			EXPECT_EQ(samples->bits[0], 0xA5);
+			EXPECT_EQ(samples->bits[1], 0x0F);
+			bEncoder = true;
+		}
+		else if (const Telemetry::Battery *volts = record.As<Telemetry::Battery>())
+		{
+			EXPECT_EQ(volts->raw, 600);
+			EXPECT_EQ(volts->volts, 7.5f);
+			bBattery = true;
+		}
+	}
+	EXPECT_EQ(accCount, SAMPLES);
+	EXPECT_TRUE(bEncoder);
+	EXPECT_TRUE(bBattery);
+
+	// The chunk holding the 5000th sample
+	ASSERT_TRUE(reader.Seek(1000000000ULL + 5000 * 1000000ULL));
+	ASSERT_TRUE(reader.Next(record));
+	EXPECT_LE(record.timestamp, 1000000000ULL + 5000 * 1000000ULL);
+	EXPECT_FALSE(reader.Seek(2000000000ULL * 10));
+
+	reader.Close();
+	unlink(path);
+}
+
+TEST(EncoderTest, message)
+{
+	// Samples: 12 samples of 0b1010 0101, 0b1111
+	const char samples[] = { 6, 0, FSM_ENCODER, 12, (char)0xA5, 0x0F };
+	EncoderMessage encoder;
+	ASSERT_TRUE(encoder.Parse(string(samples, sizeof(samples))));
+	EXPECT_FALSE(encoder.IsEdges());
+	EXPECT_EQ(encoder.GetSampleCount(), 12u);
+	EXPECT_TRUE(encoder.GetSample(0));
+	EXPECT_FALSE(encoder.GetSample(1));
+	EXPECT_EQ(encoder.GetTicks(), 6u);
+
+	// Edges: 100, 300 and 70000 us after a low level
+	const char edges[] = { 11, 0, FSM_ENCODER, ENCODER_FORMAT_EDGES, 0, 100, (char)0xAC, 0x02, (char)0xF0, (char)0xA2, 0x04 };
+	ASSERT_TRUE(encoder.Parse(string(edges, sizeof(edges))));
+	EXPECT_TRUE(encoder.IsEdges());
+	EXPECT_EQ(encoder.GetLevel(), 0);
+	ASSERT_EQ(encoder.GetDeltas().size(), 3u);
+	EXPECT_EQ(encoder.GetDeltas()[0], 100u);
+	EXPECT_EQ(encoder.GetDeltas()[1], 300u);
+	EXPECT_EQ(encoder.GetDeltas()[2], 70000u);
+	EXPECT_EQ(encoder.GetTicks(), 3u);
+
+	// A varint cut short, and more samples than bytes
+	EXPECT_FALSE(encoder.Parse(string(edges, sizeof(edges) - 1).replace(0, 1, 1, 10)));
+	EXPECT_FALSE(encoder.Parse(string(samples, sizeof(samples)).replace(3, 1, 1, 17)));
+}
+
+TEST(EncoderTest, tracker)
+{
+	// A 200 Hz square wave sampled every 500 us: a tick every 5 samples,
+	// 2500 us apart, 100 ticks per revolution = 240 RPM
+	const unsigned int SAMPLES = 128;
+	EncoderTracker tracker;
+	unsigned int sample = 0;
+	for (unsigned int i = 0; i < 20; i++)
+	{
+		string msg(4 + SAMPLES / 8, '\0');
+		msg[0] = msg.length();
+		msg[2] = FSM_ENCODER;
+		msg[3] = SAMPLES;
+		for (unsigned int j = 0; j < SAMPLES; j++, sample++)
+		{
+			if ((sample / 5) % 2)
+				msg[4 + j / 8] |= 1 << (j % 8);
+		}
+		EncoderMessage encoder;
+		ASSERT_TRUE(encoder.Parse(msg));
+		tracker.Add(encoder);
+	}
+	EXPECT_EQ(tracker.GetSamples(), 20u * SAMPLES);
+	EXPECT_EQ(tracker.GetTicks(), (20u * SAMPLES - 1) / 5);
+	EXPECT_NEAR(tracker.GetPeriod(), 2500.0, 10.0);
+	EXPECT_NEAR(tracker.GetRPM(), 240.0, 1.0);
+
+	// The same wave as edges, 3 per message
+	tracker.Reset();
+	const char edges[] = { 11, 0, FSM_ENCODER, ENCODER_FORMAT_EDGES, 0, (char)0xC4, 0x13, (char)0xC4, 0x13, (char)0xC4, 0x13 };
+	for (unsigned int i = 0; i < 20; i++)
+	{
+		EncoderMessage encoder;
+		ASSERT_TRUE(encoder.Parse(string(edges, sizeof(edges))));
+		tracker.Add(encoder);
+	}
+	EXPECT_EQ(tracker.GetTicks(), 60u);
+	EXPECT_DOUBLE_EQ(tracker.GetPeriod(), 2500.0);
+	EXPECT_DOUBLE_EQ(tracker.GetRPM(), 240.0);
+
+	// Then the wheel stops and the messages with it
+	tracker.Advance(ENCODER_IDLE_TIMEOUT / 2);
+	EXPECT_DOUBLE_EQ(tracker.GetRPM(), 240.0);
+	tracker.Advance(ENCODER_IDLE_TIMEOUT / 2);
+	EXPECT_EQ(tracker.GetTicks(), 60u);
+	EXPECT_DOUBLE_EQ(tracker.GetRPM(), 0.0);
+
+	// And restarts 5 s later at the same speed: the first edge is timed from
+	// the last before the stop, which mustn't drag the RPM down
+	const char restart[] = { 13, 0, FSM_ENCODER, ENCODER_FORMAT_EDGES, 0, (char)0xC0, (char)0x96, (char)0xB1, 0x02, (char)0xC4, 0x13, (char)0xC4, 0x13 };
+	EncoderMessage first;
+	ASSERT_TRUE(first.Parse(string(restart, sizeof(restart))));
+	ASSERT_EQ(first.GetDeltas()[0], 5000000u);
+	tracker.Add(first);
+	EXPECT_EQ(tracker.GetTicks(), 63u);
+	EXPECT_DOUBLE_EQ(tracker.GetRPM(), 240.0);
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		EncoderMessage encoder;
+		ASSERT_TRUE(encoder.Parse(string(edges, sizeof(edges))));
+		tracker.Add(encoder);
+	}
+	EXPECT_EQ(tracker.GetTicks(), 75u);
+	EXPECT_DOUBLE_EQ(tracker.GetRPM(), 240.0);
+}
+
 TEST(MotorController, setSpeed)
 {
 	if (!arduino.IsOpen())
@@ -290,6 +752,61 @@ TEST(MotorController, setSpeed)
 	usleep(10 * 1000);
 }
 
+TEST(AVRTest, pinBenchmark)
+{
+	if (!arduino.IsOpen())
+		ASSERT_TRUE(arduino.Open(ARDUINO_PORT));
+	ASSERT_TRUE(arduino.IsOpen());
+
+	ParamServer::PinBenchmark benchmark;
+	arduino.CreateFSM(benchmark.GetString());
+
+	string strResponse;
+	EXPECT_TRUE(arduino.Receive(FSM_PINBENCHMARK, strResponse, 1000));
+	ASSERT_EQ(strResponse.length(), ParamServer::PinBenchmarkPublisherMsg::GetLength());
+	ParamServer::PinBenchmarkPublisherMsg result(strResponse);
+	EXPECT_LT(result.GetFastPinWrite(), result.GetPinWrite());
+	EXPECT_LT(result.GetPinWrite(), result.GetArduinoWrite());
+	EXPECT_LT(result.GetPinRead(), result.GetArduinoRead());
+	cout << "Cycles per call - digitalWrite: " << result.GetArduinoWrite() <<
+		", digitalRead: " << result.GetArduinoRead() <<
+		", Pin::Write: " << result.GetPinWrite() <<
+		", Pin::Read: " << result.GetPinRead() <<
+		", FastPin::Write: " << result.GetFastPinWrite() <<
+		", FastPin::Read: " << result.GetFastPinRead() <<
+		", Blink::Step: " << result.GetBlink() <<
+		", Mimic::Step: " << result.GetMimic() << endl;
+
+	arduino.DestroyFSM(benchmark.GetString());
+}
+
+TEST(AVRTest, wheelEncoders)
+{
+	if (!arduino.IsOpen())
+		ASSERT_TRUE(arduino.Open(ARDUINO_PORT));
+	ASSERT_TRUE(arduino.IsOpen());
+
+	ParamServer::WheelEncoders encoders;
+	encoders.SetPeriod(50);
+	arduino.CreateFSM(encoders.GetString());
+
+	// With the wheels at rest, counts hold and velocities are zero
+	string strResponse;
+	ASSERT_TRUE(arduino.Receive(FSM_WHEELENCODERS, strResponse, 1000));
+	ASSERT_EQ(strResponse.length(), ParamServer::WheelEncodersPublisherMsg::GetLength());
+	ParamServer::WheelEncodersPublisherMsg first(strResponse);
+	ASSERT_TRUE(arduino.Receive(FSM_WHEELENCODERS, strResponse, 1000));
+	ASSERT_EQ(strResponse.length(), ParamServer::WheelEncodersPublisherMsg::GetLength());
+	ParamServer::WheelEncodersPublisherMsg second(strResponse);
+	EXPECT_EQ(second.GetCount1(), first.GetCount1());
+	EXPECT_EQ(second.GetVelocity1(), 0);
+	EXPECT_EQ(second.GetErrors(), first.GetErrors());
+	cout << "Counts: " << second.GetCount1() << ", " << second.GetCount2() << ", " <<
+		second.GetCount3() << ", " << second.GetCount4() << ", errors: " << second.GetErrors() << endl;
+
+	arduino.DestroyFSM(encoders.GetString());
+}
+
 /*
 TEST(Sentry, seek)
 {